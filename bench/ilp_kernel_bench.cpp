@@ -0,0 +1,339 @@
+/*
+ * This file is part of MICA, a Pin tool to collect
+ * microarchitecture-independent program characteristics using the Pin
+ * instrumentation framework.
+ *
+ * Please see the README.txt file distributed with the MICA release for more
+ * information.
+ */
+
+/* Microbenchmark of the ILP simulation of a list of window sizes (mica_ilp_kernel.h), against
+ * the previous implementation for the 4 hardcoded window sizes 32, 64, 128 and 256 (a loop per
+ * window over separate arrays, with modulo window indexing), which is kept below. A synthetic stream of register and memory
+ * dependences is replayed through both, which must end up with the same cycle counts.
+ *
+ * build: make ilp_kernel_bench
+ * usage: obj-replay/ilp_kernel_bench [number of instructions] [number of memory locations] */
+
+#include "mica_ilp_kernel.h"
+
+#include <time.h>
+
+/* *** previous implementation *** */
+
+#define ILP_WIN_SIZE_CNT 4
+
+const UINT32 win_sizes[ILP_WIN_SIZE_CNT] = {32, 64, 128, 256};
+
+typedef struct old_ilp_state_type {
+	INT32 size_pow_all_times_all;
+	INT64 index_all_times_all;
+	UINT64* all_times_all[ILP_WIN_SIZE_CNT];
+
+	INT64 cpuClock_interval_all[ILP_WIN_SIZE_CNT];
+	UINT64 timeAvailable_all[ILP_WIN_SIZE_CNT][MAX_NUM_REGS];
+	UINT32 windowHead_all[ILP_WIN_SIZE_CNT];
+	UINT32 windowTail_all[ILP_WIN_SIZE_CNT];
+	UINT64 cpuClock_all[ILP_WIN_SIZE_CNT];
+	UINT64* executionProfile_all[ILP_WIN_SIZE_CNT];
+	UINT64 issueTime_all[ILP_WIN_SIZE_CNT];
+} old_ilp_state;
+
+void old_init(old_ilp_state* l){
+
+	int i,j;
+
+	l->size_pow_all_times_all = 10;
+	for(i=0; i < ILP_WIN_SIZE_CNT; i++){
+		l->all_times_all[i] = (UINT64*)checked_malloc((1 << l->size_pow_all_times_all) * sizeof(UINT64));
+		l->all_times_all[i][0] = 0;
+	}
+	l->index_all_times_all = 1;
+
+	for(j=0; j < ILP_WIN_SIZE_CNT; j++){
+		l->windowHead_all[j] = 0;
+		l->windowTail_all[j] = 0;
+		l->cpuClock_all[j] = 0;
+		l->cpuClock_interval_all[j] = 0;
+		for(i = 0; i < MAX_NUM_REGS; i++){
+			l->timeAvailable_all[j][i] = 0;
+		}
+
+		l->executionProfile_all[j] = (UINT64*)checked_malloc(win_sizes[j]*sizeof(UINT64));
+
+		for(i = 0; i < (int)win_sizes[j]; i++){
+			l->executionProfile_all[j][i] = 0;
+		}
+		l->issueTime_all[j] = 0;
+	}
+}
+
+void increase_size_all_times_all(old_ilp_state* l){
+	int i;
+	UINT64* ptr;
+	l->size_pow_all_times_all++;
+
+	for(i=0; i < ILP_WIN_SIZE_CNT; i++){
+		ptr = (UINT64*)realloc(l->all_times_all[i],(1 << l->size_pow_all_times_all)*sizeof(UINT64));
+		if(ptr == (UINT64*)NULL){
+			cerr << "Could not allocate memory (realloc)!" << endl;
+			exit(1);
+		}
+		l->all_times_all[i] = ptr;
+	}
+}
+
+VOID ilp_instr_all(old_ilp_state* l){
+
+	int i;
+	UINT32 reordered;
+
+	for(i=0; i < ILP_WIN_SIZE_CNT; i++){
+
+		l->executionProfile_all[i][l->windowTail_all[i]] = l->issueTime_all[i];
+		l->windowTail_all[i] = (l->windowTail_all[i] + 1) % win_sizes[i];
+
+		if(l->windowHead_all[i] == l->windowTail_all[i]){
+			l->cpuClock_all[i]++;
+			l->cpuClock_interval_all[i]++;
+			reordered = 0;
+			while((l->executionProfile_all[i][l->windowHead_all[i]] < l->cpuClock_all[i]) && (reordered < win_sizes[i])) {
+				l->windowHead_all[i] = (l->windowHead_all[i] + 1) % win_sizes[i];
+				reordered++;
+			}
+		}
+
+		l->issueTime_all[i] = 0;
+	}
+}
+
+VOID checkIssueTime_all(old_ilp_state* l){
+	int i;
+
+	for(i=0; i < ILP_WIN_SIZE_CNT; i++){
+		if(l->cpuClock_all[i] > l->issueTime_all[i])
+			l->issueTime_all[i] = l->cpuClock_all[i];
+	}
+}
+
+VOID readRegOp_ilp_all(old_ilp_state* l, UINT32 regId){
+	int i;
+
+	for(i=0; i < ILP_WIN_SIZE_CNT; i++){
+		if(l->timeAvailable_all[i][regId] > l->issueTime_all[i])
+			l->issueTime_all[i] = l->timeAvailable_all[i][regId];
+	}
+}
+
+VOID writeRegOp_ilp_all(old_ilp_state* l, UINT32 regId){
+	int i;
+
+	for(i=0; i < ILP_WIN_SIZE_CNT; i++){
+		l->timeAvailable_all[i][regId] = l->issueTime_all[i] + 1;
+	}
+}
+
+/* memory locations are mapped to a slot in all_times_all by the caller (slot is 0 if not written yet) */
+VOID readMem_ilp_all(old_ilp_state* l, INT32 slot){
+	int i;
+
+	for(i=0; i < ILP_WIN_SIZE_CNT; i++){
+		if(l->all_times_all[i][slot] > l->issueTime_all[i])
+			l->issueTime_all[i] = l->all_times_all[i][slot];
+	}
+}
+
+VOID writeMem_ilp_all(old_ilp_state* l, INT32* slot){
+	int i;
+
+	if(*slot == 0){
+		l->index_all_times_all++;
+		if(l->index_all_times_all >= (1 << l->size_pow_all_times_all))
+			increase_size_all_times_all(l);
+		*slot = l->index_all_times_all;
+	}
+	for(i=0; i < ILP_WIN_SIZE_CNT; i++){
+		l->all_times_all[i][*slot] = l->issueTime_all[i] + 1;
+	}
+}
+
+/* *** synthetic dependence stream *** */
+
+#define BENCH_REGS 16
+#define BENCH_MAX_READS 3
+#define BENCH_MAX_WRITES 2
+#define BENCH_NO_MEM 0xffffffff
+#define BENCH_RUNS 3
+
+typedef struct bench_ins_type {
+	UINT8 reg_read_cnt;
+	UINT8 reg_write_cnt;
+	UINT8 regs_read[BENCH_MAX_READS];
+	UINT8 regs_written[BENCH_MAX_WRITES];
+	UINT32 mem_read; // memory location, BENCH_NO_MEM if none
+	UINT32 mem_write;
+} bench_ins;
+
+static UINT64 bench_seed = 42;
+
+static UINT32 bench_rand(){
+	bench_seed = bench_seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (UINT32)(bench_seed >> 33);
+}
+
+/* a loop over a body of BENCH_BODY static instructions (as in real programs, the registers used
+ * and whether memory is accessed are the same each time a static instruction executes),
+ * a third of which read memory and a sixth write it, at locations which mostly advance
+ * sequentially */
+#define BENCH_BODY 40
+
+static bench_ins* bench_stream(UINT64 n, UINT32 locs){
+	UINT64 k;
+	UINT32 j, last_loc = 0;
+	bench_ins body[BENCH_BODY];
+	bench_ins* s = (bench_ins*)checked_malloc(n * sizeof(bench_ins));
+
+	for(k = 0; k < BENCH_BODY; k++){
+		body[k].reg_read_cnt = bench_rand() % (BENCH_MAX_READS + 1);
+		for(j = 0; j < body[k].reg_read_cnt; j++)
+			body[k].regs_read[j] = bench_rand() % BENCH_REGS;
+		body[k].reg_write_cnt = bench_rand() % (BENCH_MAX_WRITES + 1);
+		for(j = 0; j < body[k].reg_write_cnt; j++)
+			body[k].regs_written[j] = bench_rand() % BENCH_REGS;
+		body[k].mem_read = (bench_rand() % 3 == 0) ? 0 : BENCH_NO_MEM;
+		body[k].mem_write = (bench_rand() % 6 == 0) ? 0 : BENCH_NO_MEM;
+	}
+
+	for(k = 0; k < n; k++){
+		s[k] = body[k % BENCH_BODY];
+
+		if(bench_rand() % 16 == 0)
+			last_loc = bench_rand() % locs;
+		else
+			last_loc = (last_loc + 1) % locs;
+		if(s[k].mem_read != BENCH_NO_MEM)
+			s[k].mem_read = last_loc;
+		if(s[k].mem_write != BENCH_NO_MEM)
+			s[k].mem_write = (last_loc + 7) % locs;
+	}
+	return s;
+}
+
+static double bench_now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double run_old(bench_ins* s, UINT64 n, UINT32 locs, INT64* clocks){
+	UINT64 k;
+	UINT32 j;
+	double start;
+	INT32* slots = (INT32*)checked_malloc(locs * sizeof(INT32));
+	old_ilp_state* l = (old_ilp_state*)checked_aligned_malloc(sizeof(old_ilp_state));
+
+	memset(slots, 0, locs * sizeof(INT32));
+	old_init(l);
+
+	start = bench_now();
+	for(k = 0; k < n; k++){
+		for(j = 0; j < s[k].reg_read_cnt; j++)
+			readRegOp_ilp_all(l, s[k].regs_read[j]);
+		if(s[k].mem_read != BENCH_NO_MEM)
+			readMem_ilp_all(l, slots[s[k].mem_read]);
+		checkIssueTime_all(l);
+		for(j = 0; j < s[k].reg_write_cnt; j++)
+			writeRegOp_ilp_all(l, s[k].regs_written[j]);
+		if(s[k].mem_write != BENCH_NO_MEM)
+			writeMem_ilp_all(l, &slots[s[k].mem_write]);
+		ilp_instr_all(l);
+	}
+	start = bench_now() - start;
+
+	for(j = 0; j < ILP_WIN_SIZE_CNT; j++){
+		clocks[j] = l->cpuClock_interval_all[j];
+		free(l->all_times_all[j]);
+		free(l->executionProfile_all[j]);
+	}
+	free(l);
+	free(slots);
+	return start;
+}
+
+static double run_new(bench_ins* s, UINT64 n, UINT32 locs, INT64* clocks){
+	UINT64 k;
+	UINT32 j;
+	double start;
+	ilp_windows* w = (ilp_windows*)checked_aligned_malloc(sizeof(ilp_windows));
+
+	ilp_windows_init(w, win_sizes, ILP_WIN_SIZE_CNT);
+
+	start = bench_now();
+	for(k = 0; k < n; k++){
+		for(j = 0; j < s[k].reg_read_cnt; j++)
+			ilp_windows_read_reg(w, s[k].regs_read[j]);
+		if(s[k].mem_read != BENCH_NO_MEM)
+			ilp_windows_read_mem(w, s[k].mem_read);
+		ilp_windows_check_issue(w);
+		for(j = 0; j < s[k].reg_write_cnt; j++)
+			ilp_windows_write_reg(w, s[k].regs_written[j]);
+		if(s[k].mem_write != BENCH_NO_MEM)
+			ilp_windows_write_mem(w, s[k].mem_write);
+		ilp_windows_issue(w);
+	}
+	start = bench_now() - start;
+
+	for(j = 0; j < ILP_WIN_SIZE_CNT; j++)
+		clocks[j] = w->cpuClock_interval[j];
+	free(w->executionProfile);
+	free(w->timeAvailable);
+	free(w->mem.keys);
+	free(w->mem.times);
+	free(w);
+	return start;
+}
+
+int main(int argc, char** argv){
+
+	UINT32 i, r;
+	UINT64 n = (argc > 1) ? strtoull(argv[1], NULL, 10) : 20000000;
+	UINT32 locs = (argc > 2) ? strtoul(argv[2], NULL, 10) : 65536;
+	INT64 clocks_old[ILP_WIN_SIZE_CNT], clocks_new[ILP_WIN_SIZE_CNT];
+	double time_old = 0, time_new = 0, time;
+	bench_ins* s;
+
+	if(n == 0 || locs == 0){
+		cerr << "usage: " << argv[0] << " [number of instructions] [number of memory locations]" << endl;
+		exit(1);
+	}
+
+	s = bench_stream(n, locs);
+
+	/* best of BENCH_RUNS runs, alternating between both kernels */
+	for(r = 0; r < BENCH_RUNS; r++){
+		time = run_old(s, n, locs, clocks_old);
+		if(r == 0 || time < time_old)
+			time_old = time;
+		time = run_new(s, n, locs, clocks_new);
+		if(r == 0 || time < time_new)
+			time_new = time;
+	}
+
+	cout << "instructions: " << n << ", memory locations: " << locs << endl;
+	cout << "cycles per window size:";
+	for(i = 0; i < ILP_WIN_SIZE_CNT; i++)
+		cout << " " << win_sizes[i] << ":" << clocks_new[i];
+	cout << endl;
+	cout << "previous kernel: " << time_old * 1e9 / n << " ns/instruction" << endl;
+	cout << "current kernel: " << time_new * 1e9 / n << " ns/instruction" << endl;
+
+	free(s);
+
+	for(i = 0; i < ILP_WIN_SIZE_CNT; i++){
+		if(clocks_old[i] != clocks_new[i]){
+			ERROR_MSG("cycle counts differ for window size " << win_sizes[i] << " (" << clocks_old[i] << " vs " << clocks_new[i] << ")");
+			exit(1);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,60 @@
+#!/bin/bash
+
+# Measures the time MICA spends instrumenting against the static instruction count
+# of the program. Synthetic programs with a growing number of static conditional
+# branches, loads and stores are generated and run under MICA; the instrumentation
+# time is taken from mica.log.
+#
+# usage: ./instrTimeBench.sh [analysis_type] [sizes]
+#   analysis_type: as in mica.conf (default: all)
+#   sizes: list of numbers of generated basic blocks (default: "1000 2000 4000 8000 16000 32000")
+# PIN_ROOT must point to the Pin kit, MICA_SO to the MICA Pin tool (default: obj-intel64/mica.so)
+
+if [ -z "$PIN_ROOT" ]; then
+	echo "ERROR: PIN_ROOT is not set"
+	exit 1
+fi
+
+analysis_type=${1:-all}
+sizes=${2:-"1000 2000 4000 8000 16000 32000"}
+mica_so=$(readlink -f ${MICA_SO:-obj-intel64/mica.so})
+cc=${CC:-gcc}
+
+if [ ! -f "$mica_so" ]; then
+	echo "ERROR: MICA Pin tool $mica_so not found"
+	exit 1
+fi
+
+workdir=$(mktemp -d)
+cd $workdir
+
+echo "analysis_type: $analysis_type" > mica.conf
+echo "interval_size: full" >> mica.conf
+echo "itypes_spec_file: $(dirname $mica_so)/../itypes_default.spec" >> mica.conf
+echo "append_pid: no" >> mica.conf
+
+echo "analysis_type: $analysis_type"
+echo "blocks static_instructions instrumentation_time(s)"
+
+for n in $sizes
+do
+	# every block has a conditional branch, a load and a store at a distinct address
+	(
+	echo "volatile long a[64];"
+	echo "int main(){"
+	echo "	long s = 0;"
+	for ((i = 0; i < n; i++))
+	do
+		echo "	if(a[$((i % 61))] > $i) s += a[$((i % 59))]; else a[$((i % 53))] = s + $i;"
+	done
+	echo "	return (int)(s & 1);"
+	echo "}"
+	) > bench_$n.c
+	$cc -O1 -o bench_$n bench_$n.c || exit 1
+
+	$PIN_ROOT/pin -t $mica_so -- ./bench_$n > /dev/null 2>&1
+	grep "instrumented" mica.log | sed "s/instrumented \([0-9]*\) static instructions in \([0-9.e-]*\) s/$n \1 \2/"
+done
+
+cd - > /dev/null
+rm -rf $workdir
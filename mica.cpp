@@ -35,39 +35,123 @@
 #include "mica_stride.h"
 #include "mica_memfootprint.h"
 #include "mica_memstackdist.h"
+#include "mica_capture.h"
+#include "mica_bbv.h"
+#include "mica_workers.h"
 
 #include <sstream>
 #include <iostream>
 #include <iomanip>
 #include <unistd.h>
+#include <time.h>
 using namespace std;
 
 /* *** Variables *** */
 
 /* global */
 INT64 interval_size; // interval size chosen
-INT64 interval_ins_count;
-INT64 interval_ins_count_for_hpc_alignment;
-INT64 total_ins_count;
-INT64 total_ins_count_for_hpc_alignment;
 
 ins_buffer_entry* ins_buffer[MAX_MEM_TABLE_ENTRIES];
 
 /* ILP */
 UINT32 _ilp_win_size;
+UINT32 _ilp_win_sizes[ILP_MAX_WIN_SIZE_CNT];
+UINT32 _ilp_win_size_cnt;
+UINT32 _ilp_buffer_size; // instructions buffered before they are simulated
 char* _itypes_spec_file;
 
+/* PPM */
+UINT32 _ppm_hist_lengths[MAX_NUM_HIST_LENGTHS];
+UINT32 _ppm_hist_length_cnt;
+
 /* ILP, MEMFOOTPRINT, MEMSTACKDIST */
 UINT32 _block_size;
 
 /* MEMFOOTPRINT */
 UINT32 _page_size;
 
+/* MEMSTACKDIST */
+UINT32 _memstackdist_block_sizes[MEMSTACKDIST_MAX_BLOCK_SIZE_CNT];
+UINT32 _memstackdist_block_size_cnt; // 0 if only block_size is used
+MEMSTACKDIST_ENGINE _memstackdist_engine;
+MEMSTACKDIST_WRITES _memstackdist_writes;
+double _memstackdist_sampling;
+UINT64 _memstackdist_sampling_lines;
+
 /* for multiprocess binaries */
 int append_pid;
 
-/* helper */
-int thread_count = 0;
+/* CUSTOM: analysis types measured together (ANALYSIS_SET_* flags) */
+UINT32 analysis_set;
+
+/* analysis threads: one per analysis type in the set, with the interval clients of that analysis type */
+int analysis_threads;
+static UINT32 worker_modules[MAX_WORKERS];
+static UINT32 worker_interval_clients[MAX_WORKERS];
+static UINT32 worker_cnt;
+
+/* per-thread state */
+TLS_KEY mica_tls_key;
+mica_thread** mica_threads;
+UINT32 mica_thread_cnt;
+static UINT32 mica_threads_size;
+static PIN_LOCK mica_threads_lock;
+
+/* allocates the per-thread state of the modules used in the chosen mode */
+static VOID (*init_thread)(mica_thread* t);
+
+/* instrumentation routine of the chosen mode, called per instruction by Trace_timed */
+static VOID (*instrument_ins)(INS ins, VOID* v);
+static UINT64 static_ins_cnt; // number of instructions instrumented
+static UINT64 count_call_cnt; // number of instruction counting calls inserted
+static UINT64 instrumentation_ns; // time spent in instrumentation routines
+
+/* instruction counting */
+UINT32 ins_lag; // lag of the instruction being instrumented (see mica_utils.h)
+UINT32 ins_run; // instructions counted by the instruction being instrumented (see mica_utils.h)
+REG mica_thread_reg; // tool register holding the mica_thread of the executing thread
+REG mica_version_reg; // tool register selecting the version of the next block (see Trace_timed)
+
+/* interval boundaries are checked once per basic block: the fast version of a trace has no
+ * further checks, the boundary version checks after every instruction and returns to the fast version */
+#define MICA_VERSION_FAST 0
+#define MICA_VERSION_BOUNDARY 1
+static BOOL trace_checked; // the trace being instrumented checks the interval after every instruction
+
+/* interval engine: routines registered by the modules to output and reset their per-interval state */
+#define MAX_INTERVAL_CLIENTS 16
+typedef struct interval_client_type {
+	VOID (*output)(mica_thread* t);
+	VOID (*reset)(mica_thread* t);
+} interval_client;
+static interval_client interval_clients[MAX_INTERVAL_CLIENTS];
+static UINT32 interval_client_cnt;
+BOOL interval_output = true; // false while per-interval output is suppressed (see mica_utils.h)
+
+/* SAMPLED: intervals chosen in bbv mode (sorted) with their weights */
+UINT32 _sampling_warmup; // number of intervals analyzed in detail before a chosen interval, without output
+char* _simpoints_file;
+char* _weights_file;
+static BOOL sampling;
+static UINT64* sample_intervals;
+static double* sample_weights;
+static UINT32 sample_cnt;
+static UINT32 sample_next; // first chosen interval which is not over yet
+static UINT64 sample_interval; // current interval of the main thread
+static BOOL sampling_detailed; // true if the analyses are instrumented (chosen or warmup interval)
+
+/* region of interest (ROI): the analyses are only instrumented inside the ROI, outside of it
+ * instructions are only counted; every switch removes all instrumentation. The ROI is either
+ * an instruction count window of the main thread, or every execution of a given function. */
+UINT64 _roi_start; // main thread instruction count at which the ROI starts
+UINT64 _roi_end; // main thread instruction count at which the ROI ends (0: end of program)
+char* _roi_function; // NULL for an instruction count window
+static BOOL roi; // ROI control enabled
+static volatile BOOL roi_active;
+static BOOL roi_over; // end of the instruction count window reached
+static UINT32 roi_depth; // nesting of calls to the ROI function
+static UINT64 roi_cnt; // number of times the ROI was entered
+static PIN_LOCK roi_lock;
 
 /**********************************************
  *                    MAIN                    *
@@ -80,16 +164,24 @@ ofstream _log;
 /* append <pid>_pin.out to name if necessary */
 const char *mkfilename(const char *name)
 {
-    char retx[100];
+	ostringstream retx;
+	retx << name;
 	if (append_pid){
-        sprintf(retx,"%s_%d_pin.out",name,getpid());
-    }
-	else{
-        sprintf(retx,"%s_pin.out",name);
-    }
-    char * x = (char*)malloc(sizeof(const char)*100);
-    strcpy(x,retx);
-	return (const char*)x;
+		retx << "_" << getpid();
+	}
+	retx << "_pin.out";
+	return (const char*)checked_strdup(retx.str().c_str());
+}
+
+/* output of the main thread goes to the usual files, other threads append _t<tid> to the name */
+const char *mkfilename_thread(const char *name, THREADID tid)
+{
+	ostringstream retx;
+	if (tid == 0){
+		return mkfilename(name);
+	}
+	retx << name << "_t" << tid;
+	return mkfilename(retx.str().c_str());
 }
 
 // find buffer entry for instruction at given address in a hash table
@@ -138,6 +230,7 @@ ins_buffer_entry* findInsBufferEntry(ADDRINT a){
 		e->next = NULL;
 		e->setRead = false;
 		e->setWritten = false;
+		e->setRegOpCnt = false;
 	}
 
 	return e;
@@ -145,27 +238,6 @@ ins_buffer_entry* findInsBufferEntry(ADDRINT a){
 
 /* ALL */
 VOID Instruction_all(INS ins, VOID* v){
-	if(interval_size == -1)	{
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_no_rep, IARG_END);
-		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_always, IARG_END);
-	}
-	else{
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_no_rep, IARG_END);
-		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_always, IARG_END);
-	}
-
 	ADDRINT insAddr = INS_Address(ins);
 	ins_buffer_entry* e = findInsBufferEntry(insAddr);
 
@@ -191,27 +263,6 @@ VOID Fini_all(INT32 code, VOID* v){
 
 /* ILP */
 VOID Instruction_ilp_all_only(INS ins, VOID* v){
-	if(interval_size == -1){
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_no_rep, IARG_END);
-		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_always, IARG_END);
-	}
-	else{
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_no_rep, IARG_END);
-		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_always, IARG_END);
-	}
-
 	ADDRINT insAddr = INS_Address(ins);
 
 	ins_buffer_entry* e = findInsBufferEntry(insAddr);
@@ -224,27 +275,6 @@ VOID Fini_ilp_all_only(INT32 code, VOID* v){
 
 /* ILP_ONE */
 VOID Instruction_ilp_one_only(INS ins, VOID* v){
-	if(interval_size == -1){
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_no_rep, IARG_END);
-		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_always, IARG_END);
-	}
-	else{
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_no_rep, IARG_END);
-		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_always, IARG_END);
-	}
-
 	ADDRINT insAddr = INS_Address(ins);
 
 	ins_buffer_entry* e = findInsBufferEntry(insAddr);
@@ -257,27 +287,6 @@ VOID Fini_ilp_one_only(INT32 code, VOID* v){
 
 /* ITYPES */
 VOID Instruction_itypes_only(INS ins, VOID* v){
-	if(interval_size == -1){
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_no_rep, IARG_END);
-		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_always, IARG_END);
-	}
-	else{
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_no_rep, IARG_END);
-		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_always, IARG_END);
-	}
-
 	instrument_itypes(ins, v);
 }
 
@@ -287,27 +296,6 @@ VOID Fini_itypes_only(INT32 code, VOID* v){
 
 /* PPM */
 VOID Instruction_ppm_only(INS ins, VOID* v){
-	if(interval_size == -1){
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_no_rep, IARG_END);
-		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_always, IARG_END);
-	}
-	else{
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_no_rep, IARG_END);
-		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_always, IARG_END);
-	}
-
 	instrument_ppm(ins, v);
 }
 
@@ -317,27 +305,6 @@ VOID Fini_ppm_only(INT32 code, VOID* v){
 
 /* REG */
 VOID Instruction_reg_only(INS ins, VOID* v){
-	if(interval_size == -1){
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_no_rep, IARG_END);
-		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_always, IARG_END);
-	}
-	else{
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_no_rep, IARG_END);
-		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_always, IARG_END);
-	}
-
 	ADDRINT insAddr = INS_Address(ins);
 
 	ins_buffer_entry* e = findInsBufferEntry(insAddr);
@@ -351,27 +318,6 @@ VOID Fini_reg_only(INT32 code, VOID* v){
 
 /* STRIDE */
 VOID Instruction_stride_only(INS ins, VOID* v){
-	if(interval_size == -1){
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_no_rep, IARG_END);
-		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_always, IARG_END);
-	}
-	else{
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_no_rep, IARG_END);
-		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_always, IARG_END);
-	}
-
 	instrument_stride(ins, v);
 }
 
@@ -381,27 +327,6 @@ VOID Fini_stride_only(INT32 code, VOID* v){
 
 /* MEMFOOTPRINT */
 VOID Instruction_memfootprint_only(INS ins, VOID* v){
-	if(interval_size == -1){
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_no_rep, IARG_END);
-		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_always, IARG_END);
-	}
-	else{
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_no_rep, IARG_END);
-		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_always, IARG_END);
-	}
-
 	instrument_memfootprint(ins, v);
 }
 
@@ -411,107 +336,547 @@ VOID Fini_memfootprint_only(INT32 code, VOID* v){
 
 /* MEMSTACKDIST */
 VOID Instruction_memstackdist_only(INS ins, VOID* v){
-	if(interval_size == -1){
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_no_rep, IARG_END);
+	instrument_memstackdist(ins, v);
+}
+
+VOID Fini_memstackdist_only(INT32 code, VOID* v){
+	fini_memstackdist(code, v);
+}
+
+/* CAPTURE: write a trace of the program, which can be analyzed offline by mica_replay */
+VOID Instruction_capture(INS ins, VOID* v){
+	instrument_capture(ins, v);
+}
+
+VOID Fini_capture(INT32 code, VOID* v){
+	fini_capture(code, v);
+}
+
+/* BBV: collect basic block vectors per interval, and choose the intervals to analyze in sampled mode */
+VOID Instruction_bbv(INS ins, VOID* v){
+	instrument_bbv(ins, v);
+}
+
+VOID Fini_bbv(INT32 code, VOID* v){
+	fini_bbv(code, v);
+}
+
+/* SAMPLED: the chosen intervals are analyzed as in 'all' mode (after a warmup), instructions are
+ * only counted in between; instrumentation is removed at every switch between both */
+VOID Instruction_sampled(INS ins, VOID* v){
+	if(sampling_detailed)
+		Instruction_all(ins, v);
+}
+
+VOID Fini_sampled(INT32 code, VOID* v){
+
+	UINT32 i;
+	ofstream output_file_sampled;
+
+	/* last (partial) interval, if chosen */
+	if(interval_output)
+		Fini_all(code, v);
+
+	/* the weight of every interval in the *_phases_int files */
+	output_file_sampled.open(mkfilename("sampled_weights"), ios::out|ios::trunc);
+	for(i = 0; i < sample_cnt && (sample_intervals[i] < sample_interval || (sample_intervals[i] == sample_interval && interval_output)); i++){
+		output_file_sampled << sample_intervals[i] << " " << sample_weights[i] << endl;
+	}
+	output_file_sampled.close();
+
+	LOG_MSG("analyzed " << i << " of " << sample_cnt << " chosen intervals (" << sample_interval << " intervals in total)");
+}
+
+/* phase of the current interval: sets interval_output if it was chosen, returns true if it should be analyzed */
+static BOOL sampling_phase(){
+
+	while(sample_next < sample_cnt && sample_intervals[sample_next] < sample_interval)
+		sample_next++;
+
+	if(sample_next == sample_cnt){
+		interval_output = false;
+		return false;
+	}
+
+	interval_output = (sample_intervals[sample_next] == sample_interval);
+
+	return sample_intervals[sample_next] - sample_interval <= _sampling_warmup;
+}
+
+/* CUSTOM: a set of analysis types (comma-separated analysis_type), instrumented with fused calls */
+VOID Instruction_custom(INS ins, VOID* v){
+	ins_buffer_entry* e = NULL;
+
+	if(analysis_set & (ANALYSIS_SET_ILP | ANALYSIS_SET_ILP_ONE | ANALYSIS_SET_REG)){
+		e = findInsBufferEntry(INS_Address(ins));
+	}
+
+	instrument_custom(ins, v, e);
+}
+
+VOID Fini_custom(INT32 code, VOID* v){
+	if(analysis_set & ANALYSIS_SET_ILP)
+		fini_ilp_all(code, v);
+	if(analysis_set & ANALYSIS_SET_ILP_ONE)
+		fini_ilp_one(code, v);
+	if(analysis_set & ANALYSIS_SET_ITYPES)
+		fini_itypes(code, v);
+	if(analysis_set & ANALYSIS_SET_PPM)
+		fini_ppm(code, v);
+	if(analysis_set & ANALYSIS_SET_REG)
+		fini_reg(code, v);
+	if(analysis_set & ANALYSIS_SET_STRIDE)
+		fini_stride(code, v);
+	if(analysis_set & ANALYSIS_SET_MEMFOOTPRINT)
+		fini_memfootprint(code, v);
+	if(analysis_set & ANALYSIS_SET_MEMSTACKDIST)
+		fini_memstackdist(code, v);
+}
+
+static VOID init_module(UINT32 module){
+	switch(module){
+		case ANALYSIS_SET_ILP: init_ilp_all(); break;
+		case ANALYSIS_SET_ILP_ONE: init_ilp_one(); break;
+		case ANALYSIS_SET_ITYPES: init_itypes(); break;
+		case ANALYSIS_SET_PPM: init_ppm(); break;
+		case ANALYSIS_SET_REG: init_reg(); break;
+		case ANALYSIS_SET_STRIDE: init_stride(); break;
+		case ANALYSIS_SET_MEMFOOTPRINT: init_memfootprint(); break;
+		case ANALYSIS_SET_MEMSTACKDIST: init_memstackdist(); break;
+	}
+}
+
+/* with analysis threads, every analysis type is instrumented on its own (without fused calls) */
+static VOID instrument_module(UINT32 module, INS ins, VOID* v){
+	switch(module){
+		case ANALYSIS_SET_ILP: instrument_ilp_all(ins, findInsBufferEntry(INS_Address(ins))); break;
+		case ANALYSIS_SET_ILP_ONE: instrument_ilp_one(ins, findInsBufferEntry(INS_Address(ins))); break;
+		case ANALYSIS_SET_ITYPES: instrument_itypes(ins, v); break;
+		case ANALYSIS_SET_PPM: instrument_ppm(ins, v); break;
+		case ANALYSIS_SET_REG: instrument_reg(ins, findInsBufferEntry(INS_Address(ins))); break;
+		case ANALYSIS_SET_STRIDE: instrument_stride(ins, v); break;
+		case ANALYSIS_SET_MEMFOOTPRINT: instrument_memfootprint(ins, v); break;
+		case ANALYSIS_SET_MEMSTACKDIST: instrument_memstackdist(ins, v); break;
+	}
+}
+
+/* the interval clients registered by each analysis type are noted, for the analysis threads */
+void init_custom(){
+
+	UINT32 module, clients;
+
+	worker_cnt = 0;
+	for(module = ANALYSIS_SET_ILP; module <= ANALYSIS_SET_MEMSTACKDIST; module <<= 1){
+		if(analysis_set & module){
+			clients = interval_client_cnt;
+			init_module(module);
+			worker_modules[worker_cnt] = module;
+			worker_interval_clients[worker_cnt] = BITS_TO_MASK(interval_client_cnt) & ~BITS_TO_MASK(clients);
+			worker_cnt++;
 		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_always, IARG_END);
 	}
-	else{
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
+}
+
+VOID init_custom_thread(mica_thread* t){
+	if(analysis_set & ANALYSIS_SET_ILP)
+		init_ilp_all_thread(t);
+	if(analysis_set & ANALYSIS_SET_ILP_ONE)
+		init_ilp_one_thread(t);
+	if(analysis_set & ANALYSIS_SET_ITYPES)
+		init_itypes_thread(t);
+	if(analysis_set & ANALYSIS_SET_PPM)
+		init_ppm_thread(t);
+	if(analysis_set & ANALYSIS_SET_REG)
+		init_reg_thread(t);
+	if(analysis_set & ANALYSIS_SET_STRIDE)
+		init_stride_thread(t);
+	if(analysis_set & ANALYSIS_SET_MEMFOOTPRINT)
+		init_memfootprint_thread(t);
+	if(analysis_set & ANALYSIS_SET_MEMSTACKDIST)
+		init_memstackdist_thread(t);
+}
+
+
+/* set of analysis types measured in the given mode */
+static UINT32 mode_analysis_set(MODE mode){
+	switch(mode){
+		case MODE_ALL: return ANALYSIS_SET_ILP | ANALYSIS_SET_ITYPES | ANALYSIS_SET_PPM | ANALYSIS_SET_REG | ANALYSIS_SET_STRIDE | ANALYSIS_SET_MEMFOOTPRINT | ANALYSIS_SET_MEMSTACKDIST;
+		case MODE_ILP: return ANALYSIS_SET_ILP;
+		case MODE_ILP_ONE: return ANALYSIS_SET_ILP_ONE;
+		case MODE_ITYPES: return ANALYSIS_SET_ITYPES;
+		case MODE_PPM: return ANALYSIS_SET_PPM;
+		case MODE_REG: return ANALYSIS_SET_REG;
+		case MODE_STRIDE: return ANALYSIS_SET_STRIDE;
+		case MODE_MEMFOOTPRINT: return ANALYSIS_SET_MEMFOOTPRINT;
+		case MODE_MEMSTACKDIST: return ANALYSIS_SET_MEMSTACKDIST;
+		default: return analysis_set;
+	}
+}
+
+/* set up analysis state for a new thread, which is kept until the program ends */
+VOID ThreadStart(THREADID tid, CONTEXT *context, INT32 flags, VOID *data)
+{
+	mica_thread* t;
+
+	/* sampled mode switches all threads between detailed analysis and counting at once,
+	 * following the intervals chosen for (and counted by) the main thread */
+	if(sampling && tid != 0){
+		cerr << "ERROR! Sampled analysis only supports single-threaded programs (thread " << tid << " started)." << endl;
+		_log << "ERROR! Sampled analysis only supports single-threaded programs (thread " << tid << " started)." << endl;
+		exit(1);
+	}
+
+	t = (mica_thread*)checked_aligned_malloc(sizeof(mica_thread));
+
+	t->tid = tid;
+	t->interval_ins_count = 0;
+	t->interval_ins_count_for_hpc_alignment = 0;
+	t->total_ins_count = 0;
+	t->total_ins_count_for_hpc_alignment = 0;
+	t->roi_ins_count = 0;
+	t->interval_clients = ~0;
+	t->ilp = NULL;
+	t->itypes = NULL;
+	t->ppm = NULL;
+	t->reg = NULL;
+	t->stride = NULL;
+	t->memfootprint = NULL;
+	t->memstackdist = NULL;
+	t->capture = NULL;
+	t->bbv = NULL;
+	t->lines = NULL;
+
+	init_thread(t);
+
+	PIN_SetThreadData(mica_tls_key, t, tid);
+	PIN_SetContextReg(context, mica_thread_reg, (ADDRINT)t);
+
+	PIN_GetLock(&mica_threads_lock, tid+1);
+	if(mica_thread_cnt == mica_threads_size){
+		mica_threads_size *= 2;
+		mica_threads = (mica_thread**)checked_realloc(mica_threads, mica_threads_size*sizeof(mica_thread*));
+	}
+	mica_threads[mica_thread_cnt++] = t;
+	PIN_ReleaseLock(&mica_threads_lock);
+
+	if(analysis_threads){
+		workers_thread_start(t);
+	}
+
+	if(tid != 0){
+		LOG_MSG("Thread " << tid << " started, analyzed separately.");
+	}
+}
+
+
+/* interval engine */
+VOID interval_register(VOID (*output)(mica_thread* t), VOID (*reset)(mica_thread* t)){
+	if(interval_client_cnt == MAX_INTERVAL_CLIENTS){
+		cerr << "FATAL ERROR: too many modules registered for interval output (max. " << MAX_INTERVAL_CLIENTS << ")" << endl;
+		_log << "FATAL ERROR: too many modules registered for interval output (max. " << MAX_INTERVAL_CLIENTS << ")" << endl;
+		exit(1);
+	}
+	interval_clients[interval_client_cnt].output = output;
+	interval_clients[interval_client_cnt].reset = reset;
+	interval_client_cnt++;
+}
+
+/* true if the instruction (with given lag) is the last one of the interval; inlined by Pin */
+static ADDRINT interval_end(mica_thread* t, UINT32 lag){
+	return (ADDRINT)(t->interval_ins_count_for_hpc_alignment - lag == interval_size);
+}
+
+/* only called if interval is 'full': output and reset the per-interval state of all modules */
+static VOID interval_close(mica_thread* t, UINT32 lag){
+
+	UINT32 i;
+	BOOL detailed;
+
+	ins_counts_rewind(t, lag);
+
+	for(i=0; i < interval_client_cnt; i++){
+		if(t->interval_clients & (1 << i)){
+			if(interval_output)
+				interval_clients[i].output(t);
+			interval_clients[i].reset(t);
 		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_no_rep, IARG_END);
+	}
+	t->interval_ins_count = 0;
+	t->interval_ins_count_for_hpc_alignment = 0;
+
+	/* sampled mode: the main thread moves on to the next interval, switching between
+	 * detailed analysis and counting only (takes effect when the current trace is left) */
+	if(sampling && t->tid == 0){
+		sample_interval++;
+		detailed = sampling_phase();
+		if(detailed != sampling_detailed){
+			sampling_detailed = detailed;
+			PIN_RemoveInstrumentation();
 		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_always, IARG_END);
 	}
 
-	instrument_memstackdist(ins, v);
+	ins_counts_forward(t, lag);
 }
 
-VOID Fini_memstackdist_only(INT32 code, VOID* v){
-	fini_memstackdist(code, v);
+/* true if the interval may end within the next n instructions, selects the boundary version; inlined by Pin */
+static ADDRINT interval_block_check(mica_thread* t, UINT32 n){
+	return (ADDRINT)(interval_size - t->interval_ins_count_for_hpc_alignment <= (INT64)n);
 }
 
-/* MY TYPE */
-VOID Instruction_custom(INS ins, VOID* v){
+/* one check per instruction for all modules (or the given interval clients), after the analysis calls of the instruction itself */
+static VOID check_interval(INS ins, UINT32 clients){
+	if(interval_size != -1 && (clients & BITS_TO_MASK(interval_client_cnt)) != 0){
+		mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, interval_end, IARG_REG_VALUE, mica_thread_reg, IARG_UINT32, ins_lag, IARG_END);
+		mica_insert_call(MICA_THEN_CALL, ins, IPOINT_BEFORE, interval_close, IARG_REG_VALUE, mica_thread_reg, IARG_UINT32, ins_lag, IARG_END);
+	}
+}
 
+/* count a REP prefixed instruction on its own, once per iteration (and once for hpc alignment) */
+static VOID count_rep_instruction(INS ins){
 	if(interval_size == -1){
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_for_hpc_alignment_no_rep, IARG_END);
-		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full_count_always, IARG_END);
+		mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
+		mica_insert_call(MICA_THEN_CALL, ins, IPOINT_BEFORE, all_instr_full_count_for_hpc_alignment_with_rep, IARG_THREAD_ID, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, all_instr_full_count_always, IARG_THREAD_ID, IARG_END);
 	}
 	else{
-		if(INS_HasRealRep(ins)){
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
-			INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_with_rep, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
-		}
-		else{
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_for_hpc_alignment_no_rep, IARG_END);
-		}
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals_count_always, IARG_END);
+		mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, returnArg, IARG_FIRST_REP_ITERATION, IARG_END);
+		mica_insert_call(MICA_THEN_CALL, ins, IPOINT_BEFORE, all_instr_intervals_count_for_hpc_alignment_with_rep, IARG_THREAD_ID, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, all_instr_intervals_count_always, IARG_THREAD_ID, IARG_END);
 	}
+	count_call_cnt++;
+}
 
-	cerr << "Please choose a subset of characteristics you want to use, and remove this message (along with the exit call)" << endl;
-	exit(1);
-	// Choose subset of characteristics, and make the same adjustments in Fini_custom and init_custom below
+/* count a run of n non-REP instructions with a single (inlined) call before its first instruction */
+static VOID count_run(INS ins, UINT32 n){
+	if(interval_size == -1){
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, all_instr_full_count_run, IARG_REG_VALUE, mica_thread_reg, IARG_UINT32, n, IARG_END);
+	}
+	else{
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, all_instr_intervals_count_run, IARG_REG_VALUE, mica_thread_reg, IARG_UINT32, n, IARG_END);
+	}
+#ifdef VERBOSE
+	mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, all_instr_count_run_progress, IARG_REG_VALUE, mica_thread_reg, IARG_UINT32, n, IARG_END);
+	mica_insert_call(MICA_THEN_CALL, ins, IPOINT_BEFORE, all_instr_count_run_report, IARG_REG_VALUE, mica_thread_reg, IARG_END);
+#endif
+	count_call_cnt++;
+}
 
-	//ADDRINT insAddr = INS_Address(ins);
-	//ins_buffer_entry* e = findInsBufferEntry(insAddr);
+/* ROI switches, done by the program threads (instrumentation changes when the current trace is left) */
+static VOID roi_set(BOOL active){
+
+	PIN_GetLock(&roi_lock, 1);
+	if(active != roi_active){
+		roi_active = active;
+		if(active)
+			roi_cnt++;
+		else if(_roi_function == NULL)
+			roi_over = true;
+		PIN_RemoveInstrumentation();
+	}
+	PIN_ReleaseLock(&roi_lock);
+}
 
-	//instrument_ilp_all(ins, e);
-	//instrument_ilp_one(ins, e);
-	//instrument_itypes(ins, v);
-	//instrument_ppm(ins, v);
-	//instrument_reg(ins, e);
-	//instrument_stride(ins, v);
-	//instrument_memfootprint(ins, v);
-	//instrument_memstackdist(ins, v);
+static VOID roi_enter(){
+	roi_set(true);
 }
 
-VOID Fini_custom(INT32 code, VOID* v){
-	//fini_ilp_all(code, v);
-	//fini_ilp_one(code, v);
-	//fini_itypes(code, v);
-	//fini_ppm(code, v);
-	//fini_reg(code, v);
-	//fini_stride(code, v);
-	//fini_memfootprint(code, v);
-	//fini_memstackdist(code, v);
+static VOID roi_leave(){
+	roi_set(false);
 }
 
-void init_custom(){
-	//init_ilp_all();
-	//init_ilp_one();
-	//init_itypes();
-	//init_ppm();
-	//init_reg();
-	//init_stride();
-	//init_memfootprint();
-	//init_memstackdist();
+/* count n instructions, true if the main thread reaches the start (end) of the window; inlined by Pin */
+static ADDRINT roi_count_to_start(mica_thread* t, UINT32 n){
+	t->roi_ins_count += n;
+	return (ADDRINT)(t->tid == 0 && t->roi_ins_count >= _roi_start);
 }
 
+static ADDRINT roi_count_to_end(mica_thread* t, UINT32 n){
+	t->roi_ins_count += n;
+	return (ADDRINT)(t->tid == 0 && t->roi_ins_count >= _roi_end);
+}
 
-VOID ThreadStart(THREADID id, CONTEXT *context, INT32 flags, VOID *data)
-{
-	if (__sync_fetch_and_add(&thread_count, 1))
-	{
-		LOG_MSG("WARNING: Thread creation detected, results can be corrupted!\n");
-		WARNING_MSG("Thread creation detected, results can be corrupted!");
+static VOID roi_count(mica_thread* t, UINT32 n){
+	t->roi_ins_count += n;
+}
+
+/* calls of the ROI function may be nested, the ROI ends when the outermost one returns */
+static VOID roi_function_enter(){
+	if(__sync_fetch_and_add(&roi_depth, 1) == 0)
+		roi_set(true);
+}
+
+static VOID roi_function_exit(){
+	if(__sync_sub_and_fetch(&roi_depth, 1) == 0)
+		roi_set(false);
+}
+
+/* outside the ROI, instructions are only counted (once per run), up to the start of the ROI */
+static VOID instrument_roi_outside(INS ins){
+
+	if(ins_run == 0)
+		return;
+
+	if(_roi_function == NULL && !roi_over){
+		mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, roi_count_to_start, IARG_REG_VALUE, mica_thread_reg, IARG_UINT32, ins_run, IARG_END);
+		mica_insert_call(MICA_THEN_CALL, ins, IPOINT_BEFORE, roi_enter, IARG_END);
+	}
+	else{
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, roi_count, IARG_REG_VALUE, mica_thread_reg, IARG_UINT32, ins_run, IARG_END);
+	}
+	count_call_cnt++;
+}
+
+/* inside an instruction count window with an end, instructions are counted up to the end as well */
+static VOID instrument_roi_inside(INS ins){
+
+	if(ins_run == 0 || _roi_function != NULL || _roi_end == 0)
+		return;
+
+	mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, roi_count_to_end, IARG_REG_VALUE, mica_thread_reg, IARG_UINT32, ins_run, IARG_END);
+	mica_insert_call(MICA_THEN_CALL, ins, IPOINT_BEFORE, roi_leave, IARG_END);
+}
+
+VOID Routine_roi(RTN rtn, VOID* v){
+
+	if(RTN_Name(rtn) != _roi_function)
+		return;
+
+	RTN_Open(rtn);
+	RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)roi_function_enter, IARG_END);
+	RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR)roi_function_exit, IARG_END);
+	RTN_Close(rtn);
+}
+
+VOID Fini_roi(INT32 code, VOID* v){
+
+	UINT32 k;
+	UINT64 outside = 0;
+
+	for(k=0; k < mica_thread_cnt; k++)
+		outside += mica_threads[k]->roi_ins_count;
+
+	if(_roi_function == NULL){
+		LOG_MSG("region of interest: instructions " << _roi_start << " to " << _roi_end << " of the main thread, " << (roi_cnt > 0 ? "reached" : "not reached"));
+	}
+	else{
+		LOG_MSG("region of interest: function " << _roi_function << " entered " << roi_cnt << " times, " << outside << " instructions outside of it");
 	}
 }
 
+/* count and instrument an instruction: REP prefixed instructions are counted on their own,
+ * the head of a run of n other instructions counts the whole run (n is 0 for the rest of the run) */
+static VOID instrument_counted(INS ins, VOID* v, UINT32 n){
+
+	UINT32 id, w;
+
+	if(roi){
+		if(!roi_active){
+			instrument_roi_outside(ins);
+			return;
+		}
+		instrument_roi_inside(ins);
+	}
+
+	if(!analysis_threads){
+		if(INS_HasRealRep(ins))
+			count_rep_instruction(ins);
+		else if(n > 0)
+			count_run(ins, n);
+		instrument_ins(ins, v);
+		if(trace_checked)
+			check_interval(ins, ~0);
+		return;
+	}
+
+	/* analysis threads: the calls of every analysis type are recorded for its own thread,
+	 * the program thread only fills an event record */
+	id = workers_new_ins();
+	for(w = 0; w < worker_cnt; w++){
+		workers_record_begin(id, w);
+		if(INS_HasRealRep(ins))
+			count_rep_instruction(ins);
+		else if(n > 0)
+			count_run(ins, n);
+		instrument_module(worker_modules[w], ins, v);
+		check_interval(ins, worker_interval_clients[w]);
+		workers_record_end();
+	}
+	workers_fill(ins, id);
+}
+
+/* instructions are counted per basic block rather than per instruction: a basic block is split
+ * in runs of instructions without REP prefix (which may execute zero or more times), each run is
+ * counted at its head, after which every instruction is instrumented by the chosen mode
+ *
+ * the end of an interval is checked once per basic block, at its head and before anything else:
+ * the instruction count of a block grows by at most one per (static) instruction, so the interval
+ * can only end within the block if no more instructions remain in the interval than the block has;
+ * only then the block switches to the boundary version of the trace, which checks after every
+ * instruction and so closes the interval at the exact instruction (the analysis routines of the
+ * fast version inserted after the version case are not done for that block)
+ *
+ * instrumentation is done once per trace (unless the code cache is flushed),
+ * its cost grows with the static footprint of the program, so it is measured and logged */
+VOID Trace_timed(TRACE trace, VOID* v){
+
+	struct timespec start, end;
+	BBL bbl;
+	INS ins, run_end;
+	UINT32 n, k;
+	BOOL versions;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* analysis threads check every instruction (their calls are recorded), outside the ROI nothing is checked */
+	versions = interval_size != -1 && !analysis_threads && interval_client_cnt > 0 && (!roi || roi_active);
+	trace_checked = !versions || TRACE_Version(trace) == MICA_VERSION_BOUNDARY;
+
+	for(bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)){
+		ins = BBL_InsHead(bbl);
+		if(versions){
+			if(trace_checked){
+				BBL_SetTargetVersion(bbl, MICA_VERSION_FAST);
+			}
+			else{
+				mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, interval_block_check, IARG_REG_VALUE, mica_thread_reg, IARG_UINT32, BBL_NumIns(bbl), IARG_RETURN_REGS, mica_version_reg, IARG_END);
+				INS_InsertVersionCase(ins, mica_version_reg, 1, MICA_VERSION_BOUNDARY, IARG_END);
+			}
+		}
+		while(INS_Valid(ins)){
+			if(INS_HasRealRep(ins)){
+				ins_lag = 0;
+				ins_run = 1;
+				instrument_counted(ins, v, 0);
+				static_ins_cnt++;
+				ins = INS_Next(ins);
+				continue;
+			}
+
+			/* find the end of this run */
+			n = 0;
+			for(run_end = ins; INS_Valid(run_end) && !INS_HasRealRep(run_end); run_end = INS_Next(run_end))
+				n++;
+
+			for(k = 0; k < n; k++){
+				ins_lag = n - 1 - k;
+				ins_run = (k == 0 ? n : 0);
+				instrument_counted(ins, v, k == 0 ? n : 0);
+				static_ins_cnt++;
+				ins = INS_Next(ins);
+			}
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	instrumentation_ns += (UINT64)(end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+}
+
+VOID Fini_instrumentation(INT32 code, VOID* v){
+	LOG_MSG("instrumented " << static_ins_cnt << " static instructions in " << (double)instrumentation_ns / 1e9 << " s");
+	LOG_MSG("inserted " << count_call_cnt << " instruction counting calls (" << (double)count_call_cnt / static_ins_cnt << " per static instruction)");
+}
+
 
 /************
  *   MAIN   *
@@ -523,78 +888,135 @@ int main(int argc, char* argv[]){
 
 	setup_mica_log(&_log);
 
-	read_config(&_log, &interval_size, &mode, &_ilp_win_size, &_block_size, &_page_size, &_itypes_spec_file, &append_pid);
+	read_config(&_log, &interval_size, &mode, &_ilp_win_size, _ilp_win_sizes, &_ilp_win_size_cnt, &_ilp_buffer_size, _ppm_hist_lengths, &_ppm_hist_length_cnt, &_block_size, &_page_size, &_itypes_spec_file, &append_pid, _memstackdist_block_sizes, &_memstackdist_block_size_cnt, &_memstackdist_engine, &_memstackdist_writes, &_memstackdist_sampling, &_memstackdist_sampling_lines, &analysis_set, &analysis_threads, &_bbv_clusters, &_sampling_warmup, &_simpoints_file, &_weights_file, &_roi_start, &_roi_end, &_roi_function);
 
 	cerr << "interval_size: " << interval_size << ", mode: " << mode << endl;
 
-	interval_ins_count = 0;
-	interval_ins_count_for_hpc_alignment = 0;
-	total_ins_count = 0;
-	total_ins_count_for_hpc_alignment = 0;
+	/* with analysis threads, the analysis types are measured as a set, one thread each */
+	if(analysis_threads){
+		analysis_set = mode_analysis_set(mode);
+		mode = MODE_CUSTOM;
+	}
+
+	mica_thread_cnt = 0;
+	mica_threads_size = 16;
+	mica_threads = (mica_thread**)checked_malloc(mica_threads_size*sizeof(mica_thread*));
+	PIN_InitLock(&mica_threads_lock);
 
 	for(i=0; i < MAX_MEM_TABLE_ENTRIES; i++){
 		ins_buffer[i] = (ins_buffer_entry*)NULL;
 	}
 
+	/* without a window or function, the ROI is the whole program */
+	roi = (_roi_start != 0 || _roi_end != 0 || _roi_function != NULL);
+	roi_active = !roi;
+	roi_over = false;
+	roi_depth = 0;
+	roi_cnt = 0;
+	PIN_InitLock(&roi_lock);
+	if(_roi_function != NULL){
+		PIN_InitSymbols();
+	}
+
 	switch(mode){
 		case MODE_ALL:
 			init_all();
+			init_thread = init_all_thread;
 			PIN_Init(argc, argv);
-			INS_AddInstrumentFunction(Instruction_all, 0);
+			instrument_ins = Instruction_all;
 			PIN_AddFiniFunction(Fini_all, 0);
 			break;
 		case MODE_ILP:
 			init_ilp_all();
+			init_thread = init_ilp_all_thread;
 			PIN_Init(argc, argv);
-			INS_AddInstrumentFunction(Instruction_ilp_all_only, 0);
+			instrument_ins = Instruction_ilp_all_only;
 			PIN_AddFiniFunction(Fini_ilp_all_only, 0);
 			break;
 		case MODE_ILP_ONE:
 			init_ilp_one();
+			init_thread = init_ilp_one_thread;
 			PIN_Init(argc, argv);
-			INS_AddInstrumentFunction(Instruction_ilp_one_only, 0);
+			instrument_ins = Instruction_ilp_one_only;
 			PIN_AddFiniFunction(Fini_ilp_one_only, 0);
 			break;
 		case MODE_ITYPES:
 			init_itypes();
+			init_thread = init_itypes_thread;
 			PIN_Init(argc, argv);
-			INS_AddInstrumentFunction(Instruction_itypes_only, 0);
+			instrument_ins = Instruction_itypes_only;
 			PIN_AddFiniFunction(Fini_itypes_only, 0);
 			break;
 		case MODE_PPM:
 			init_ppm();
+			init_thread = init_ppm_thread;
 			PIN_Init(argc, argv);
-			INS_AddInstrumentFunction(Instruction_ppm_only, 0);
+			instrument_ins = Instruction_ppm_only;
 			PIN_AddFiniFunction(Fini_ppm_only, 0);
 			break;
 		case MODE_REG:
 			init_reg();
+			init_thread = init_reg_thread;
 			PIN_Init(argc, argv);
-			INS_AddInstrumentFunction(Instruction_reg_only, 0);
+			instrument_ins = Instruction_reg_only;
 			PIN_AddFiniFunction(Fini_reg_only, 0);
 			break;
 		case MODE_STRIDE:
 			init_stride();
+			init_thread = init_stride_thread;
 			PIN_Init(argc, argv);
-			INS_AddInstrumentFunction(Instruction_stride_only, 0);
+			instrument_ins = Instruction_stride_only;
 			PIN_AddFiniFunction(Fini_stride_only, 0);
 			break;
 		case MODE_MEMFOOTPRINT:
 			init_memfootprint();
+			init_thread = init_memfootprint_thread;
 			PIN_Init(argc, argv);
-			INS_AddInstrumentFunction(Instruction_memfootprint_only, 0);
+			instrument_ins = Instruction_memfootprint_only;
 			PIN_AddFiniFunction(Fini_memfootprint_only, 0);
 			break;
 		case MODE_MEMSTACKDIST:
 			init_memstackdist();
+			init_thread = init_memstackdist_thread;
 			PIN_Init(argc, argv);
-			INS_AddInstrumentFunction(Instruction_memstackdist_only, 0);
+			instrument_ins = Instruction_memstackdist_only;
 			PIN_AddFiniFunction(Fini_memstackdist_only, 0);
 			break;
+		case MODE_CAPTURE:
+			init_capture();
+			init_thread = init_capture_thread;
+			PIN_Init(argc, argv);
+			instrument_ins = Instruction_capture;
+			PIN_AddFiniFunction(Fini_capture, 0);
+			break;
+		case MODE_BBV:
+			init_bbv();
+			init_thread = init_bbv_thread;
+			PIN_Init(argc, argv);
+			instrument_ins = Instruction_bbv;
+			PIN_AddFiniFunction(Fini_bbv, 0);
+			break;
+		case MODE_SAMPLED:
+			init_all();
+			init_thread = init_all_thread;
+			sample_cnt = read_simpoints(_simpoints_file, _weights_file, &sample_intervals, &sample_weights);
+			LOG_MSG(sample_cnt << " chosen intervals, warmup of " << _sampling_warmup << " intervals");
+			sampling = true;
+			sample_next = 0;
+			sample_interval = 0;
+			sampling_detailed = sampling_phase();
+			PIN_Init(argc, argv);
+			instrument_ins = Instruction_sampled;
+			PIN_AddFiniFunction(Fini_sampled, 0);
+			break;
 		case MODE_CUSTOM:
 			init_custom();
+			init_thread = init_custom_thread;
 			PIN_Init(argc, argv);
-			INS_AddInstrumentFunction(Instruction_custom, 0);
+			instrument_ins = Instruction_custom;
+			if(analysis_threads){
+				init_workers(worker_cnt, worker_interval_clients); // adds a fini function to finish the analysis first
+			}
 			PIN_AddFiniFunction(Fini_custom, 0);
 			break;
 		default:
@@ -603,9 +1025,32 @@ int main(int argc, char* argv[]){
 			exit(1);
 	}
 
-	// The tool does not handle multithreaded programs.
-	// Since results might be bogus, we print a warning
-	// when presence of multiple threads is detected by PIN.
+	static_ins_cnt = 0;
+	count_call_cnt = 0;
+	instrumentation_ns = 0;
+	mica_thread_reg = PIN_ClaimToolRegister();
+	if(!REG_valid(mica_thread_reg)){
+		cerr << "FATAL ERROR: Unable to claim a Pin tool register for instruction counting!" << endl;
+		_log << "FATAL ERROR: Unable to claim a Pin tool register for instruction counting!" << endl;
+		exit(1);
+	}
+	mica_version_reg = PIN_ClaimToolRegister();
+	if(!REG_valid(mica_version_reg)){
+		cerr << "FATAL ERROR: Unable to claim a Pin tool register for interval checks!" << endl;
+		_log << "FATAL ERROR: Unable to claim a Pin tool register for interval checks!" << endl;
+		exit(1);
+	}
+	TRACE_AddInstrumentFunction(Trace_timed, 0);
+	PIN_AddFiniFunction(Fini_instrumentation, 0);
+	if(_roi_function != NULL){
+		RTN_AddInstrumentFunction(Routine_roi, 0);
+	}
+	if(roi){
+		PIN_AddFiniFunction(Fini_roi, 0);
+	}
+
+	// every thread is analyzed separately, using its own analysis state
+	mica_tls_key = PIN_CreateThreadDataKey(NULL);
 	PIN_AddThreadStartFunction(ThreadStart, NULL);
 
 	// starts program, never returns
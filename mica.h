@@ -40,6 +40,8 @@ extern int append_pid;
 #define BITS_TO_MASK(x) ((1ull << (x)) - 1ull)
 #define BITS_TO_COUNT(x) (1ull << (x))
 
+#define CACHE_LINE_SIZE 64
+
 
 /* *** defines *** */
 
@@ -48,6 +50,7 @@ extern int append_pid;
 /* ILP/MEMFOOTPRINT */
 
 #define ILP_WIN_SIZE_BASE 32
+#define ILP_MAX_WIN_SIZE_CNT 16 // window sizes simulated at once (ilp_sizes)
 
 // number of stack entries in single hash table item
 #define LOG_MAX_MEM_ENTRIES     16
@@ -61,9 +64,8 @@ extern int append_pid;
 #define MAX_MEM_TABLE_ENTRIES 12289 // hash table size, should be a prime number (769, 1543, 3079, 6151, 12289, 24593, 49157, 98317, 196613, 393241, 786433)
 
 /* PPM */
-#define MAX_HIST_LENGTH 12
-#define NUM_HIST_LENGTHS 3
-const UINT32 history_lengths[NUM_HIST_LENGTHS] = {4,8,12};
+#define MAX_HIST_LENGTH 24 // longest history length (ppm_history_lengths)
+#define MAX_NUM_HIST_LENGTHS 8 // history lengths simulated at once (ppm_history_lengths)
 
 /* REG */
 #define MAX_NUM_REGS 4096
@@ -73,12 +75,17 @@ const UINT32 history_lengths[NUM_HIST_LENGTHS] = {4,8,12};
 #define MAX_REG_USE MAX_DIST
 
 /* STRIDE */
-#define MAX_DISTR 524288 // 2^21
+/* strides are counted in power-of-two buckets: bucket 0 holds stride 0, bucket b holds strides in (2^(b-2), 2^(b-1)],
+ * up to 2^18 (the largest stride reported), the last bucket holds all larger strides */
+#define LOG_MAX_STRIDE 18
+#define STRIDE_BUCKET_CNT (LOG_MAX_STRIDE + 3)
 
 /* MEMREUSEDIST */
 
 #define BUCKET_CNT 19 // number of reuse distance buckets to use
+#define MEMSTACKDIST_MAX_BLOCK_SIZE_CNT 8 // granularities measured at once (memstackdist_block_sizes)
 
 const char *mkfilename(const char *name);
+const char *mkfilename_thread(const char *name, THREADID tid);
 
 #endif
@@ -10,30 +10,20 @@
 /* MICA includes */
 #include "mica_all.h"
 #include "mica_ilp.h" // needed for empty_all_buffer_all
-#include "mica_itypes.h" // needed for itypes_count , itypes_instr_interval_output and itypes_instr_interval_reset
-#include "mica_ppm.h" // needed for instrument_ppm_cond_br, ppm_instr_interval_output and ppm_instr_interval_reset
-#include "mica_reg.h" // needed for reg_instr_full, reg_instr_intervals, reg_instr_interval_output and reg_instr_interval_reset
-#include "mica_stride.h" // needed for stride_index_mem*, readMem_stride, writeMem_stride, stride_instr_interval_output and stride_instr_interval_reset
-#include "mica_memfootprint.h" // needed for memOp, memfootprint_instr_interval_output and memfootprint_instr_interval_reset
-#include "mica_memstackdist.h" // needed for memstackdist_memRead, memstackdist_instr_interval_output and memstackdist_instr_interval_reset
+#include "mica_itypes.h" // needed for instrument_itypes_runs
+#include "mica_ppm.h" // needed for instrument_ppm_cond_br
+#include "mica_reg.h" // needed for reg_instr_full
+#include "mica_stride.h" // needed for stride_index_mem*, readMem_stride, writeMem_stride
+#include "mica_memfootprint.h" // needed for memOp_lines
+#include "mica_memstackdist.h" // needed for memstackdist_memRead_lines/memstackdist_memWrite_lines
+#include "mica_init.h" // needed for ANALYSIS_SET_*
 
-#define PROGRESS_THRESHOLD 10000000 // 10M
+#include <sstream>
 
-extern INT64 total_ins_count;
-extern INT64 total_ins_count_for_hpc_alignment;
-extern INT64 interval_ins_count;
-extern INT64 interval_ins_count_for_hpc_alignment; // one count for REP prefixed instructions
+#define PROGRESS_THRESHOLD 10000000 // 10M
 
 extern INT64 interval_size;
-
-extern identifier** group_identifiers;
-extern INT64* group_ids_cnt;
-extern INT64* group_counts;
-extern INT64 number_of_groups;
-
-extern INT64 other_ids_cnt;
-extern INT64 other_ids_max_cnt;
-extern identifier* other_group_identifiers;
+extern UINT32 analysis_set;
 
 void init_all(){
 
@@ -46,208 +36,248 @@ void init_all(){
 	init_memstackdist();
 }
 
-ADDRINT returnArg(BOOL arg){
+VOID init_all_thread(mica_thread* t){
 
-	return arg;
+	init_ilp_all_thread(t);
+	init_itypes_thread(t);
+	init_ppm_thread(t);
+	init_reg_thread(t);
+	init_stride_thread(t);
+	init_memfootprint_thread(t);
+	init_memstackdist_thread(t);
 }
 
-VOID all_instr_full_count_always(){
+ADDRINT returnArg(BOOL arg){
 
-	total_ins_count++;
+	return arg;
+}
 
 #ifdef VERBOSE
-	if (__builtin_expect (total_ins_count % PROGRESS_THRESHOLD == 0, false)) {
-		ofstream progress_file;
-		progress_file.open ("mica_progress.txt", ios::out | ios::trunc);
-		progress_file << total_ins_count << " instructions analyzed" << endl;
-		progress_file.close ();
+/* progress is tracked per thread, in mica_progress.txt for the main thread */
+static VOID report_progress(mica_thread* t){
+
+	ofstream progress_file;
+	if(t->tid == 0){
+		progress_file.open("mica_progress.txt", ios::out | ios::trunc);
+	}
+	else{
+		ostringstream name;
+		name << "mica_progress_t" << t->tid << ".txt";
+		progress_file.open(name.str().c_str(), ios::out | ios::trunc);
 	}
+	progress_file << t->total_ins_count << " instructions analyzed" << endl;
+	progress_file.close();
+}
 #endif
+
+/* count a run of n non-REP instructions, inserted at the head of the run;
+ * takes the thread context from a tool register, so Pin can inline it */
+VOID all_instr_full_count_run(mica_thread* t, UINT32 n){
+	t->total_ins_count += n;
+	t->total_ins_count_for_hpc_alignment += n;
 }
 
-VOID all_instr_full_count_for_hpc_alignment_no_rep(){
-	total_ins_count_for_hpc_alignment++;
+VOID all_instr_intervals_count_run(mica_thread* t, UINT32 n){
+	t->total_ins_count += n;
+	t->total_ins_count_for_hpc_alignment += n;
+	t->interval_ins_count += n;
+	t->interval_ins_count_for_hpc_alignment += n;
 }
 
-VOID all_instr_full_count_for_hpc_alignment_with_rep(UINT32 repCnt){
-	if(repCnt > 0){
-		total_ins_count_for_hpc_alignment++;
-	}
+#ifdef VERBOSE
+/* true if the last run of n instructions crossed a multiple of PROGRESS_THRESHOLD */
+ADDRINT all_instr_count_run_progress(mica_thread* t, UINT32 n){
+	return (ADDRINT)(t->total_ins_count % PROGRESS_THRESHOLD < n);
 }
 
-VOID all_instr_intervals_count_always(){
-	total_ins_count++;
-	interval_ins_count++;
+VOID all_instr_count_run_report(mica_thread* t){
+	report_progress(t);
+}
+#endif
+
+/* counting for REP prefixed instructions, which are not part of a run (once per iteration) */
+VOID all_instr_full_count_always(THREADID tid){
+
+	mica_thread* t = get_mica_thread(tid);
+
+	t->total_ins_count++;
 
 #ifdef VERBOSE
-	if (__builtin_expect(total_ins_count % PROGRESS_THRESHOLD == 0, false)) {
-		ofstream progress_file;
-		progress_file.open("mica_progress.txt", ios::out | ios::trunc);
-		progress_file << total_ins_count << " instructions analyzed" << endl;
-		progress_file.close();
+	if (__builtin_expect (t->total_ins_count % PROGRESS_THRESHOLD == 0, false)) {
+		report_progress(t);
 	}
 #endif
 }
 
-VOID all_instr_intervals_count_for_hpc_alignment_no_rep(){
-	total_ins_count_for_hpc_alignment++;
-	interval_ins_count_for_hpc_alignment++;
+VOID all_instr_full_count_for_hpc_alignment_with_rep(THREADID tid, UINT32 repCnt){
+	if(repCnt > 0){
+		get_mica_thread(tid)->total_ins_count_for_hpc_alignment++;
+	}
 }
 
-VOID all_instr_intervals_count_for_hpc_alignment_with_rep(UINT32 repCnt){
+VOID all_instr_intervals_count_always(THREADID tid){
+
+	mica_thread* t = get_mica_thread(tid);
+
+	t->total_ins_count++;
+	t->interval_ins_count++;
+
+#ifdef VERBOSE
+	if (__builtin_expect(t->total_ins_count % PROGRESS_THRESHOLD == 0, false)) {
+		report_progress(t);
+	}
+#endif
+}
+
+VOID all_instr_intervals_count_for_hpc_alignment_with_rep(THREADID tid, UINT32 repCnt){
 	if(repCnt > 0){
-		total_ins_count_for_hpc_alignment++;
-		interval_ins_count_for_hpc_alignment++;
+		mica_thread* t = get_mica_thread(tid);
+
+		t->total_ins_count_for_hpc_alignment++;
+		t->interval_ins_count_for_hpc_alignment++;
 	}
 }
 
-ADDRINT all_buffer_instruction_2reads_write(void* _e, ADDRINT read1_addr, ADDRINT read2_addr, ADDRINT read_size, UINT32 stride_index_memread1, UINT32 stride_index_memread2, ADDRINT write_addr, ADDRINT write_size, UINT32 stride_index_memwrite){
+/* memfootprint and memstackdist share the cache lines of a memory operand, split and looked up once */
+static inline VOID all_memRead(mica_thread* t, ADDRINT addr, ADDRINT size){
+	mem_lines l;
+
+	mem_lines_resolve(t->lines, &l, addr, size);
+	memOp_lines(t, &l);
+	memstackdist_memRead_lines(t, &l);
+}
+
+static inline VOID all_memWrite(mica_thread* t, ADDRINT addr, ADDRINT size){
+	mem_lines l;
+
+	mem_lines_resolve(t->lines, &l, addr, size);
+	memOp_lines(t, &l);
+	memstackdist_memWrite_lines(t, &l);
+}
+
+ADDRINT all_buffer_instruction_2reads_write(THREADID tid, void* _e, ADDRINT read1_addr, ADDRINT read2_addr, ADDRINT read_size, UINT32 stride_index_memread1, UINT32 stride_index_memread2, ADDRINT write_addr, ADDRINT write_size, UINT32 stride_index_memwrite, UINT32 lag){
+
+	mica_thread* t = get_mica_thread(tid);
 
 	//itypes_count_mem_read();
 	//itypes_count_mem_write();
-	readMem_stride(stride_index_memread1, read1_addr, read_size);
-	readMem_stride(stride_index_memread2, read2_addr, read_size);
-	writeMem_stride(stride_index_memwrite, write_addr, write_size);
-	memOp(read1_addr, read_size); // memfootprint
-	memOp(read2_addr, read_size);
-	memOp(write_addr, write_size);
-	memstackdist_memRead(read1_addr, read_size); // memstackdist
-	memstackdist_memRead(read2_addr, read_size);
+	readMem_stride(t, stride_index_memread1, read1_addr, read_size);
+	readMem_stride(t, stride_index_memread2, read2_addr, read_size);
+	writeMem_stride(t, stride_index_memwrite, write_addr, write_size);
+	all_memRead(t, read1_addr, read_size); // memfootprint, memstackdist
+	all_memRead(t, read2_addr, read_size);
+	all_memWrite(t, write_addr, write_size);
 	//return ilp_buffer_instruction_2reads_write(_e, read1_addr, read2_addr, read_size, write_addr, write_size);
-	ilp_buffer_instruction_only(_e);
-	ilp_buffer_instruction_read(read1_addr, read_size);
-	ilp_buffer_instruction_read2(read2_addr);
-	ilp_buffer_instruction_write(write_addr, write_size);
-	return ilp_buffer_instruction_next();
+	ilp_buffer_instruction_only(t, _e);
+	ilp_buffer_instruction_read(t, read1_addr, read_size);
+	ilp_buffer_instruction_read2(t, read2_addr);
+	ilp_buffer_instruction_write(t, write_addr, write_size);
+	return ilp_buffer_instruction_next(t, lag);
 }
 
-ADDRINT all_buffer_instruction_read_write(void* _e, ADDRINT read1_addr, ADDRINT read_size, UINT32 stride_index_memread1, ADDRINT write_addr, ADDRINT write_size, UINT32 stride_index_memwrite){
+ADDRINT all_buffer_instruction_read_write(THREADID tid, void* _e, ADDRINT read1_addr, ADDRINT read_size, UINT32 stride_index_memread1, ADDRINT write_addr, ADDRINT write_size, UINT32 stride_index_memwrite, UINT32 lag){
+
+	mica_thread* t = get_mica_thread(tid);
 
 	//itypes_count_mem_read();
 	//itypes_count_mem_write();
-	readMem_stride(stride_index_memread1, read1_addr, read_size);
-	writeMem_stride(stride_index_memwrite, write_addr, write_size);
-	memOp(read1_addr, read_size); // memfootprint
-	memOp(write_addr, write_size);
-	memstackdist_memRead(read1_addr, read_size); // memstackdist
+	readMem_stride(t, stride_index_memread1, read1_addr, read_size);
+	writeMem_stride(t, stride_index_memwrite, write_addr, write_size);
+	all_memRead(t, read1_addr, read_size); // memfootprint, memstackdist
+	all_memWrite(t, write_addr, write_size);
 	//return ilp_buffer_instruction_read_write(_e, read1_addr, read_size, write_addr, write_size);
-	ilp_buffer_instruction_only(_e);
-	ilp_buffer_instruction_read(read1_addr, read_size);
-	ilp_buffer_instruction_write(write_addr, write_size);
-	return ilp_buffer_instruction_next();
+	ilp_buffer_instruction_only(t, _e);
+	ilp_buffer_instruction_read(t, read1_addr, read_size);
+	ilp_buffer_instruction_write(t, write_addr, write_size);
+	return ilp_buffer_instruction_next(t, lag);
 }
 
-ADDRINT all_buffer_instruction_2reads(void* _e, ADDRINT read1_addr, ADDRINT read2_addr, ADDRINT read_size, UINT32 stride_index_memread1, UINT32 stride_index_memread2){
+ADDRINT all_buffer_instruction_2reads(THREADID tid, void* _e, ADDRINT read1_addr, ADDRINT read2_addr, ADDRINT read_size, UINT32 stride_index_memread1, UINT32 stride_index_memread2, UINT32 lag){
+
+	mica_thread* t = get_mica_thread(tid);
 
 	//itypes_count_mem_read();
-	readMem_stride(stride_index_memread1, read1_addr, read_size);
-	readMem_stride(stride_index_memread2, read2_addr, read_size);
-	memOp(read1_addr, read_size); // memfootprint
-	memOp(read2_addr, read_size);
-	memstackdist_memRead(read1_addr, read_size); // memstackdist
-	memstackdist_memRead(read2_addr, read_size);
+	readMem_stride(t, stride_index_memread1, read1_addr, read_size);
+	readMem_stride(t, stride_index_memread2, read2_addr, read_size);
+	all_memRead(t, read1_addr, read_size); // memfootprint, memstackdist
+	all_memRead(t, read2_addr, read_size);
 	//return ilp_buffer_instruction_2reads(_e, read1_addr, read2_addr, read_size);
-	ilp_buffer_instruction_only(_e);
-	ilp_buffer_instruction_read(read1_addr, read_size);
-	ilp_buffer_instruction_read2(read2_addr);
-	return ilp_buffer_instruction_next();
+	ilp_buffer_instruction_only(t, _e);
+	ilp_buffer_instruction_read(t, read1_addr, read_size);
+	ilp_buffer_instruction_read2(t, read2_addr);
+	return ilp_buffer_instruction_next(t, lag);
 }
 
-ADDRINT all_buffer_instruction_read(void* _e, ADDRINT read1_addr, ADDRINT read_size, UINT32 stride_index_memread1){
+ADDRINT all_buffer_instruction_read(THREADID tid, void* _e, ADDRINT read1_addr, ADDRINT read_size, UINT32 stride_index_memread1, UINT32 lag){
+
+	mica_thread* t = get_mica_thread(tid);
 
 	//itypes_count_mem_read();
-	readMem_stride(stride_index_memread1, read1_addr, read_size);
-	memOp(read1_addr, read_size); // memfootprint
-	memstackdist_memRead(read1_addr, read_size); // memstackdist
+	readMem_stride(t, stride_index_memread1, read1_addr, read_size);
+	all_memRead(t, read1_addr, read_size); // memfootprint, memstackdist
 	//return ilp_buffer_instruction_read(_e, read1_addr, read_size);
-	ilp_buffer_instruction_only(_e);
-	ilp_buffer_instruction_read(read1_addr, read_size);
-	return ilp_buffer_instruction_next();
+	ilp_buffer_instruction_only(t, _e);
+	ilp_buffer_instruction_read(t, read1_addr, read_size);
+	return ilp_buffer_instruction_next(t, lag);
 }
 
-ADDRINT all_buffer_instruction_write(void* _e, ADDRINT write_addr, ADDRINT write_size, UINT32 stride_index_memwrite){
+ADDRINT all_buffer_instruction_write(THREADID tid, void* _e, ADDRINT write_addr, ADDRINT write_size, UINT32 stride_index_memwrite, UINT32 lag){
+
+	mica_thread* t = get_mica_thread(tid);
 
 	//itypes_count_mem_write();
-	writeMem_stride(stride_index_memwrite, write_addr, write_size);
-	memOp(write_addr, write_size); // memfootprint
+	writeMem_stride(t, stride_index_memwrite, write_addr, write_size);
+	all_memWrite(t, write_addr, write_size); // memfootprint, memstackdist
 	//return ilp_buffer_instruction_write(_e, write_addr, write_size);
-	ilp_buffer_instruction_only(_e);
-	ilp_buffer_instruction_write(write_addr, write_size);
-	return ilp_buffer_instruction_next();
+	ilp_buffer_instruction_only(t, _e);
+	ilp_buffer_instruction_write(t, write_addr, write_size);
+	return ilp_buffer_instruction_next(t, lag);
 }
 
-ADDRINT all_buffer_instruction(void* _e){
+ADDRINT all_buffer_instruction(THREADID tid, void* _e, UINT32 lag){
 
-	//return ilp_buffer_instruction(_e);
-	ilp_buffer_instruction_only(_e);
-	return ilp_buffer_instruction_next();
-}
+	mica_thread* t = get_mica_thread(tid);
 
-VOID all_instr_full(VOID* _e, ADDRINT instrAddr, ADDRINT size){
-	reg_instr_full(_e);
-	instrMem(instrAddr, size);
+	//return ilp_buffer_instruction(_e);
+	ilp_buffer_instruction_only(t, _e);
+	return ilp_buffer_instruction_next(t, lag);
 }
 
-ADDRINT all_instr_intervals(VOID* _e, ADDRINT instrAddr, ADDRINT size){
-	reg_instr_intervals(_e);
-	instrMem(instrAddr, size);
-	return (ADDRINT)(interval_ins_count_for_hpc_alignment == interval_size);
-};
+VOID all_instr_full(THREADID tid, VOID* _e, ADDRINT instrAddr, ADDRINT size, UINT32 lag){
 
-VOID all_instr_interval(){
+	mica_thread* t = get_mica_thread(tid);
 
-	/* output per interval for ILP is done by ilp-buffering functions */
-
-	itypes_instr_interval_output();
-	itypes_instr_interval_reset();
+	reg_instr_full(t, _e, lag);
+	instrMem(t, instrAddr, size);
+}
 
-	ppm_instr_interval_output();
-	ppm_instr_interval_reset();
+/* empty the ILP buffer, leaving the interval counters to the other analyses */
+static VOID instr_interval_for_ilp(mica_thread* t, UINT32 lag, VOID (*empty_buffer)(mica_thread* t)){
 
-	reg_instr_interval_output();
-	reg_instr_interval_reset();
+	ins_counts_rewind(t, lag);
 
-	stride_instr_interval_output();
-	stride_instr_interval_reset();
+	// save these, because emptying the ILP buffer resets them
+	INT64 interval_ins_count_backup = t->interval_ins_count;
+	INT64 interval_ins_count_for_hpc_alignment_backup = t->interval_ins_count_for_hpc_alignment;
 
-	memfootprint_instr_interval_output();
-	memfootprint_instr_interval_reset();
+	empty_buffer(t);
 
-	memstackdist_instr_interval_output();
-	memstackdist_instr_interval_reset();
+	// restore
+	t->interval_ins_count = interval_ins_count_backup;
+	t->interval_ins_count_for_hpc_alignment = interval_ins_count_for_hpc_alignment_backup;
 
-	interval_ins_count = 0;
-	interval_ins_count_for_hpc_alignment = 0;
+	ins_counts_forward(t, lag);
 }
 
-VOID all_instr_interval_for_ilp(){
-
-	// save these, because empty_ilp_buffer_all resets them
-	INT64 interval_ins_count_backup = interval_ins_count;
-	INT64 interval_ins_count_for_hpc_alignment_backup = interval_ins_count_for_hpc_alignment;
-
-	empty_ilp_buffer_all();
-
-	// restore
-	interval_ins_count = interval_ins_count_backup;
-	interval_ins_count_for_hpc_alignment = interval_ins_count_for_hpc_alignment_backup;
+VOID all_instr_interval_for_ilp(THREADID tid, UINT32 lag){
+	instr_interval_for_ilp(get_mica_thread(tid), lag, empty_ilp_buffer_all);
 }
 
-VOID instrument_all(INS ins, VOID* v, ins_buffer_entry* e){
+/* register operands (ILP, REG) and register operand count (REG), buffered per static instruction */
+static VOID buffer_register_operands(INS ins, ins_buffer_entry* e){
 
-	UINT32 i, j, maxNumRegsProd, maxNumRegsCons, regReadCnt, regWriteCnt, opCnt, regOpCnt;
+	UINT32 i, maxNumRegsProd, maxNumRegsCons, regReadCnt, regWriteCnt, opCnt, regOpCnt;
 	REG reg;
-	BOOL categorized = false;
-	char cat[50];
-	char opcode[50];
-
-	UINT32 stride_index_memread1;
-	UINT32 stride_index_memread2;
-	UINT32 stride_index_memwrite;
-
-	/* fetch cateogry and opcode for this instruction */
-	strcpy(cat,CATEGORY_StringShort(INS_Category(ins)).c_str());
-	strcpy(opcode,INS_Mnemonic(ins).c_str());
 
 	// buffer register reads per static instruction
 	if(!e->setRead){
@@ -337,6 +367,20 @@ VOID instrument_all(INS ins, VOID* v, ins_buffer_entry* e){
 		e->regOpCnt = regOpCnt;
 		e->setRegOpCnt = true;
 	}
+}
+
+VOID instrument_all(INS ins, VOID* v, ins_buffer_entry* e){
+
+	char cat[50];
+
+	UINT32 stride_index_memread1;
+	UINT32 stride_index_memread2;
+	UINT32 stride_index_memwrite;
+
+	/* fetch cateogry for this instruction */
+	strcpy(cat,CATEGORY_StringShort(INS_Category(ins)).c_str());
+
+	buffer_register_operands(ins, e);
 
 	// buffer memory operations (and instruction register buffer) with one single InsertCall
 	if(INS_IsMemoryRead(ins)){
@@ -351,10 +395,10 @@ VOID instrument_all(INS ins, VOID* v, ins_buffer_entry* e){
 
 				stride_index_memread2 = stride_index_memRead2(INS_Address(ins));
 
-				INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)all_buffer_instruction_2reads_write, IARG_PTR, (void*)e, IARG_MEMORYREAD_EA, IARG_MEMORYREAD2_EA, IARG_MEMORYREAD_SIZE, IARG_UINT32, stride_index_memread1, IARG_UINT32, stride_index_memread2, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_UINT32, stride_index_memwrite, IARG_END);
+				mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, all_buffer_instruction_2reads_write, IARG_THREAD_ID, IARG_PTR, (void*)e, IARG_MEMORYREAD_EA, IARG_MEMORYREAD2_EA, IARG_MEMORYREAD_SIZE, IARG_UINT32, stride_index_memread1, IARG_UINT32, stride_index_memread2, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_UINT32, stride_index_memwrite, IARG_UINT32, ins_lag, IARG_END);
 			}
 			else{
-				INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)all_buffer_instruction_read_write, IARG_PTR, (void*)e, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_UINT32, stride_index_memread1, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_UINT32, stride_index_memwrite, IARG_END);
+				mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, all_buffer_instruction_read_write, IARG_THREAD_ID, IARG_PTR, (void*)e, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_UINT32, stride_index_memread1, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_UINT32, stride_index_memwrite, IARG_UINT32, ins_lag, IARG_END);
 
 			}
 		}
@@ -363,11 +407,11 @@ VOID instrument_all(INS ins, VOID* v, ins_buffer_entry* e){
 
 				stride_index_memread2 = stride_index_memRead2(INS_Address(ins));
 
-				INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)all_buffer_instruction_2reads, IARG_PTR, (void*)e, IARG_MEMORYREAD_EA, IARG_MEMORYREAD2_EA, IARG_MEMORYREAD_SIZE, IARG_UINT32 , stride_index_memread1, IARG_UINT32, stride_index_memread2, IARG_END);
+				mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, all_buffer_instruction_2reads, IARG_THREAD_ID, IARG_PTR, (void*)e, IARG_MEMORYREAD_EA, IARG_MEMORYREAD2_EA, IARG_MEMORYREAD_SIZE, IARG_UINT32 , stride_index_memread1, IARG_UINT32, stride_index_memread2, IARG_UINT32, ins_lag, IARG_END);
 			}
 			else{
 
-				INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)all_buffer_instruction_read, IARG_PTR, (void*)e, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_UINT32, stride_index_memread1, IARG_END);
+				mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, all_buffer_instruction_read, IARG_THREAD_ID, IARG_PTR, (void*)e, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_UINT32, stride_index_memread1, IARG_UINT32, ins_lag, IARG_END);
 			}
 		}
 	}
@@ -376,100 +420,218 @@ VOID instrument_all(INS ins, VOID* v, ins_buffer_entry* e){
 
 			stride_index_memwrite =  stride_index_memWrite(INS_Address(ins));
 
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)all_buffer_instruction_write, IARG_PTR, (void*)e, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_UINT32, stride_index_memwrite, IARG_END);
+			mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, all_buffer_instruction_write, IARG_THREAD_ID, IARG_PTR, (void*)e, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_UINT32, stride_index_memwrite, IARG_UINT32, ins_lag, IARG_END);
 		}
 		else{
-			INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)all_buffer_instruction, IARG_PTR, (void*)e, IARG_END);
+			mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, all_buffer_instruction, IARG_THREAD_ID, IARG_PTR, (void*)e, IARG_UINT32, ins_lag, IARG_END);
 		}
 	}
 
 	/* InsertIfCall returns true if ILP buffer is full */
-	//INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)empty_ilp_buffer_all, IARG_END);
-	INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_interval_for_ilp, IARG_END); // wrapper for empty_ilp_buffer_all
+	//mica_insert_call(MICA_THEN_CALL, ins, IPOINT_BEFORE, empty_ilp_buffer_all, IARG_END);
+	mica_insert_call(MICA_THEN_CALL, ins, IPOINT_BEFORE, all_instr_interval_for_ilp, IARG_THREAD_ID, IARG_UINT32, ins_lag, IARG_END); // wrapper for empty_ilp_buffer_all
 
 	/* +++ ITYPES +++ */
 
-	// go over all groups, increase group count if instruction matches that group
-	// group counts are increased at most once per instruction executed,
-	// even if the instruction matches multiple identifiers in that group
-	for(i=0; i < number_of_groups; i++){
-		for(j=0; j < group_ids_cnt[i]; j++){
-			if(group_identifiers[i][j].type == identifier_type::ID_TYPE_CATEGORY){
-				if(strcmp(group_identifiers[i][j].str, cat) == 0){
-					INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)itypes_count, IARG_UINT32, i, IARG_END);
-					categorized = true;
-					break;
+	// (register transfers are not counted in this mode)
+	instrument_itypes_runs(ins, false);
+
+	/* +++ PPM *** */
+	if(strcmp(cat,"COND_BR") == 0){
+		instrument_ppm_cond_br(ins);
+	}
+	/* inserting calls for counting instructions and checking interval boundaries is done in mica.cpp */
+	mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, all_instr_full, IARG_THREAD_ID, IARG_PTR, (void*)e, IARG_ADDRINT, INS_Address(ins), IARG_ADDRINT, (ADDRINT)INS_Size(ins), IARG_UINT32, ins_lag, IARG_END);
+}
+
+/* *** custom mode: a set of analyses measured together *** */
+
+/* memory operations of the analyses in the set */
+static inline VOID custom_memRead(mica_thread* t, UINT32 stride_index, ADDRINT addr, ADDRINT size){
+	mem_lines l;
+
+	if(analysis_set & ANALYSIS_SET_STRIDE)
+		readMem_stride(t, stride_index, addr, size);
+	if(analysis_set & (ANALYSIS_SET_MEMFOOTPRINT | ANALYSIS_SET_MEMSTACKDIST))
+		mem_lines_resolve(t->lines, &l, addr, size);
+	if(analysis_set & ANALYSIS_SET_MEMFOOTPRINT)
+		memOp_lines(t, &l);
+	if(analysis_set & ANALYSIS_SET_MEMSTACKDIST)
+		memstackdist_memRead_lines(t, &l);
+}
+
+static inline VOID custom_memWrite(mica_thread* t, UINT32 stride_index, ADDRINT addr, ADDRINT size){
+	mem_lines l;
+
+	if(analysis_set & ANALYSIS_SET_STRIDE)
+		writeMem_stride(t, stride_index, addr, size);
+	if(analysis_set & (ANALYSIS_SET_MEMFOOTPRINT | ANALYSIS_SET_MEMSTACKDIST))
+		mem_lines_resolve(t->lines, &l, addr, size);
+	if(analysis_set & ANALYSIS_SET_MEMFOOTPRINT)
+		memOp_lines(t, &l);
+	if(analysis_set & ANALYSIS_SET_MEMSTACKDIST)
+		memstackdist_memWrite_lines(t, &l);
+}
+
+/* buffer the instruction for ILP (if in the set), returns true if the ILP buffer should be emptied */
+static inline ADDRINT custom_buffer_instruction(mica_thread* t, void* _e, ADDRINT read1_addr, ADDRINT read2_addr, ADDRINT read_size, ADDRINT write_addr, ADDRINT write_size, UINT32 lag){
+
+	if(!(analysis_set & (ANALYSIS_SET_ILP | ANALYSIS_SET_ILP_ONE)))
+		return 0;
+
+	ilp_buffer_instruction_only(t, _e);
+	if(read1_addr != 0){
+		ilp_buffer_instruction_read(t, read1_addr, read_size);
+		if(read2_addr != 0)
+			ilp_buffer_instruction_read2(t, read2_addr);
+	}
+	if(write_addr != 0)
+		ilp_buffer_instruction_write(t, write_addr, write_size);
+	return ilp_buffer_instruction_next(t, lag);
+}
+
+ADDRINT custom_instruction_2reads_write(THREADID tid, void* _e, ADDRINT read1_addr, ADDRINT read2_addr, ADDRINT read_size, UINT32 stride_index_memread1, UINT32 stride_index_memread2, ADDRINT write_addr, ADDRINT write_size, UINT32 stride_index_memwrite, UINT32 lag){
+
+	mica_thread* t = get_mica_thread(tid);
+
+	custom_memRead(t, stride_index_memread1, read1_addr, read_size);
+	custom_memRead(t, stride_index_memread2, read2_addr, read_size);
+	custom_memWrite(t, stride_index_memwrite, write_addr, write_size);
+	return custom_buffer_instruction(t, _e, read1_addr, read2_addr, read_size, write_addr, write_size, lag);
+}
+
+ADDRINT custom_instruction_read_write(THREADID tid, void* _e, ADDRINT read1_addr, ADDRINT read_size, UINT32 stride_index_memread1, ADDRINT write_addr, ADDRINT write_size, UINT32 stride_index_memwrite, UINT32 lag){
+
+	mica_thread* t = get_mica_thread(tid);
+
+	custom_memRead(t, stride_index_memread1, read1_addr, read_size);
+	custom_memWrite(t, stride_index_memwrite, write_addr, write_size);
+	return custom_buffer_instruction(t, _e, read1_addr, 0, read_size, write_addr, write_size, lag);
+}
+
+ADDRINT custom_instruction_2reads(THREADID tid, void* _e, ADDRINT read1_addr, ADDRINT read2_addr, ADDRINT read_size, UINT32 stride_index_memread1, UINT32 stride_index_memread2, UINT32 lag){
+
+	mica_thread* t = get_mica_thread(tid);
+
+	custom_memRead(t, stride_index_memread1, read1_addr, read_size);
+	custom_memRead(t, stride_index_memread2, read2_addr, read_size);
+	return custom_buffer_instruction(t, _e, read1_addr, read2_addr, read_size, 0, 0, lag);
+}
+
+ADDRINT custom_instruction_read(THREADID tid, void* _e, ADDRINT read1_addr, ADDRINT read_size, UINT32 stride_index_memread1, UINT32 lag){
+
+	mica_thread* t = get_mica_thread(tid);
+
+	custom_memRead(t, stride_index_memread1, read1_addr, read_size);
+	return custom_buffer_instruction(t, _e, read1_addr, 0, read_size, 0, 0, lag);
+}
+
+ADDRINT custom_instruction_write(THREADID tid, void* _e, ADDRINT write_addr, ADDRINT write_size, UINT32 stride_index_memwrite, UINT32 lag){
+
+	mica_thread* t = get_mica_thread(tid);
+
+	custom_memWrite(t, stride_index_memwrite, write_addr, write_size);
+	return custom_buffer_instruction(t, _e, 0, 0, 0, write_addr, write_size, lag);
+}
+
+ADDRINT custom_instruction(THREADID tid, void* _e, UINT32 lag){
+	return custom_buffer_instruction(get_mica_thread(tid), _e, 0, 0, 0, 0, 0, lag);
+}
+
+/* only called if ILP buffer is full (or at the end of an interval) */
+VOID custom_instr_interval_for_ilp(THREADID tid, UINT32 lag){
+	if(analysis_set & ANALYSIS_SET_ILP)
+		instr_interval_for_ilp(get_mica_thread(tid), lag, empty_ilp_buffer_all);
+	else
+		instr_interval_for_ilp(get_mica_thread(tid), lag, empty_buffer_one);
+}
+
+/* per-instruction analyses of REG and MEMFOOTPRINT (instruction fetches) */
+VOID custom_instr(THREADID tid, VOID* _e, ADDRINT instrAddr, ADDRINT size, UINT32 lag){
+
+	mica_thread* t = get_mica_thread(tid);
+
+	if(analysis_set & ANALYSIS_SET_REG)
+		reg_instr_full(t, _e, lag);
+	if(analysis_set & ANALYSIS_SET_MEMFOOTPRINT)
+		instrMem(t, instrAddr, size);
+}
+
+/* like instrument_all, but only for the analyses in the set; e is only needed for ILP and REG */
+VOID instrument_custom(INS ins, VOID* v, ins_buffer_entry* e){
+
+	BOOL ilp = (analysis_set & (ANALYSIS_SET_ILP | ANALYSIS_SET_ILP_ONE)) != 0;
+	BOOL mem = (analysis_set & (ANALYSIS_SET_STRIDE | ANALYSIS_SET_MEMFOOTPRINT | ANALYSIS_SET_MEMSTACKDIST)) != 0;
+	BOOL stride = (analysis_set & ANALYSIS_SET_STRIDE) != 0;
+
+	UINT32 stride_index_memread1 = 0;
+	UINT32 stride_index_memread2 = 0;
+	UINT32 stride_index_memwrite = 0;
+
+	if(e != NULL)
+		buffer_register_operands(ins, e);
+
+	// buffer memory operations (and instruction register buffer) with one single InsertCall
+	if(ilp || (mem && (INS_IsMemoryRead(ins) || INS_IsMemoryWrite(ins)))){
+
+		if(INS_IsMemoryRead(ins)){
+
+			if(stride)
+				stride_index_memread1 = stride_index_memRead1(INS_Address(ins));
+
+			if(INS_IsMemoryWrite(ins)){
+
+				if(stride)
+					stride_index_memwrite = stride_index_memWrite(INS_Address(ins));
+
+				if(INS_HasMemoryRead2(ins)){
+
+					if(stride)
+						stride_index_memread2 = stride_index_memRead2(INS_Address(ins));
+
+					mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, custom_instruction_2reads_write, IARG_THREAD_ID, IARG_PTR, (void*)e, IARG_MEMORYREAD_EA, IARG_MEMORYREAD2_EA, IARG_MEMORYREAD_SIZE, IARG_UINT32, stride_index_memread1, IARG_UINT32, stride_index_memread2, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_UINT32, stride_index_memwrite, IARG_UINT32, ins_lag, IARG_END);
+				}
+				else{
+					mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, custom_instruction_read_write, IARG_THREAD_ID, IARG_PTR, (void*)e, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_UINT32, stride_index_memread1, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_UINT32, stride_index_memwrite, IARG_UINT32, ins_lag, IARG_END);
 				}
 			}
 			else{
-				if(group_identifiers[i][j].type == identifier_type::ID_TYPE_OPCODE){
-					if(strcmp(group_identifiers[i][j].str, opcode) == 0){
-						INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)itypes_count, IARG_UINT32, i, IARG_END);
-						categorized = true;
-						break;
-					}
+				if(INS_HasMemoryRead2(ins)){
+
+					if(stride)
+						stride_index_memread2 = stride_index_memRead2(INS_Address(ins));
+
+					mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, custom_instruction_2reads, IARG_THREAD_ID, IARG_PTR, (void*)e, IARG_MEMORYREAD_EA, IARG_MEMORYREAD2_EA, IARG_MEMORYREAD_SIZE, IARG_UINT32, stride_index_memread1, IARG_UINT32, stride_index_memread2, IARG_UINT32, ins_lag, IARG_END);
 				}
 				else{
-					if(group_identifiers[i][j].type == identifier_type::ID_TYPE_SPECIAL){
-						if(strcmp(group_identifiers[i][j].str, "mem_read") == 0 && INS_IsMemoryRead(ins) ){
-							INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)itypes_count, IARG_UINT32, i, IARG_END);
-							categorized = true;
-							break;
-						}
-						else{
-							if(strcmp(group_identifiers[i][j].str, "mem_write") == 0 && INS_IsMemoryWrite(ins) ){
-								INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)itypes_count, IARG_UINT32, i, IARG_END);
-								categorized = true;
-								break;
-							}
-							else{
-							}
-						}
-					}
-					else{
-						cerr << "ERROR! Unknown identifier type specified (" << group_identifiers[i][j].type << ")" << endl;
-					}
+					mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, custom_instruction_read, IARG_THREAD_ID, IARG_PTR, (void*)e, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_UINT32, stride_index_memread1, IARG_UINT32, ins_lag, IARG_END);
 				}
 			}
 		}
-	}
-
-	// count instruction that don't fit in any of the specified categories in the last group
-	if( !categorized ){
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)itypes_count, IARG_UINT32, (unsigned int)number_of_groups, IARG_END);
+		else{
+			if(INS_IsMemoryWrite(ins)){
 
-		// check whether this category is already known in the 'other' group
-		for(i=0; i < other_ids_cnt; i++){
-			if(strcmp(other_group_identifiers[i].str, cat) == 0)
-				break;
-		}
+				if(stride)
+					stride_index_memwrite = stride_index_memWrite(INS_Address(ins));
 
-		// if a new instruction category is found, add it to the set
-		if(i == other_ids_cnt){
-			other_group_identifiers[other_ids_cnt].type = identifier_type::ID_TYPE_CATEGORY;
-			other_group_identifiers[other_ids_cnt].str = checked_strdup(cat);
-			other_ids_cnt++;
+				mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, custom_instruction_write, IARG_THREAD_ID, IARG_PTR, (void*)e, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_UINT32, stride_index_memwrite, IARG_UINT32, ins_lag, IARG_END);
+			}
+			else{
+				mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, custom_instruction, IARG_THREAD_ID, IARG_PTR, (void*)e, IARG_UINT32, ins_lag, IARG_END);
+			}
 		}
 
-		// prepare for (possible) next category
-		if(other_ids_cnt == other_ids_max_cnt){
-			other_ids_max_cnt *= 2;
-			other_group_identifiers = (identifier*)checked_realloc(other_group_identifiers, other_ids_max_cnt*sizeof(identifier));
-		}
+		/* InsertIfCall returns true if ILP buffer is full (never without ILP) */
+		mica_insert_call(MICA_THEN_CALL, ins, IPOINT_BEFORE, custom_instr_interval_for_ilp, IARG_THREAD_ID, IARG_UINT32, ins_lag, IARG_END);
 	}
 
-	/* +++ PPM *** */
-	if(strcmp(cat,"COND_BR") == 0){
-		instrument_ppm_cond_br(ins);
-	}
-	/* inserting calls for counting instructions is done in mica.cpp */
-	if(interval_size != -1){
-		INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_intervals, IARG_PTR, (void*)e, IARG_ADDRINT, INS_Address(ins), IARG_ADDRINT, (ADDRINT)INS_Size(ins), IARG_END);
-		/* only called if interval is 'full' */
-		INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_interval, IARG_END);
-	}
-	else{
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)all_instr_full, IARG_PTR, (void*)e, IARG_ADDRINT, INS_Address(ins), IARG_ADDRINT, (ADDRINT)INS_Size(ins), IARG_END);
-	}
+	if(analysis_set & ANALYSIS_SET_ITYPES)
+		instrument_itypes(ins, v);
+
+	if(analysis_set & ANALYSIS_SET_PPM)
+		instrument_ppm(ins, v);
 
+	/* inserting calls for counting instructions and checking interval boundaries is done in mica.cpp */
+	if(analysis_set & (ANALYSIS_SET_REG | ANALYSIS_SET_MEMFOOTPRINT))
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, custom_instr, IARG_THREAD_ID, IARG_PTR, (void*)e, IARG_ADDRINT, INS_Address(ins), IARG_ADDRINT, (ADDRINT)INS_Size(ins), IARG_UINT32, ins_lag, IARG_END);
 }
@@ -11,11 +11,17 @@
 #include "mica_utils.h"
 
 VOID init_all();
+VOID init_all_thread(mica_thread* t);
 ADDRINT returnArg(BOOL arg);
-VOID all_instr_full_count_always();
-VOID all_instr_full_count_for_hpc_alignment_no_rep();
-VOID all_instr_full_count_for_hpc_alignment_with_rep(UINT32 repCnt);
-VOID all_instr_intervals_count_always();
-VOID all_instr_intervals_count_for_hpc_alignment_no_rep();
-VOID all_instr_intervals_count_for_hpc_alignment_with_rep(UINT32 repCnt);
+VOID all_instr_full_count_run(mica_thread* t, UINT32 n);
+VOID all_instr_intervals_count_run(mica_thread* t, UINT32 n);
+#ifdef VERBOSE
+ADDRINT all_instr_count_run_progress(mica_thread* t, UINT32 n);
+VOID all_instr_count_run_report(mica_thread* t);
+#endif
+VOID all_instr_full_count_always(THREADID tid);
+VOID all_instr_full_count_for_hpc_alignment_with_rep(THREADID tid, UINT32 repCnt);
+VOID all_instr_intervals_count_always(THREADID tid);
+VOID all_instr_intervals_count_for_hpc_alignment_with_rep(THREADID tid, UINT32 repCnt);
 VOID instrument_all(INS ins, VOID* v, ins_buffer_entry* e);
+VOID instrument_custom(INS ins, VOID* v, ins_buffer_entry* e);
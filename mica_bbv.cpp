@@ -0,0 +1,443 @@
+/*
+ * This file is part of MICA, a Pin tool to collect
+ * microarchitecture-independent program characteristics using the Pin
+ * instrumentation framework.
+ *
+ * Please see the README.txt file distributed with the MICA release for more
+ * information.
+ */
+
+#include "pin.H"
+
+#include <math.h>
+#include <float.h>
+
+/* MICA includes */
+#include "mica_utils.h"
+#include "mica_bbv.h"
+
+/* Global variables */
+
+extern ofstream _log;
+
+UINT32 _bbv_clusters;
+
+/* block ids by address of the first instruction, assigned at instrumentation time (starting from 1) */
+static ins_index bbv_blocks;
+static UINT32 bbv_block_cnt;
+
+/* per-thread state */
+typedef struct bbv_state_type {
+	UINT64* counts; // instructions executed per block in the current interval, by block id
+	UINT32 counts_size;
+	UINT32* touched; // blocks executed in the current interval
+	UINT32 touched_cnt;
+	UINT32 touched_size;
+	double* proj; // projected vectors of all intervals so far, BBV_DIMS per interval
+	UINT64 interval_cnt;
+	UINT64 proj_size; // in intervals
+} bbv_state;
+
+
+/* random projection: fixed pseudo-random value in [-1,1) for every (block, dimension) */
+static inline double bbv_random(UINT32 id, UINT32 d){
+
+	UINT64 z = ((UINT64)id * BBV_DIMS + d) + 0x9E3779B97F4A7C15ULL;
+
+	/* splitmix64 finalizer */
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z = z ^ (z >> 31);
+
+	return (double)(z >> 11) / (double)(1ULL << 52) - 1.0;
+}
+
+/* initializing */
+void init_bbv(){
+
+	ins_index_init(&bbv_blocks);
+	bbv_block_cnt = 0;
+
+	interval_register(bbv_instr_interval_output, bbv_instr_interval_reset);
+}
+
+VOID init_bbv_thread(mica_thread* t){
+
+	bbv_state* b = (bbv_state*)checked_aligned_malloc(sizeof(bbv_state));
+
+	b->counts_size = 1024;
+	b->counts = (UINT64*)checked_malloc(b->counts_size * sizeof(UINT64));
+	memset(b->counts, 0, b->counts_size * sizeof(UINT64));
+	b->touched_size = 1024;
+	b->touched = (UINT32*)checked_malloc(b->touched_size * sizeof(UINT32));
+	b->touched_cnt = 0;
+	b->proj_size = 1024;
+	b->proj = (double*)checked_malloc(b->proj_size * BBV_DIMS * sizeof(double));
+	b->interval_cnt = 0;
+
+	t->bbv = b;
+
+	ofstream output_file_bbv;
+	output_file_bbv.open(mkfilename_thread("bbv", t->tid), ios::out|ios::trunc);
+	output_file_bbv.close();
+}
+
+/* blocks instrumented after the thread started get a slot the first time they are executed */
+static VOID bbv_grow(bbv_state* b, UINT32 id){
+
+	UINT32 size = b->counts_size;
+
+	while(size <= id)
+		size *= 2;
+	b->counts = (UINT64*)checked_realloc(b->counts, size * sizeof(UINT64));
+	memset(b->counts + b->counts_size, 0, (size - b->counts_size) * sizeof(UINT64));
+	b->counts_size = size;
+}
+
+static VOID bbv_count(mica_thread* t, UINT32 id, UINT32 n){
+
+	bbv_state* b = t->bbv;
+
+	if(id >= b->counts_size)
+		bbv_grow(b, id);
+
+	if(b->counts[id] == 0){
+		if(b->touched_cnt == b->touched_size){
+			b->touched_size *= 2;
+			b->touched = (UINT32*)checked_realloc(b->touched, b->touched_size * sizeof(UINT32));
+		}
+		b->touched[b->touched_cnt++] = id;
+	}
+	b->counts[id] += n;
+}
+
+/* write the vector of the current interval, and keep its projection for clustering */
+VOID bbv_instr_interval_output(mica_thread* t){
+
+	bbv_state* b = t->bbv;
+	UINT64 total = 0;
+	UINT32 i, d, id;
+	double* p;
+	double f;
+	ofstream output_file_bbv;
+
+	/* every interval is recorded, so intervals are numbered as in sampled mode (an interval
+	 * can have no blocks if a run longer than the interval was counted in the previous one) */
+	output_file_bbv.open(mkfilename_thread("bbv", t->tid), ios::out|ios::app);
+	output_file_bbv << "T";
+	for(i = 0; i < b->touched_cnt; i++){
+		id = b->touched[i];
+		output_file_bbv << ":" << id << ":" << b->counts[id] << " ";
+		total += b->counts[id];
+	}
+	output_file_bbv << endl;
+	output_file_bbv.close();
+
+	if(b->interval_cnt == b->proj_size){
+		b->proj_size *= 2;
+		b->proj = (double*)checked_realloc(b->proj, b->proj_size * BBV_DIMS * sizeof(double));
+	}
+	p = b->proj + b->interval_cnt * BBV_DIMS;
+	for(d = 0; d < BBV_DIMS; d++)
+		p[d] = 0.0;
+	for(i = 0; i < b->touched_cnt; i++){
+		id = b->touched[i];
+		f = (double)b->counts[id] / (double)total;
+		for(d = 0; d < BBV_DIMS; d++)
+			p[d] += f * bbv_random(id, d);
+	}
+	b->interval_cnt++;
+}
+
+VOID bbv_instr_interval_reset(mica_thread* t){
+
+	bbv_state* b = t->bbv;
+	UINT32 i;
+
+	for(i = 0; i < b->touched_cnt; i++)
+		b->counts[b->touched[i]] = 0;
+	b->touched_cnt = 0;
+}
+
+/* instrumenting (instruction level): one call per block, at the instruction which counts it */
+VOID instrument_bbv(INS ins, VOID* v){
+
+	ADDRINT a = INS_Address(ins);
+	UINT32 id;
+
+	if(ins_run == 0)
+		return;
+
+	id = ins_index_lookup(&bbv_blocks, a);
+	if(id == 0){
+		id = ++bbv_block_cnt;
+		ins_index_insert(&bbv_blocks, a, id);
+	}
+
+	mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, bbv_count, IARG_REG_VALUE, mica_thread_reg, IARG_UINT32, id, IARG_UINT32, ins_run, IARG_END);
+}
+
+/* *** clustering *** */
+
+static inline double bbv_distance(const double* x, const double* y){
+
+	double dist = 0.0;
+	UINT32 d;
+
+	for(d = 0; d < BBV_DIMS; d++)
+		dist += (x[d] - y[d]) * (x[d] - y[d]);
+
+	return dist;
+}
+
+/* k-means (seeded as in k-means++, with a fixed seed so runs are repeatable) on n projected vectors;
+ * assign[i] is set to the cluster of vector i, the number of clusters used is returned */
+static UINT32 bbv_kmeans(const double* vec, UINT64 n, UINT32 k, UINT32* assign, double* centers){
+
+	UINT64 i, j, best_i;
+	UINT32 c, d, iter, best_c;
+	UINT64 seed = 42;
+	double* min_dist = (double*)checked_malloc(n * sizeof(double));
+	UINT64* sizes = (UINT64*)checked_malloc(k * sizeof(UINT64));
+	double sum, r, dist, best;
+	BOOL changed;
+
+	if(k > n)
+		k = n;
+
+	/* seeding: first center at random, then proportional to the squared distance to the closest center */
+	for(c = 0; c < k; c++){
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		r = (double)(seed >> 11) / (double)(1ULL << 53);
+		j = 0;
+		if(c == 0){
+			j = (UINT64)(r * n);
+		}
+		else{
+			sum = 0.0;
+			for(i = 0; i < n; i++)
+				sum += min_dist[i];
+			r *= sum;
+			for(j = 0; j < n - 1 && r >= min_dist[j]; j++)
+				r -= min_dist[j];
+		}
+		memcpy(centers + c * BBV_DIMS, vec + j * BBV_DIMS, BBV_DIMS * sizeof(double));
+		for(i = 0; i < n; i++){
+			dist = bbv_distance(vec + i * BBV_DIMS, centers + c * BBV_DIMS);
+			if(c == 0 || dist < min_dist[i])
+				min_dist[i] = dist;
+		}
+	}
+
+	for(i = 0; i < n; i++)
+		assign[i] = k;
+
+	for(iter = 0; iter < BBV_KMEANS_ITERATIONS; iter++){
+
+		/* assign every vector to the closest center */
+		changed = false;
+		for(i = 0; i < n; i++){
+			best = DBL_MAX;
+			best_c = 0;
+			for(c = 0; c < k; c++){
+				dist = bbv_distance(vec + i * BBV_DIMS, centers + c * BBV_DIMS);
+				if(dist < best){
+					best = dist;
+					best_c = c;
+				}
+			}
+			if(assign[i] != best_c){
+				assign[i] = best_c;
+				changed = true;
+			}
+			min_dist[i] = best;
+		}
+		if(!changed)
+			break;
+
+		/* move the centers to the mean of their vectors */
+		memset(centers, 0, k * BBV_DIMS * sizeof(double));
+		memset(sizes, 0, k * sizeof(UINT64));
+		for(i = 0; i < n; i++){
+			sizes[assign[i]]++;
+			for(d = 0; d < BBV_DIMS; d++)
+				centers[assign[i] * BBV_DIMS + d] += vec[i * BBV_DIMS + d];
+		}
+		for(c = 0; c < k; c++){
+			if(sizes[c] == 0){
+				/* empty cluster: restart it from the vector furthest from its center */
+				best_i = 0;
+				for(i = 1; i < n; i++){
+					if(min_dist[i] > min_dist[best_i])
+						best_i = i;
+				}
+				memcpy(centers + c * BBV_DIMS, vec + best_i * BBV_DIMS, BBV_DIMS * sizeof(double));
+				min_dist[best_i] = 0.0;
+				continue;
+			}
+			for(d = 0; d < BBV_DIMS; d++)
+				centers[c * BBV_DIMS + d] /= (double)sizes[c];
+		}
+	}
+
+	free(min_dist);
+	free(sizes);
+
+	return k;
+}
+
+/* choose one interval per cluster (the closest to its center) and write the simpoints and weights files */
+static VOID bbv_choose(mica_thread* t){
+
+	bbv_state* b = t->bbv;
+	UINT64 n = b->interval_cnt;
+	UINT64 i;
+	UINT32 c, k, used;
+	UINT32* assign;
+	double* centers;
+	UINT64* sizes;
+	UINT64* chosen;
+	double* chosen_dist;
+	double dist;
+	ofstream output_file_simpoints;
+	ofstream output_file_weights;
+
+	output_file_simpoints.open(mkfilename_thread("simpoints", t->tid), ios::out|ios::trunc);
+	output_file_weights.open(mkfilename_thread("weights", t->tid), ios::out|ios::trunc);
+
+	if(n > 0){
+		assign = (UINT32*)checked_malloc(n * sizeof(UINT32));
+		centers = (double*)checked_malloc(_bbv_clusters * BBV_DIMS * sizeof(double));
+		k = bbv_kmeans(b->proj, n, _bbv_clusters, assign, centers);
+
+		sizes = (UINT64*)checked_malloc(k * sizeof(UINT64));
+		chosen = (UINT64*)checked_malloc(k * sizeof(UINT64));
+		chosen_dist = (double*)checked_malloc(k * sizeof(double));
+		for(c = 0; c < k; c++){
+			sizes[c] = 0;
+			chosen_dist[c] = DBL_MAX;
+		}
+		for(i = 0; i < n; i++){
+			c = assign[i];
+			sizes[c]++;
+			dist = bbv_distance(b->proj + i * BBV_DIMS, centers + c * BBV_DIMS);
+			if(dist < chosen_dist[c]){
+				chosen_dist[c] = dist;
+				chosen[c] = i;
+			}
+		}
+
+		/* clusters are numbered from 0, skipping empty ones */
+		used = 0;
+		for(c = 0; c < k; c++){
+			if(sizes[c] == 0)
+				continue;
+			output_file_simpoints << chosen[c] << " " << used << endl;
+			output_file_weights << (double)sizes[c] / (double)n << " " << used << endl;
+			used++;
+		}
+
+		LOG_MSG("thread " << t->tid << ": " << n << " intervals in " << used << " clusters");
+
+		free(assign);
+		free(centers);
+		free(sizes);
+		free(chosen);
+		free(chosen_dist);
+	}
+
+	output_file_simpoints.close();
+	output_file_weights.close();
+}
+
+/* finishing... */
+VOID fini_bbv(INT32 code, VOID* v){
+
+	UINT32 k;
+	mica_thread* t;
+
+	for(k=0; k < mica_thread_cnt; k++){
+		t = mica_threads[k];
+		/* last (partial) interval */
+		bbv_instr_interval_output(t);
+		bbv_instr_interval_reset(t);
+		bbv_choose(t);
+	}
+
+	LOG_MSG(bbv_block_cnt << " blocks");
+}
+
+/* *** sampled mode *** */
+
+/* chosen intervals and their weights, as written by bbv_choose (or by SimPoint) */
+UINT32 read_simpoints(const char* simpoints_file, const char* weights_file, UINT64** intervals, double** weights){
+
+	FILE* f;
+	UINT32 cnt = 0, size = 64;
+	UINT32 i, j, c;
+	UINT64 interval;
+	UINT32* clusters;
+	double w;
+	double* cluster_weights;
+	UINT32 cluster_cnt = 0;
+
+	*intervals = (UINT64*)checked_malloc(size * sizeof(UINT64));
+	clusters = (UINT32*)checked_malloc(size * sizeof(UINT32));
+
+	f = fopen(simpoints_file, "r");
+	if(f == (FILE*)NULL){
+		cerr << "ERROR! Could not open simpoints file " << simpoints_file << endl;
+		_log << "ERROR! Could not open simpoints file " << simpoints_file << endl;
+		exit(1);
+	}
+	while(fscanf(f, "%llu %u", (unsigned long long*)&interval, &c) == 2){
+		if(cnt == size){
+			size *= 2;
+			*intervals = (UINT64*)checked_realloc(*intervals, size * sizeof(UINT64));
+			clusters = (UINT32*)checked_realloc(clusters, size * sizeof(UINT32));
+		}
+		(*intervals)[cnt] = interval;
+		clusters[cnt] = c;
+		if(c + 1 > cluster_cnt)
+			cluster_cnt = c + 1;
+		cnt++;
+	}
+	fclose(f);
+
+	cluster_weights = (double*)checked_malloc((cluster_cnt + 1) * sizeof(double));
+	for(c = 0; c < cluster_cnt; c++)
+		cluster_weights[c] = 0.0;
+
+	f = fopen(weights_file, "r");
+	if(f == (FILE*)NULL){
+		cerr << "ERROR! Could not open weights file " << weights_file << endl;
+		_log << "ERROR! Could not open weights file " << weights_file << endl;
+		exit(1);
+	}
+	while(fscanf(f, "%lf %u", &w, &c) == 2){
+		if(c < cluster_cnt)
+			cluster_weights[c] = w;
+	}
+	fclose(f);
+
+	*weights = (double*)checked_malloc((cnt + 1) * sizeof(double));
+	for(i = 0; i < cnt; i++)
+		(*weights)[i] = cluster_weights[clusters[i]];
+
+	/* sort by interval (insertion sort, there are few chosen intervals) */
+	for(i = 1; i < cnt; i++){
+		interval = (*intervals)[i];
+		w = (*weights)[i];
+		for(j = i; j > 0 && (*intervals)[j-1] > interval; j--){
+			(*intervals)[j] = (*intervals)[j-1];
+			(*weights)[j] = (*weights)[j-1];
+		}
+		(*intervals)[j] = interval;
+		(*weights)[j] = w;
+	}
+
+	free(clusters);
+	free(cluster_weights);
+
+	return cnt;
+}
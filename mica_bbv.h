@@ -0,0 +1,47 @@
+/*
+ * This file is part of MICA, a Pin tool to collect
+ * microarchitecture-independent program characteristics using the Pin
+ * instrumentation framework.
+ *
+ * Please see the README.txt file distributed with the MICA release for more
+ * information.
+ */
+
+#include "mica.h"
+#include "mica_utils.h"
+
+#ifndef MICA_BBV
+#define MICA_BBV
+
+/* *** basic block vectors (SimPoint) ***
+ *
+ * In bbv mode, the number of instructions executed per block (a run of instructions
+ * without REP prefix in a basic block, or a REP prefixed instruction) is recorded per
+ * interval, in the SimPoint frequency vector format (bbv_pin.out, one line per interval):
+ *   T:<block id>:<instruction count> :<block id>:<instruction count> ...
+ * (block ids start from 1).
+ *
+ * When the program ends, the intervals are clustered with k-means on a random projection
+ * of their (normalized) vectors, and the interval closest to the center of each cluster
+ * is chosen to represent it, in the SimPoint output format:
+ *   simpoints_pin.out: <interval> <cluster> per chosen interval (intervals start from 0)
+ *   weights_pin.out: <weight> <cluster> (fraction of all intervals in the cluster)
+ * The sampled mode (see mica.cpp) reads these files to analyze the chosen intervals only. */
+
+#define BBV_DIMS 15 // dimensions of the random projection (as in SimPoint)
+#define BBV_KMEANS_ITERATIONS 100
+
+extern UINT32 _bbv_clusters;
+
+void init_bbv();
+VOID init_bbv_thread(mica_thread* t);
+VOID instrument_bbv(INS ins, VOID* v);
+VOID fini_bbv(INT32 code, VOID* v);
+
+VOID bbv_instr_interval_output(mica_thread* t);
+VOID bbv_instr_interval_reset(mica_thread* t);
+
+/* chosen intervals (sorted) and their weights, from files in the SimPoint output format; returns the number of chosen intervals */
+UINT32 read_simpoints(const char* simpoints_file, const char* weights_file, UINT64** intervals, double** weights);
+
+#endif
@@ -0,0 +1,257 @@
+/*
+ * This file is part of MICA, a Pin tool to collect
+ * microarchitecture-independent program characteristics using the Pin
+ * instrumentation framework.
+ *
+ * Please see the README.txt file distributed with the MICA release for more
+ * information.
+ */
+
+#include "pin.H"
+
+/* MICA includes */
+#include "mica_utils.h"
+#include "mica_capture.h"
+
+/* Global variables */
+
+extern ofstream _log;
+
+/* instruction table, written at instrumentation time (serialized by Pin) */
+static FILE* capture_ins_file;
+static ins_index capture_indices; // address -> id + 1
+static UINT32 capture_ins_cnt;
+
+/* per-thread state */
+typedef struct capture_state_type {
+	FILE* file;
+	UINT8* buf;
+	UINT32 len;
+	ADDRINT last_addr; // previous memory address in the event stream
+	UINT64 event_cnt;
+	UINT64 byte_cnt;
+} capture_state;
+
+
+static FILE* capture_open(const char* name, const char* magic){
+
+	FILE* f = fopen(name, "wb");
+
+	if(f == (FILE*)NULL){
+		cerr << "FATAL ERROR: Could not create trace file " << name << endl;
+		_log << "FATAL ERROR: Could not create trace file " << name << endl;
+		exit(1);
+	}
+	fwrite(magic, 1, CAPTURE_MAGIC_LENGTH, f);
+
+	return f;
+}
+
+void init_capture(){
+
+	capture_ins_file = capture_open(mkfilename("mica_trace_ins"), CAPTURE_INS_MAGIC);
+	ins_index_init(&capture_indices);
+	capture_ins_cnt = 0;
+}
+
+VOID init_capture_thread(mica_thread* t){
+
+	UINT32 tid = t->tid;
+	capture_state* c = (capture_state*)checked_aligned_malloc(sizeof(capture_state));
+
+	c->file = capture_open(mkfilename_thread("mica_trace", t->tid), CAPTURE_TRACE_MAGIC);
+	fwrite(&tid, sizeof(UINT32), 1, c->file);
+	c->buf = (UINT8*)checked_malloc(CAPTURE_BUFFER_SIZE);
+	c->len = 0;
+	c->last_addr = 0;
+	c->event_cnt = 0;
+	c->byte_cnt = 0;
+
+	t->capture = c;
+}
+
+static VOID capture_flush(capture_state* c){
+
+	if(fwrite(c->buf, 1, c->len, c->file) != c->len){
+		cerr << "FATAL ERROR: Could not write to trace file" << endl;
+		_log << "FATAL ERROR: Could not write to trace file" << endl;
+		exit(1);
+	}
+	c->byte_cnt += c->len;
+	c->len = 0;
+}
+
+static inline VOID capture_put_byte(capture_state* c, UINT8 b){
+	c->buf[c->len++] = b;
+}
+
+static inline VOID capture_put_varint(capture_state* c, UINT64 v){
+	while(v >= 0x80){
+		c->buf[c->len++] = (UINT8)(v | 0x80);
+		v >>= 7;
+	}
+	c->buf[c->len++] = (UINT8)v;
+}
+
+/* addresses are stored relative to the previous one (zigzag encoded), which keeps them short for local accesses */
+static inline VOID capture_put_addr(capture_state* c, ADDRINT addr){
+	INT64 d = (INT64)(addr - c->last_addr);
+	capture_put_varint(c, ((UINT64)d << 1) ^ (UINT64)(d >> 63));
+	c->last_addr = addr;
+}
+
+/* analysis routines, called in this order for every executed instruction */
+VOID capture_ins(THREADID tid, UINT32 id){
+
+	capture_state* c = get_mica_thread(tid)->capture;
+
+	/* make sure the whole event fits in the buffer */
+	if(c->len > CAPTURE_BUFFER_SIZE - CAPTURE_EVENT_MAX_SIZE)
+		capture_flush(c);
+
+	capture_put_varint(c, id);
+	c->event_cnt++;
+}
+
+VOID capture_rep(THREADID tid, BOOL first, ADDRINT repCnt){
+
+	capture_state* c = get_mica_thread(tid)->capture;
+
+	capture_put_byte(c, first ? 1 : 0);
+	if(first)
+		capture_put_varint(c, repCnt);
+}
+
+VOID capture_mem(THREADID tid, ADDRINT addr, ADDRINT size){
+
+	capture_state* c = get_mica_thread(tid)->capture;
+
+	capture_put_addr(c, addr);
+	capture_put_varint(c, size);
+}
+
+VOID capture_mem_addr(THREADID tid, ADDRINT addr){
+	capture_put_addr(get_mica_thread(tid)->capture, addr);
+}
+
+VOID capture_branch(THREADID tid, BOOL taken){
+	capture_put_byte(get_mica_thread(tid)->capture, taken ? 1 : 0);
+}
+
+static VOID capture_write_string(const string& s){
+
+	UINT8 len = s.length() > 255 ? 255 : (UINT8)s.length();
+
+	fwrite(&len, 1, 1, capture_ins_file);
+	fwrite(s.c_str(), 1, len, capture_ins_file);
+}
+
+/* the registers considered by MICA (see mica_reg.cpp) */
+static BOOL capture_reg_used(REG reg){
+	return REG_valid(reg) && (REG_is_fr(reg) || REG_is_mm(reg) || REG_is_xmm(reg) || REG_is_gr(reg) || REG_is_gr8(reg) || REG_is_gr16(reg) || REG_is_gr32(reg) || REG_is_gr64(reg));
+}
+
+static VOID capture_write_regs(UINT32 maxNumRegs, REG (*get_reg)(INS, UINT32), INS ins){
+
+	UINT32 i;
+	UINT16 regs[256];
+	UINT8 cnt = 0;
+	REG reg;
+
+	for(i = 0; i < maxNumRegs && cnt < 255; i++){
+		reg = get_reg(ins, i);
+		if(capture_reg_used(reg))
+			regs[cnt++] = (UINT16)reg;
+	}
+	fwrite(&cnt, 1, 1, capture_ins_file);
+	fwrite(regs, sizeof(UINT16), cnt, capture_ins_file);
+}
+
+/* new static instruction: append its record to the instruction table */
+static UINT32 capture_register_ins(INS ins){
+
+	UINT64 addr = INS_Address(ins);
+	UINT8 size = (UINT8)INS_Size(ins);
+	UINT8 flags = 0;
+	UINT8 opCnt = (UINT8)INS_OperandCount(ins);
+	UINT8 isReg;
+	UINT32 i;
+	string cat = CATEGORY_StringShort(INS_Category(ins));
+
+	if(INS_IsMemoryRead(ins))
+		flags |= CAPTURE_INS_MEM_READ;
+	if(INS_HasMemoryRead2(ins))
+		flags |= CAPTURE_INS_MEM_READ2;
+	if(INS_IsMemoryWrite(ins))
+		flags |= CAPTURE_INS_MEM_WRITE;
+	if(INS_HasRealRep(ins))
+		flags |= CAPTURE_INS_REP;
+	if(cat == "COND_BR")
+		flags |= CAPTURE_INS_COND_BR;
+	if(INS_IsMov(ins))
+		flags |= CAPTURE_INS_MOV;
+
+	fwrite(&addr, sizeof(UINT64), 1, capture_ins_file);
+	fwrite(&size, 1, 1, capture_ins_file);
+	fwrite(&flags, 1, 1, capture_ins_file);
+	fwrite(&opCnt, 1, 1, capture_ins_file);
+	for(i = 0; i < opCnt; i++){
+		isReg = INS_OperandIsReg(ins, i) ? 1 : 0;
+		fwrite(&isReg, 1, 1, capture_ins_file);
+	}
+	capture_write_regs(INS_MaxNumRRegs(ins), INS_RegR, ins);
+	capture_write_regs(INS_MaxNumWRegs(ins), INS_RegW, ins);
+	capture_write_string(cat);
+	capture_write_string(INS_Mnemonic(ins));
+	capture_write_string(INS_Disassemble(ins));
+
+	ins_index_insert(&capture_indices, INS_Address(ins), capture_ins_cnt + 1);
+
+	return capture_ins_cnt++;
+}
+
+/* instrumenting (instruction level) */
+VOID instrument_capture(INS ins, VOID* v){
+
+	UINT32 id = ins_index_lookup(&capture_indices, INS_Address(ins));
+
+	if(id == 0)
+		id = capture_register_ins(ins);
+	else
+		id--;
+
+	mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, capture_ins, IARG_THREAD_ID, IARG_UINT32, id, IARG_END);
+
+	if(INS_HasRealRep(ins)){
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, capture_rep, IARG_THREAD_ID, IARG_FIRST_REP_ITERATION, IARG_REG_VALUE, INS_RepCountRegister(ins), IARG_END);
+	}
+	if(INS_IsMemoryRead(ins)){
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, capture_mem, IARG_THREAD_ID, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_END);
+	}
+	if(INS_HasMemoryRead2(ins)){
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, capture_mem_addr, IARG_THREAD_ID, IARG_MEMORYREAD2_EA, IARG_END);
+	}
+	if(INS_IsMemoryWrite(ins)){
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, capture_mem, IARG_THREAD_ID, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_END);
+	}
+	if(CATEGORY_StringShort(INS_Category(ins)) == "COND_BR"){
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, capture_branch, IARG_THREAD_ID, IARG_BRANCH_TAKEN, IARG_END);
+	}
+}
+
+/* finishing... */
+VOID fini_capture(INT32 code, VOID* v){
+
+	UINT32 k;
+	capture_state* c;
+
+	fclose(capture_ins_file);
+	LOG_MSG("captured " << capture_ins_cnt << " static instructions");
+
+	for(k=0; k < mica_thread_cnt; k++){
+		c = mica_threads[k]->capture;
+		capture_flush(c);
+		fclose(c->file);
+		LOG_MSG("captured " << c->event_cnt << " events for thread " << mica_threads[k]->tid << " (" << (double)c->byte_cnt / c->event_cnt << " bytes per event)");
+	}
+}
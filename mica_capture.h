@@ -0,0 +1,57 @@
+/*
+ * This file is part of MICA, a Pin tool to collect
+ * microarchitecture-independent program characteristics using the Pin
+ * instrumentation framework.
+ *
+ * Please see the README.txt file distributed with the MICA release for more
+ * information.
+ */
+
+#include "mica.h"
+#include "mica_utils.h"
+
+#ifndef MICA_CAPTURE
+#define MICA_CAPTURE
+
+/* *** trace format (written in capture mode, read by mica_replay) ***
+ *
+ * instruction table (mica_trace_ins_pin.out), shared by all threads:
+ *   magic "MICAINS1", then one record per static instruction, in order of id (starting from 0):
+ *     UINT64 address, UINT8 size, UINT8 flags (CAPTURE_INS_*),
+ *     UINT8 operand count, one UINT8 per operand (1 if it is a register),
+ *     UINT8 number of registers read, UINT16 per register, idem for registers written
+ *     (only the registers considered by MICA, i.e. general-purpose and floating-point ones),
+ *     category, mnemonic and disassembly as strings (UINT8 length + characters)
+ *
+ * event stream (mica_trace_pin.out, mica_trace_t<tid>_pin.out), one per thread:
+ *   magic "MICATRC1", UINT32 thread id, then one event per executed instruction
+ *   (or iteration of a REP prefixed instruction):
+ *     id (varint),
+ *     REP prefixed: UINT8 1 for the first iteration (followed by the REP count as varint), 0 otherwise
+ *     memory read: address (zigzag varint, relative to the previous address in the stream), size (varint)
+ *     second memory read: address (zigzag varint, relative)
+ *     memory write: address (zigzag varint, relative), size (varint)
+ *     conditional branch: UINT8 1 if taken, 0 otherwise
+ *
+ * Fixed size fields are written in host byte order (little-endian, as Pin runs on x86). */
+
+#define CAPTURE_INS_MAGIC "MICAINS1"
+#define CAPTURE_TRACE_MAGIC "MICATRC1"
+#define CAPTURE_MAGIC_LENGTH 8
+
+#define CAPTURE_INS_MEM_READ  (1 << 0)
+#define CAPTURE_INS_MEM_READ2 (1 << 1)
+#define CAPTURE_INS_MEM_WRITE (1 << 2)
+#define CAPTURE_INS_REP       (1 << 3)
+#define CAPTURE_INS_COND_BR   (1 << 4)
+#define CAPTURE_INS_MOV       (1 << 5)
+
+#define CAPTURE_BUFFER_SIZE (1 << 20) // per-thread event buffer (bytes)
+#define CAPTURE_EVENT_MAX_SIZE 80 // upper bound for the size of a single event (bytes)
+
+void init_capture();
+VOID init_capture_thread(mica_thread* t);
+VOID instrument_capture(INS ins, VOID* v);
+VOID fini_capture(INT32 code, VOID* v);
+
+#endif
@@ -12,25 +12,24 @@
 /* MICA includes */
 #include "mica_utils.h"
 #include "mica_ilp.h"
+#include "mica_ilp_kernel.h"
 
 #include <sstream>
 #include <iostream>
 using namespace std;
 
-#define ILP_WIN_SIZE_CNT 4
-
-const UINT32 win_sizes[ILP_WIN_SIZE_CNT] = {32, 64, 128, 256};
-
 extern UINT32 _ilp_win_size;
 UINT32 win_size;
 
+extern UINT32 _ilp_win_sizes[ILP_MAX_WIN_SIZE_CNT];
+extern UINT32 _ilp_win_size_cnt;
+
 extern UINT32 _block_size;
 UINT32 ilp_block_size;
 
 /* buffer settings */
 
-//#define ILP_BUFFER_SIZE 256
-#define ILP_BUFFER_SIZE 200
+extern UINT32 _ilp_buffer_size;
 
 /* buffer variables */
 
@@ -47,48 +46,33 @@ typedef struct ilp_buffer_entry_type{
 
 } ilp_buffer_entry;
 
-ilp_buffer_entry* ilp_buffer[ILP_BUFFER_SIZE];
-UINT32 ilp_buffer_index;
-
-void init_ilp_buffering();
-VOID fini_ilp_buffering_all();
-VOID fini_ilp_buffering_one();
+void init_ilp_buffering(struct ilp_state_type* l);
+VOID fini_ilp_buffering_all(mica_thread* t);
+VOID fini_ilp_buffering_one(mica_thread* t);
 
 /* Global variables */
 
 extern INT64 interval_size;
-extern INT64 interval_ins_count;
-extern INT64 interval_ins_count_for_hpc_alignment;
-extern INT64 total_ins_count;
-extern INT64 total_ins_count_for_hpc_alignment;
-ofstream output_file_ilp_one;
-ofstream output_file_ilp_all;
-
-INT32 size_pow_all_times_all;
-INT64 index_all_times_all;
-UINT64* all_times_all[ILP_WIN_SIZE_CNT];
-
-INT32 size_pow_times;
-INT64 index_all_times;
-UINT64* all_times;
-
-INT64 cpuClock_interval_all[ILP_WIN_SIZE_CNT];
-UINT64 timeAvailable_all[ILP_WIN_SIZE_CNT][MAX_NUM_REGS];
-nlist* memAddressesTable_all[MAX_MEM_TABLE_ENTRIES];
-UINT32 windowHead_all[ILP_WIN_SIZE_CNT];
-UINT32 windowTail_all[ILP_WIN_SIZE_CNT];
-UINT64 cpuClock_all[ILP_WIN_SIZE_CNT];
-UINT64* executionProfile_all[ILP_WIN_SIZE_CNT];
-UINT64 issueTime_all[ILP_WIN_SIZE_CNT];
-
-INT64 cpuClock_interval;
-UINT64 timeAvailable[MAX_NUM_REGS];
-nlist* memAddressesTable[MAX_MEM_TABLE_ENTRIES];
-UINT32 windowHead;
-UINT32 windowTail;
-UINT64 cpuClock;
-UINT64* executionProfile;
-UINT64 issueTime;
+
+/* per-thread state */
+typedef struct ilp_state_type {
+	/* buffer variables */
+	ilp_buffer_entry* ilp_buffer; // _ilp_buffer_size entries
+	UINT32 ilp_buffer_index;
+
+	/* all window sizes in ilp_sizes (see mica_ilp_kernel.h) */
+	ilp_windows all;
+
+	/* one given window size */
+	INT64 cpuClock_interval;
+	UINT64 timeAvailable[MAX_NUM_REGS];
+	ilp_mem_store mem; // one time per block (see mica_ilp_kernel.h)
+	UINT32 windowHead;
+	UINT32 windowTail;
+	UINT64 cpuClock;
+	UINT64* executionProfile;
+	UINT64 issueTime;
+} ilp_state;
 
 /*************************
       ILP (COMMON)
@@ -106,158 +90,120 @@ void init_ilp_common(){
 /* initializing */
 void init_ilp_one(){
 
-	UINT32 i;
-
 	init_ilp_common();
-	init_ilp_buffering();
 
 	win_size = _ilp_win_size;
 	ilp_block_size = _block_size;
 
-	size_pow_times = 10;
-	all_times = (UINT64*)checked_malloc((1 << size_pow_times) * sizeof(UINT64));
-	index_all_times = 1; // don't use first element of all_times
+}
 
-	windowHead = 0;
-	windowTail = 0;
-	cpuClock = 0;
-	cpuClock_interval = 0;
+VOID init_ilp_one_thread(mica_thread* t){
+
+	UINT32 i;
+	ilp_state* l = (ilp_state*)checked_aligned_malloc(sizeof(ilp_state));
+
+	t->ilp = l;
+
+	init_ilp_buffering(l);
+
+	l->windowHead = 0;
+	l->windowTail = 0;
+	l->cpuClock = 0;
+	l->cpuClock_interval = 0;
 	for(i = 0; i < MAX_NUM_REGS; i++){
-		timeAvailable[i] = 0;
+		l->timeAvailable[i] = 0;
 	}
+	ilp_mem_init(&l->mem, 1);
 
-	executionProfile = (UINT64*)checked_malloc(win_size*sizeof(UINT64));
+	l->executionProfile = (UINT64*)checked_malloc(win_size*sizeof(UINT64));
 
 	for(i = 0; i < win_size; i++){
-		executionProfile[i] = 0;
+		l->executionProfile[i] = 0;
 	}
-	issueTime = 0;
+	l->issueTime = 0;
 
 	if(interval_size != -1){
-		if(interval_size % ILP_BUFFER_SIZE != 0){
-			cerr << "ERROR! Interval size is not a multiple of ILP buffer size. (" << interval_size << " vs " << ILP_BUFFER_SIZE << ")" << endl;
-			exit(-1);
-		}
 		char filename[100];
         sprintf(filename, "ilp-win%d_phases_int", win_size);
-		output_file_ilp_one.open(mkfilename(filename), ios::out|ios::trunc);
+		ofstream output_file_ilp_one;
+		output_file_ilp_one.open(mkfilename_thread(filename, t->tid), ios::out|ios::trunc);
 		output_file_ilp_one.close();
 	}
 }
 
-/* support */
-void increase_size_all_times_one(){
-	UINT64* ptr;
-
-	size_pow_times++;
-
-	ptr = (UINT64*)realloc(all_times, (1 << size_pow_times)*sizeof(UINT64));
-	if(ptr == (UINT64*)NULL){
-		cerr << "Could not allocate memory (realloc)!" << endl;
-		exit(1);
-	}
-	all_times = ptr;
-}
-
 /* per-instruction stuff */
-VOID ilp_instr_one(){
+VOID ilp_instr_one(ilp_state* l){
 
 	const UINT32 win_size_const = win_size;
 	UINT32 reordered;
 
 	/* set issue time for tail of instruction window */
-	executionProfile[windowTail] = issueTime;
-	windowTail = (windowTail + 1) % win_size_const;
+	l->executionProfile[l->windowTail] = l->issueTime;
+	l->windowTail = (l->windowTail + 1) % win_size_const;
 
 	/* if instruction window (issue buffer) full */
-	if(windowHead == windowTail){
-		cpuClock++;
-		cpuClock_interval++;
+	if(l->windowHead == l->windowTail){
+		l->cpuClock++;
+		l->cpuClock_interval++;
 		reordered = 0;
 		/* remove all instructions which are done from beginning of window,
 		 * until an instruction comes along which is not ready yet:
-		 * -> check executionProfile to see which instructions are done
+		 * -> check l->executionProfile to see which instructions are done
 		 * -> commit maximum win_size instructions (i.e. stop when issue buffer is empty)
 		 */
-		while((executionProfile[windowHead] < cpuClock) && (reordered < win_size_const)) {
-			windowHead = (windowHead + 1) % win_size_const;
+		while((l->executionProfile[l->windowHead] < l->cpuClock) && (reordered < win_size_const)) {
+			l->windowHead = (l->windowHead + 1) % win_size_const;
 			reordered++;
 		}
 		//assert(reordered != 0);
 	}
 
 	/* reset issue times */
-	issueTime = 0;
-}
-
-VOID ilp_instr_full_one(){
-
-	/* counting instructions is done in all_instr_full() */
-
-	ilp_instr_one();
+	l->issueTime = 0;
 }
 
-VOID ilp_instr_intervals_one(){
+/* end of an interval, after the buffered instructions up to its last one were simulated */
+VOID ilp_instr_intervals_one(mica_thread* t){
 
-	int i;
+	ilp_state* l = t->ilp;
 
 	/* counting instructions is done in all_instr_intervals() */
 
-	ilp_instr_one();
-
-	if(interval_ins_count_for_hpc_alignment == interval_size){
-
-        char filename[100];
-        sprintf(filename, "ilp-win%d_phases_int", win_size);
-
-		output_file_ilp_one.open(mkfilename(filename), ios::out|ios::app);
+	char filename[100];
+	sprintf(filename, "ilp-win%d_phases_int", win_size);
 
-		output_file_ilp_one << interval_size << " " << cpuClock_interval << endl;
+	ofstream output_file_ilp_one;
 
-		/* reset */
-		interval_ins_count = 0;
-		interval_ins_count_for_hpc_alignment = 0;
+	/* not during warmup in sampled mode */
+	if(interval_output){
+		output_file_ilp_one.open(mkfilename_thread(filename, t->tid), ios::out|ios::app);
 
-		cpuClock_interval = 0;
+		output_file_ilp_one << interval_size << " " << l->cpuClock_interval << endl;
+	}
 
-		/* clean up memory used, to avoid memory problems for long (CPU2006) benchmarks */
-		size_pow_times = 10;
+	/* reset */
+	t->interval_ins_count = 0;
+	t->interval_ins_count_for_hpc_alignment = 0;
 
-		free(all_times);
-		all_times = (UINT64*)checked_malloc((1 << size_pow_times) * sizeof(UINT64));
-		index_all_times = 1;
+	l->cpuClock_interval = 0;
 
-		nlist* np;
-		nlist* np_rm;
-		for(i=0; i < MAX_MEM_TABLE_ENTRIES; i++){
-			np = memAddressesTable[i];
-			while(np != (nlist*)NULL){
-				np_rm = np;
-				np = np->next;
-				free(np_rm->mem);
-				free(np_rm);
-			}
-			memAddressesTable[i] = (nlist*) NULL;
-		}
-
-		output_file_ilp_one.close();
-	}
+	output_file_ilp_one.close();
 }
 
-VOID checkIssueTime_one(){
+VOID checkIssueTime_one(ilp_state* l){
 
-	if(cpuClock > issueTime)
-		issueTime = cpuClock;
+	if(l->cpuClock > l->issueTime)
+		l->issueTime = l->cpuClock;
 }
 
 /* register stuff */
-VOID readRegOp_ilp_one(UINT32 regId){
+VOID readRegOp_ilp_one(ilp_state* l, UINT32 regId){
 
-	if(timeAvailable[regId] > issueTime)
-		issueTime = timeAvailable[regId];
+	if(l->timeAvailable[regId] > l->issueTime)
+		l->issueTime = l->timeAvailable[regId];
 }
 
-VOID readRegOp_ilp_one_fast(VOID* _e){
+VOID readRegOp_ilp_one_fast(ilp_state* l, VOID* _e){
 
 	ins_buffer_entry* e = (ins_buffer_entry*)_e;
 
@@ -267,80 +213,52 @@ VOID readRegOp_ilp_one_fast(VOID* _e){
 
 	for(i=0; i < e->regReadCnt; i++){
 		regId = (UINT32)e->regsRead[i];
-		if(timeAvailable[regId] > issueTime)
-			issueTime = timeAvailable[regId];
+		if(l->timeAvailable[regId] > l->issueTime)
+			l->issueTime = l->timeAvailable[regId];
 	}
 }
 
-VOID writeRegOp_ilp_one(UINT32 regId){
+VOID writeRegOp_ilp_one(ilp_state* l, UINT32 regId){
 
-	timeAvailable[regId] = issueTime + 1;
+	l->timeAvailable[regId] = l->issueTime + 1;
 }
 
-VOID writeRegOp_ilp_one_fast(VOID* _e){
+VOID writeRegOp_ilp_one_fast(ilp_state* l, VOID* _e){
 
 	ins_buffer_entry* e = (ins_buffer_entry*)_e;
 
 	INT32 i;
 
 	for(i=0; i < e->regWriteCnt; i++)
-		timeAvailable[(UINT32)e->regsWritten[i]] = issueTime + 1;
+		l->timeAvailable[(UINT32)e->regsWritten[i]] = l->issueTime + 1;
 }
 
 /* memory access stuff */
-VOID readMem_ilp_one(ADDRINT effAddr, ADDRINT size){
-
+VOID readMem_ilp_one(ilp_state* l, ADDRINT effAddr, ADDRINT size){
 
 	ADDRINT a;
-	ADDRINT upperMemAddr, indexInChunk;
-	memNode* chunk = (memNode*)NULL;
+	UINT64* avail;
 	ADDRINT shiftedAddr = effAddr >> ilp_block_size;
 	ADDRINT shiftedEndAddr = (effAddr + size - 1) >> ilp_block_size;
 
 	if(size > 0){
 		for(a = shiftedAddr; a <= shiftedEndAddr; a++){
-			upperMemAddr = a >> LOG_MAX_MEM_ENTRIES;
-			indexInChunk = a ^ (upperMemAddr << LOG_MAX_MEM_ENTRIES);
-
-			chunk = lookup(memAddressesTable, upperMemAddr);
-			if(chunk == (memNode*)NULL)
-				chunk = install(memAddressesTable, upperMemAddr);
-
-			//assert(indexInChunk < MAX_MEM_ENTRIES);
-			//assert(chunk->timeAvailable[indexInChunk] < (1 << size_pow_times));
-			if(all_times[chunk->timeAvailable[indexInChunk]] > issueTime)
-				issueTime = all_times[chunk->timeAvailable[indexInChunk]];
+			avail = ilp_mem_lookup(&l->mem, a);
+			if(avail != NULL && *avail > l->issueTime)
+				l->issueTime = *avail;
 		}
 	}
 }
 
-VOID writeMem_ilp_one(ADDRINT effAddr, ADDRINT size){
+VOID writeMem_ilp_one(ilp_state* l, ADDRINT effAddr, ADDRINT size){
 
 	ADDRINT a;
-	ADDRINT upperMemAddr, indexInChunk;
-	memNode* chunk = (memNode*)NULL;
 	ADDRINT shiftedAddr = effAddr >> ilp_block_size;
 	ADDRINT shiftedEndAddr = (effAddr + size - 1) >> ilp_block_size;
 
 	if(size > 0){
-		for(a = shiftedAddr; a <= shiftedEndAddr; a++){
-			upperMemAddr = a >> LOG_MAX_MEM_ENTRIES;
-			indexInChunk = a ^ (upperMemAddr << LOG_MAX_MEM_ENTRIES);
-
-			chunk = lookup(memAddressesTable,upperMemAddr);
-			if(chunk == (memNode*)NULL)
-				chunk = install(memAddressesTable,upperMemAddr);
-
-			//assert(indexInChunk < MAX_MEM_ENTRIES);
-			if(chunk->timeAvailable[indexInChunk] == 0){
-				index_all_times++;
-				if(index_all_times >= (1 << size_pow_times))
-					increase_size_all_times_one();
-				chunk->timeAvailable[indexInChunk] = index_all_times;
-			}
-			//assert(chunk->timeAvailable[indexInChunk] < (1 << size_pow_times));
-			all_times[chunk->timeAvailable[indexInChunk]] = issueTime + 1;
-		}
+		for(a = shiftedAddr; a <= shiftedEndAddr; a++)
+			*ilp_mem_insert(&l->mem, a, &l->cpuClock) = l->issueTime + 1;
 	}
 }
 
@@ -410,269 +328,126 @@ VOID writeMem_ilp_one(ADDRINT effAddr, ADDRINT size){
 VOID fini_ilp_one(INT32 code, VOID* v){
 
     char filename[100];
+	UINT32 k;
+	mica_thread* t;
+	ofstream output_file_ilp_one;
+	INT64 merged_cpuClock = 0;
 
-	fini_ilp_buffering_one();
+	for(k=0; k < mica_thread_cnt; k++){
+		t = mica_threads[k];
 
-	if(interval_size == -1){
-        sprintf(filename, "ilp-win%d_full_int", win_size);
+		fini_ilp_buffering_one(t);
 
-        output_file_ilp_one.open(mkfilename(filename), ios::out|ios::trunc);
-		//output_file_ilp_one << total_ins_count;
-	}
-	else{
-        sprintf(filename, "ilp-win%d_phases_int", win_size);
-        output_file_ilp_one.open(mkfilename(filename), ios::out|ios::app);
-		output_file_ilp_one << interval_ins_count;
+		if(interval_size == -1){
+            sprintf(filename, "ilp-win%d_full_int", win_size);
+
+            output_file_ilp_one.open(mkfilename_thread(filename, t->tid), ios::out|ios::trunc);
+			//output_file_ilp_one << total_ins_count;
+		}
+		else{
+            sprintf(filename, "ilp-win%d_phases_int", win_size);
+            output_file_ilp_one.open(mkfilename_thread(filename, t->tid), ios::out|ios::app);
+			output_file_ilp_one << t->interval_ins_count;
+		}
+		output_file_ilp_one << " " << t->ilp->cpuClock_interval << endl;
+
+		//output_file_ilp_one << "number of instructions: " << total_ins_count_for_hpc_alignment << endl;
+		output_file_ilp_one.close();
+
+		merged_cpuClock += t->ilp->cpuClock_interval;
 	}
-	output_file_ilp_one << " " << cpuClock_interval << endl;
 
-	//output_file_ilp_one << "number of instructions: " << total_ins_count_for_hpc_alignment << endl;
-	output_file_ilp_one.close();
+	/* threads are modelled as independent instruction streams, so cycle counts are summed */
+	if(interval_size == -1 && mica_thread_cnt > 1){
+        sprintf(filename, "ilp-win%d_full_int_merged", win_size);
+		output_file_ilp_one.open(mkfilename(filename), ios::out|ios::trunc);
+		output_file_ilp_one << " " << merged_cpuClock << endl;
+		output_file_ilp_one.close();
+	}
 }
 
 /***************************************
-     ILP (all 4 hardcoded window sizes)
+     ILP (all window sizes in ilp_sizes)
 ****************************************/
 
 /* initializing */
 void init_ilp_all(){
 
-	int i,j;
-
 	init_ilp_common();
-	init_ilp_buffering();
-
-	size_pow_all_times_all = 10;
-	for(i=0; i < ILP_WIN_SIZE_CNT; i++){
-		all_times_all[i] = (UINT64*)checked_malloc((1 << size_pow_all_times_all) * sizeof(UINT64));
-	}
-	index_all_times_all = 1; // don't use first element of all_times_all
 
 	ilp_block_size = _block_size;
 
-	for(j=0; j < ILP_WIN_SIZE_CNT; j++){
-		windowHead_all[j] = 0;
-		windowTail_all[j] = 0;
-		cpuClock_all[j] = 0;
-		cpuClock_interval_all[j] = 0;
-		for(i = 0; i < MAX_NUM_REGS; i++){
-			timeAvailable_all[j][i] = 0;
-		}
-
-		executionProfile_all[j] = (UINT64*)checked_malloc(win_sizes[j]*sizeof(UINT64));
-
-		for(i = 0; i < (int)win_sizes[j]; i++){
-			executionProfile_all[j][i] = 0;
-		}
-		issueTime_all[j] = 0;
-	}
-
-	if(interval_size != -1){
-		if(interval_size % ILP_BUFFER_SIZE != 0){
-			cerr << "ERROR! Interval size is not a multiple of ILP buffer size. (" << interval_size << " vs " << ILP_BUFFER_SIZE << ")" << endl;
-			exit(-1);
-		}
-		output_file_ilp_all.open(mkfilename("ilp_phases_int"), ios::out|ios::trunc);
-		output_file_ilp_all.close();
-	}
 }
 
-/* support */
-void increase_size_all_times_all(){
-	int i;
-	UINT64* ptr;
-	size_pow_all_times_all++;
-
-	for(i=0; i < ILP_WIN_SIZE_CNT; i++){
-		ptr = (UINT64*)realloc(all_times_all[i],(1 << size_pow_all_times_all)*sizeof(UINT64));
-		if(ptr == (UINT64*)NULL){
-			cerr << "Could not allocate memory (realloc)!" << endl;
-			exit(1);
-		}
-		all_times_all[i] = ptr;
-	}
-}
+VOID init_ilp_all_thread(mica_thread* t){
 
-/* per-instruction stuff */
-VOID ilp_instr_all(){
-
-	int i;
-	UINT32 reordered;
+	ilp_state* l = (ilp_state*)checked_aligned_malloc(sizeof(ilp_state));
 
+	t->ilp = l;
 
-	for(i=0; i < ILP_WIN_SIZE_CNT; i++){
-
-		/* set issue time for tail of instruction window */
-		executionProfile_all[i][windowTail_all[i]] = issueTime_all[i];
-		windowTail_all[i] = (windowTail_all[i] + 1) % win_sizes[i];
-
-		/* if instruction window (issue buffer) full */
-		if(windowHead_all[i] == windowTail_all[i]){
-			cpuClock_all[i]++;
-			cpuClock_interval_all[i]++;
-			reordered = 0;
-			/* remove all instructions which are done from beginning of window,
-			 * until an instruction comes along which is not ready yet:
-			 * -> check executionProfile_all to see which instructions are done
-			 * -> commit maximum win_size instructions (i.e. stop when issue buffer is empty)
-			 */
-			while((executionProfile_all[i][windowHead_all[i]] < cpuClock_all[i]) && (reordered < win_sizes[i])) {
-				windowHead_all[i] = (windowHead_all[i] + 1) % win_sizes[i];
-				reordered++;
-			}
-			//assert(reordered != 0);
-		}
+	init_ilp_buffering(l);
 
-		/* reset issue times */
-		issueTime_all[i] = 0;
+	ilp_windows_init(&l->all, _ilp_win_sizes, _ilp_win_size_cnt);
 
+	if(interval_size != -1){
+		ofstream output_file_ilp_all;
+		output_file_ilp_all.open(mkfilename_thread("ilp_phases_int", t->tid), ios::out|ios::trunc);
+		output_file_ilp_all.close();
 	}
-
-}
-
-VOID ilp_instr_full_all(){
-
-	/* counting instructions is done in all_instr_full() */
-
-	ilp_instr_all();
 }
 
-VOID ilp_instr_intervals_all(){
+/* end of an interval, after the buffered instructions up to its last one were simulated */
+VOID ilp_instr_intervals_all(mica_thread* t){
 
-	int i;
+	UINT32 i;
+	ilp_state* l = t->ilp;
 
 	/* counting instructions is done in all_instr_intervals() */
 
-	if(interval_ins_count_for_hpc_alignment == interval_size){
+	ofstream output_file_ilp_all;
 
-		output_file_ilp_all.open(mkfilename("ilp_phases_int"), ios::out|ios::app);
+	/* not during warmup in sampled mode */
+	if(interval_output){
+		output_file_ilp_all.open(mkfilename_thread("ilp_phases_int", t->tid), ios::out|ios::app);
 
-		output_file_ilp_all << interval_ins_count;
-		for(i = 0; i < ILP_WIN_SIZE_CNT; i++)
-			output_file_ilp_all << " " << cpuClock_interval_all[i];
+		output_file_ilp_all << t->interval_ins_count;
+		for(i = 0; i < _ilp_win_size_cnt; i++)
+			output_file_ilp_all << " " << l->all.cpuClock_interval[i];
 		output_file_ilp_all << endl;
-
-		/* reset */
-		interval_ins_count = 0;
-		interval_ins_count_for_hpc_alignment = 0;
-
-		for(i = 0; i < ILP_WIN_SIZE_CNT; i++)
-			cpuClock_interval_all[i] = 0;
-
-		/* clean up memory used, to avoid memory problems for long (CPU2006) benchmarks */
-		size_pow_all_times_all = 10;
-		for(i = 0; i < ILP_WIN_SIZE_CNT; i++){
-			free(all_times_all[i]);
-			all_times_all[i] = (UINT64*)checked_malloc((1 << size_pow_all_times_all) * sizeof(UINT64));
-		}
-		index_all_times_all = 1;
-
-		nlist* np;
-		nlist* np_rm;
-		for(i=0; i < MAX_MEM_TABLE_ENTRIES; i++){
-			np = memAddressesTable_all[i];
-			while(np != (nlist*)NULL){
-				np_rm = np;
-				np = np->next;
-				free(np_rm->mem);
-				free(np_rm);
-			}
-			memAddressesTable_all[i] = (nlist*) NULL;
-		}
-
-		output_file_ilp_all.close();
 	}
 
-	ilp_instr_all();
-}
+	/* reset */
+	t->interval_ins_count = 0;
+	t->interval_ins_count_for_hpc_alignment = 0;
 
-VOID checkIssueTime_all(){
-	int i;
+	for(i = 0; i < _ilp_win_size_cnt; i++)
+		l->all.cpuClock_interval[i] = 0;
 
-	for(i=0; i < ILP_WIN_SIZE_CNT; i++){
-		if(cpuClock_all[i] > issueTime_all[i])
-			issueTime_all[i] = cpuClock_all[i];
-	}
-}
-
-/* register stuff */
-VOID readRegOp_ilp_all(UINT32 regId){
-	int i;
-
-	for(i=0; i < ILP_WIN_SIZE_CNT; i++){
-
-		if(timeAvailable_all[i][regId] > issueTime_all[i])
-			issueTime_all[i] = timeAvailable_all[i][regId];
-	}
-}
-
-VOID writeRegOp_ilp_all(UINT32 regId){
-	int i;
-
-	for(i=0; i < ILP_WIN_SIZE_CNT; i++){
-		timeAvailable_all[i][regId] = issueTime_all[i] + 1;
-	 }
+	output_file_ilp_all.close();
 }
 
 /* memory access stuff */
-VOID readMem_ilp_all(ADDRINT effAddr, ADDRINT size){
-
-	int i;
+VOID readMem_ilp_all(ilp_state* l, ADDRINT effAddr, ADDRINT size){
 
 	ADDRINT a;
-	ADDRINT upperMemAddr, indexInChunk;
-	memNode* chunk = (memNode*)NULL;
 	ADDRINT shiftedAddr = effAddr >> ilp_block_size;
 	ADDRINT shiftedEndAddr = (effAddr + size - 1) >> ilp_block_size;
 
 	if(size > 0){
-		for(a = shiftedAddr; a <= shiftedEndAddr; a++){
-			upperMemAddr = a >> LOG_MAX_MEM_ENTRIES;
-			indexInChunk = a ^ (upperMemAddr << LOG_MAX_MEM_ENTRIES);
-
-			chunk = lookup(memAddressesTable_all,upperMemAddr);
-			if(chunk == (memNode*)NULL)
-				chunk = install(memAddressesTable_all,upperMemAddr);
-
-			//assert(indexInChunk < MAX_MEM_ENTRIES);
-			for(i=0; i < ILP_WIN_SIZE_CNT; i++){
-
-				if(all_times_all[i][chunk->timeAvailable[indexInChunk]] > issueTime_all[i])
-					issueTime_all[i] = all_times_all[i][chunk->timeAvailable[indexInChunk]];
-			}
-		}
+		for(a = shiftedAddr; a <= shiftedEndAddr; a++)
+			ilp_windows_read_mem(&l->all, a);
 	}
 }
 
-VOID writeMem_ilp_all(ADDRINT effAddr, ADDRINT size){
-	int i;
+VOID writeMem_ilp_all(ilp_state* l, ADDRINT effAddr, ADDRINT size){
 
 	ADDRINT a;
-	ADDRINT upperMemAddr, indexInChunk;
-	memNode* chunk = (memNode*)NULL;
 	ADDRINT shiftedAddr = effAddr >> ilp_block_size;
 	ADDRINT shiftedEndAddr = (effAddr + size - 1) >> ilp_block_size;
 
 	if(size > 0){
-		for(a = shiftedAddr; a <= shiftedEndAddr; a++){
-			upperMemAddr = a >> LOG_MAX_MEM_ENTRIES;
-			indexInChunk = a ^ (upperMemAddr << LOG_MAX_MEM_ENTRIES);
-
-			chunk = lookup(memAddressesTable_all,upperMemAddr);
-			if(chunk == (memNode*)NULL)
-				chunk = install(memAddressesTable_all,upperMemAddr);
-
-			//assert(indexInChunk < MAX_MEM_ENTRIES);
-			if(chunk->timeAvailable[indexInChunk] == 0){
-				index_all_times_all++;
-				if(index_all_times_all >= (1 << size_pow_all_times_all))
-					increase_size_all_times_all();
-				chunk->timeAvailable[indexInChunk] = index_all_times_all;
-			}
-			for(i=0; i < ILP_WIN_SIZE_CNT; i++){
-				all_times_all[i][chunk->timeAvailable[indexInChunk]] = issueTime_all[i] + 1;
-			}
-		}
+		for(a = shiftedAddr; a <= shiftedEndAddr; a++)
+			ilp_windows_write_mem(&l->all, a);
 	}
 }
 
@@ -739,25 +514,51 @@ VOID writeMem_ilp_all(ADDRINT effAddr, ADDRINT size){
 /* finishing... */
 VOID fini_ilp_all(INT32 code, VOID* v){
 
-	int i;
+	UINT32 i;
+	UINT32 k;
+	mica_thread* t;
+	ofstream output_file_ilp_all;
+	INT64 merged_ins_count = 0;
+	INT64 merged_cpuClock[ILP_MAX_WIN_SIZE_CNT];
 
-	fini_ilp_buffering_all();
+	for(i = 0; i < _ilp_win_size_cnt; i++)
+		merged_cpuClock[i] = 0;
 
-	if(interval_size == -1){
-		output_file_ilp_all.open(mkfilename("ilp_full_int"), ios::out|ios::trunc);
-		output_file_ilp_all << total_ins_count;
-	}
-	else{
-		output_file_ilp_all.open(mkfilename("ilp_phases_int"), ios::out|ios::app);
-		output_file_ilp_all << interval_ins_count;
+	for(k=0; k < mica_thread_cnt; k++){
+		t = mica_threads[k];
+
+		fini_ilp_buffering_all(t);
+
+		if(interval_size == -1){
+			output_file_ilp_all.open(mkfilename_thread("ilp_full_int", t->tid), ios::out|ios::trunc);
+			output_file_ilp_all << t->total_ins_count;
+		}
+		else{
+			output_file_ilp_all.open(mkfilename_thread("ilp_phases_int", t->tid), ios::out|ios::app);
+			output_file_ilp_all << t->interval_ins_count;
+		}
+		for(i = 0; i < _ilp_win_size_cnt; i++)
+			output_file_ilp_all << " " << t->ilp->all.cpuClock_interval[i];
+		output_file_ilp_all << " ";
+
+		output_file_ilp_all << endl;
+		//output_file_ilp_all << "number of instructions: " << total_ins_count_for_hpc_alignment << endl;
+		output_file_ilp_all.close();
+
+		merged_ins_count += t->total_ins_count;
+		for(i = 0; i < _ilp_win_size_cnt; i++)
+			merged_cpuClock[i] += t->ilp->all.cpuClock_interval[i];
 	}
-	for(i = 0; i < ILP_WIN_SIZE_CNT; i++)
-		output_file_ilp_all << " " << cpuClock_interval_all[i];
-	output_file_ilp_all << " ";
 
-	output_file_ilp_all << endl;
-	//output_file_ilp_all << "number of instructions: " << total_ins_count_for_hpc_alignment << endl;
-	output_file_ilp_all.close();
+	/* threads are modelled as independent instruction streams, so cycle counts are summed */
+	if(interval_size == -1 && mica_thread_cnt > 1){
+		output_file_ilp_all.open(mkfilename("ilp_full_int_merged"), ios::out|ios::trunc);
+		output_file_ilp_all << merged_ins_count;
+		for(i = 0; i < _ilp_win_size_cnt; i++)
+			output_file_ilp_all << " " << merged_cpuClock[i];
+		output_file_ilp_all << " " << endl;
+		output_file_ilp_all.close();
+	}
 }
 
 /**************************
@@ -773,141 +574,187 @@ VOID fini_ilp_all(INT32 code, VOID* v){
  */
 
 /* initializing */
-void init_ilp_buffering(){
-
-	int i;
-
-	ilp_buffer_index = 0;
-	for(i=0; i < ILP_BUFFER_SIZE; i++){
-		ilp_buffer[i] = (ilp_buffer_entry*)checked_malloc(sizeof(ilp_buffer_entry));
-		ilp_buffer[i]->e = (ins_buffer_entry*)NULL;
-		ilp_buffer[i]->mem_read1_addr = 0;
-		ilp_buffer[i]->mem_read2_addr = 0;
-		ilp_buffer[i]->mem_read_size = 0;
-		ilp_buffer[i]->mem_write_addr = 0;
-		ilp_buffer[i]->mem_write_size = 0;
+void init_ilp_buffering(ilp_state* l){
+
+	UINT32 i;
+
+	l->ilp_buffer_index = 0;
+	l->ilp_buffer = (ilp_buffer_entry*)checked_aligned_malloc(_ilp_buffer_size * sizeof(ilp_buffer_entry));
+	for(i=0; i < _ilp_buffer_size; i++){
+		l->ilp_buffer[i].e = (ins_buffer_entry*)NULL;
+		l->ilp_buffer[i].mem_read1_addr = 0;
+		l->ilp_buffer[i].mem_read2_addr = 0;
+		l->ilp_buffer[i].mem_read_size = 0;
+		l->ilp_buffer[i].mem_write_addr = 0;
+		l->ilp_buffer[i].mem_write_size = 0;
 	}
 }
 
-VOID ilp_buffer_instruction_only(void* _e){
-	ilp_buffer[ilp_buffer_index]->e = (ins_buffer_entry*)_e;
+VOID ilp_buffer_instruction_only(mica_thread* t, void* _e){
+	ilp_state* l = t->ilp;
+	l->ilp_buffer[l->ilp_buffer_index].e = (ins_buffer_entry*)_e;
 }
 
-VOID ilp_buffer_instruction_read(ADDRINT read1_addr, ADDRINT read_size){
-	ilp_buffer[ilp_buffer_index]->mem_read1_addr = read1_addr;
-	ilp_buffer[ilp_buffer_index]->mem_read_size = read_size;
+VOID ilp_buffer_instruction_read(mica_thread* t, ADDRINT read1_addr, ADDRINT read_size){
+	ilp_state* l = t->ilp;
+	l->ilp_buffer[l->ilp_buffer_index].mem_read1_addr = read1_addr;
+	l->ilp_buffer[l->ilp_buffer_index].mem_read_size = read_size;
 }
 
-VOID ilp_buffer_instruction_read2(ADDRINT read2_addr){
-	ilp_buffer[ilp_buffer_index]->mem_read2_addr = read2_addr;
+VOID ilp_buffer_instruction_read2(mica_thread* t, ADDRINT read2_addr){
+	ilp_state* l = t->ilp;
+	l->ilp_buffer[l->ilp_buffer_index].mem_read2_addr = read2_addr;
 }
 
-VOID ilp_buffer_instruction_write(ADDRINT write_addr, ADDRINT write_size){
-	ilp_buffer[ilp_buffer_index]->mem_write_addr = write_addr;
-	ilp_buffer[ilp_buffer_index]->mem_write_size = write_size;
+VOID ilp_buffer_instruction_write(mica_thread* t, ADDRINT write_addr, ADDRINT write_size){
+	ilp_state* l = t->ilp;
+	l->ilp_buffer[l->ilp_buffer_index].mem_write_addr = write_addr;
+	l->ilp_buffer[l->ilp_buffer_index].mem_write_size = write_size;
 }
 
-ADDRINT ilp_buffer_instruction_next(){
-	ilp_buffer_index++;
-	return (ADDRINT)(ilp_buffer_index == ILP_BUFFER_SIZE || interval_ins_count_for_hpc_alignment == interval_size);
+ADDRINT ilp_buffer_instruction_next(mica_thread* t, UINT32 lag){
+	ilp_state* l = t->ilp;
+	l->ilp_buffer_index++;
+	return (ADDRINT)(l->ilp_buffer_index == _ilp_buffer_size || t->interval_ins_count_for_hpc_alignment - lag == interval_size);
+}
+
+/* wrappers used when instrumenting for ILP only */
+VOID ilp_buffer_instruction_only_tid(THREADID tid, void* _e){
+	ilp_buffer_instruction_only(get_mica_thread(tid), _e);
+}
+
+VOID ilp_buffer_instruction_read_tid(THREADID tid, ADDRINT read1_addr, ADDRINT read_size){
+	ilp_buffer_instruction_read(get_mica_thread(tid), read1_addr, read_size);
+}
+
+VOID ilp_buffer_instruction_read2_tid(THREADID tid, ADDRINT read2_addr){
+	ilp_buffer_instruction_read2(get_mica_thread(tid), read2_addr);
+}
+
+VOID ilp_buffer_instruction_write_tid(THREADID tid, ADDRINT write_addr, ADDRINT write_size){
+	ilp_buffer_instruction_write(get_mica_thread(tid), write_addr, write_size);
+}
+
+ADDRINT ilp_buffer_instruction_next_tid(THREADID tid, UINT32 lag){
+	return ilp_buffer_instruction_next(get_mica_thread(tid), lag);
 }
 
 /* empty buffer for one given window size  */
-VOID empty_buffer_one(){
+VOID empty_buffer_one(mica_thread* t){
 	UINT32 i,j;
+	ilp_state* l = t->ilp;
 
-	for(i=0; i < ilp_buffer_index; i++){
+	for(i=0; i < l->ilp_buffer_index; i++){
 
 		// register reads
-		for(j=0; j < (UINT32)ilp_buffer[i]->e->regReadCnt; j++){
-			readRegOp_ilp_one((UINT32)ilp_buffer[i]->e->regsRead[j]);
+		for(j=0; j < (UINT32)l->ilp_buffer[i].e->regReadCnt; j++){
+			readRegOp_ilp_one(l, (UINT32)l->ilp_buffer[i].e->regsRead[j]);
 		}
 
 		// memory reads
-		if(ilp_buffer[i]->mem_read1_addr != 0){
-			readMem_ilp_one(ilp_buffer[i]->mem_read1_addr, ilp_buffer[i]->mem_read_size);
-			ilp_buffer[i]->mem_read1_addr = 0;
+		if(l->ilp_buffer[i].mem_read1_addr != 0){
+			readMem_ilp_one(l, l->ilp_buffer[i].mem_read1_addr, l->ilp_buffer[i].mem_read_size);
+			l->ilp_buffer[i].mem_read1_addr = 0;
 
-			if(ilp_buffer[i]->mem_read2_addr != 0){
-				readMem_ilp_one(ilp_buffer[i]->mem_read2_addr, ilp_buffer[i]->mem_read_size);
-				ilp_buffer[i]->mem_read2_addr = 0;
+			if(l->ilp_buffer[i].mem_read2_addr != 0){
+				readMem_ilp_one(l, l->ilp_buffer[i].mem_read2_addr, l->ilp_buffer[i].mem_read_size);
+				l->ilp_buffer[i].mem_read2_addr = 0;
 			}
 
-			ilp_buffer[i]->mem_read_size = 0;
+			l->ilp_buffer[i].mem_read_size = 0;
 		}
 
-		checkIssueTime_one();
+		checkIssueTime_one(l);
 
 		// register writes
-		for(j=0; j < (UINT32)ilp_buffer[i]->e->regWriteCnt; j++){
-			writeRegOp_ilp_one((UINT32)ilp_buffer[i]->e->regsWritten[j]);
+		for(j=0; j < (UINT32)l->ilp_buffer[i].e->regWriteCnt; j++){
+			writeRegOp_ilp_one(l, (UINT32)l->ilp_buffer[i].e->regsWritten[j]);
 		}
 
 		// memory writes
-		if(ilp_buffer[i]->mem_write_addr != 0){
-			writeMem_ilp_one(ilp_buffer[i]->mem_write_addr, ilp_buffer[i]->mem_write_size);
-			ilp_buffer[i]->mem_write_addr = 0;
-			ilp_buffer[i]->mem_write_size = 0;
+		if(l->ilp_buffer[i].mem_write_addr != 0){
+			writeMem_ilp_one(l, l->ilp_buffer[i].mem_write_addr, l->ilp_buffer[i].mem_write_size);
+			l->ilp_buffer[i].mem_write_addr = 0;
+			l->ilp_buffer[i].mem_write_size = 0;
 		}
 
-		ilp_buffer[i]->e = (ins_buffer_entry*)NULL;
+		l->ilp_buffer[i].e = (ins_buffer_entry*)NULL;
 
-		if(interval_size == -1)
-			ilp_instr_full_one();
-		else
-			ilp_instr_intervals_one();
+		ilp_instr_one(l);
 	}
 
-	ilp_buffer_index = 0;
+	l->ilp_buffer_index = 0;
+
+	/* the buffer is emptied at the end of every interval */
+	if(interval_size != -1 && t->interval_ins_count_for_hpc_alignment == interval_size)
+		ilp_instr_intervals_one(t);
+}
+
+VOID empty_buffer_one_tid(THREADID tid, UINT32 lag){
+	mica_thread* t = get_mica_thread(tid);
+
+	ins_counts_rewind(t, lag);
+	empty_buffer_one(t);
+	ins_counts_forward(t, lag);
 }
 
-/* empty buffer for all 4 (hardcoded) window sizes */
-VOID empty_ilp_buffer_all(){
+/* empty buffer for all window sizes */
+VOID empty_ilp_buffer_all(mica_thread* t){
 	UINT32 i,j;
+	ilp_state* l = t->ilp;
 
-	for(i=0; i < ilp_buffer_index; i++){
+	for(i=0; i < l->ilp_buffer_index; i++){
 
 		// register reads
-		for(j=0; j < (UINT32)ilp_buffer[i]->e->regReadCnt; j++){
-			readRegOp_ilp_all((UINT32)ilp_buffer[i]->e->regsRead[j]);
+		for(j=0; j < (UINT32)l->ilp_buffer[i].e->regReadCnt; j++){
+			ilp_windows_read_reg(&l->all, (UINT32)l->ilp_buffer[i].e->regsRead[j]);
 		}
 
 		// memory reads
-		if(ilp_buffer[i]->mem_read1_addr != 0){
-			readMem_ilp_all(ilp_buffer[i]->mem_read1_addr, ilp_buffer[i]->mem_read_size);
-			ilp_buffer[i]->mem_read1_addr = 0;
+		if(l->ilp_buffer[i].mem_read1_addr != 0){
+			readMem_ilp_all(l, l->ilp_buffer[i].mem_read1_addr, l->ilp_buffer[i].mem_read_size);
+			l->ilp_buffer[i].mem_read1_addr = 0;
 
-			if(ilp_buffer[i]->mem_read2_addr != 0){
-				readMem_ilp_all(ilp_buffer[i]->mem_read2_addr, ilp_buffer[i]->mem_read_size);
-				ilp_buffer[i]->mem_read2_addr = 0;
+			if(l->ilp_buffer[i].mem_read2_addr != 0){
+				readMem_ilp_all(l, l->ilp_buffer[i].mem_read2_addr, l->ilp_buffer[i].mem_read_size);
+				l->ilp_buffer[i].mem_read2_addr = 0;
 			}
 
-			ilp_buffer[i]->mem_read_size = 0;
+			l->ilp_buffer[i].mem_read_size = 0;
 		}
 
-		checkIssueTime_all();
+		ilp_windows_check_issue(&l->all);
 
 		// register writes
-		for(j=0; j < (UINT32)ilp_buffer[i]->e->regWriteCnt; j++){
-			writeRegOp_ilp_all((UINT32)ilp_buffer[i]->e->regsWritten[j]);
+		for(j=0; j < (UINT32)l->ilp_buffer[i].e->regWriteCnt; j++){
+			ilp_windows_write_reg(&l->all, (UINT32)l->ilp_buffer[i].e->regsWritten[j]);
 		}
 
 		// memory writes
-		if(ilp_buffer[i]->mem_write_addr != 0){
-			writeMem_ilp_all(ilp_buffer[i]->mem_write_addr, ilp_buffer[i]->mem_write_size);
-			ilp_buffer[i]->mem_write_addr = 0;
-			ilp_buffer[i]->mem_write_size = 0;
+		if(l->ilp_buffer[i].mem_write_addr != 0){
+			writeMem_ilp_all(l, l->ilp_buffer[i].mem_write_addr, l->ilp_buffer[i].mem_write_size);
+			l->ilp_buffer[i].mem_write_addr = 0;
+			l->ilp_buffer[i].mem_write_size = 0;
 		}
 
-		ilp_buffer[i]->e = (ins_buffer_entry*)NULL;
+		l->ilp_buffer[i].e = (ins_buffer_entry*)NULL;
 
-		if(interval_size == -1)
-			ilp_instr_full_all();
-		else
-			ilp_instr_intervals_all();
+		ilp_windows_issue(&l->all);
 	}
 
-	ilp_buffer_index = 0;
+	l->ilp_buffer_index = 0;
+
+	/* the buffer is emptied at the end of every interval */
+	if(interval_size != -1 && t->interval_ins_count_for_hpc_alignment == interval_size)
+		ilp_instr_intervals_all(t);
+}
+
+VOID empty_ilp_buffer_all_tid(THREADID tid, UINT32 lag){
+	mica_thread* t = get_mica_thread(tid);
+
+	ins_counts_rewind(t, lag);
+	empty_ilp_buffer_all(t);
+	ins_counts_forward(t, lag);
 }
 
 /* instrumenting (instruction level) */
@@ -991,22 +838,22 @@ VOID instrument_ilp_buffering_common(INS ins, ins_buffer_entry* e){
 	}
 
 	// buffer memory operations (and instruction register buffer) with one single InsertCall
-	INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ilp_buffer_instruction_only, IARG_PTR, (void*)e, IARG_END);
+	mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, ilp_buffer_instruction_only_tid, IARG_THREAD_ID, IARG_PTR, (void*)e, IARG_END);
 
 	if(INS_IsMemoryRead(ins)){
 
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ilp_buffer_instruction_read, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_END);
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, ilp_buffer_instruction_read_tid, IARG_THREAD_ID, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_END);
 
 		if(INS_HasMemoryRead2(ins)){
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ilp_buffer_instruction_read2, IARG_MEMORYREAD2_EA, IARG_END);
+			mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, ilp_buffer_instruction_read2_tid, IARG_THREAD_ID, IARG_MEMORYREAD2_EA, IARG_END);
 		}
 	}
 
 	if(INS_IsMemoryWrite(ins)){
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ilp_buffer_instruction_write, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_END);
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, ilp_buffer_instruction_write_tid, IARG_THREAD_ID, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_END);
 	}
 
-	INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)ilp_buffer_instruction_next, IARG_END);
+	mica_insert_call(MICA_IF_CALL, ins, IPOINT_BEFORE, ilp_buffer_instruction_next_tid, IARG_THREAD_ID, IARG_UINT32, ins_lag, IARG_END);
 
 }
 
@@ -1014,25 +861,25 @@ VOID instrument_ilp_one(INS ins, ins_buffer_entry* e){
 
 	instrument_ilp_buffering_common(ins, e);
 	// only called if buffer is full
-	INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)empty_buffer_one, IARG_END);
+	mica_insert_call(MICA_THEN_CALL, ins, IPOINT_BEFORE, empty_buffer_one_tid, IARG_THREAD_ID, IARG_UINT32, ins_lag, IARG_END);
 }
 
 VOID instrument_ilp_all(INS ins, ins_buffer_entry* e){
 
 	instrument_ilp_buffering_common(ins, e);
 	// only called if buffer is full
-	INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)empty_ilp_buffer_all, IARG_END);
+	mica_insert_call(MICA_THEN_CALL, ins, IPOINT_BEFORE, empty_ilp_buffer_all_tid, IARG_THREAD_ID, IARG_UINT32, ins_lag, IARG_END);
 }
 
-VOID fini_ilp_buffering_all(){
+VOID fini_ilp_buffering_all(mica_thread* t){
 
-	if(ilp_buffer_index != 0)
-		empty_ilp_buffer_all();
+	if(t->ilp->ilp_buffer_index != 0)
+		empty_ilp_buffer_all(t);
 }
 
-VOID fini_ilp_buffering_one(){
+VOID fini_ilp_buffering_one(mica_thread* t){
 
-	if(ilp_buffer_index != 0)
-		empty_buffer_one();
+	if(t->ilp->ilp_buffer_index != 0)
+		empty_buffer_one(t);
 }
 
@@ -12,6 +12,8 @@
 
 void init_ilp_all();
 void init_ilp_one();
+VOID init_ilp_all_thread(mica_thread* t);
+VOID init_ilp_one_thread(mica_thread* t);
 
 VOID instrument_ilp_all(INS ins, ins_buffer_entry* e);
 VOID instrument_ilp_one(INS ins, ins_buffer_entry* e);
@@ -21,18 +23,19 @@ VOID fini_ilp_one(INT32 code, VOID* v);
 
 /* support for fast instrumentation of all characteristics in a single run (avoid multiple InsertCalls!) */
 //void ilp_buffer_instruction_only(void* _e);
-VOID PIN_FAST_ANALYSIS_CALL ilp_buffer_instruction_only(void* _e);
+VOID PIN_FAST_ANALYSIS_CALL ilp_buffer_instruction_only(mica_thread* t, void* _e);
 //void ilp_buffer_instruction_read(ADDRINT read1_addr, ADDRINT read_size);
-VOID PIN_FAST_ANALYSIS_CALL ilp_buffer_instruction_read(ADDRINT read1_addr, ADDRINT read_size);
+VOID PIN_FAST_ANALYSIS_CALL ilp_buffer_instruction_read(mica_thread* t, ADDRINT read1_addr, ADDRINT read_size);
 //void ilp_buffer_instruction_read2(ADDRINT read2_addr);
-VOID PIN_FAST_ANALYSIS_CALL ilp_buffer_instruction_read2(ADDRINT read2_addr);
+VOID PIN_FAST_ANALYSIS_CALL ilp_buffer_instruction_read2(mica_thread* t, ADDRINT read2_addr);
 //void ilp_buffer_instruction_write(ADDRINT write_addr, ADDRINT write_size);
-VOID PIN_FAST_ANALYSIS_CALL ilp_buffer_instruction_write(ADDRINT write_addr, ADDRINT write_size);
-ADDRINT ilp_buffer_instruction_next();
+VOID PIN_FAST_ANALYSIS_CALL ilp_buffer_instruction_write(mica_thread* t, ADDRINT write_addr, ADDRINT write_size);
+ADDRINT ilp_buffer_instruction_next(mica_thread* t, UINT32 lag);
 /*ADDRINT ilp_buffer_instruction_2reads_write(void* _e, ADDRINT read1_addr, ADDRINT read2_addr, ADDRINT read_size, ADDRINT write_addr, ADDRINT write_size);
 ADDRINT ilp_buffer_instruction_read_write(void* _e, ADDRINT read1_addr, ADDRINT read_size, ADDRINT write_addr, ADDRINT write_size);
 ADDRINT ilp_buffer_instruction_2reads(void* _e, ADDRINT read1_addr, ADDRINT read2_addr, ADDRINT read_size);
 ADDRINT ilp_buffer_instruction_read(void* _e, ADDRINT read1_addr, ADDRINT read_size);
 ADDRINT ilp_buffer_instruction_write(void* _e, ADDRINT write_addr, ADDRINT write_size);
 ADDRINT ilp_buffer_instruction(void* _e);*/
-VOID empty_ilp_buffer_all(); 
+VOID empty_ilp_buffer_all(mica_thread* t);
+VOID empty_buffer_one(mica_thread* t);
@@ -0,0 +1,262 @@
+/*
+ * This file is part of MICA, a Pin tool to collect
+ * microarchitecture-independent program characteristics using the Pin
+ * instrumentation framework.
+ *
+ * Please see the README.txt file distributed with the MICA release for more
+ * information.
+ */
+
+#include "mica.h"
+#include "mica_utils.h"
+
+#ifndef MICA_ILP_KERNEL
+#define MICA_ILP_KERNEL
+
+/* *** ILP simulation of a list of window sizes (ilp mode) ***
+ *
+ * The windows see the same instruction stream, so their state is kept as a struct of
+ * arrays, indexed by window last: every per-instruction update is a loop over the windows,
+ * without branches, which the compiler can vectorize, and the register and memory
+ * locations an instruction depends on are looked up once for all windows.
+ * Window sizes are powers of two, so the instruction windows are masked ring buffers,
+ * stored back to back in a single array.
+ *
+ * The times at which memory blocks are available are kept in an ilp_mem_store (below).
+ *
+ * A benchmark comparing this kernel with the previous (per window) implementation
+ * is in bench/ilp_kernel_bench.cpp. */
+
+/* *** memory block availability times ***
+ *
+ * Open-addressing hash table from block address to the time at which the block is available,
+ * for each of cnt windows. An instruction never issues before the current cycle of a window,
+ * so a time which is not later than the current cycle (for every window) no longer delays
+ * any instruction: the entry is stale, and is treated as if the block was never written.
+ * Stale entries are reused by new blocks, and dropped when the table is rebuilt (when it
+ * runs out of empty slots), so the size of the table follows the number of blocks written
+ * by instructions which may still delay others (bounded by the window sizes), rather than
+ * the memory footprint of the program. */
+
+#define ILP_MEM_INIT_SIZE 1024
+#define ILP_MEM_EMPTY ((ADDRINT)-1) // key of empty slots (not a block address)
+
+typedef struct ilp_mem_store_type {
+	ADDRINT* keys;
+	UINT64* times; // cnt per slot
+	UINT32 cnt;
+	UINT32 mask; // number of slots - 1 (number of slots is a power of two)
+	UINT32 used; // slots which are not empty (including stale ones)
+} ilp_mem_store;
+
+static inline UINT32 ilp_mem_index(ilp_mem_store* m, ADDRINT key){
+	return (UINT32)(((UINT64)key * 0x9E3779B97F4A7C15ULL) >> 32) & m->mask;
+}
+
+static inline void ilp_mem_alloc(ilp_mem_store* m, UINT32 size){
+	UINT32 i;
+
+	m->keys = (ADDRINT*)checked_malloc(size * sizeof(ADDRINT));
+	m->times = (UINT64*)checked_malloc(size * m->cnt * sizeof(UINT64));
+	for(i = 0; i < size; i++)
+		m->keys[i] = ILP_MEM_EMPTY;
+	m->mask = size - 1;
+	m->used = 0;
+}
+
+static inline void ilp_mem_init(ilp_mem_store* m, UINT32 cnt){
+	m->cnt = cnt;
+	ilp_mem_alloc(m, ILP_MEM_INIT_SIZE);
+}
+
+static inline BOOL ilp_mem_stale(ilp_mem_store* m, UINT32 slot, const UINT64* clock){
+	UINT32 i;
+	BOOL live = false;
+	UINT64* times = m->times + slot * m->cnt;
+
+	for(i = 0; i < m->cnt; i++)
+		live |= (times[i] > clock[i]);
+	return !live;
+}
+
+/* rebuilds the table with its live entries only, in a table at most one quarter full */
+static inline void ilp_mem_rebuild(ilp_mem_store* m, const UINT64* clock){
+	UINT32 i, j, live = 0, size = ILP_MEM_INIT_SIZE;
+	ilp_mem_store old = *m;
+
+	for(i = 0; i <= old.mask; i++){
+		if(old.keys[i] != ILP_MEM_EMPTY && !ilp_mem_stale(&old, i, clock))
+			live++;
+	}
+	while(size < 4 * live)
+		size *= 2;
+
+	ilp_mem_alloc(m, size);
+	for(i = 0; i <= old.mask; i++){
+		if(old.keys[i] != ILP_MEM_EMPTY && !ilp_mem_stale(&old, i, clock)){
+			for(j = ilp_mem_index(m, old.keys[i]); m->keys[j] != ILP_MEM_EMPTY; j = (j + 1) & m->mask);
+			m->keys[j] = old.keys[i];
+			memcpy(m->times + j * m->cnt, old.times + i * m->cnt, m->cnt * sizeof(UINT64));
+			m->used++;
+		}
+	}
+	free(old.keys);
+	free(old.times);
+}
+
+/* times for the block, NULL if it was not written yet (or its entry was dropped) */
+static inline UINT64* ilp_mem_lookup(ilp_mem_store* m, ADDRINT key){
+	UINT32 i;
+
+	for(i = ilp_mem_index(m, key); m->keys[i] != ILP_MEM_EMPTY; i = (i + 1) & m->mask){
+		if(m->keys[i] == key)
+			return m->times + i * m->cnt;
+	}
+	return NULL;
+}
+
+/* times for the block, which are about to be written (for a new entry they are undefined) */
+static inline UINT64* ilp_mem_insert(ilp_mem_store* m, ADDRINT key, const UINT64* clock){
+	UINT32 i;
+	UINT32 reuse = m->mask + 1; // first stale slot on the way (none)
+
+	for(i = ilp_mem_index(m, key); m->keys[i] != ILP_MEM_EMPTY; i = (i + 1) & m->mask){
+		if(m->keys[i] == key)
+			return m->times + i * m->cnt;
+		if(reuse > m->mask && ilp_mem_stale(m, i, clock))
+			reuse = i;
+	}
+
+	/* the block is not in the table, so it can take the place of a stale entry */
+	if(reuse <= m->mask){
+		m->keys[reuse] = key;
+		return m->times + reuse * m->cnt;
+	}
+
+	if(4 * (m->used + 1) > 3 * (m->mask + 1)){
+		ilp_mem_rebuild(m, clock);
+		for(i = ilp_mem_index(m, key); m->keys[i] != ILP_MEM_EMPTY; i = (i + 1) & m->mask);
+	}
+	m->keys[i] = key;
+	m->used++;
+	return m->times + i * m->cnt;
+}
+
+typedef struct ilp_windows_type {
+	UINT32 cnt; // number of windows
+	UINT32 size[ILP_MAX_WIN_SIZE_CNT];
+	UINT32 mask[ILP_MAX_WIN_SIZE_CNT];
+	UINT32 offset[ILP_MAX_WIN_SIZE_CNT]; // of each window in executionProfile
+	UINT64 issueTime[ILP_MAX_WIN_SIZE_CNT];
+	UINT64 cpuClock[ILP_MAX_WIN_SIZE_CNT];
+	INT64 cpuClock_interval[ILP_MAX_WIN_SIZE_CNT];
+	UINT32 windowHead[ILP_MAX_WIN_SIZE_CNT];
+	UINT32 windowTail[ILP_MAX_WIN_SIZE_CNT];
+	UINT64* executionProfile;
+	/* time at which registers are available, cnt per register */
+	UINT64* timeAvailable;
+	/* time at which memory blocks are available */
+	ilp_mem_store mem;
+} ilp_windows;
+
+/* sizes are powers of two (checked when reading the configuration) */
+static inline void ilp_windows_init(ilp_windows* w, const UINT32* sizes, UINT32 cnt){
+	UINT32 i, profile_size = 0;
+
+	memset(w, 0, sizeof(ilp_windows));
+	w->cnt = cnt;
+	for(i = 0; i < cnt; i++){
+		w->size[i] = sizes[i];
+		w->mask[i] = sizes[i] - 1;
+		w->offset[i] = profile_size;
+		profile_size += sizes[i];
+	}
+	w->executionProfile = (UINT64*)checked_malloc(profile_size * sizeof(UINT64));
+	memset(w->executionProfile, 0, profile_size * sizeof(UINT64));
+	w->timeAvailable = (UINT64*)checked_malloc(MAX_NUM_REGS * cnt * sizeof(UINT64));
+	memset(w->timeAvailable, 0, MAX_NUM_REGS * cnt * sizeof(UINT64));
+	ilp_mem_init(&w->mem, cnt);
+}
+
+static inline void ilp_windows_read_reg(ilp_windows* w, UINT32 regId){
+	UINT32 i;
+	UINT64* avail = w->timeAvailable + regId * w->cnt;
+
+	for(i = 0; i < w->cnt; i++)
+		w->issueTime[i] = avail[i] > w->issueTime[i] ? avail[i] : w->issueTime[i];
+}
+
+static inline void ilp_windows_write_reg(ilp_windows* w, UINT32 regId){
+	UINT32 i;
+	UINT64* avail = w->timeAvailable + regId * w->cnt;
+
+	for(i = 0; i < w->cnt; i++)
+		avail[i] = w->issueTime[i] + 1;
+}
+
+static inline void ilp_windows_read_mem(ilp_windows* w, ADDRINT block){
+	UINT32 i;
+	UINT64* avail = ilp_mem_lookup(&w->mem, block);
+
+	if(avail == NULL)
+		return;
+	for(i = 0; i < w->cnt; i++)
+		w->issueTime[i] = avail[i] > w->issueTime[i] ? avail[i] : w->issueTime[i];
+}
+
+static inline void ilp_windows_write_mem(ilp_windows* w, ADDRINT block){
+	UINT32 i;
+	UINT64* avail = ilp_mem_insert(&w->mem, block, w->cpuClock);
+
+	for(i = 0; i < w->cnt; i++)
+		avail[i] = w->issueTime[i] + 1;
+}
+
+/* an instruction can not issue before the current cycle */
+static inline void ilp_windows_check_issue(ilp_windows* w){
+	UINT32 i;
+
+	for(i = 0; i < w->cnt; i++)
+		w->issueTime[i] = w->cpuClock[i] > w->issueTime[i] ? w->cpuClock[i] : w->issueTime[i];
+}
+
+/* removes all instructions which are done from the head of a full window,
+ * until an instruction comes along which is not ready yet (at most the window size) */
+static inline void ilp_windows_commit(ilp_windows* w, UINT32 i){
+	UINT32 reordered = 0;
+	UINT64* profile = w->executionProfile + w->offset[i];
+
+	while((profile[w->windowHead[i]] < w->cpuClock[i]) && (reordered < w->size[i])){
+		w->windowHead[i] = (w->windowHead[i] + 1) & w->mask[i];
+		reordered++;
+	}
+}
+
+/* adds the instruction to the tail of the windows (issue buffers); when a window is full,
+ * the clock advances and done instructions are committed */
+static inline void ilp_windows_issue(ilp_windows* w){
+	UINT32 i, full;
+	UINT32 full_mask = 0;
+
+	for(i = 0; i < w->cnt; i++){
+		w->executionProfile[w->offset[i] + w->windowTail[i]] = w->issueTime[i];
+		w->windowTail[i] = (w->windowTail[i] + 1) & w->mask[i];
+
+		full = (w->windowHead[i] == w->windowTail[i]);
+		w->cpuClock[i] += full;
+		w->cpuClock_interval[i] += full;
+		full_mask |= full << i;
+
+		/* reset issue times */
+		w->issueTime[i] = 0;
+	}
+
+	/* committing depends on the issue times in the window, so it is done per full window */
+	while(full_mask){
+		i = __builtin_ctz(full_mask);
+		ilp_windows_commit(w, i);
+		full_mask &= full_mask - 1;
+	}
+}
+
+#endif
@@ -29,25 +29,58 @@ void setup_mica_log(ofstream *log){
 /*
  * Read mica.conf config file for MICA.
  *
- * analysis_type: 'all' | 'ilp' | 'ilp_one' | 'itypes' | 'ppm' | 'reg' | 'stride' | 'memfootprint' | 'memstackdist' | 'custom'
+ * analysis_type: 'all' | 'ilp' | 'ilp_one' | 'itypes' | 'ppm' | 'reg' | 'stride' | 'memfootprint' | 'memstackdist' | 'capture' | 'bbv' | 'sampled' | <comma-separated list>
  * interval_size: 'full' | <integer>
  * ilp_size: <integer>
+ * ilp_sizes: <comma-separated list of integers>
+ * ilp_buffer_size: <integer>
+ * ppm_history_lengths: <comma-separated list of integers>
  * itypes_spec_file: <string>
+ * append_pid: 'yes' | 'no'
+ * memstackdist_block_sizes: <comma-separated list of integers>
+ * memstackdist_engine: 'lru' | 'tree'
+ * memstackdist_writes: 'no' | 'merged' | 'separate'
+ * memstackdist_sampling: 'no' | <rate>
+ * memstackdist_sampling_lines: <integer>
+ * analysis_threads: 'yes' | 'no'
+ * bbv_clusters: <integer>
+ * sampling_warmup: <integer>
+ * simpoints_file: <string>
+ * weights_file: <string>
+ * roi_start: <integer>
+ * roi_end: <integer>
+ * roi_function: <string>
  */
-enum CONFIG_PARAM {UNKNOWN_CONFIG_PARAM = -1, ANALYSIS_TYPE = 0, INTERVAL_SIZE, ILP_SIZE, _BLOCK_SIZE, _PAGE_SIZE, ITYPES_SPEC_FILE, APPEND_PID, CONF_PAR_CNT};
-const char* config_params_str[CONF_PAR_CNT] = {"analysis_type",   "interval_size", "ilp_size", "block_size", "page_size", "itypes_spec_file"};
-enum ANALYSIS_TYPE {UNKNOWN_ANALYSIS_TYPE = -1, ALL=0, ILP, ILP_ONE, ITYPES, PPM, MICA_REG, STRIDE, MEMFOOTPRINT, MEMSTACKDIST, CUSTOM, ANA_TYPE_CNT};
-const char* analysis_types_str[ANA_TYPE_CNT] = { "all",   "ilp", "ilp_one", "itypes", "ppm", "reg", "stride", "memfootprint", "memstackdist", "custom"};
+enum CONFIG_PARAM {UNKNOWN_CONFIG_PARAM = -1, ANALYSIS_TYPE = 0, INTERVAL_SIZE, ILP_SIZE, ILP_SIZES, ILP_BUFFER_SIZE, PPM_HISTORY_LENGTHS, _BLOCK_SIZE, _PAGE_SIZE, ITYPES_SPEC_FILE, APPEND_PID, _MEMSTACKDIST_BLOCK_SIZES, _MEMSTACKDIST_ENGINE, _MEMSTACKDIST_WRITES, _MEMSTACKDIST_SAMPLING, _MEMSTACKDIST_SAMPLING_LINES, _ANALYSIS_THREADS, _BBV_CLUSTERS, _SAMPLING_WARMUP, _SIMPOINTS_FILE, _WEIGHTS_FILE, _ROI_START, _ROI_END, _ROI_FUNCTION, CONF_PAR_CNT};
+const char* config_params_str[CONF_PAR_CNT] = {"analysis_type",   "interval_size", "ilp_size", "ilp_sizes", "ilp_buffer_size", "ppm_history_lengths", "block_size", "page_size", "itypes_spec_file", "append_pid", "memstackdist_block_sizes", "memstackdist_engine", "memstackdist_writes", "memstackdist_sampling", "memstackdist_sampling_lines", "analysis_threads", "bbv_clusters", "sampling_warmup", "simpoints_file", "weights_file", "roi_start", "roi_end", "roi_function"};
+enum ANALYSIS_TYPE {UNKNOWN_ANALYSIS_TYPE = -1, ALL=0, ILP, ILP_ONE, ITYPES, PPM, MICA_REG, STRIDE, MEMFOOTPRINT, MEMSTACKDIST, CAPTURE, BBV, SAMPLED, ANA_TYPE_CNT};
+const char* analysis_types_str[ANA_TYPE_CNT] = { "all",   "ilp", "ilp_one", "itypes", "ppm", "reg", "stride", "memfootprint", "memstackdist", "capture", "bbv", "sampled"};
 
 enum CONFIG_PARAM findConfigParam(char* s){
 
 	if(strcmp(s, "analysis_type") == 0){ return ANALYSIS_TYPE; }
 	if(strcmp(s, "interval_size") == 0){ return INTERVAL_SIZE; }
 	if(strcmp(s, "ilp_size") == 0){ return ILP_SIZE; }
+	if(strcmp(s, "ilp_sizes") == 0){ return ILP_SIZES; }
+	if(strcmp(s, "ilp_buffer_size") == 0){ return ILP_BUFFER_SIZE; }
+	if(strcmp(s, "ppm_history_lengths") == 0){ return PPM_HISTORY_LENGTHS; }
 	if(strcmp(s, "block_size") == 0){ return _BLOCK_SIZE; }
 	if(strcmp(s, "page_size") == 0){ return _PAGE_SIZE; }
 	if(strcmp(s, "itypes_spec_file") == 0){ return ITYPES_SPEC_FILE; }
 	if(strcmp(s, "append_pid") == 0){ return APPEND_PID; }
+	if(strcmp(s, "memstackdist_block_sizes") == 0){ return _MEMSTACKDIST_BLOCK_SIZES; }
+	if(strcmp(s, "memstackdist_engine") == 0){ return _MEMSTACKDIST_ENGINE; }
+	if(strcmp(s, "memstackdist_writes") == 0){ return _MEMSTACKDIST_WRITES; }
+	if(strcmp(s, "memstackdist_sampling") == 0){ return _MEMSTACKDIST_SAMPLING; }
+	if(strcmp(s, "memstackdist_sampling_lines") == 0){ return _MEMSTACKDIST_SAMPLING_LINES; }
+	if(strcmp(s, "analysis_threads") == 0){ return _ANALYSIS_THREADS; }
+	if(strcmp(s, "bbv_clusters") == 0){ return _BBV_CLUSTERS; }
+	if(strcmp(s, "sampling_warmup") == 0){ return _SAMPLING_WARMUP; }
+	if(strcmp(s, "simpoints_file") == 0){ return _SIMPOINTS_FILE; }
+	if(strcmp(s, "weights_file") == 0){ return _WEIGHTS_FILE; }
+	if(strcmp(s, "roi_start") == 0){ return _ROI_START; }
+	if(strcmp(s, "roi_end") == 0){ return _ROI_END; }
+	if(strcmp(s, "roi_function") == 0){ return _ROI_FUNCTION; }
 
 	return UNKNOWN_CONFIG_PARAM;
 }
@@ -63,12 +96,142 @@ enum ANALYSIS_TYPE findAnalysisType(char* s){
 	if(strcmp(s, "stride") == 0){ return STRIDE; }
 	if(strcmp(s, "memfootprint") == 0){ return MEMFOOTPRINT; }
 	if(strcmp(s, "memstackdist") == 0){ return MEMSTACKDIST; }
-	if(strcmp(s, "custom") == 0){ return CUSTOM; }
+	if(strcmp(s, "capture") == 0){ return CAPTURE; }
+	if(strcmp(s, "bbv") == 0){ return BBV; }
+	if(strcmp(s, "sampled") == 0){ return SAMPLED; }
 
 	return UNKNOWN_ANALYSIS_TYPE;
 }
 
-void read_config(ofstream* log, INT64* intervalSize, MODE* mode, UINT32* _ilp_win_size, UINT32* _block_size, UINT32* _page_size, char** _itypes_spec_file, int* append_pid){
+/* set of analysis types in a comma-separated list (e.g. ppm,memstackdist), measured together in custom mode */
+UINT32 findAnalysisSet(ofstream* log, char* s){
+
+	UINT32 set = 0;
+	char* type;
+
+	for(type = strtok(s, ","); type != NULL; type = strtok(NULL, ",")){
+
+		switch(findAnalysisType(type)){
+			case ILP: set |= ANALYSIS_SET_ILP; break;
+			case ILP_ONE: set |= ANALYSIS_SET_ILP_ONE; break;
+			case ITYPES: set |= ANALYSIS_SET_ITYPES; break;
+			case PPM: set |= ANALYSIS_SET_PPM; break;
+			case MICA_REG: set |= ANALYSIS_SET_REG; break;
+			case STRIDE: set |= ANALYSIS_SET_STRIDE; break;
+			case MEMFOOTPRINT: set |= ANALYSIS_SET_MEMFOOTPRINT; break;
+			case MEMSTACKDIST: set |= ANALYSIS_SET_MEMSTACKDIST; break;
+			default:
+				cerr << "ERROR: Analysis type \"" << type << "\" can not be part of a list of analysis types!" << endl;
+				(*log) << "ERROR: Analysis type \"" << type << "\" can not be part of a list of analysis types!" << endl;
+				exit(1);
+		}
+	}
+
+	if((set & ANALYSIS_SET_ILP) && (set & ANALYSIS_SET_ILP_ONE)){
+		cerr << "ERROR: Analysis types \"ilp\" and \"ilp_one\" can not be combined!" << endl;
+		(*log) << "ERROR: Analysis types \"ilp\" and \"ilp_one\" can not be combined!" << endl;
+		exit(1);
+	}
+
+	return set;
+}
+
+/* window sizes in a comma-separated list (e.g. 16,32,64), simulated together in ilp mode; returns the number of sizes */
+UINT32 findIlpSizes(ofstream* log, char* s, UINT32* sizes){
+
+	UINT32 cnt = 0;
+	char* size;
+
+	for(size = strtok(s, ","); size != NULL; size = strtok(NULL, ",")){
+
+		if(cnt == ILP_MAX_WIN_SIZE_CNT){
+			cerr << "ERROR: At most " << ILP_MAX_WIN_SIZE_CNT << " window sizes can be specified in ilp_sizes!" << endl;
+			(*log) << "ERROR: At most " << ILP_MAX_WIN_SIZE_CNT << " window sizes can be specified in ilp_sizes!" << endl;
+			exit(1);
+		}
+
+		sizes[cnt] = (UINT32)atoi(size);
+
+		/* the instruction windows are masked ring buffers (see mica_ilp_kernel.h) */
+		if(sizes[cnt] == 0 || (sizes[cnt] & (sizes[cnt] - 1)) != 0){
+			cerr << "ERROR: ILP window size \"" << size << "\" in ilp_sizes is not a power of two (use ilp_one for other sizes)!" << endl;
+			(*log) << "ERROR: ILP window size \"" << size << "\" in ilp_sizes is not a power of two (use ilp_one for other sizes)!" << endl;
+			exit(1);
+		}
+		cnt++;
+	}
+
+	if(cnt == 0){
+		cerr << "ERROR: No window sizes found in ilp_sizes!" << endl;
+		(*log) << "ERROR: No window sizes found in ilp_sizes!" << endl;
+		exit(1);
+	}
+
+	return cnt;
+}
+
+/* history lengths in a comma-separated list (e.g. 4,8,12), simulated together in ppm mode; returns the number of lengths */
+UINT32 findPpmHistoryLengths(ofstream* log, char* s, UINT32* lengths){
+
+	UINT32 cnt = 0;
+	char* length;
+
+	for(length = strtok(s, ","); length != NULL; length = strtok(NULL, ",")){
+
+		if(cnt == MAX_NUM_HIST_LENGTHS){
+			cerr << "ERROR: At most " << MAX_NUM_HIST_LENGTHS << " history lengths can be specified in ppm_history_lengths!" << endl;
+			(*log) << "ERROR: At most " << MAX_NUM_HIST_LENGTHS << " history lengths can be specified in ppm_history_lengths!" << endl;
+			exit(1);
+		}
+
+		lengths[cnt] = (UINT32)atoi(length);
+
+		/* the predictors are specialized for each history length up to MAX_HIST_LENGTH (see mica_ppm.cpp) */
+		if(lengths[cnt] == 0 || lengths[cnt] > MAX_HIST_LENGTH){
+			cerr << "ERROR: History length \"" << length << "\" in ppm_history_lengths should be between 1 and " << MAX_HIST_LENGTH << "!" << endl;
+			(*log) << "ERROR: History length \"" << length << "\" in ppm_history_lengths should be between 1 and " << MAX_HIST_LENGTH << "!" << endl;
+			exit(1);
+		}
+		cnt++;
+	}
+
+	if(cnt == 0){
+		cerr << "ERROR: No history lengths found in ppm_history_lengths!" << endl;
+		(*log) << "ERROR: No history lengths found in ppm_history_lengths!" << endl;
+		exit(1);
+	}
+
+	return cnt;
+}
+
+/* block sizes (2^size) in a comma-separated list (e.g. 5,6,7,12), measured together in memstackdist mode; returns the number of sizes */
+UINT32 findMemstackdistBlockSizes(ofstream* log, char* s, UINT32* sizes){
+
+	UINT32 cnt = 0;
+	char* size;
+
+	for(size = strtok(s, ","); size != NULL; size = strtok(NULL, ",")){
+
+		if(cnt == MEMSTACKDIST_MAX_BLOCK_SIZE_CNT){
+			cerr << "ERROR: At most " << MEMSTACKDIST_MAX_BLOCK_SIZE_CNT << " block sizes can be specified in memstackdist_block_sizes!" << endl;
+			(*log) << "ERROR: At most " << MEMSTACKDIST_MAX_BLOCK_SIZE_CNT << " block sizes can be specified in memstackdist_block_sizes!" << endl;
+			exit(1);
+		}
+
+		sizes[cnt] = (UINT32)atoi(size);
+		cnt++;
+	}
+
+	if(cnt == 0){
+		cerr << "ERROR: No block sizes found in memstackdist_block_sizes!" << endl;
+		(*log) << "ERROR: No block sizes found in memstackdist_block_sizes!" << endl;
+		exit(1);
+	}
+
+	return cnt;
+}
+
+void read_config(ofstream* log, INT64* intervalSize, MODE* mode, UINT32* _ilp_win_size, UINT32* _ilp_win_sizes, UINT32* _ilp_win_size_cnt, UINT32* _ilp_buffer_size, UINT32* _ppm_hist_lengths, UINT32* _ppm_hist_length_cnt, UINT32* _block_size, UINT32* _page_size, char** _itypes_spec_file, int* append_pid, UINT32* _memstackdist_block_sizes, UINT32* _memstackdist_block_size_cnt, MEMSTACKDIST_ENGINE* _memstackdist_engine, MEMSTACKDIST_WRITES* _memstackdist_writes, double* _memstackdist_sampling, UINT64* _memstackdist_sampling_lines, UINT32* _analysis_set, int* _analysis_threads, UINT32* _bbv_clusters, UINT32* _sampling_warmup, char** _simpoints_file, char** _weights_file, UINT64* _roi_start, UINT64* _roi_end, char** _roi_function){
 
 	int i;
 	char* param;
@@ -89,9 +252,33 @@ void read_config(ofstream* log, INT64* intervalSize, MODE* mode, UINT32* _ilp_wi
 
 	// default values
 	*mode = UNKNOWN_MODE;
+	*_analysis_set = 0;
 	*_ilp_win_size = 0;
+	*_ilp_win_size_cnt = 4;
+	_ilp_win_sizes[0] = 32;
+	_ilp_win_sizes[1] = 64;
+	_ilp_win_sizes[2] = 128;
+	_ilp_win_sizes[3] = 256;
+	*_ilp_buffer_size = 200;
+	*_ppm_hist_length_cnt = 3;
+	_ppm_hist_lengths[0] = 4;
+	_ppm_hist_lengths[1] = 8;
+	_ppm_hist_lengths[2] = 12;
 	*_block_size = 6; // default block size = 64 bytes (2^6)
 	*_page_size = 12; // default page size = 4KB (2^12)
+	*_memstackdist_block_size_cnt = 0; // block_size only
+	*_memstackdist_engine = MEMSTACKDIST_ENGINE_TREE;
+	*_memstackdist_writes = MEMSTACKDIST_WRITES_NO; // reads only
+	*_memstackdist_sampling = 0.0; // exact reuse distances
+	*_memstackdist_sampling_lines = 65536;
+	*_analysis_threads = 0;
+	*_bbv_clusters = 10;
+	*_sampling_warmup = 1;
+	*_simpoints_file = checked_strdup("simpoints_pin.out");
+	*_weights_file = checked_strdup("weights_pin.out");
+	*_roi_start = 0;
+	*_roi_end = 0; // end of program
+	*_roi_function = NULL;
 
 	while(!feof(config_file)){
 
@@ -102,12 +289,30 @@ void read_config(ofstream* log, INT64* intervalSize, MODE* mode, UINT32* _ilp_wi
 			exit(1);
 		}
 
+		/* lists may have spaces after the commas (e.g. "ppm, stride"), read the rest of the list */
+		while(val[strlen(val) - 1] == ','){
+			if (fscanf(config_file, "%s\n", val + strlen(val)) != 1)
+			{
+				cerr << "ERROR: invalid config entry found" << endl;
+				(*log) << "ERROR: invalid config entry found" << endl;
+				exit(1);
+			}
+		}
+
 		switch(findConfigParam(param)){
 
 			case ANALYSIS_TYPE:
 				// figure out mode we are running in
 				cerr << "Analysis type: " << val << endl;
 
+				if(strchr(val, ',') != NULL){
+					*mode = MODE_CUSTOM;
+					cerr << "Measuring CUSTOM characteristics (" << val << ")..." << endl;
+					(*log) << "Measuring CUSTOM characteristics (" << val << ")..." << endl;
+					*_analysis_set = findAnalysisSet(log, val);
+					break;
+				}
+
 				switch(findAnalysisType(val)){
 
 					case ALL:
@@ -164,9 +369,22 @@ void read_config(ofstream* log, INT64* intervalSize, MODE* mode, UINT32* _ilp_wi
 						(*log) << "Measuring MEMSTACKDIST characteristics..." << endl;
 						break;
 
-					case CUSTOM:
-						*mode = MODE_CUSTOM;
-						(*log) << "Measuring CUSTOM characteristics..." << endl;
+					case CAPTURE:
+						*mode = MODE_CAPTURE;
+						cerr << "Capturing a trace for offline analysis..." << endl;
+						(*log) << "Capturing a trace for offline analysis..." << endl;
+						break;
+
+					case BBV:
+						*mode = MODE_BBV;
+						cerr << "Collecting basic block vectors..." << endl;
+						(*log) << "Collecting basic block vectors..." << endl;
+						break;
+
+					case SAMPLED:
+						*mode = MODE_SAMPLED;
+						cerr << "Measuring ALL characteristics for the chosen intervals..." << endl;
+						(*log) << "Measuring ALL characteristics for the chosen intervals..." << endl;
 						break;
 
 					default:
@@ -202,6 +420,32 @@ void read_config(ofstream* log, INT64* intervalSize, MODE* mode, UINT32* _ilp_wi
 				(*log) << "ILP window size: " << *_ilp_win_size << endl;
 				break;
 
+			case ILP_SIZES:
+
+				cerr << "ILP window sizes: " << val << endl;
+				(*log) << "ILP window sizes: " << val << endl;
+				*_ilp_win_size_cnt = findIlpSizes(log, val, _ilp_win_sizes);
+				break;
+
+			case ILP_BUFFER_SIZE:
+
+				*_ilp_buffer_size = (UINT32)atoi(val);
+				if(*_ilp_buffer_size == 0){
+					cerr << "ERROR! ILP buffer size should be larger than zero." << endl;
+					(*log) << "ERROR! ILP buffer size should be larger than zero." << endl;
+					exit(1);
+				}
+				cerr << "ILP buffer size: " << *_ilp_buffer_size << endl;
+				(*log) << "ILP buffer size: " << *_ilp_buffer_size << endl;
+				break;
+
+			case PPM_HISTORY_LENGTHS:
+
+				cerr << "PPM history lengths: " << val << endl;
+				(*log) << "PPM history lengths: " << val << endl;
+				*_ppm_hist_length_cnt = findPpmHistoryLengths(log, val, _ppm_hist_lengths);
+				break;
+
 			case _BLOCK_SIZE:
 				*_block_size = (UINT32)atoi(val);
 				cerr << "block size: 2^" << *_block_size << endl;
@@ -241,6 +485,141 @@ void read_config(ofstream* log, INT64* intervalSize, MODE* mode, UINT32* _ilp_wi
 					exit(1);
 				}
 				break;
+
+			case _MEMSTACKDIST_BLOCK_SIZES:
+
+				cerr << "memstackdist block sizes (log2): " << val << endl;
+				(*log) << "memstackdist block sizes (log2): " << val << endl;
+				*_memstackdist_block_size_cnt = findMemstackdistBlockSizes(log, val, _memstackdist_block_sizes);
+				break;
+
+			case _MEMSTACKDIST_ENGINE:
+				if (strcmp(val, "lru") == 0){
+					*_memstackdist_engine = MEMSTACKDIST_ENGINE_LRU;
+				}
+				else if (strcmp(val, "tree") == 0){
+					*_memstackdist_engine = MEMSTACKDIST_ENGINE_TREE;
+				}
+				else{
+					cerr << "ERROR! memstackdist_engine can be either lru or tree" << endl;
+					(*log) << "ERROR! memstackdist_engine can be either lru or tree" << endl;
+					exit(1);
+				}
+				cerr << "memstackdist engine: " << val << endl;
+				(*log) << "memstackdist engine: " << val << endl;
+				break;
+
+			case _MEMSTACKDIST_WRITES:
+				if (strcmp(val, "no") == 0){
+					*_memstackdist_writes = MEMSTACKDIST_WRITES_NO;
+				}
+				else if (strcmp(val, "merged") == 0){
+					*_memstackdist_writes = MEMSTACKDIST_WRITES_MERGED;
+				}
+				else if (strcmp(val, "separate") == 0){
+					*_memstackdist_writes = MEMSTACKDIST_WRITES_SEPARATE;
+				}
+				else{
+					cerr << "ERROR! memstackdist_writes can be either no, merged or separate" << endl;
+					(*log) << "ERROR! memstackdist_writes can be either no, merged or separate" << endl;
+					exit(1);
+				}
+				cerr << "memstackdist writes: " << val << endl;
+				(*log) << "memstackdist writes: " << val << endl;
+				break;
+
+			case _MEMSTACKDIST_SAMPLING:
+				if (strcmp(val, "no") == 0){
+					*_memstackdist_sampling = 0.0;
+				}
+				else{
+					*_memstackdist_sampling = atof(val);
+					if(*_memstackdist_sampling <= 0.0 || *_memstackdist_sampling > 1.0){
+						cerr << "ERROR! memstackdist_sampling should be either no or a rate in (0,1]" << endl;
+						(*log) << "ERROR! memstackdist_sampling should be either no or a rate in (0,1]" << endl;
+						exit(1);
+					}
+				}
+				cerr << "memstackdist sampling: " << val << endl;
+				(*log) << "memstackdist sampling: " << val << endl;
+				break;
+
+			case _MEMSTACKDIST_SAMPLING_LINES:
+				*_memstackdist_sampling_lines = (UINT64)atoll(val);
+				if(*_memstackdist_sampling_lines == 0){
+					cerr << "ERROR! memstackdist_sampling_lines should be a positive integer" << endl;
+					(*log) << "ERROR! memstackdist_sampling_lines should be a positive integer" << endl;
+					exit(1);
+				}
+				cerr << "memstackdist sampling lines: " << *_memstackdist_sampling_lines << endl;
+				(*log) << "memstackdist sampling lines: " << *_memstackdist_sampling_lines << endl;
+				break;
+
+			case _ANALYSIS_THREADS:
+				if (strcmp(val, "yes") == 0){
+					*_analysis_threads = 1;
+				}
+				else if (strcmp(val, "no") == 0){
+					*_analysis_threads = 0;
+				}
+				else{
+					cerr << "ERROR! analysis_threads can be either yes or no" << endl;
+					(*log) << "ERROR! analysis_threads can be either yes or no" << endl;
+					exit(1);
+				}
+				cerr << "analysis threads: " << val << endl;
+				(*log) << "analysis threads: " << val << endl;
+				break;
+
+			case _BBV_CLUSTERS:
+				*_bbv_clusters = (UINT32)atoi(val);
+				if(*_bbv_clusters == 0){
+					cerr << "ERROR! bbv_clusters should be a positive integer" << endl;
+					(*log) << "ERROR! bbv_clusters should be a positive integer" << endl;
+					exit(1);
+				}
+				cerr << "BBV clusters: " << *_bbv_clusters << endl;
+				(*log) << "BBV clusters: " << *_bbv_clusters << endl;
+				break;
+
+			case _SAMPLING_WARMUP:
+				*_sampling_warmup = (UINT32)atoi(val);
+				cerr << "sampling warmup: " << *_sampling_warmup << " intervals" << endl;
+				(*log) << "sampling warmup: " << *_sampling_warmup << " intervals" << endl;
+				break;
+
+			case _SIMPOINTS_FILE:
+				free(*_simpoints_file);
+				*_simpoints_file = checked_strdup(val);
+				cerr << "simpoints file: " << *_simpoints_file << endl;
+				(*log) << "simpoints file: " << *_simpoints_file << endl;
+				break;
+
+			case _WEIGHTS_FILE:
+				free(*_weights_file);
+				*_weights_file = checked_strdup(val);
+				cerr << "weights file: " << *_weights_file << endl;
+				(*log) << "weights file: " << *_weights_file << endl;
+				break;
+
+			case _ROI_START:
+				*_roi_start = (UINT64)atoll(val);
+				cerr << "ROI start: " << *_roi_start << " instructions" << endl;
+				(*log) << "ROI start: " << *_roi_start << " instructions" << endl;
+				break;
+
+			case _ROI_END:
+				*_roi_end = (UINT64)atoll(val);
+				cerr << "ROI end: " << *_roi_end << " instructions" << endl;
+				(*log) << "ROI end: " << *_roi_end << " instructions" << endl;
+				break;
+
+			case _ROI_FUNCTION:
+				*_roi_function = checked_strdup(val);
+				cerr << "ROI function: " << *_roi_function << endl;
+				(*log) << "ROI function: " << *_roi_function << endl;
+				break;
+
 			default:
 				cerr << "ERROR: Unknown config parameter specified: " << param << " (" << val << ")" << endl;
 				cerr << "Known config parameters:" << endl;
@@ -263,12 +642,42 @@ void read_config(ofstream* log, INT64* intervalSize, MODE* mode, UINT32* _ilp_wi
 		exit(1);
 	}
 
-	if(*mode == MODE_ILP_ONE && *_ilp_win_size == 0){
+	if((*mode == MODE_ILP_ONE || (*_analysis_set & ANALYSIS_SET_ILP_ONE)) && *_ilp_win_size == 0){
 		cerr << "ERROR! \"ilp_one\" mode was specified, but no window size (ilp_size) was found along with it!" << endl;
 		(*log) << "ERROR! ERROR! \"ilp_one\" mode was specified, but no window size (ilp_size) was found along with it!" << endl;
 		exit(1);
 	}
 
+	if(*mode == MODE_CAPTURE && *_analysis_threads){
+		cerr << "ERROR! analysis_threads can not be used with the \"capture\" analysis type." << endl;
+		(*log) << "ERROR! analysis_threads can not be used with the \"capture\" analysis type." << endl;
+		exit(1);
+	}
+
+	if((*mode == MODE_BBV || *mode == MODE_SAMPLED) && *_analysis_threads){
+		cerr << "ERROR! analysis_threads can not be used with the \"bbv\" and \"sampled\" analysis types." << endl;
+		(*log) << "ERROR! analysis_threads can not be used with the \"bbv\" and \"sampled\" analysis types." << endl;
+		exit(1);
+	}
+
+	if(*_roi_function != NULL && (*_roi_start != 0 || *_roi_end != 0)){
+		cerr << "ERROR! roi_function can not be combined with roi_start and roi_end." << endl;
+		(*log) << "ERROR! roi_function can not be combined with roi_start and roi_end." << endl;
+		exit(1);
+	}
+
+	if(*_roi_end != 0 && *_roi_end <= *_roi_start){
+		cerr << "ERROR! roi_end should be larger than roi_start." << endl;
+		(*log) << "ERROR! roi_end should be larger than roi_start." << endl;
+		exit(1);
+	}
+
+	if((*mode == MODE_BBV || *mode == MODE_SAMPLED) && *intervalSize == -1){
+		cerr << "ERROR! The \"bbv\" and \"sampled\" analysis types require an interval_size other than full." << endl;
+		(*log) << "ERROR! The \"bbv\" and \"sampled\" analysis types require an interval_size other than full." << endl;
+		exit(1);
+	}
+
 	(*log).close();
 
 	free(param);
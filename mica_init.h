@@ -16,8 +16,18 @@
 #include "mica_memfootprint.h"
 #include "mica_memstackdist.h"
 
-enum MODE { UNKNOWN_MODE, MODE_ALL, MODE_ILP, MODE_ILP_ONE, MODE_ITYPES, MODE_PPM, MODE_REG, MODE_STRIDE, MODE_MEMFOOTPRINT, MODE_MEMSTACKDIST, MODE_CUSTOM };
+enum MODE { UNKNOWN_MODE, MODE_ALL, MODE_ILP, MODE_ILP_ONE, MODE_ITYPES, MODE_PPM, MODE_REG, MODE_STRIDE, MODE_MEMFOOTPRINT, MODE_MEMSTACKDIST, MODE_CUSTOM, MODE_CAPTURE, MODE_BBV, MODE_SAMPLED };
+
+/* analysis types measured together in custom mode (comma-separated analysis_type) */
+#define ANALYSIS_SET_ILP          (1 << 0)
+#define ANALYSIS_SET_ILP_ONE      (1 << 1)
+#define ANALYSIS_SET_ITYPES       (1 << 2)
+#define ANALYSIS_SET_PPM          (1 << 3)
+#define ANALYSIS_SET_REG          (1 << 4)
+#define ANALYSIS_SET_STRIDE       (1 << 5)
+#define ANALYSIS_SET_MEMFOOTPRINT (1 << 6)
+#define ANALYSIS_SET_MEMSTACKDIST (1 << 7)
 
 void setup_mica_log(ofstream *log);
 
-void read_config(ofstream *log, INT64* interval_size, MODE* mode, UINT32* _ilp_win_size, UINT32* _block_size, UINT32* _page_size, char** _itypes_spec_file, int* append_pid);
+void read_config(ofstream *log, INT64* interval_size, MODE* mode, UINT32* _ilp_win_size, UINT32* _ilp_win_sizes, UINT32* _ilp_win_size_cnt, UINT32* _ilp_buffer_size, UINT32* _ppm_hist_lengths, UINT32* _ppm_hist_length_cnt, UINT32* _block_size, UINT32* _page_size, char** _itypes_spec_file, int* append_pid, UINT32* _memstackdist_block_sizes, UINT32* _memstackdist_block_size_cnt, MEMSTACKDIST_ENGINE* _memstackdist_engine, MEMSTACKDIST_WRITES* _memstackdist_writes, double* _memstackdist_sampling, UINT64* _memstackdist_sampling_lines, UINT32* _analysis_set, int* _analysis_threads, UINT32* _bbv_clusters, UINT32* _sampling_warmup, char** _simpoints_file, char** _weights_file, UINT64* _roi_start, UINT64* _roi_end, char** _roi_function);
@@ -16,58 +16,103 @@
 /* Global variables */
 
 extern INT64 interval_size;
-extern INT64 interval_ins_count;
-extern INT64 interval_ins_count_for_hpc_alignment;
-extern INT64 total_ins_count;
-extern INT64 total_ins_count_for_hpc_alignment;
 extern char* _itypes_spec_file;
 
-ofstream output_file_itypes;
-
 identifier** group_identifiers;
 INT64* group_ids_cnt;
-INT64* group_counts;
 INT64 number_of_groups;
 
 INT64 other_ids_cnt;
 INT64 other_ids_max_cnt;
 identifier* other_group_identifiers;
 
-/* counter functions */
-ADDRINT itypes_instr_intervals(){
-	return (ADDRINT)(interval_ins_count_for_hpc_alignment == interval_size);
-};
+/* groups counted by a run of instructions (see ins_run in mica_utils.h): the groups
+ * of each instruction, and the number of times each group is counted by the whole run */
+typedef struct itypes_run_type {
+	UINT32 ins_cnt;
+	UINT32* ins_group_start; // groups of instruction k are ins_groups[ins_group_start[k] .. ins_group_start[k+1]-1]
+	UINT32* ins_groups;
+	UINT32 cnt; // number of distinct groups counted by the run
+	UINT32* groups;
+	UINT32* counts;
+	itypes_run_type* next; // run with the same head and another length
+} itypes_run;
+
+/* runs are classified once, and looked up by the address of their head, runs with the same head
+ * but another length (e.g., a trace entering the block halfway) are chained */
+static ins_index itypes_run_index; // address -> index in itypes_runs + 1
+static itypes_run** itypes_runs;
+static UINT32 itypes_run_cnt;
+static UINT32 itypes_run_max_cnt;
+static UINT32 itypes_max_ins_groups; // bound on the groups a single instruction is counted in
+
+/* per-thread state */
+typedef struct itypes_state_type {
+	INT64* group_counts;
+	// last run counted, and the total instruction count at its end
+	itypes_run* run;
+	INT64 run_end;
+} itypes_state;
+
+/* group counts are added for a whole run at its head; when an interval ends inside that run,
+ * the instructions which follow the boundary (the last ones of the run) are taken out of
+ * (sign -1) or put back into (sign 1) the counts */
+static VOID itypes_run_move(mica_thread* t, INT64 sign){
+	itypes_state* s = t->itypes;
+	itypes_run* r = s->run;
+	INT64 rest;
+	UINT32 k, g;
+
+	if(r == NULL)
+		return;
+
+	// instruction counts are rewound to the boundary when interval clients are called
+	rest = s->run_end - t->total_ins_count;
+	if(rest <= 0)
+		return;
+
+	for(k = r->ins_cnt - (UINT32)rest; k < r->ins_cnt; k++){
+		for(g = r->ins_group_start[k]; g < r->ins_group_start[k+1]; g++){
+			s->group_counts[r->ins_groups[g]] += sign;
+		}
+	}
+}
 
-VOID itypes_instr_interval_output(){
+/* counter functions */
+VOID itypes_instr_interval_output(mica_thread* t){
 	int i;
-	output_file_itypes.open(mkfilename("itypes_phases_int"), ios::out|ios::app);
+	ofstream output_file_itypes;
+	itypes_run_move(t, -1);
+	output_file_itypes.open(mkfilename_thread("itypes_phases_int", t->tid), ios::out|ios::app);
 	output_file_itypes << interval_size;
 	for(i=0; i < number_of_groups+1; i++){
-		output_file_itypes << " " << group_counts[i];
+		output_file_itypes << " " << t->itypes->group_counts[i];
 	}
 	output_file_itypes << endl;
 	output_file_itypes.close();
+	itypes_run_move(t, 1);
 }
 
-VOID itypes_instr_interval_reset(){
+VOID itypes_instr_interval_reset(mica_thread* t){
 	int i;
 	for(i=0; i < number_of_groups+1; i++){
-		group_counts[i] = 0;
+		t->itypes->group_counts[i] = 0;
 	}
+	itypes_run_move(t, 1);
 }
 
-VOID itypes_instr_interval(){
+/* count the groups of a run of instructions, once per execution of the run (after the run itself was counted) */
+static VOID itypes_count_run(mica_thread* t, itypes_run* r){
+	itypes_state* s = t->itypes;
+	UINT32 i;
 
-	itypes_instr_interval_output();
-	itypes_instr_interval_reset();
-	interval_ins_count = 0;
-	interval_ins_count_for_hpc_alignment = 0;
+	for(i = 0; i < r->cnt; i++){
+		s->group_counts[r->groups[i]] += r->counts[i];
+	}
+	s->run = r;
+	s->run_end = t->total_ins_count;
 }
 
-VOID itypes_count(UINT32 gid){
-	group_counts[gid]++;
-};
-
 // initialize default groups
 VOID init_itypes_default_groups(){
 
@@ -75,10 +120,6 @@ VOID init_itypes_default_groups(){
 
 	group_identifiers = (identifier**)checked_malloc((number_of_groups+1)*sizeof(identifier*));
 	group_ids_cnt = (INT64*)checked_malloc((number_of_groups+1)*sizeof(INT64));
-	group_counts = (INT64*)checked_malloc((number_of_groups+1)*sizeof(INT64));
-	for(int i=0; i < number_of_groups+1; i++){
-		group_counts[i] = 0;
-	}
 
 	// memory reads
 	group_ids_cnt[0] = 1;
@@ -217,9 +258,8 @@ VOID init_itypes(){
 
 			group_identifiers = (identifier**)checked_malloc((number_of_groups+1)*sizeof(identifier*));
 			group_ids_cnt = (INT64*)checked_malloc((number_of_groups+1)*sizeof(INT64));
-			group_counts = (INT64*)checked_malloc((number_of_groups+1)*sizeof(INT64));
 			for(i=0; i < number_of_groups+1; i++){
-				group_counts[i] = 0;
+				group_ids_cnt[i] = 0;
 			}
 
 			// count number of subgroups per group
@@ -306,18 +346,49 @@ VOID init_itypes(){
 	other_ids_max_cnt = 2;
 	other_group_identifiers = (identifier*)checked_malloc(other_ids_max_cnt*sizeof(identifier));
 
+	// an instruction is counted at most once per group, except for reg_transfer identifiers (which don't end the group)
+	itypes_max_ins_groups = 1;
+	for(i=0; i < number_of_groups; i++){
+		itypes_max_ins_groups += group_ids_cnt[i];
+	}
+
+	ins_index_init(&itypes_run_index);
+	itypes_run_cnt = 0;
+	itypes_run_max_cnt = 1024;
+	itypes_runs = (itypes_run**)checked_malloc(itypes_run_max_cnt*sizeof(itypes_run*));
+
 	// (initializing total instruction counts is done in mica.cpp)
 
+	interval_register(itypes_instr_interval_output, itypes_instr_interval_reset);
+}
+
+VOID init_itypes_thread(mica_thread* t){
+
+	int i;
+
+	t->itypes = (itypes_state*)checked_aligned_malloc(sizeof(itypes_state));
+	t->itypes->group_counts = (INT64*)checked_malloc((number_of_groups+1)*sizeof(INT64));
+	for(i=0; i < number_of_groups+1; i++){
+		t->itypes->group_counts[i] = 0;
+	}
+	t->itypes->run = NULL;
+	t->itypes->run_end = 0;
+
 	if(interval_size != -1){
-		output_file_itypes.open(mkfilename("itypes_phases_int"), ios::out|ios::trunc);
+		ofstream output_file_itypes;
+		output_file_itypes.open(mkfilename_thread("itypes_phases_int", t->tid), ios::out|ios::trunc);
 		output_file_itypes.close();
 	}
 }
 
 /* instrumenting (instruction level) */
-VOID instrument_itypes(INS ins, VOID* v){
+
+// classify an instruction: store the groups it is counted in (at most itypes_max_ins_groups) in gids,
+// and return their number; register move instructions are only counted if reg_transfer is set
+static UINT32 itypes_ins_groups(INS ins, UINT32* gids, BOOL reg_transfer){
 
 	int i,j;
+	UINT32 cnt = 0;
 	char cat[50];
 	char opcode[50];
 	strcpy(cat,CATEGORY_StringShort(INS_Category(ins)).c_str());
@@ -331,7 +402,7 @@ VOID instrument_itypes(INS ins, VOID* v){
 		for(j=0; j < group_ids_cnt[i]; j++){
 			if(group_identifiers[i][j].type == identifier_type::ID_TYPE_CATEGORY){
 				if(strcmp(group_identifiers[i][j].str, cat) == 0){
-					INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)itypes_count, IARG_UINT32, i, IARG_END);
+					gids[cnt++] = i;
 					categorized = true;
 					break;
 				}
@@ -339,7 +410,7 @@ VOID instrument_itypes(INS ins, VOID* v){
 			else{
 				if(group_identifiers[i][j].type == identifier_type::ID_TYPE_OPCODE){
 					if(strcmp(group_identifiers[i][j].str, opcode) == 0){
-						INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)itypes_count, IARG_UINT32, i, IARG_END);
+						gids[cnt++] = i;
 						categorized = true;
 						break;
 					}
@@ -347,27 +418,27 @@ VOID instrument_itypes(INS ins, VOID* v){
 				else{
 					if(group_identifiers[i][j].type == identifier_type::ID_TYPE_SPECIAL){
 						if(strcmp(group_identifiers[i][j].str, "mem_read") == 0 && INS_IsMemoryRead(ins) ){
-							INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)itypes_count, IARG_UINT32, i, IARG_END);
+							gids[cnt++] = i;
 							categorized = true;
 							break;
 						}
 						else{
 							if(strcmp(group_identifiers[i][j].str, "mem_write") == 0 && INS_IsMemoryWrite(ins) ){
-								INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)itypes_count, IARG_UINT32, i, IARG_END);
+								gids[cnt++] = i;
 								categorized = true;
 								break;
 							}
-							else if(strcmp(group_identifiers[i][j].str, "reg_transfer") == 0 && INS_IsMov(ins) ){
+							else if(reg_transfer && strcmp(group_identifiers[i][j].str, "reg_transfer") == 0 && INS_IsMov(ins) ){
 								UINT32 flag=0,n;
 								n=INS_OperandCount(ins);
-								for(UINT32 i=0;i<n;i++){
-								    if(!INS_OperandIsReg(ins,i)){
+								for(UINT32 k=0;k<n;k++){
+								    if(!INS_OperandIsReg(ins,k)){
 										flag=1;
 										break;
 								    }
 								}
 								if(flag==0)
-								    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)itypes_count, IARG_UINT32, i, IARG_END);
+								    gids[cnt++] = i;
 							}
 							else{
 							}
@@ -383,7 +454,7 @@ VOID instrument_itypes(INS ins, VOID* v){
 
 	// count instruction that don't fit in any of the specified categories in the last group
 	if( !categorized ){
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)itypes_count, IARG_UINT32, (unsigned int)number_of_groups, IARG_END);
+		gids[cnt++] = (UINT32)number_of_groups;
 
 		// check whether this category is already known in the 'other' group
 		for(i=0; i < other_ids_cnt; i++){
@@ -405,37 +476,156 @@ VOID instrument_itypes(INS ins, VOID* v){
 		}
 	}
 
-	/* inserting calls for counting instructions is done in mica.cpp */
-	if(interval_size != -1){
-		INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)itypes_instr_intervals,IARG_END);
-		/* only called if interval is 'full' */
-		INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)itypes_instr_interval,IARG_END);
+	return cnt;
+}
+
+// classify the n instructions of the run starting at ins
+static itypes_run* itypes_new_run(INS ins, UINT32 n, BOOL reg_transfer){
+
+	UINT32 i, k, total;
+	UINT32* group_cnts = (UINT32*)checked_malloc((number_of_groups+1)*sizeof(UINT32));
+	itypes_run* r = (itypes_run*)checked_malloc(sizeof(itypes_run));
+
+	r->ins_cnt = n;
+	r->next = NULL;
+	r->ins_group_start = (UINT32*)checked_malloc((n+1)*sizeof(UINT32));
+	r->ins_groups = (UINT32*)checked_malloc(n*itypes_max_ins_groups*sizeof(UINT32));
+
+	total = 0;
+	for(k = 0; k < n; k++){
+		r->ins_group_start[k] = total;
+		total += itypes_ins_groups(ins, r->ins_groups + total, reg_transfer);
+		ins = INS_Next(ins);
+	}
+	r->ins_group_start[n] = total;
+	r->ins_groups = (UINT32*)checked_realloc(r->ins_groups, (total > 0 ? total : 1)*sizeof(UINT32));
+
+	// aggregate the groups of the whole run
+	for(i = 0; i < number_of_groups+1; i++){
+		group_cnts[i] = 0;
+	}
+	for(i = 0; i < total; i++){
+		group_cnts[r->ins_groups[i]]++;
+	}
+	r->cnt = 0;
+	for(i = 0; i < number_of_groups+1; i++){
+		if(group_cnts[i] > 0)
+			r->cnt++;
+	}
+	r->groups = (UINT32*)checked_malloc((r->cnt > 0 ? r->cnt : 1)*sizeof(UINT32));
+	r->counts = (UINT32*)checked_malloc((r->cnt > 0 ? r->cnt : 1)*sizeof(UINT32));
+	k = 0;
+	for(i = 0; i < number_of_groups+1; i++){
+		if(group_cnts[i] > 0){
+			r->groups[k] = i;
+			r->counts[k] = group_cnts[i];
+			k++;
+		}
+	}
+	free(group_cnts);
+
+	return r;
+}
+
+/* group counts are increased with a single call per run of instructions, at its head (where ins_run > 0);
+ * the groups of each run are determined once, the same run may be instrumented again in other traces */
+VOID instrument_itypes_runs(INS ins, BOOL reg_transfer){
+
+	ADDRINT a = INS_Address(ins);
+	UINT32 id;
+	itypes_run* r;
+
+	if(ins_run == 0)
+		return;
+
+	id = ins_index_lookup(&itypes_run_index, a);
+	if(id == 0){
+		r = itypes_new_run(ins, ins_run, reg_transfer);
+		if(itypes_run_cnt == itypes_run_max_cnt){
+			itypes_run_max_cnt *= 2;
+			itypes_runs = (itypes_run**)checked_realloc(itypes_runs, itypes_run_max_cnt*sizeof(itypes_run*));
+		}
+		itypes_runs[itypes_run_cnt++] = r;
+		ins_index_insert(&itypes_run_index, a, itypes_run_cnt);
 	}
+	else{
+		for(r = itypes_runs[id-1]; r->ins_cnt != ins_run && r->next != NULL; r = r->next);
+		if(r->ins_cnt != ins_run){
+			r->next = itypes_new_run(ins, ins_run, reg_transfer);
+			r = r->next;
+		}
+	}
+
+	mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, itypes_count_run, IARG_REG_VALUE, mica_thread_reg, IARG_PTR, (VOID*)r, IARG_END);
+}
+
+VOID instrument_itypes(INS ins, VOID* v){
+
+	instrument_itypes_runs(ins, true);
+
+	/* inserting calls for counting instructions and checking interval boundaries is done in mica.cpp */
+}
+
+/* full execution output: instruction counts and group counts (excluding the 'other' group) */
+static VOID itypes_output_full(const char* filename, INT64 ins_count_for_hpc_alignment, INT64 ins_count, INT64* group_counts){
+	int i;
+	ofstream output_file_itypes;
+
+	output_file_itypes.open(filename, ios::out|ios::trunc);
+	output_file_itypes << ins_count_for_hpc_alignment << " " << ins_count;
+	for(i=0; i < number_of_groups; i++){
+		output_file_itypes << " " << group_counts[i];
+	}
+	output_file_itypes << endl;
+	//output_file_itypes << "number of instructions: " << total_ins_count_for_hpc_alignment << endl;
+	output_file_itypes << " ";
+	output_file_itypes.close();
 }
 
 /* finishing... */
 VOID fini_itypes(INT32 code, VOID* v){
 	int i;
+	UINT32 k;
+	mica_thread* t;
 
 	if(interval_size == -1){
-		output_file_itypes.open(mkfilename("itypes_full_int"), ios::out|ios::trunc);
-		output_file_itypes << total_ins_count_for_hpc_alignment << " " << total_ins_count;
-		for(i=0; i < number_of_groups; i++){
-			output_file_itypes << " " << group_counts[i];
+		INT64 merged_ins_count_for_hpc_alignment = 0;
+		INT64 merged_ins_count = 0;
+		INT64* merged_group_counts = (INT64*)checked_malloc((number_of_groups+1)*sizeof(INT64));
+		for(i=0; i < number_of_groups+1; i++){
+			merged_group_counts[i] = 0;
 		}
-		output_file_itypes << endl;
+
+		for(k=0; k < mica_thread_cnt; k++){
+			t = mica_threads[k];
+			itypes_output_full(mkfilename_thread("itypes_full_int", t->tid), t->total_ins_count_for_hpc_alignment, t->total_ins_count, t->itypes->group_counts);
+
+			merged_ins_count_for_hpc_alignment += t->total_ins_count_for_hpc_alignment;
+			merged_ins_count += t->total_ins_count;
+			for(i=0; i < number_of_groups+1; i++){
+				merged_group_counts[i] += t->itypes->group_counts[i];
+			}
+		}
+		if(mica_thread_cnt > 1){
+			itypes_output_full(mkfilename("itypes_full_int_merged"), merged_ins_count_for_hpc_alignment, merged_ins_count, merged_group_counts);
+		}
+		free(merged_group_counts);
 	}
 	else{
-		output_file_itypes.open(mkfilename("itypes_phases_int"), ios::out|ios::app);
-		output_file_itypes << interval_ins_count;
-		for(i=0; i < number_of_groups+1; i++){
-			output_file_itypes << " " << group_counts[i];
+		for(k=0; k < mica_thread_cnt; k++){
+			t = mica_threads[k];
+
+			ofstream output_file_itypes;
+			output_file_itypes.open(mkfilename_thread("itypes_phases_int", t->tid), ios::out|ios::app);
+			output_file_itypes << t->interval_ins_count;
+			for(i=0; i < number_of_groups+1; i++){
+				output_file_itypes << " " << t->itypes->group_counts[i];
+			}
+			output_file_itypes << endl;
+			output_file_itypes << " ";
+			output_file_itypes.close();
 		}
-		output_file_itypes << endl;
 	}
-	//output_file_itypes << "number of instructions: " << total_ins_count_for_hpc_alignment << endl;
-	output_file_itypes << " ";
-	output_file_itypes.close();
 
 	// print instruction categories in 'other' group of instructions
 	ofstream output_file_other_group_categories;
@@ -8,6 +8,7 @@
  */
 
 #include "mica.h"
+#include "mica_utils.h"
 
 #ifndef MICA_ITYPES_H
 #define MICA_ITYPES_H
@@ -21,16 +22,16 @@ typedef struct identifier_type{
 } identifier;
 
 VOID init_itypes();
+VOID init_itypes_thread(mica_thread* t);
 VOID init_itypes_default_groups();
 
 VOID instrument_itypes(INS ins, VOID* v);
+VOID instrument_itypes_runs(INS ins, BOOL reg_transfer);
 VOID instrument_itypes_bbl(TRACE trace, VOID* v);
 VOID fini_itypes(INT32 code, VOID* v);
 
 
-VOID itypes_count(UINT32 gid);
-
-VOID itypes_instr_interval_output();
-VOID itypes_instr_interval_reset();
+VOID itypes_instr_interval_output(mica_thread* t);
+VOID itypes_instr_interval_reset(mica_thread* t);
 
 #endif
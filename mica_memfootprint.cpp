@@ -16,10 +16,6 @@
 /* Global variables */
 
 extern INT64 interval_size;
-extern INT64 interval_ins_count;
-extern INT64 interval_ins_count_for_hpc_alignment;
-extern INT64 total_ins_count;
-extern INT64 total_ins_count_for_hpc_alignment;
 
 extern UINT32 _block_size;
 extern UINT32 _page_size;
@@ -27,143 +23,173 @@ extern UINT32 _page_size;
 static UINT32 memfootprint_block_size;
 static UINT32 page_size;
 
-static ofstream output_file_memfootprint;
+/* chunk of the footprint covering MAX_MEM_BLOCK consecutive blocks, one bit per referenced block */
+typedef struct footprint_chunk_type {
+	UINT64 referenced[MAX_MEM_BLOCK / 64];
+} footprint_chunk;
+
+/* working set table: chunks by upper address bits and the number of bits set (working set size) */
+typedef struct footprint_table_type {
+	addr_map chunks;
+	long long wss;
+} footprint_table;
+
+/* per-thread state, the chunks of the (D-stream) cache block table are in the line directory */
+typedef struct memfootprint_state_type {
+	addr_map* lines;
+	footprint_table DmemCacheWorkingSetTable;
+	footprint_table DmemPageWorkingSetTable;
+	footprint_table ImemCacheWorkingSetTable;
+	footprint_table ImemPageWorkingSetTable;
+} memfootprint_state;
+
+
+static inline footprint_chunk* footprint_lookup(footprint_table* table, ADDRINT key){
+	return (footprint_chunk*)addr_map_lookup(&table->chunks, key);
+}
 
-static nlist* DmemCacheWorkingSetTable[MAX_MEM_TABLE_ENTRIES];
-static nlist* DmemPageWorkingSetTable[MAX_MEM_TABLE_ENTRIES];
-static nlist* ImemCacheWorkingSetTable[MAX_MEM_TABLE_ENTRIES];
-static nlist* ImemPageWorkingSetTable[MAX_MEM_TABLE_ENTRIES];
+static footprint_chunk* footprint_alloc(){
 
+	footprint_chunk* c = (footprint_chunk*)checked_malloc(sizeof(footprint_chunk));
 
-static long long DmemCacheWSS() {
-	long long DmemCacheWorkingSetSize = 0L;
-	for (int i = 0; i < MAX_MEM_TABLE_ENTRIES; i++) {
-		for (nlist *np = DmemCacheWorkingSetTable [i]; np != (nlist*) NULL; np = np->next) {
-			for (ADDRINT j = 0; j < MAX_MEM_BLOCK; j++) {
-				if ((np->mem)->numReferenced [j]) {
-					DmemCacheWorkingSetSize++;
-				}
-			}
-		}
-	}
-	return DmemCacheWorkingSetSize;
+	memset(c->referenced, 0, sizeof(c->referenced));
+
+	return c;
 }
 
-static long long ImemCacheWSS() {
-	long long ImemCacheWorkingSetSize = 0L;
-	for (int i = 0; i < MAX_MEM_TABLE_ENTRIES; i++) {
-		for (nlist *np = ImemCacheWorkingSetTable [i]; np != (nlist*) NULL; np = np->next) {
-			for (ADDRINT j = 0; j < MAX_MEM_BLOCK; j++) {
-				if ((np->mem)->numReferenced [j]) {
-					ImemCacheWorkingSetSize++;
-				}
-			}
-		}
-	}
-	return ImemCacheWorkingSetSize;
+static footprint_chunk* footprint_install(footprint_table* table, ADDRINT key){
+
+	footprint_chunk* c = footprint_alloc();
+
+	addr_map_insert(&table->chunks, key, c);
+
+	return c;
 }
 
-static long long DmemPageWSS() {
-	long long DmemPageWorkingSetSize = 0L;
-	for (int i = 0; i < MAX_MEM_TABLE_ENTRIES; i++) {
-		for (nlist *np = DmemPageWorkingSetTable [i]; np != (nlist*) NULL; np = np->next) {
-			for (ADDRINT j = 0; j < MAX_MEM_BLOCK; j++) {
-				if ((np->mem)->numReferenced [j]) {
-					DmemPageWorkingSetSize++;
-				}
-			}
-		}
+/* mark block a as referenced in chunk, the working set size only changes the first time */
+static inline VOID footprint_chunk_set(footprint_table* table, footprint_chunk* chunk, ADDRINT a){
+
+	ADDRINT indexInChunk = a & BITS_TO_MASK(LOG_MAX_MEM_BLOCK);
+	UINT64 bit = 1ULL << (indexInChunk & 63);
+
+	if(!(chunk->referenced[indexInChunk >> 6] & bit)){
+		chunk->referenced[indexInChunk >> 6] |= bit;
+		table->wss++;
 	}
-	return DmemPageWorkingSetSize;
 }
 
-static long long ImemPageWSS() {
-	long long ImemPageWorkingSetSize = 0L;
-	for (int i = 0; i < MAX_MEM_TABLE_ENTRIES; i++) {
-		for (nlist *np = ImemPageWorkingSetTable [i]; np != (nlist*) NULL; np = np->next) {
-			for (ADDRINT j = 0; j < MAX_MEM_BLOCK; j++) {
-				if ((np->mem)->numReferenced [j]) {
-					ImemPageWorkingSetSize++;
-				}
-			}
-		}
-	}
-	return ImemPageWorkingSetSize;
+/* mark block a as referenced */
+static inline VOID footprint_set(footprint_table* table, ADDRINT a){
+
+	ADDRINT upperAddr = a >> LOG_MAX_MEM_BLOCK;
+	footprint_chunk* chunk;
+
+	chunk = footprint_lookup(table, upperAddr);
+	if(chunk == (footprint_chunk*)NULL)
+		chunk = footprint_install(table, upperAddr);
+
+	footprint_chunk_set(table, chunk, a);
+}
+
+/* mark block a as referenced, its chunk is in directory chunk d */
+static inline VOID footprint_dir_set(footprint_table* table, line_dir_chunk* d, ADDRINT a){
+
+	if(d->client[LINE_DIR_MEMFOOTPRINT] == NULL)
+		d->client[LINE_DIR_MEMFOOTPRINT] = footprint_alloc();
+
+	footprint_chunk_set(table, (footprint_chunk*)d->client[LINE_DIR_MEMFOOTPRINT], a);
+}
+
+static VOID footprint_clear(footprint_table* table){
+	addr_map_clear(&table->chunks);
+	table->wss = 0;
+}
+
+/* number of blocks referenced in a working set table */
+static inline long long WSS(footprint_table* table) {
+	return table->wss;
+}
+
+static VOID memfootprint_output(ofstream& output_file_memfootprint, memfootprint_state* m){
+
+	long long DmemCacheWorkingSetSize = WSS(&m->DmemCacheWorkingSetTable);
+	long long DmemPageWorkingSetSize = WSS(&m->DmemPageWorkingSetTable);
+	long long ImemCacheWorkingSetSize = WSS(&m->ImemCacheWorkingSetTable);
+	long long ImemPageWorkingSetSize = WSS(&m->ImemPageWorkingSetTable);
+
+	output_file_memfootprint << DmemCacheWorkingSetSize << " " << DmemPageWorkingSetSize << " " << ImemCacheWorkingSetSize << " " << ImemPageWorkingSetSize << endl;
+}
+
+static VOID init_footprint_table(footprint_table* table){
+	addr_map_init(&table->chunks);
+	table->wss = 0;
+}
+
+static VOID init_memfootprint_tables(memfootprint_state* m){
+	init_footprint_table(&m->DmemCacheWorkingSetTable);
+	init_footprint_table(&m->DmemPageWorkingSetTable);
+	init_footprint_table(&m->ImemCacheWorkingSetTable);
+	init_footprint_table(&m->ImemPageWorkingSetTable);
 }
 
 /* initializing */
 void init_memfootprint(){
-	int i;
-
-	for (i = 0; i < MAX_MEM_TABLE_ENTRIES; i++) {
-		DmemCacheWorkingSetTable[i] = (nlist*) NULL;
-		DmemPageWorkingSetTable[i] = (nlist*) NULL;
-		ImemCacheWorkingSetTable[i] = (nlist*) NULL;
-		ImemPageWorkingSetTable[i] = (nlist*) NULL;
-	}
 
 	memfootprint_block_size = _block_size;
 	page_size = _page_size;
 
+	interval_register(memfootprint_instr_interval_output, memfootprint_instr_interval_reset);
+}
+
+VOID init_memfootprint_thread(mica_thread* t){
+
+	t->memfootprint = (memfootprint_state*) checked_aligned_malloc(sizeof(memfootprint_state));
+	init_memfootprint_tables(t->memfootprint);
+	t->memfootprint->lines = line_dir_of(t);
+
 	if(interval_size != -1){
-		output_file_memfootprint.open(mkfilename("memfootprint_phases_int"), ios::out|ios::trunc);
+		ofstream output_file_memfootprint;
+		output_file_memfootprint.open(mkfilename_thread("memfootprint_phases_int", t->tid), ios::out|ios::trunc);
 		output_file_memfootprint.close();
 	}
 }
 
-VOID memOp(ADDRINT effMemAddr, ADDRINT size){
-	if(size > 0){
+VOID memOp_lines(mica_thread* t, const mem_lines* l){
+	if(l->size > 0){
+		memfootprint_state* m = t->memfootprint;
 		ADDRINT a;
-		ADDRINT addr, endAddr, upperAddr, indexInChunk;
-		memNode* chunk;
+		ADDRINT addr, endAddr;
 
 		/* D-stream (64-byte) cache block memory footprint */
 
-		addr = effMemAddr >> memfootprint_block_size;
-		endAddr = (effMemAddr + size - 1) >> memfootprint_block_size;
-
-		for(a = addr; a <= endAddr; a++){
-
-			upperAddr = a >> LOG_MAX_MEM_BLOCK;
-			indexInChunk = a ^ (upperAddr << LOG_MAX_MEM_BLOCK);
-
-			chunk = lookup(DmemCacheWorkingSetTable, upperAddr);
-			if(chunk == (memNode*)NULL)
-				chunk = install(DmemCacheWorkingSetTable, upperAddr);
-
-			//assert(indexInChunk >= 0 && indexInChunk < MAX_MEM_BLOCK);
-			chunk->numReferenced[indexInChunk] = true;
-
+		for(a = l->first; a <= l->last; a++){
+			footprint_dir_set(&m->DmemCacheWorkingSetTable, mem_lines_chunk(m->lines, l, a), a);
 		}
 
 		/* D-stream (4KB) page block memory footprint */
-	
-		addr = effMemAddr >> page_size;
-		endAddr = (effMemAddr + size - 1) >> page_size;
 
-		for(a = addr; a <= endAddr; a++){
-
-			upperAddr = a >> LOG_MAX_MEM_BLOCK;
-			indexInChunk = a ^ (upperAddr << LOG_MAX_MEM_BLOCK);
-
-			chunk = lookup(DmemPageWorkingSetTable, upperAddr);
-			if(chunk == (memNode*)NULL)
-				chunk = install(DmemPageWorkingSetTable, upperAddr);
-
-			//assert(indexInChunk >= 0 && indexInChunk < MAX_MEM_BLOCK);
-			chunk->numReferenced[indexInChunk] = true;
+		addr = l->ea >> page_size;
+		endAddr = (l->ea + l->size - 1) >> page_size;
 
+		for(a = addr; a <= endAddr; a++){
+			footprint_set(&m->DmemPageWorkingSetTable, a);
 		}
 	}
 }
 
-VOID instrMem(ADDRINT instrAddr, ADDRINT size){
+VOID memOp(mica_thread* t, ADDRINT effMemAddr, ADDRINT size){
+	mem_lines l;
+
+	mem_lines_resolve(t->memfootprint->lines, &l, effMemAddr, size);
+	memOp_lines(t, &l);
+}
+
+VOID instrMem(mica_thread* t, ADDRINT instrAddr, ADDRINT size){
 
 	if(size > 0){
+		memfootprint_state* m = t->memfootprint;
 		ADDRINT a;
-		ADDRINT addr, endAddr, upperAddr, indexInChunk;
-		memNode* chunk;
-
+		ADDRINT addr, endAddr;
 
 		/* I-stream (64-byte) cache block memory footprint */
 
@@ -171,17 +197,7 @@ VOID instrMem(ADDRINT instrAddr, ADDRINT size){
 		endAddr = (instrAddr + size - 1) >> memfootprint_block_size;
 
 		for(a = addr; a <= endAddr; a++){
-
-			upperAddr = a >> LOG_MAX_MEM_BLOCK;
-			indexInChunk = a ^ (upperAddr << LOG_MAX_MEM_BLOCK);
-
-			chunk = lookup(ImemCacheWorkingSetTable, upperAddr);
-			if(chunk == (memNode*)NULL)
-				chunk = install(ImemCacheWorkingSetTable, upperAddr);
-
-			//assert(indexInChunk >= 0 && indexInChunk < MAX_MEM_BLOCK);
-			chunk->numReferenced[indexInChunk] = true;
-
+			footprint_set(&m->ImemCacheWorkingSetTable, a);
 		}
 
 		/* I-stream (4KB) page block memory footprint */
@@ -190,64 +206,38 @@ VOID instrMem(ADDRINT instrAddr, ADDRINT size){
 		endAddr = (instrAddr + size - 1) >> page_size;
 
 		for(a = addr; a <= endAddr; a++){
-
-			upperAddr = a >> LOG_MAX_MEM_BLOCK;
-			indexInChunk = a ^ (upperAddr << LOG_MAX_MEM_BLOCK);
-
-			chunk = lookup(ImemPageWorkingSetTable, upperAddr);
-			if(chunk == (memNode*)NULL)
-				chunk = install(ImemPageWorkingSetTable, upperAddr);
-
-			//assert(indexInChunk >= 0 && indexInChunk < MAX_MEM_BLOCK);
-			chunk->numReferenced[indexInChunk] = true;
+			footprint_set(&m->ImemPageWorkingSetTable, a);
 		}
 	}
 }
 
-static VOID memfootprint_instr_full(ADDRINT instrAddr, ADDRINT size){
-
-	/* counting instructions is done in all_instr_full() */
-
-	instrMem(instrAddr, size);
+VOID memOp_tid(THREADID tid, ADDRINT effMemAddr, ADDRINT size){
+	memOp(get_mica_thread(tid), effMemAddr, size);
 }
 
-static ADDRINT memfootprint_instr_intervals(ADDRINT instrAddr, ADDRINT size){
+static VOID memfootprint_instr_full(THREADID tid, ADDRINT instrAddr, ADDRINT size){
 
-	/* counting instructions is done in all_instr_intervals() */
+	/* counting instructions is done in all_instr_full() */
 
-	instrMem(instrAddr, size);
-	return (ADDRINT)(interval_ins_count_for_hpc_alignment == interval_size);
+	instrMem(get_mica_thread(tid), instrAddr, size);
 }
 
-VOID memfootprint_instr_interval_output(){
-
-	output_file_memfootprint.open(mkfilename("memfootprint_phases_int"), ios::out|ios::app);
+VOID memfootprint_instr_interval_output(mica_thread* t){
+	ofstream output_file_memfootprint;
 
-	long long DmemCacheWorkingSetSize = DmemCacheWSS();
-	long long DmemPageWorkingSetSize = DmemPageWSS();
-	long long ImemCacheWorkingSetSize = ImemCacheWSS();
-	long long ImemPageWorkingSetSize = ImemPageWSS();
-
-	output_file_memfootprint << DmemCacheWorkingSetSize << " " << DmemPageWorkingSetSize << " " << ImemCacheWorkingSetSize << " " << ImemPageWorkingSetSize << endl;
+	output_file_memfootprint.open(mkfilename_thread("memfootprint_phases_int", t->tid), ios::out|ios::app);
+	memfootprint_output(output_file_memfootprint, t->memfootprint);
 	output_file_memfootprint.close();
 }
 
-VOID memfootprint_instr_interval_reset(){
+VOID memfootprint_instr_interval_reset(mica_thread* t){
+	memfootprint_state* m = t->memfootprint;
 	/* clean used memory, to avoid memory shortage for long (CPU2006) benchmarks */
-	for(ADDRINT i=0; i < MAX_MEM_TABLE_ENTRIES; i++){
-		free_nlist(DmemCacheWorkingSetTable[i]);
-		free_nlist(DmemPageWorkingSetTable[i]);
-		free_nlist(ImemCacheWorkingSetTable[i]);
-		free_nlist(ImemPageWorkingSetTable[i]);
-	}
-}
-
-static VOID memfootprint_instr_interval(){
-
-	memfootprint_instr_interval_output();
-	memfootprint_instr_interval_reset();
-	interval_ins_count = 0;
-	interval_ins_count_for_hpc_alignment = 0;
+	line_dir_clear(m->lines, LINE_DIR_MEMFOOTPRINT);
+	footprint_clear(&m->DmemCacheWorkingSetTable);
+	footprint_clear(&m->DmemPageWorkingSetTable);
+	footprint_clear(&m->ImemCacheWorkingSetTable);
+	footprint_clear(&m->ImemPageWorkingSetTable);
 }
 
 /* instrumenting (instruction level) */
@@ -255,44 +245,92 @@ VOID instrument_memfootprint(INS ins, VOID* v){
 
 	if(INS_IsMemoryRead(ins)){
 
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)memOp, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_END);
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, memOp_tid, IARG_THREAD_ID, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_END);
 
 		if(INS_HasMemoryRead2(ins)){
 
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)memOp, IARG_MEMORYREAD2_EA, IARG_MEMORYREAD_SIZE, IARG_END);
+			mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, memOp_tid, IARG_THREAD_ID, IARG_MEMORYREAD2_EA, IARG_MEMORYREAD_SIZE, IARG_END);
 		}
 	}
 	if(INS_IsMemoryWrite(ins)){
 
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)memOp, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_END);
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, memOp_tid, IARG_THREAD_ID, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_END);
+	}
+
+	/* interval boundaries are checked in mica.cpp */
+	mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, memfootprint_instr_full, IARG_THREAD_ID, IARG_ADDRINT, INS_Address(ins), IARG_ADDRINT, (ADDRINT)INS_Size(ins), IARG_END);
+}
+
+
+/* add all blocks referenced in chunk c (with upper address bits key) to table 'to' */
+static VOID merge_chunk(footprint_table* to, ADDRINT key, footprint_chunk* c){
+	footprint_chunk* chunk;
+	UINT64 added;
+
+	chunk = footprint_lookup(to, key);
+	if(chunk == (footprint_chunk*)NULL)
+		chunk = footprint_install(to, key);
+	for (ADDRINT j = 0; j < MAX_MEM_BLOCK / 64; j++) {
+		added = c->referenced[j] & ~chunk->referenced[j];
+		chunk->referenced[j] |= added;
+		to->wss += __builtin_popcountll(added);
 	}
+}
 
-	if(interval_size == -1)
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)memfootprint_instr_full, IARG_ADDRINT, INS_Address(ins), IARG_ADDRINT, (ADDRINT)INS_Size(ins), IARG_END);
-	else{
-		INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)memfootprint_instr_intervals, IARG_ADDRINT, INS_Address(ins), IARG_ADDRINT, (ADDRINT)INS_Size(ins), IARG_END);
-		INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)memfootprint_instr_interval, IARG_END);
+/* add all blocks referenced in table 'from' to table 'to' */
+static VOID merge_working_set(footprint_table* to, footprint_table* from){
+	for (UINT32 i = 0; i <= from->chunks.mask; i++) {
+		if(from->chunks.slots[i].chunk != NULL)
+			merge_chunk(to, from->chunks.slots[i].key, (footprint_chunk*)from->chunks.slots[i].chunk);
 	}
 }
 
+/* add all blocks referenced in the chunks of line directory 'lines' to table 'to' */
+static VOID merge_dir_working_set(footprint_table* to, addr_map* lines){
+	line_dir_chunk* d;
+
+	for (UINT32 i = 0; i <= lines->mask; i++) {
+		d = (line_dir_chunk*)lines->slots[i].chunk;
+		if(d != NULL && d->client[LINE_DIR_MEMFOOTPRINT] != NULL)
+			merge_chunk(to, lines->slots[i].key, (footprint_chunk*)d->client[LINE_DIR_MEMFOOTPRINT]);
+	}
+}
 
 /* finishing... */
 VOID fini_memfootprint(INT32 code, VOID* v){
 
-	long long DmemCacheWorkingSetSize = DmemCacheWSS();
-	long long DmemPageWorkingSetSize = DmemPageWSS();
-	long long ImemCacheWorkingSetSize = ImemCacheWSS();
-	long long ImemPageWorkingSetSize = ImemPageWSS();
+	UINT32 k;
+	mica_thread* t;
+	ofstream output_file_memfootprint;
 
-	if(interval_size == -1){
-		output_file_memfootprint.open(mkfilename("memfootprint_full_int"), ios::out|ios::trunc);
-	}
-	else{
-		output_file_memfootprint.open(mkfilename("memfootprint_phases_int"), ios::out|ios::app);
+	for(k=0; k < mica_thread_cnt; k++){
+		t = mica_threads[k];
+		if(interval_size == -1){
+			output_file_memfootprint.open(mkfilename_thread("memfootprint_full_int", t->tid), ios::out|ios::trunc);
+		}
+		else{
+			output_file_memfootprint.open(mkfilename_thread("memfootprint_phases_int", t->tid), ios::out|ios::app);
+		}
+		memfootprint_output(output_file_memfootprint, t->memfootprint);
+		//output_file_memfootprint << "number of instructions: " << total_ins_count_for_hpc_alignment << endl;
+		output_file_memfootprint << " ";
+		output_file_memfootprint.close();
 	}
 
-	output_file_memfootprint << DmemCacheWorkingSetSize << " " << DmemPageWorkingSetSize << " " << ImemCacheWorkingSetSize << " " << ImemPageWorkingSetSize << endl;
-	//output_file_memfootprint << "number of instructions: " << total_ins_count_for_hpc_alignment << endl;
-	output_file_memfootprint << " ";
-	output_file_memfootprint.close();
+	if(interval_size == -1 && mica_thread_cnt > 1){
+		/* the footprint of the whole program is the union of the per-thread footprints */
+		memfootprint_state* merged = (memfootprint_state*) checked_malloc(sizeof(memfootprint_state));
+		init_memfootprint_tables(merged);
+		for(k=0; k < mica_thread_cnt; k++){
+			memfootprint_state* m = mica_threads[k]->memfootprint;
+			merge_dir_working_set(&merged->DmemCacheWorkingSetTable, m->lines);
+			merge_working_set(&merged->DmemPageWorkingSetTable, &m->DmemPageWorkingSetTable);
+			merge_working_set(&merged->ImemCacheWorkingSetTable, &m->ImemCacheWorkingSetTable);
+			merge_working_set(&merged->ImemPageWorkingSetTable, &m->ImemPageWorkingSetTable);
+		}
+		output_file_memfootprint.open(mkfilename("memfootprint_full_int_merged"), ios::out|ios::trunc);
+		memfootprint_output(output_file_memfootprint, merged);
+		output_file_memfootprint << " ";
+		output_file_memfootprint.close();
+	}
 }
@@ -8,13 +8,16 @@
  */
 
 #include "mica.h"
+#include "mica_utils.h"
 
 void init_memfootprint();
+VOID init_memfootprint_thread(mica_thread* t);
 VOID instrument_memfootprint(INS ins, VOID* v);
 VOID fini_memfootprint(INT32 code, VOID* v);
 
-VOID memOp(ADDRINT effMemAddr, ADDRINT size);
-VOID instrMem(ADDRINT instrAddr, ADDRINT size);
+VOID memOp(mica_thread* t, ADDRINT effMemAddr, ADDRINT size);
+VOID memOp_lines(mica_thread* t, const mem_lines* l);
+VOID instrMem(mica_thread* t, ADDRINT instrAddr, ADDRINT size);
 
-VOID memfootprint_instr_interval_output();
-VOID memfootprint_instr_interval_reset();
+VOID memfootprint_instr_interval_output(mica_thread* t);
+VOID memfootprint_instr_interval_reset(mica_thread* t);
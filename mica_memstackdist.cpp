@@ -16,16 +16,21 @@
 /* Global variables */
 
 extern INT64 interval_size;
-extern INT64 interval_ins_count;
-extern INT64 interval_ins_count_for_hpc_alignment;
-extern INT64 total_ins_count;
-extern INT64 total_ins_count_for_hpc_alignment;
 
 extern UINT32 _block_size;
-
-static UINT32 memstackdist_block_size;
-
-static ofstream output_file_memstackdist;
+extern UINT32 _memstackdist_block_sizes[MEMSTACKDIST_MAX_BLOCK_SIZE_CNT];
+extern UINT32 _memstackdist_block_size_cnt;
+extern MEMSTACKDIST_ENGINE _memstackdist_engine;
+extern MEMSTACKDIST_WRITES _memstackdist_writes;
+extern double _memstackdist_sampling;
+extern UINT64 _memstackdist_sampling_lines;
+
+static UINT32 memstackdist_block_sizes[MEMSTACKDIST_MAX_BLOCK_SIZE_CNT]; // granularities (log2 of the cache line size)
+static UINT32 memstackdist_block_size_cnt;
+static MEMSTACKDIST_ENGINE memstackdist_engine;
+static MEMSTACKDIST_WRITES memstackdist_writes;
+static double memstackdist_sampling; // initial sampling rate, 0 if every cache line is tracked
+static UINT64 memstackdist_sampling_lines; // maximum number of cache lines tracked when sampling
 
 /* A single entry of the cache line reference stack.
  * below points to the entry below us in the stack
@@ -40,58 +45,233 @@ typedef struct stack_entry_type {
 	INT32 bucket;
 } stack_entry;
 
-/* A single entry of the hash table, contains an array of stack entries referenced by part of cache line index. */
-typedef struct block_type_fast {
-	ADDRINT id;
-	stack_entry* stack_entries[MAX_MEM_ENTRIES];
-	struct block_type_fast* next;
-} block_fast;
+/* The state of a cache line (its stack entry for the LRU engine, its last access time for the tree engine,
+ * NULL/0 if it was never accessed) is found in two levels: the upper part of the cache line index selects
+ * a chunk of MAX_MEM_ENTRIES lines in an address map, which points to sub-chunks of SUB_CHUNK_ENTRIES lines
+ * (4KB of state). Sub-chunks are only allocated when one of their lines is accessed, so memory follows the
+ * cache lines touched rather than the (4MB) regions touched. */
+#define LOG_SUB_CHUNK_ENTRIES 9
+#define SUB_CHUNK_ENTRIES BITS_TO_COUNT(LOG_SUB_CHUNK_ENTRIES)
+#define MASK_SUB_CHUNK_ENTRIES BITS_TO_MASK(LOG_SUB_CHUNK_ENTRIES)
+
+typedef struct line_chunk_type {
+	VOID* sub_chunks[MAX_MEM_ENTRIES / SUB_CHUNK_ENTRIES]; // NULL if none of the lines was accessed
+} line_chunk;
+
+/* Stack entries, chunks and sub-chunks live as long as the thread (the stack and the set of
+ * lines only grow), so they are carved out of large blocks rather than allocated one by one. */
+#define POOL_BLOCK_SIZE (1 << 20)
+
+/* A cache line selected for sampling, chained in a hash table on cache line address.
+ * Sampled lines are spread over the whole address space, so they are not grouped per chunk. */
+typedef struct sample_entry_type {
+	ADDRINT block_addr;
+	UINT64 hash; // spatial hash of the cache line address, the line is sampled while hash < threshold
+	UINT64 last_access; // last access time in the tree, 0 if never accessed
+	struct sample_entry_type* next;
+} sample_entry;
+
+/* initial number of access times covered by the tree (power of two) */
+#define LOG_INIT_TREE_SIZE 20
+
+/* reuse distance histogram: number of memory references, cold references and references per bucket */
+typedef struct stackdist_hist_type {
+	INT64 mem_ref_cnt;
+	INT64 cold_refs;
+	INT64 buckets[BUCKET_CNT];
+	/* when sampling, the scaled counts (estimates), which are rounded to the counters above for output */
+	double sampled_cold_refs;
+	double sampled_buckets[BUCKET_CNT];
+} stackdist_hist;
+
+/* reuse distances at a single granularity (cache line size) */
+typedef struct stackdist_gran_type {
+	UINT32 block_size;
+
+	stack_entry* stack_top;
+	UINT64 stack_size;
+
+	addr_map stack_chunks; // stack entry of each cache line
+
+	/* References to stack entries that are the oldest entries belonging to the particular bucket.
+	 * This is used to update bucket attributes of stack entries efficiently. Since the last
+	 * bucket is overflow bucket, last borderline entry should never be set. */
+	stack_entry* borderline_stack_entries[BUCKET_CNT];
+
+	/* Order statistics tree engine (Bennett-Kruskal): every cache line is only marked at its last access time,
+	 * the reuse distance is the number of marks between the previous access and now, counted with a Fenwick tree.
+	 * Access times are compacted (renumbered in order) when the tree is full. */
+	addr_map time_chunks; // last access time of each cache line
+	UINT32* tree; // tree[i] counts the marks in (i - lowbit(i), i]
+	UINT64** time_slots; // for each marked access time, the hash table slot that holds it
+	UINT64 tree_size; // number of access times the tree can hold, time 0 is never used
+	UINT64 now; // current access time
+	UINT64 live_blocks; // number of marks (distinct cache lines referenced)
+
+	/* Sampling (SHARDS): only cache lines whose address hashes below a threshold are fed to the tree,
+	 * reuse distances and counts are scaled by the inverse of the sampling rate. When more than
+	 * memstackdist_sampling_lines lines are tracked, the threshold is lowered to the largest hash tracked
+	 * and the lines at or above it are dropped, so memory stays bounded and the rate only decreases. */
+	sample_entry** sample_table;
+	UINT64 sample_table_mask;
+	sample_entry** sample_heap; // max-heap on hash of all tracked lines
+	UINT64 sample_cnt;
+	UINT64 sample_threshold;
+	double sample_weight; // 1 / effective sampling rate
+
+	/* block the pool is allocating from */
+	char* pool_next;
+	UINT64 pool_left;
+
+	/* line directory of the thread holding the chunks of the cache lines (instead of stack_chunks or time_chunks),
+	 * for a single granularity of block_size bytes (NULL for the others) */
+	addr_map* lines;
+	LINE_DIR_CLIENT lines_client;
+} stackdist_gran;
+
+/* per-thread state: reuse distances for each granularity, measured in a single pass */
+typedef struct memstackdist_state_type {
+	stackdist_gran* gran[MEMSTACKDIST_MAX_BLOCK_SIZE_CNT];
+	stackdist_hist reads[MEMSTACKDIST_MAX_BLOCK_SIZE_CNT];
+	/* memory writes (memstackdist_writes) go to the stacks of the reads (merged) or to their
+	 * own stacks (separate), and are counted in their own histograms */
+	stackdist_gran* write_gran[MEMSTACKDIST_MAX_BLOCK_SIZE_CNT];
+	stackdist_hist writes[MEMSTACKDIST_MAX_BLOCK_SIZE_CNT];
+	addr_map* lines; // line directory, NULL if no granularity uses it
+} memstackdist_state;
 
-static stack_entry* stack_top;
-static UINT64 stack_size;
+/* initializing */
+void init_memstackdist(){
 
-static block_fast* hashTableCacheBlocks_fast[MAX_MEM_TABLE_ENTRIES];
-static INT64 mem_ref_cnt;
-static INT64 cold_refs;
+	UINT32 i;
 
-/* Counters of accesses into each bucket. */
-static INT64 buckets[BUCKET_CNT];
-/* References to stack entries that are the oldest entries belonging to the particular bucket.
- * This is used to update bucket attributes of stack entries efficiently. Since the last
- * bucket is overflow bucket, last borderline entry should never be set. */
-static stack_entry* borderline_stack_entries[BUCKET_CNT];
+	/* a single granularity, the block size, unless a list is given */
+	if(_memstackdist_block_size_cnt == 0){
+		memstackdist_block_sizes[0] = _block_size;
+		memstackdist_block_size_cnt = 1;
+	}
+	else{
+		for(i = 0; i < _memstackdist_block_size_cnt; i++)
+			memstackdist_block_sizes[i] = _memstackdist_block_sizes[i];
+		memstackdist_block_size_cnt = _memstackdist_block_size_cnt;
+	}
+	memstackdist_engine = _memstackdist_engine;
+	memstackdist_writes = _memstackdist_writes;
+	memstackdist_sampling = _memstackdist_sampling;
+	memstackdist_sampling_lines = _memstackdist_sampling_lines;
 
-/* initializing */
-void init_memstackdist(){
+	interval_register(memstackdist_instr_interval_output, memstackdist_instr_interval_reset);
+}
+
+static stackdist_gran* init_stackdist_gran(UINT32 block_size){
 
 	int i;
+	stackdist_gran* m = (stackdist_gran*) checked_aligned_malloc(sizeof(stackdist_gran));
 
 	/* initialize */
-	cold_refs = 0;
+	m->block_size = block_size;
+	for(i=0; i < BUCKET_CNT; i++){
+		m->borderline_stack_entries[i] = NULL;
+	}
+	m->pool_next = NULL;
+	m->pool_left = 0;
+	m->lines = NULL;
+	/* sampling is always done with the tree engine, lines can not be dropped from the middle of the LRU stack cheaply */
+	if(memstackdist_engine == MEMSTACKDIST_ENGINE_TREE || memstackdist_sampling > 0.0){
+		addr_map_init(&m->time_chunks);
+		m->tree_size = BITS_TO_COUNT(LOG_INIT_TREE_SIZE);
+		m->tree = (UINT32*) checked_malloc(m->tree_size * sizeof(UINT32));
+		memset(m->tree, 0, m->tree_size * sizeof(UINT32));
+		m->time_slots = (UINT64**) checked_malloc(m->tree_size * sizeof(UINT64*));
+		m->now = 1;
+		m->live_blocks = 0;
+		m->stack_top = NULL;
+	}
+	if(memstackdist_sampling > 0.0){
+		m->sample_table_mask = 1;
+		while(m->sample_table_mask < memstackdist_sampling_lines)
+			m->sample_table_mask *= 2;
+		m->sample_table = (sample_entry**) checked_malloc(m->sample_table_mask * sizeof(sample_entry*));
+		memset(m->sample_table, 0, m->sample_table_mask * sizeof(sample_entry*));
+		m->sample_table_mask--;
+		/* one extra entry, the heap is trimmed right after it overflows */
+		m->sample_heap = (sample_entry**) checked_malloc((memstackdist_sampling_lines + 1) * sizeof(sample_entry*));
+		m->sample_cnt = 0;
+		if(memstackdist_sampling >= 1.0)
+			m->sample_threshold = ~((UINT64)0);
+		else
+			m->sample_threshold = (UINT64)(memstackdist_sampling * 18446744073709551616.0); // rate * 2^64
+		m->sample_weight = 1.0 / memstackdist_sampling;
+	}
+	else{
+		/* access stack */
+		/* a dummy entry is inserted on the stack top to save some checks later */
+		/* since the dummy entry is not in the hash table, it should never be used */
+		addr_map_init(&m->stack_chunks);
+		m->stack_top = (stack_entry*) checked_malloc(sizeof(stack_entry));
+		m->stack_top->block_addr = 0;
+		m->stack_top->above = NULL;
+		m->stack_top->below = NULL;
+		m->stack_top->bucket = 0;
+		m->stack_size = 1;
+	}
+
+	return m;
+}
+
+static VOID stackdist_hist_reset(stackdist_hist* h){
+	int i;
+
+	h->mem_ref_cnt = 0;
+	h->cold_refs = 0;
+	for(i=0; i < BUCKET_CNT; i++){
+		h->buckets[i] = 0;
+	}
+	h->sampled_cold_refs = 0.0;
 	for(i=0; i < BUCKET_CNT; i++){
-		buckets[i] = 0;
-		borderline_stack_entries[i] = NULL;
-	}
-	mem_ref_cnt = 0;
-	/* hash table */
-	for (i = 0; i < MAX_MEM_TABLE_ENTRIES; i++) {
-		hashTableCacheBlocks_fast[i] = NULL;
-	}
-	/* access stack */
-	/* a dummy entry is inserted on the stack top to save some checks later */
-	/* since the dummy entry is not in the hash table, it should never be used */
-	stack_top = (stack_entry*) checked_malloc(sizeof(stack_entry));
-	stack_top->block_addr = 0;
-	stack_top->above = NULL;
-	stack_top->below = NULL;
-	stack_top->bucket = 0;
-	stack_size = 1;
-
-	memstackdist_block_size = _block_size;
+		h->sampled_buckets[i] = 0.0;
+	}
+}
+
+VOID init_memstackdist_thread(mica_thread* t){
+
+	UINT32 g;
+	memstackdist_state* m = (memstackdist_state*) checked_aligned_malloc(sizeof(memstackdist_state));
+
+	t->memstackdist = m;
+	m->lines = NULL;
+
+	for(g = 0; g < memstackdist_block_size_cnt; g++){
+		m->gran[g] = init_stackdist_gran(memstackdist_block_sizes[g]);
+		stackdist_hist_reset(&m->reads[g]);
+		switch(memstackdist_writes){
+			case MEMSTACKDIST_WRITES_MERGED: m->write_gran[g] = m->gran[g]; break;
+			case MEMSTACKDIST_WRITES_SEPARATE: m->write_gran[g] = init_stackdist_gran(memstackdist_block_sizes[g]); break;
+			default: m->write_gran[g] = NULL; break;
+		}
+		stackdist_hist_reset(&m->writes[g]);
+
+		/* the (first) granularity of block_size keeps its cache lines in the line directory, shared with memfootprint
+		 * (sampled lines are kept in the sample table) */
+		if(memstackdist_block_sizes[g] == _block_size && m->lines == NULL && memstackdist_sampling == 0.0){
+			m->lines = line_dir_of(t);
+			m->gran[g]->lines = m->lines;
+			m->gran[g]->lines_client = LINE_DIR_MEMSTACKDIST_READS;
+			if(memstackdist_writes == MEMSTACKDIST_WRITES_SEPARATE){
+				m->write_gran[g]->lines = m->lines;
+				m->write_gran[g]->lines_client = LINE_DIR_MEMSTACKDIST_WRITES;
+			}
+		}
+	}
 
 	if(interval_size != -1){
-		output_file_memstackdist.open(mkfilename("memstackdist_phases_int"), ios::out|ios::trunc);
+		ofstream output_file_memstackdist;
+		output_file_memstackdist.open(mkfilename_thread("memstackdist_phases_int", t->tid), ios::out|ios::trunc);
 		output_file_memstackdist.close();
+		if(memstackdist_sampling > 0.0){
+			output_file_memstackdist.open(mkfilename_thread("memstackdist_phases_int_rate", t->tid), ios::out|ios::trunc);
+			output_file_memstackdist.close();
+		}
 	}
 }
 
@@ -100,88 +280,152 @@ void init_memstackdist(){
 
 }*/
 
-static ADDRINT memstackdist_instr_intervals(){
-
-	/* counting instructions is done in all_instr_intervals() */
-
-	return (ADDRINT)(interval_ins_count_for_hpc_alignment == interval_size);
-}
-
-VOID memstackdist_instr_interval_output(){
+/* number of memory references, cold references and reuse distance buckets */
+static VOID memstackdist_output(ofstream& output_file_memstackdist, INT64 mem_ref_cnt, INT64 cold_refs, INT64* buckets){
 	int i;
-	output_file_memstackdist.open(mkfilename("memstackdist_phases_int"), ios::out|ios::app);
 	output_file_memstackdist << mem_ref_cnt << " " << cold_refs;
 	for(i=0; i < BUCKET_CNT; i++){
 		output_file_memstackdist << " " << buckets[i];
 	}
-	output_file_memstackdist << endl;
-	output_file_memstackdist.close();
 }
 
-VOID memstackdist_instr_interval_reset(){
+/* when sampling, the (scaled) cold references and buckets are estimates, round them to the integer counters;
+ * the difference between the number of references and the estimated number is added to the first bucket
+ * (SHARDS_adj), which corrects for sampling more or less hot cache lines than expected */
+static VOID memstackdist_sampled_counts(stackdist_hist* h){
 	int i;
-	mem_ref_cnt = 0;
-	cold_refs = 0;
-	for(i=0; i < BUCKET_CNT; i++){
-		buckets[i] = 0;
+	double estimated_refs;
+	if(memstackdist_sampling > 0.0){
+		estimated_refs = h->sampled_cold_refs;
+		for(i=0; i < BUCKET_CNT; i++){
+			estimated_refs += h->sampled_buckets[i];
+		}
+		h->cold_refs = (INT64)(h->sampled_cold_refs + 0.5);
+		for(i=0; i < BUCKET_CNT; i++){
+			h->buckets[i] = (INT64)(h->sampled_buckets[i] + 0.5);
+		}
+		h->buckets[0] += (INT64)((double)h->mem_ref_cnt - estimated_refs);
+		if(h->buckets[0] < 0)
+			h->buckets[0] = 0;
 	}
 }
 
-static VOID memstackdist_instr_interval(){
+/* effective sampling rate */
+static double memstackdist_sampling_rate(stackdist_gran* m){
+	return 1.0 / m->sample_weight;
+}
 
-	memstackdist_instr_interval_output();
-	memstackdist_instr_interval_reset();
-	interval_ins_count = 0;
-	interval_ins_count_for_hpc_alignment = 0;
+/* the histograms of each granularity, in the order of memstackdist_block_sizes, for reads and then for writes */
+static VOID memstackdist_output_all(ofstream& output_file_memstackdist, memstackdist_state* s){
+	UINT32 g;
+	for(g = 0; g < memstackdist_block_size_cnt; g++){
+		memstackdist_sampled_counts(&s->reads[g]);
+		if(g > 0)
+			output_file_memstackdist << " ";
+		memstackdist_output(output_file_memstackdist, s->reads[g].mem_ref_cnt, s->reads[g].cold_refs, s->reads[g].buckets);
+	}
+	if(memstackdist_writes != MEMSTACKDIST_WRITES_NO){
+		for(g = 0; g < memstackdist_block_size_cnt; g++){
+			memstackdist_sampled_counts(&s->writes[g]);
+			output_file_memstackdist << " ";
+			memstackdist_output(output_file_memstackdist, s->writes[g].mem_ref_cnt, s->writes[g].cold_refs, s->writes[g].buckets);
+		}
+	}
 }
 
-/* hash table support */
+/* effective sampling rate of each granularity, followed by those of the stacks of the writes if they are separate */
+static VOID memstackdist_output_rates(ofstream& output_file_memstackdist, memstackdist_state* s){
+	UINT32 g;
+	for(g = 0; g < memstackdist_block_size_cnt; g++)
+		output_file_memstackdist << (g > 0 ? " " : "") << memstackdist_sampling_rate(s->gran[g]);
+	if(memstackdist_writes == MEMSTACKDIST_WRITES_SEPARATE){
+		for(g = 0; g < memstackdist_block_size_cnt; g++)
+			output_file_memstackdist << " " << memstackdist_sampling_rate(s->write_gran[g]);
+	}
+	output_file_memstackdist << endl;
+}
 
-/** entry_lookup
- *
- * Finds an arrray of stack entry references for a given address key (upper part of address) in a hash table.
- */
-stack_entry** entry_lookup(block_fast** table, ADDRINT key){
+VOID memstackdist_instr_interval_output(mica_thread* t){
+	ofstream output_file_memstackdist;
 
-	block_fast* b;
+	output_file_memstackdist.open(mkfilename_thread("memstackdist_phases_int", t->tid), ios::out|ios::app);
+	memstackdist_output_all(output_file_memstackdist, t->memstackdist);
+	output_file_memstackdist << endl;
+	output_file_memstackdist.close();
 
-	for (b = table[key % MAX_MEM_TABLE_ENTRIES]; b != NULL; b = b->next){
-		if(b->id == key)
-			return b->stack_entries;
+	if(memstackdist_sampling > 0.0){
+		output_file_memstackdist.open(mkfilename_thread("memstackdist_phases_int_rate", t->tid), ios::out|ios::app);
+		memstackdist_output_rates(output_file_memstackdist, t->memstackdist);
+		output_file_memstackdist.close();
 	}
+}
 
-	return NULL;
+VOID memstackdist_instr_interval_reset(mica_thread* t){
+	UINT32 g;
+
+	for(g = 0; g < memstackdist_block_size_cnt; g++){
+		stackdist_hist_reset(&t->memstackdist->reads[g]);
+		stackdist_hist_reset(&t->memstackdist->writes[g]);
+	}
 }
 
-/** entry_install
+/* cache line state support */
+
+/** pool_alloc
  *
- * Installs a new array of stack entry references for a given address key (upper part of address) in a hash table.
+ * Allocates size bytes from the current pool block, which is replaced by a new one when it runs out.
  */
-static stack_entry** entry_install(block_fast** table, ADDRINT key){
+static inline VOID* pool_alloc(stackdist_gran* m, UINT64 size){
 
-	block_fast* b;
+	VOID* p;
 
-	ADDRINT index = key % MAX_MEM_TABLE_ENTRIES;
+	if(size > m->pool_left){
+		m->pool_next = (char*)checked_malloc(POOL_BLOCK_SIZE);
+		m->pool_left = POOL_BLOCK_SIZE;
+	}
+	p = m->pool_next;
+	m->pool_next += size;
+	m->pool_left -= size;
 
-	b = table[index];
+	return p;
+}
 
-	if(b == NULL) {
-		b = (block_fast*)checked_malloc(sizeof(block_fast));
-		table[index] = b;
+/** line_state
+ *
+ * Finds the state (of state_size bytes) of cache line a of memory operand l, in the line directory or else
+ * in chunks. The chunk and sub-chunk holding it are allocated (with all state zero) when one of their lines
+ * is accessed for the first time.
+ */
+static inline VOID* line_state(stackdist_gran* m, addr_map* chunks, const mem_lines* l, ADDRINT a, UINT64 state_size){
+
+	ADDRINT upperAddr = a >> LOG_MAX_MEM_ENTRIES;
+	ADDRINT sub = (a & MASK_MAX_MEM_ENTRIES) >> LOG_SUB_CHUNK_ENTRIES;
+	line_dir_chunk* d;
+	line_chunk* c;
+
+	if(m->lines != NULL){
+		d = mem_lines_chunk(m->lines, l, a);
+		c = (line_chunk*)d->client[m->lines_client];
+		if(c == NULL){
+			c = (line_chunk*)pool_alloc(m, sizeof(line_chunk));
+			memset(c, 0, sizeof(line_chunk));
+			d->client[m->lines_client] = c;
+		}
 	}
 	else{
-		while(b->next != NULL){
-			b = b->next;
+		c = (line_chunk*)addr_map_lookup(chunks, upperAddr);
+		if(c == NULL){
+			c = (line_chunk*)pool_alloc(m, sizeof(line_chunk));
+			memset(c, 0, sizeof(line_chunk));
+			addr_map_insert(chunks, upperAddr, c);
 		}
-		b->next = (block_fast*)checked_malloc(sizeof(block_fast));
-		b = b->next;
 	}
-	b->next = NULL;
-	b->id = key;
-	for(ADDRINT i = 0; i < MAX_MEM_ENTRIES; i++){
-		b->stack_entries[i] = NULL;
+	if(c->sub_chunks[sub] == NULL){
+		c->sub_chunks[sub] = pool_alloc(m, SUB_CHUNK_ENTRIES * state_size);
+		memset(c->sub_chunks[sub], 0, SUB_CHUNK_ENTRIES * state_size);
 	}
-	return b->stack_entries;
+
+	return (char*)c->sub_chunks[sub] + (a & MASK_SUB_CHUNK_ENTRIES) * state_size;
 }
 
 
@@ -192,12 +436,12 @@ static stack_entry** entry_install(block_fast** table, ADDRINT key){
  *
  * Checks whether the stack structure is internally consistent.
  */
-static VOID stack_sanity_check(){
+static VOID stack_sanity_check(stackdist_gran* m){
 
 	UINT64 position = 0;
 	INT32 bucket = 0;
 
-	stack_entry *e = stack_top;
+	stack_entry *e = m->stack_top;
 
 	if (e->above != NULL){
 		ERROR_MSG("Item above top of stack.");
@@ -228,7 +472,7 @@ static VOID stack_sanity_check(){
 		{
 			UINT64 borderline = ((UINT64) 1) << bucket;
 			if (position == borderline){
-				if (borderline_stack_entries [bucket] != e){
+				if (m->borderline_stack_entries [bucket] != e){
 					ERROR_MSG("Incorrect bucket borderline.");
 					exit(1);
 				}
@@ -249,7 +493,7 @@ static VOID stack_sanity_check(){
  * Moves the stack entry e corresponding to the address a to the top of stack.
  * The stack entry can be NULL, in which case a new stack entry is created.
  */
-static VOID move_to_top_fast(stack_entry *e, ADDRINT a){
+static VOID move_to_top_fast(stackdist_gran* m, stack_entry *e, ADDRINT a){
 
 	INT32 bucket;
 
@@ -266,19 +510,19 @@ static VOID move_to_top_fast(stack_entry *e, ADDRINT a){
 			// adjust all borderline entries above the entry touched (note that we can be sure those entries exist)
 			// a borderline entry is an entry whose bucket will change when an item is inserted above it on the stack
 			for(bucket=0; bucket < BUCKET_CNT && bucket < e->bucket; bucket++){
-				borderline_stack_entries[bucket]->bucket++;
-				borderline_stack_entries[bucket] = borderline_stack_entries[bucket]->above;
+				m->borderline_stack_entries[bucket]->bucket++;
+				m->borderline_stack_entries[bucket] = m->borderline_stack_entries[bucket]->above;
 			}
 			// if the entry touched was a borderline entry, new borderline entry is the one above the touched one
-			if(e == borderline_stack_entries[e->bucket]){
-				borderline_stack_entries[e->bucket] = borderline_stack_entries[e->bucket]->above;
+			if(e == m->borderline_stack_entries[e->bucket]){
+				m->borderline_stack_entries[e->bucket] = m->borderline_stack_entries[e->bucket]->above;
 			}
 
 			// place new entry on top of LRU stack
-			e->below = stack_top;
+			e->below = m->stack_top;
 			e->above = NULL;
-			stack_top->above = e;
-			stack_top = e;
+			m->stack_top->above = e;
+			m->stack_top = e;
 			e->bucket = 0;
 		}
 		/* else: if top of stack was referenced again, nothing to do! */
@@ -286,49 +530,49 @@ static VOID move_to_top_fast(stack_entry *e, ADDRINT a){
 	}
 	else{
 		// allocate memory for new stack entry
-		stack_entry* e = (stack_entry*) checked_malloc(sizeof(stack_entry));
+		stack_entry* e = (stack_entry*) pool_alloc(m, sizeof(stack_entry));
 
 		// initialize with address and refer prev to top of stack
 		e->block_addr = a;
 		e->above = NULL;
-		e->below = stack_top;
+		e->below = m->stack_top;
 		e->bucket = 0;
 
 		// adjust top of stack
-		stack_top->above = e;
-		stack_top = e;
+		m->stack_top->above = e;
+		m->stack_top = e;
 
-		stack_size++;
+		m->stack_size++;
 
 		// adjust all borderline entries that exist up until the overflow bucket
 		// (which really has no borderline entry since there is no next bucket)
 		// we retain the number of the first free bucket for next code
 		for(bucket=0; bucket < BUCKET_CNT - 1; bucket++){
-			if (borderline_stack_entries[bucket] == NULL) break;
-			borderline_stack_entries[bucket]->bucket++;
-			borderline_stack_entries[bucket] = borderline_stack_entries[bucket]->above;
+			if (m->borderline_stack_entries[bucket] == NULL) break;
+			m->borderline_stack_entries[bucket]->bucket++;
+			m->borderline_stack_entries[bucket] = m->borderline_stack_entries[bucket]->above;
 		}
 
 		// if the stack size has reached a boundary of a bucket, set the boundary entry for this bucket
 		// the variable types are chosen deliberately large for overflow safety
-		// at least they should not overflow sooner than stack_size anyway
+		// at least they should not overflow sooner than m->stack_size anyway
 		// overflow bucket boundar is never set
 		if (bucket < BUCKET_CNT - 1)
 		{
 			UINT64 borderline_distance = ((UINT64) 2) << bucket;
-			if(stack_size == borderline_distance){
+			if(m->stack_size == borderline_distance){
 				// find the bottom of the stack by traversing from somewhere close to it
 				stack_entry *stack_bottom;
-				if (bucket) stack_bottom = borderline_stack_entries [bucket-1];
-				       else stack_bottom = stack_top;
+				if (bucket) stack_bottom = m->borderline_stack_entries [bucket-1];
+				       else stack_bottom = m->stack_top;
 				while (stack_bottom->below) stack_bottom = stack_bottom->below;
 				// the new borderline is the bottom of the stack
-				borderline_stack_entries [bucket] = stack_bottom;
+				m->borderline_stack_entries [bucket] = stack_bottom;
 			}
 		}
 	}
 
-	// stack_sanity_check();
+	// stack_sanity_check(m);
 }
 
 /* determine reuse distance (= number of unique cache blocks referenced since last time this cache was referenced)
@@ -343,82 +587,443 @@ static INT64 det_reuse_dist_bucket(stack_entry* e){
 		return -1;
 }
 
-/* register memory access (either read of write) determine which cache lines are touched */
-VOID memstackdist_memRead(ADDRINT effMemAddr, ADDRINT size){
+/* order statistics tree support */
 
-	ADDRINT a, endAddr, addr, upperAddr, indexInChunk;
-	stack_entry** chunk;
-	stack_entry* entry_for_addr;
+/* number of marks at access times 1 up to and including i */
+static inline UINT64 tree_prefix(const UINT32* tree, UINT64 i){
+	UINT64 sum = 0;
+	for(; i > 0; i &= i - 1)
+		sum += tree[i];
+	return sum;
+}
 
-	/* Calculate index in cache addresses. The calculation does not
-	 * handle address overflows but those are unlikely to happen. */
-	addr = effMemAddr >> memstackdist_block_size;
-	endAddr = (effMemAddr + size - 1) >> memstackdist_block_size;
+static inline VOID tree_add(UINT32* tree, UINT64 size, UINT64 i, INT32 delta){
+	for(; i < size; i += i & (~i + 1))
+		tree[i] += delta;
+}
 
-	/* The hit is counted for all cache lines involved. */
-	for(a = addr; a <= endAddr; a++){
+/** tree_compact
+ *
+ * Called when the current access time runs off the end of the tree: renumbers the marked access times
+ * 1..live_blocks (keeping their order, so reuse distances are unchanged) and grows the tree if more
+ * than half of it would be in use afterwards.
+ */
+static VOID tree_compact(stackdist_gran* m){
+
+	UINT64 i, n, low;
+	UINT64 new_size = m->tree_size;
+	UINT64** new_slots;
+
+	while(2 * (m->live_blocks + 1) > new_size)
+		new_size *= 2;
+
+	new_slots = (UINT64**) checked_malloc(new_size * sizeof(UINT64*));
+
+	n = 0;
+	for(i = 1; i < m->now; i++){
+		/* a slot only holds its last access time, older times are stale */
+		if(m->time_slots[i] != NULL && *(m->time_slots[i]) == i){
+			n++;
+			*(m->time_slots[i]) = n;
+			new_slots[n] = m->time_slots[i];
+		}
+	}
+	//assert(n == m->live_blocks);
+
+	free(m->time_slots);
+	m->time_slots = new_slots;
+
+	if(new_size != m->tree_size){
+		free(m->tree);
+		m->tree = (UINT32*) checked_malloc(new_size * sizeof(UINT32));
+		m->tree_size = new_size;
+	}
+
+	/* times 1..n are marked: tree[i] = |(i - lowbit(i), i] intersected with [1, n]| */
+	m->tree[0] = 0;
+	for(i = 1; i < m->tree_size; i++){
+		low = i - (i & (~i + 1));
+		m->tree[i] = (UINT32)((i < n ? i : n) - (low < n ? low : n));
+	}
+
+	m->now = n + 1;
+}
+
+/* bucket of a reuse distance, matching the buckets of the LRU stack:
+ * distances 0 and 1 go in bucket 0, distances in [2^b, 2^(b+1)) in bucket b, the last bucket is the overflow bucket */
+static inline INT64 reuse_dist_bucket(UINT64 dist){
+
+	INT64 b;
+
+	if(dist <= 1)
+		return 0;
+	b = 63 - __builtin_clzll(dist);
+	if(b > BUCKET_CNT - 1)
+		b = BUCKET_CNT - 1;
+	return b;
+}
+
+/* register the access of a single cache line for the tree engine,
+ * returns the reuse distance or -1 for a cold reference */
+static INT64 tree_access(stackdist_gran* m, UINT64* slot){
+
+	INT64 dist;
+	UINT64 last = *slot;
+
+	if(m->now == m->tree_size)
+		tree_compact(m);
+
+	/* compaction may have renumbered the last access */
+	last = *slot;
+
+	if(last == 0){
+		dist = -1;
+		m->live_blocks++;
+	}
+	else{
+		/* number of distinct cache lines referenced since the last access to this one */
+		dist = (INT64)(tree_prefix(m->tree, m->now - 1) - tree_prefix(m->tree, last));
+		tree_add(m->tree, m->tree_size, last, -1);
+		m->time_slots[last] = NULL;
+	}
+
+	tree_add(m->tree, m->tree_size, m->now, 1);
+	m->time_slots[m->now] = slot;
+	*slot = m->now;
+	m->now++;
+
+	return dist;
+}
+
+/* tree support for sampling */
+
+/* spatial hash of a cache line address (64-bit finalizer of MurmurHash3) */
+static inline UINT64 sample_hash(ADDRINT a){
+	UINT64 h = (UINT64)a;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static VOID sample_heap_push(stackdist_gran* m, sample_entry* e){
+
+	UINT64 i = m->sample_cnt++;
+
+	while(i > 0 && m->sample_heap[(i - 1) / 2]->hash < e->hash){
+		m->sample_heap[i] = m->sample_heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	m->sample_heap[i] = e;
+}
+
+static sample_entry* sample_heap_pop(stackdist_gran* m){
+
+	UINT64 i, c;
+	sample_entry* top = m->sample_heap[0];
+	sample_entry* e = m->sample_heap[--m->sample_cnt];
+
+	i = 0;
+	while((c = 2 * i + 1) < m->sample_cnt){
+		if(c + 1 < m->sample_cnt && m->sample_heap[c + 1]->hash > m->sample_heap[c]->hash)
+			c++;
+		if(m->sample_heap[c]->hash <= e->hash)
+			break;
+		m->sample_heap[i] = m->sample_heap[c];
+		i = c;
+	}
+	m->sample_heap[i] = e;
+
+	return top;
+}
+
+/** sample_drop
+ *
+ * Lowers the sampling threshold to the largest hash tracked and stops tracking all lines at or above it.
+ */
+static VOID sample_drop(stackdist_gran* m){
+
+	sample_entry* e;
+	sample_entry** p;
+
+	m->sample_threshold = m->sample_heap[0]->hash;
+	m->sample_weight = 18446744073709551616.0 / (double)m->sample_threshold; // 2^64 / threshold
+
+	while(m->sample_cnt > 0 && m->sample_heap[0]->hash >= m->sample_threshold){
+
+		e = sample_heap_pop(m);
+
+		/* remove the mark of the last access from the tree */
+		if(e->last_access != 0){
+			tree_add(m->tree, m->tree_size, e->last_access, -1);
+			m->time_slots[e->last_access] = NULL;
+			m->live_blocks--;
+		}
+
+		for(p = &m->sample_table[e->block_addr & m->sample_table_mask]; *p != e; p = &(*p)->next);
+		*p = e->next;
+		free(e);
+	}
+}
+
+/* register the access of a single cache line when sampling */
+static VOID sample_access(stackdist_gran* m, stackdist_hist* hist, ADDRINT a){
+
+	INT64 dist;
+	sample_entry* e;
+	UINT64 h = sample_hash(a);
+
+	if(h >= m->sample_threshold)
+		return;
+
+	for(e = m->sample_table[a & m->sample_table_mask]; e != NULL; e = e->next){
+		if(e->block_addr == a)
+			break;
+	}
+	if(e == NULL){
+		e = (sample_entry*) checked_malloc(sizeof(sample_entry));
+		e->block_addr = a;
+		e->hash = h;
+		e->last_access = 0;
+		e->next = m->sample_table[a & m->sample_table_mask];
+		m->sample_table[a & m->sample_table_mask] = e;
+		sample_heap_push(m, e);
+	}
+
+	dist = tree_access(m, &e->last_access);
+
+	/* each sampled reference stands for 1/rate references, with a reuse distance scaled likewise */
+	if(dist < 0)
+		hist->sampled_cold_refs += m->sample_weight;
+	else
+		hist->sampled_buckets[reuse_dist_bucket((UINT64)((double)dist * m->sample_weight))] += m->sample_weight;
+
+	if(m->sample_cnt > memstackdist_sampling_lines)
+		sample_drop(m);
+}
+
+/* register the access of the cache lines of memory operand l at a single granularity, counted in histogram h */
+static VOID stackdist_access(stackdist_gran* m, stackdist_hist* h, const mem_lines* l){
+
+	ADDRINT a;
+	ADDRINT addr, endAddr;
+
+	if(m->block_size == _block_size){
+		addr = l->first;
+		endAddr = l->last;
+	}
+	else{
+		addr = l->ea >> m->block_size;
+		endAddr = (l->ea + l->size - 1) >> m->block_size;
+	}
+
+	if(memstackdist_sampling > 0.0){
+
+		for(a = addr; a <= endAddr; a++){
+			sample_access(m, h, a);
+			h->mem_ref_cnt++;
+		}
+		return;
+	}
+
+	if(memstackdist_engine == MEMSTACKDIST_ENGINE_TREE){
+
+		UINT64* last_access;
+
+		for(a = addr; a <= endAddr; a++){
+
+			last_access = (UINT64*)line_state(m, &m->time_chunks, l, a, sizeof(UINT64));
+
+			INT64 dist = tree_access(m, last_access);
+
+			if(dist < 0)
+				h->cold_refs++;
+			else
+				h->buckets[reuse_dist_bucket((UINT64)dist)]++;
 
-		/* split the cache line address into hash key of chunk and index in chunk */
-		upperAddr = a >> LOG_MAX_MEM_ENTRIES;
-		indexInChunk = a & MASK_MAX_MEM_ENTRIES;
+			h->mem_ref_cnt++;
+		}
+		return;
+	}
 
-		chunk = entry_lookup(hashTableCacheBlocks_fast, upperAddr);
-		if(chunk == NULL) chunk = entry_install(hashTableCacheBlocks_fast, upperAddr);
+	stack_entry** entry;
+	stack_entry* entry_for_addr;
 
-		entry_for_addr = chunk[indexInChunk];
+	/* The hit is counted for all cache lines involved. */
+	for(a = addr; a <= endAddr; a++){
+
+		entry = (stack_entry**)line_state(m, &m->stack_chunks, l, a, sizeof(stack_entry*));
+		entry_for_addr = *entry;
 
 		/* determine reuse distance for this access (if it has been accessed before) */
 		INT64 b = det_reuse_dist_bucket(entry_for_addr);
 
 		if(b < 0)
-			cold_refs++;
+			h->cold_refs++;
 		else
-			buckets[b]++;
+			h->buckets[b]++;
 
 		/* adjust LRU stack */
 		/* as a side effect, can allocate new entry, which could have been NULL so far */
-		move_to_top_fast(entry_for_addr, a);
+		move_to_top_fast(m, entry_for_addr, a);
 
 		/* update hash table for new cache blocks */
-		if(chunk[indexInChunk] == NULL) chunk[indexInChunk] = stack_top;
+		if(*entry == NULL) *entry = m->stack_top;
 
-		mem_ref_cnt++;
+		h->mem_ref_cnt++;
 	}
 }
 
+/* register memory read of the cache lines of l, at every granularity */
+VOID memstackdist_memRead_lines(mica_thread* t, const mem_lines* l){
+
+	UINT32 g;
+	memstackdist_state* s = t->memstackdist;
+
+	for(g = 0; g < memstackdist_block_size_cnt; g++)
+		stackdist_access(s->gran[g], &s->reads[g], l);
+}
+
+/* register memory write of the cache lines of l, only if writes are tracked (memstackdist_writes) */
+VOID memstackdist_memWrite_lines(mica_thread* t, const mem_lines* l){
+
+	UINT32 g;
+	memstackdist_state* s = t->memstackdist;
+
+	if(memstackdist_writes == MEMSTACKDIST_WRITES_NO)
+		return;
+
+	for(g = 0; g < memstackdist_block_size_cnt; g++)
+		stackdist_access(s->write_gran[g], &s->writes[g], l);
+}
+
+/* The calculation of the cache lines does not handle address overflows but those are unlikely to happen. */
+VOID memstackdist_memRead(mica_thread* t, ADDRINT effMemAddr, ADDRINT size){
+	mem_lines l;
+
+	mem_lines_resolve(t->memstackdist->lines, &l, effMemAddr, size);
+	memstackdist_memRead_lines(t, &l);
+}
+
+VOID memstackdist_memWrite(mica_thread* t, ADDRINT effMemAddr, ADDRINT size){
+	mem_lines l;
+
+	if(memstackdist_writes == MEMSTACKDIST_WRITES_NO)
+		return;
+
+	mem_lines_resolve(t->memstackdist->lines, &l, effMemAddr, size);
+	memstackdist_memWrite_lines(t, &l);
+}
+
+VOID memstackdist_memRead_tid(THREADID tid, ADDRINT effMemAddr, ADDRINT size){
+	memstackdist_memRead(get_mica_thread(tid), effMemAddr, size);
+}
+
+VOID memstackdist_memWrite_tid(THREADID tid, ADDRINT effMemAddr, ADDRINT size){
+	memstackdist_memWrite(get_mica_thread(tid), effMemAddr, size);
+}
+
 VOID instrument_memstackdist(INS ins, VOID *v){
 
 	if( INS_IsMemoryRead(ins) ){
 
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)memstackdist_memRead, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_END);
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, memstackdist_memRead_tid, IARG_THREAD_ID, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_END);
 
 		if( INS_HasMemoryRead2(ins) )
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)memstackdist_memRead, IARG_MEMORYREAD2_EA, IARG_MEMORYREAD_SIZE, IARG_END);
+			mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, memstackdist_memRead_tid, IARG_THREAD_ID, IARG_MEMORYREAD2_EA, IARG_MEMORYREAD_SIZE, IARG_END);
 	}
 
-	if(interval_size != -1){
-		INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)memstackdist_instr_intervals,IARG_END);
-		/* only called if interval is 'full' */
-		INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)memstackdist_instr_interval,IARG_END);
-	}
+	if( memstackdist_writes != MEMSTACKDIST_WRITES_NO && INS_IsMemoryWrite(ins) )
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, memstackdist_memWrite_tid, IARG_THREAD_ID, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_END);
+
+	/* interval boundaries are checked in mica.cpp */
 }
 
 /* finishing... */
 VOID fini_memstackdist(INT32 code, VOID* v){
 
 	int i;
+	UINT32 g,k;
+	mica_thread* t;
+	memstackdist_state* s;
+	ofstream output_file_memstackdist;
+	memstackdist_state* merged;
+
+	for(k=0; k < mica_thread_cnt; k++){
+		t = mica_threads[k];
+		if(interval_size == -1){
+			output_file_memstackdist.open(mkfilename_thread("memstackdist_full_int", t->tid), ios::out|ios::trunc);
+		}
+		else{
+			output_file_memstackdist.open(mkfilename_thread("memstackdist_phases_int", t->tid), ios::out|ios::app);
+		}
+		memstackdist_output_all(output_file_memstackdist, t->memstackdist);
+		//output_file_memstackdist << endl << "number of instructions: " << total_ins_count_for_hpc_alignment << endl;
+		output_file_memstackdist << " ";
+		output_file_memstackdist.close();
 
-	if(interval_size == -1){
-		output_file_memstackdist.open(mkfilename("memstackdist_full_int"), ios::out|ios::trunc);
-	}
-	else{
-		output_file_memstackdist.open(mkfilename("memstackdist_phases_int"), ios::out|ios::app);
+		if(memstackdist_sampling > 0.0){
+			if(interval_size == -1){
+				output_file_memstackdist.open(mkfilename_thread("memstackdist_full_int_rate", t->tid), ios::out|ios::trunc);
+			}
+			else{
+				output_file_memstackdist.open(mkfilename_thread("memstackdist_phases_int_rate", t->tid), ios::out|ios::app);
+			}
+			memstackdist_output_rates(output_file_memstackdist, t->memstackdist);
+			output_file_memstackdist.close();
+		}
 	}
-	output_file_memstackdist << mem_ref_cnt << " " << cold_refs;
-	for(i=0; i < BUCKET_CNT; i++){
-		output_file_memstackdist << " " << buckets[i];
+
+	/* each thread has its own LRU stack, so the merged histogram is the sum of per-thread reuse distances,
+	 * with the lowest effective sampling rate of all threads */
+	if(interval_size == -1 && mica_thread_cnt > 1){
+		merged = (memstackdist_state*) checked_aligned_malloc(sizeof(memstackdist_state));
+		for(g=0; g < memstackdist_block_size_cnt; g++){
+			stackdist_hist_reset(&merged->reads[g]);
+			stackdist_hist_reset(&merged->writes[g]);
+			merged->gran[g] = mica_threads[0]->memstackdist->gran[g];
+			merged->write_gran[g] = mica_threads[0]->memstackdist->write_gran[g];
+		}
+		for(k=0; k < mica_thread_cnt; k++){
+			s = mica_threads[k]->memstackdist;
+			for(g=0; g < memstackdist_block_size_cnt; g++){
+				if(memstackdist_sampling > 0.0 && s->gran[g]->sample_weight > merged->gran[g]->sample_weight)
+					merged->gran[g] = s->gran[g];
+				if(memstackdist_writes == MEMSTACKDIST_WRITES_SEPARATE && memstackdist_sampling > 0.0 && s->write_gran[g]->sample_weight > merged->write_gran[g]->sample_weight)
+					merged->write_gran[g] = s->write_gran[g];
+				merged->reads[g].mem_ref_cnt += s->reads[g].mem_ref_cnt;
+				merged->reads[g].cold_refs += s->reads[g].cold_refs;
+				merged->writes[g].mem_ref_cnt += s->writes[g].mem_ref_cnt;
+				merged->writes[g].cold_refs += s->writes[g].cold_refs;
+				for(i=0; i < BUCKET_CNT; i++){
+					merged->reads[g].buckets[i] += s->reads[g].buckets[i];
+					merged->writes[g].buckets[i] += s->writes[g].buckets[i];
+				}
+			}
+		}
+
+		/* the per-thread counts are already rounded, the merged ones are not sampled again */
+		output_file_memstackdist.open(mkfilename("memstackdist_full_int_merged"), ios::out|ios::trunc);
+		for(g=0; g < memstackdist_block_size_cnt; g++){
+			if(g > 0)
+				output_file_memstackdist << " ";
+			memstackdist_output(output_file_memstackdist, merged->reads[g].mem_ref_cnt, merged->reads[g].cold_refs, merged->reads[g].buckets);
+		}
+		if(memstackdist_writes != MEMSTACKDIST_WRITES_NO){
+			for(g=0; g < memstackdist_block_size_cnt; g++){
+				output_file_memstackdist << " ";
+				memstackdist_output(output_file_memstackdist, merged->writes[g].mem_ref_cnt, merged->writes[g].cold_refs, merged->writes[g].buckets);
+			}
+		}
+		output_file_memstackdist << " ";
+		output_file_memstackdist.close();
+		if(memstackdist_sampling > 0.0){
+			output_file_memstackdist.open(mkfilename("memstackdist_full_int_rate_merged"), ios::out|ios::trunc);
+			memstackdist_output_rates(output_file_memstackdist, merged);
+			output_file_memstackdist.close();
+		}
+		free(merged);
 	}
-	//output_file_memstackdist << endl << "number of instructions: " << total_ins_count_for_hpc_alignment << endl;
-	output_file_memstackdist << " ";
-	output_file_memstackdist.close();
 }
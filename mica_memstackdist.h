@@ -8,11 +8,27 @@
  */
 
 #include "mica.h"
+#include "mica_utils.h"
+
+#ifndef MICA_MEMSTACKDIST_H
+#define MICA_MEMSTACKDIST_H
+
+/* engine used to compute reuse distances: the original LRU stack, or an order statistics tree indexed by access time */
+enum MEMSTACKDIST_ENGINE { MEMSTACKDIST_ENGINE_LRU = 0, MEMSTACKDIST_ENGINE_TREE };
+
+/* memory writes: not tracked, on the same stacks as the reads, or on stacks of their own */
+enum MEMSTACKDIST_WRITES { MEMSTACKDIST_WRITES_NO = 0, MEMSTACKDIST_WRITES_MERGED, MEMSTACKDIST_WRITES_SEPARATE };
 
 void init_memstackdist();
+VOID init_memstackdist_thread(mica_thread* t);
 VOID instrument_memstackdist(INS ins, VOID* v);
 VOID fini_memstackdist(INT32 code, VOID* v);
 
-VOID memstackdist_memRead(ADDRINT effMemAddr, ADDRINT size);
-VOID memstackdist_instr_interval_output();
-VOID memstackdist_instr_interval_reset();
+VOID memstackdist_memRead(mica_thread* t, ADDRINT effMemAddr, ADDRINT size);
+VOID memstackdist_memWrite(mica_thread* t, ADDRINT effMemAddr, ADDRINT size);
+VOID memstackdist_memRead_lines(mica_thread* t, const mem_lines* l);
+VOID memstackdist_memWrite_lines(mica_thread* t, const mem_lines* l);
+VOID memstackdist_instr_interval_output(mica_thread* t);
+VOID memstackdist_instr_interval_reset(mica_thread* t);
+
+#endif
@@ -16,127 +16,174 @@
 /* Global variables */
 
 extern INT64 interval_size;
-extern INT64 interval_ins_count;
-extern INT64 interval_ins_count_for_hpc_alignment;
-extern INT64 total_ins_count;
-extern INT64 total_ins_count_for_hpc_alignment;
+extern UINT32 _ppm_hist_lengths[MAX_NUM_HIST_LENGTHS];
+extern UINT32 _ppm_hist_length_cnt;
 
-ofstream output_file_ppm;
-
-BOOL lastInstBr; // was the last instruction a cond. branch instruction?
-ADDRINT nextAddr; // address of the instruction after the last cond.branch
 UINT32 numStatCondBranchInst; // number of static cond. branch instructions up until now (-> unique id for the cond. branch)
 //UINT32 lastBrId; // index of last cond. branch instruction
-INT64* transition_counts;
-char* local_taken;
-INT64* local_taken_counts;
-INT64* local_brCounts;
-ADDRINT* indices_condBr;
-UINT32 indices_condBr_size;
-/* incorrect predictions counters */
-INT64 GAg_incorrect_pred[NUM_HIST_LENGTHS];
-INT64 GAs_incorrect_pred[NUM_HIST_LENGTHS];
-INT64 PAg_incorrect_pred[NUM_HIST_LENGTHS];
-INT64 PAs_incorrect_pred[NUM_HIST_LENGTHS];
-/* prediction for each of the 4 predictors */
-INT32 GAg_pred_taken[NUM_HIST_LENGTHS];
-INT32 GAs_pred_taken[NUM_HIST_LENGTHS];
-INT32 PAg_pred_taken[NUM_HIST_LENGTHS];
-INT32 PAs_pred_taken[NUM_HIST_LENGTHS];
-/* size of local pattern history */
-INT64 brHist_size;
-/* global/local history */
-INT32 bhr;
-INT32* local_bhr;
-/* global/local pattern history tables */
-char*** GAg_pht;
-char*** PAg_pht;
-char**** GAs_pht;
-char**** PAs_pht;
-/* check if page entries were touched (memory efficiency) */
-char* GAs_touched;
-char* PAs_touched;
-/* prediction history */
-int GAg_pred_hist[NUM_HIST_LENGTHS];
-int PAg_pred_hist[NUM_HIST_LENGTHS];
-int GAs_pred_hist[NUM_HIST_LENGTHS];
-int PAs_pred_hist[NUM_HIST_LENGTHS];
+ins_index indices_condBr;
+
+/* pattern history tables (PHTs): for each history length j, one table of 2^i counters per order
+ * i <= _ppm_hist_lengths[j], stored back to back in a single array of ppm_pht_size counters
+ * (the table of order i starts at ppm_pht_offsets[j] + 2^i - 1) */
+UINT32 ppm_pht_offsets[MAX_NUM_HIST_LENGTHS];
+UINT32 ppm_pht_size;
+
+/* the GAs and PAs predictors keep PHTs per branch for history lengths up to PPM_MAX_BRANCH_LENGTH,
+ * laid out as above but for those lengths only (ppm_branch_pht_offsets, ppm_branch_pht_size) */
+#define PPM_MAX_BRANCH_LENGTH 12
+UINT32 ppm_branch_pht_offsets[MAX_NUM_HIST_LENGTHS];
+UINT32 ppm_branch_pht_size;
+
+/* longer histories would take 2^(bits+1) counters per branch, so their GAs and PAs predictors
+ * share a fixed number of table sets instead, selected by the low bits of the branch (at most
+ * 2^PPM_SHARED_PHT_LOG counters for all sets, per predictor and history length) */
+#define PPM_SHARED_PHT_LOG 24
+UINT32 ppm_shared_sets[MAX_NUM_HIST_LENGTHS]; // 0 for per-branch PHTs
+UINT32 ppm_shared_set_size[MAX_NUM_HIST_LENGTHS];
+
+/* the per-branch PHTs of the GAs and PAs predictors are allocated in bulk, in slots of an arena
+ * (one slot per branch executed by the thread, holding its GAs PHTs followed by its PAs PHTs) */
+#define PPM_ARENA_INIT_SIZE (1 << 20) // bytes (at least two slots)
+
+/* per-thread state */
+typedef struct ppm_state_type {
+	INT64* transition_counts;
+	char* local_taken;
+	INT64* local_taken_counts;
+	INT64* local_brCounts;
+	/* incorrect predictions counters */
+	INT64 GAg_incorrect_pred[MAX_NUM_HIST_LENGTHS];
+	INT64 GAs_incorrect_pred[MAX_NUM_HIST_LENGTHS];
+	INT64 PAg_incorrect_pred[MAX_NUM_HIST_LENGTHS];
+	INT64 PAs_incorrect_pred[MAX_NUM_HIST_LENGTHS];
+	/* prediction for each of the 4 predictors */
+	INT32 GAg_pred_taken[MAX_NUM_HIST_LENGTHS];
+	INT32 GAs_pred_taken[MAX_NUM_HIST_LENGTHS];
+	INT32 PAg_pred_taken[MAX_NUM_HIST_LENGTHS];
+	INT32 PAs_pred_taken[MAX_NUM_HIST_LENGTHS];
+	/* size of local pattern history */
+	INT64 brHist_size;
+	/* global/local history */
+	INT32 bhr;
+	INT32* local_bhr;
+	/* global/local pattern history tables */
+	char* GAg_pht;
+	char* PAg_pht;
+	/* per-branch pattern history tables (GAs and PAs): arena slot of each branch (0 if none yet) */
+	UINT32* pht_slot;
+	char* pht_arena; // slot 0 is not used
+	UINT32 pht_arena_cnt;
+	UINT32 pht_arena_size;
+	/* shared GAs sets followed by shared PAs sets, per history length (NULL for per-branch PHTs) */
+	char* shared_pht[MAX_NUM_HIST_LENGTHS];
+	/* prediction history */
+	int GAg_pred_hist[MAX_NUM_HIST_LENGTHS];
+	int PAg_pred_hist[MAX_NUM_HIST_LENGTHS];
+	int GAs_pred_hist[MAX_NUM_HIST_LENGTHS];
+	int PAs_pred_hist[MAX_NUM_HIST_LENGTHS];
+} ppm_state;
+
+/* predictor kernel for each history length in _ppm_hist_lengths (see ppm_kernel below) */
+typedef VOID (*ppm_kernel_fun)(ppm_state* p, UINT32 j, UINT32 id, char* GAs_pht, char* PAs_pht, BOOL taken);
+static ppm_kernel_fun ppm_kernels[MAX_NUM_HIST_LENGTHS];
+extern const ppm_kernel_fun ppm_kernels_by_length[MAX_HIST_LENGTH + 1];
 
 /* initializing */
 void init_ppm(){
 
-	UINT32 i,j;
-	int k;
-
 	/* initializing total instruction counts is done in mica.cpp */
 
-	brHist_size = 512;
+	UINT32 j, h;
 
 	numStatCondBranchInst = 1;
 
+	ppm_pht_size = 0;
+	ppm_branch_pht_size = 0;
+	for(j = 0; j < _ppm_hist_length_cnt; j++){
+		h = _ppm_hist_lengths[j];
+		ppm_pht_offsets[j] = ppm_pht_size;
+		ppm_pht_size += (1 << (h + 1)) - 1;
+		if(h <= PPM_MAX_BRANCH_LENGTH){
+			ppm_branch_pht_offsets[j] = ppm_branch_pht_size;
+			ppm_branch_pht_size += (1 << (h + 1)) - 1;
+			ppm_shared_sets[j] = 0;
+		}
+		else{
+			ppm_shared_set_size[j] = 1 << (h + 1);
+			ppm_shared_sets[j] = (h + 1 < PPM_SHARED_PHT_LOG) ? 1 << (PPM_SHARED_PHT_LOG - h - 1) : 1;
+		}
+		ppm_kernels[j] = ppm_kernels_by_length[h];
+	}
+
 	/* translation of instruction address to indices */
-	indices_condBr_size = 1024;
-	indices_condBr = (ADDRINT*) checked_malloc(indices_condBr_size*sizeof(ADDRINT));
+	ins_index_init(&indices_condBr);
 
-	lastInstBr = false;
+	interval_register(ppm_instr_interval_output, ppm_instr_interval_reset);
+}
+
+VOID init_ppm_thread(mica_thread* t){
+
+	UINT32 i,j;
+	ppm_state* p = (ppm_state*) checked_aligned_malloc(sizeof(ppm_state));
+
+	t->ppm = p;
+
+	p->brHist_size = 512;
 
 	/* global/local history */
-	bhr = 0;
-	local_bhr = (int*) checked_malloc(brHist_size * sizeof(int));
-
-	/* GAg PPM predictor */
-	GAg_pht = (char***) checked_malloc(NUM_HIST_LENGTHS * sizeof(char**));
-	for(j = 0; j < NUM_HIST_LENGTHS; j++) {
-		GAg_pht[j] = (char**) checked_malloc((history_lengths[j]+1)*sizeof(char*));
-		for(i = 0; i <= history_lengths[j]; i++){
-			GAg_pht[j][i] = (char*) checked_malloc((1 << i)*sizeof(char));
-			for(k = 0; k < (1 << i); k++)
-				GAg_pht[j][i][k] = 0;
-		}
+	p->bhr = 0;
+	p->local_bhr = (int*) checked_malloc(p->brHist_size * sizeof(int));
+
+	/* GAg and PAg PPM predictors */
+	p->GAg_pht = (char*) checked_malloc(ppm_pht_size * sizeof(char));
+	memset(p->GAg_pht, 0, ppm_pht_size * sizeof(char));
+	p->PAg_pht = (char*) checked_malloc(ppm_pht_size * sizeof(char));
+	memset(p->PAg_pht, 0, ppm_pht_size * sizeof(char));
+
+	/* GAs and PAs PPM predictors */
+	p->pht_slot = (UINT32*) checked_malloc(p->brHist_size * sizeof(UINT32));
+	p->pht_arena = NULL;
+	p->pht_arena_size = 0;
+	p->pht_arena_cnt = 1;
+	if(ppm_branch_pht_size > 0){
+		p->pht_arena_size = PPM_ARENA_INIT_SIZE / (2 * ppm_branch_pht_size);
+		if(p->pht_arena_size < 2)
+			p->pht_arena_size = 2;
+		p->pht_arena = (char*) checked_malloc((size_t)p->pht_arena_size * 2 * ppm_branch_pht_size * sizeof(char));
 	}
-
-	/* PAg PPM predictor */
-	PAg_pht = (char***) checked_malloc(NUM_HIST_LENGTHS * sizeof(char**));
-	for(j = 0; j < NUM_HIST_LENGTHS; j++) {
-		PAg_pht[j] = (char**) checked_malloc((history_lengths[j]+1)*sizeof(char*));
-		for(i = 0; i <= history_lengths[j]; i++){
-			PAg_pht[j][i] = (char*) checked_malloc((1 << i)*sizeof(char));
-			for(k = 0; k < (1 << i); k++)
-				PAg_pht[j][i][k] = 0;
+	for(j = 0; j < _ppm_hist_length_cnt; j++){
+		p->shared_pht[j] = NULL;
+		if(ppm_shared_sets[j] > 0){
+			p->shared_pht[j] = (char*) checked_malloc((size_t)2 * ppm_shared_sets[j] * ppm_shared_set_size[j] * sizeof(char));
+			memset(p->shared_pht[j], -1, (size_t)2 * ppm_shared_sets[j] * ppm_shared_set_size[j] * sizeof(char));
 		}
 	}
 
-	/* GAs PPM predictor */
-	GAs_touched = (char*) checked_malloc(brHist_size * sizeof(char));
-	GAs_pht = (char****) checked_malloc(brHist_size * sizeof(char***));
-
-	/* PAs PPM predictor */
-	PAs_touched = (char*) checked_malloc(brHist_size * sizeof(char));
-	PAs_pht = (char****) checked_malloc(brHist_size * sizeof(char***));
-
-	transition_counts = (INT64*) checked_malloc(brHist_size * sizeof(INT64));
-	local_taken = (char*) checked_malloc(brHist_size * sizeof(char));
-	local_brCounts = (INT64*) checked_malloc(brHist_size * sizeof(INT64));
-	local_taken_counts = (INT64*) checked_malloc(brHist_size * sizeof(INT64));
-
-	for(i = 0; i < brHist_size; i++){
-		transition_counts[i] = 0;
-		local_taken[i] = -1;
-		local_brCounts[i] = 0;
-		local_taken_counts[i] = 0;
-		GAs_touched[i] = 0;
-		PAs_touched[i] = 0;
+	p->transition_counts = (INT64*) checked_malloc(p->brHist_size * sizeof(INT64));
+	p->local_taken = (char*) checked_malloc(p->brHist_size * sizeof(char));
+	p->local_brCounts = (INT64*) checked_malloc(p->brHist_size * sizeof(INT64));
+	p->local_taken_counts = (INT64*) checked_malloc(p->brHist_size * sizeof(INT64));
+
+	for(i = 0; i < p->brHist_size; i++){
+		p->local_bhr[i] = 0;
+		p->transition_counts[i] = 0;
+		p->local_taken[i] = -1;
+		p->local_brCounts[i] = 0;
+		p->local_taken_counts[i] = 0;
+		p->pht_slot[i] = 0;
 	}
 
-	for(j=0; j < NUM_HIST_LENGTHS; j++){
-		GAg_incorrect_pred[j] = 0;
-		GAs_incorrect_pred[j] = 0;
-		PAg_incorrect_pred[j] = 0;
-		PAs_incorrect_pred[j] = 0;
+	for(j=0; j < _ppm_hist_length_cnt; j++){
+		p->GAg_incorrect_pred[j] = 0;
+		p->GAs_incorrect_pred[j] = 0;
+		p->PAg_incorrect_pred[j] = 0;
+		p->PAs_incorrect_pred[j] = 0;
 	}
 
 	if(interval_size != -1){
-		output_file_ppm.open(mkfilename("ppm_phases_int"), ios::out|ios::trunc);
+		ofstream output_file_ppm;
+		output_file_ppm.open(mkfilename_thread("ppm_phases_int", t->tid), ios::out|ios::trunc);
 		output_file_ppm.close();
 	}
 
@@ -145,407 +192,245 @@ void init_ppm(){
 /*VOID ppm_instr_full(){
 }*/
 
-ADDRINT ppm_instr_intervals(){
-
-	return (ADDRINT)(interval_ins_count_for_hpc_alignment == interval_size);
-}
-
-VOID ppm_instr_interval_output(){
+/* mispredictions per predictor and history length, followed by branch/transition/taken counts */
+static VOID ppm_output(ofstream& output_file_ppm, ppm_state* p, BOOL leading_space){
 	int i;
+	UINT32 j;
 	INT64 total_transition_count = 0;
 	INT64 total_taken_count = 0;
 	INT64 total_brCount = 0;
 
-	output_file_ppm.open(mkfilename("ppm_phases_int"), ios::out|ios::app);
+	for(j=0; j < _ppm_hist_length_cnt; j++)
+		output_file_ppm << ((leading_space || j > 0) ? " " : "") << p->GAg_incorrect_pred[j] << " " << p->PAg_incorrect_pred[j] << " " << p->GAs_incorrect_pred[j] << " " << p->PAs_incorrect_pred[j];
 
-	output_file_ppm << interval_size;
-	for(i = 0; i < NUM_HIST_LENGTHS; i++)
-		output_file_ppm << " " << GAg_incorrect_pred[i] << " " << PAg_incorrect_pred[i] << " " << GAs_incorrect_pred[i] << " " << PAs_incorrect_pred[i];
-
-	for(i=0; i < brHist_size; i++){
-		if(local_brCounts[i] > 0){
-			if( transition_counts[i] > local_brCounts[i]/2)
-				total_transition_count += local_brCounts[i]-transition_counts[i];
+	for(i=0; i < p->brHist_size; i++){
+		if(p->local_brCounts[i] > 0){
+			if( p->transition_counts[i] > p->local_brCounts[i]/2)
+				total_transition_count += p->local_brCounts[i]-p->transition_counts[i];
 			else
-				total_transition_count += transition_counts[i];
+				total_transition_count += p->transition_counts[i];
 
-			if( local_taken_counts[i] > local_brCounts[i]/2)
-				total_taken_count += local_brCounts[i] - local_taken_counts[i];
+			if( p->local_taken_counts[i] > p->local_brCounts[i]/2)
+				total_taken_count += p->local_brCounts[i] - p->local_taken_counts[i];
 			else
-				total_taken_count += local_taken_counts[i];
-			total_brCount += local_brCounts[i];
+				total_taken_count += p->local_taken_counts[i];
+			total_brCount += p->local_brCounts[i];
 		}
 	}
 	output_file_ppm << " " << total_brCount << " " << total_transition_count << " " << total_taken_count << endl;
-	output_file_ppm.close();
 }
 
-VOID ppm_instr_interval_reset(){
+VOID ppm_instr_interval_output(mica_thread* t){
+	ofstream output_file_ppm;
 
-	int i;
+	output_file_ppm.open(mkfilename_thread("ppm_phases_int", t->tid), ios::out|ios::app);
 
-	for(i = 0; i < NUM_HIST_LENGTHS; i++){
-		GAg_incorrect_pred[i] = 0;
-		GAs_incorrect_pred[i] = 0;
-		PAg_incorrect_pred[i] = 0;
-		PAs_incorrect_pred[i] = 0;
-	}
-	for(i=0; i < brHist_size; i++){
-		local_brCounts[i] = 0;
-		local_taken_counts[i] = 0;
-		transition_counts[i] = 0;
-	}
+	output_file_ppm << interval_size;
+	ppm_output(output_file_ppm, t->ppm, true);
+	output_file_ppm.close();
 }
 
-VOID ppm_instr_interval(){
-
-
-	ppm_instr_interval_output();
-	ppm_instr_interval_reset();
+VOID ppm_instr_interval_reset(mica_thread* t){
 
-	interval_ins_count = 0;
-	interval_ins_count_for_hpc_alignment = 0;
+	int i;
+	UINT32 j;
+	ppm_state* p = t->ppm;
+
+	for(j = 0; j < _ppm_hist_length_cnt; j++){
+		p->GAg_incorrect_pred[j] = 0;
+		p->GAs_incorrect_pred[j] = 0;
+		p->PAg_incorrect_pred[j] = 0;
+		p->PAs_incorrect_pred[j] = 0;
+	}
+	for(i=0; i < p->brHist_size; i++){
+		p->local_brCounts[i] = 0;
+		p->local_taken_counts[i] = 0;
+		p->transition_counts[i] = 0;
+	}
 }
 
 /* double memory space for branch history size when needed */
-VOID reallocate_brHist(){
-
-	INT32* int_ptr;
-	char* char_ptr;
-	char**** char4_ptr;
-	INT64* int64_ptr;
-
-	brHist_size = brHist_size*2;
-
-	int_ptr = (INT32*) checked_realloc(local_bhr,brHist_size * sizeof(INT32));
-	/*if(int_ptr == (INT32*) NULL) {
-		cerr << "Could not allocate memory" << endl;
-		exit(1);
-	}*/
-	local_bhr = int_ptr;
-
-	char_ptr = (char*) checked_realloc(GAs_touched, brHist_size * sizeof(char));
-	/*if(char_ptr == (char*) NULL){
-		cerr << "Could not allocate memory" << endl;
-		exit(1);
-	}*/
-	GAs_touched = char_ptr;
-
-	char4_ptr = (char****) checked_realloc(GAs_pht,brHist_size * sizeof(char***));
-	/*if(char4_ptr == (char****) NULL) {
-		cerr << "Could not allocate memory" << endl;
-		exit(1);
-	}*/
-	GAs_pht = char4_ptr;
-
-	char_ptr = (char*) checked_realloc(PAs_touched,brHist_size * sizeof(char));
-	/*if(char_ptr == (char*) NULL) {
-		cerr << "Could not allocate memory" << endl;
-		exit(1);
-	}*/
-	PAs_touched = char_ptr;
-
-	char4_ptr = (char****) checked_realloc(PAs_pht,brHist_size * sizeof(char***));
-	/*if(char4_ptr == (char****) NULL) {
-		cerr << "Could not allocate memory" << endl;
-		exit(1);
-	}*/
-	PAs_pht = char4_ptr;
-
-	char_ptr = (char*) checked_realloc(local_taken,brHist_size * sizeof(char));
-	/*if(char_ptr == (char*) NULL) {
-		cerr << "Could not allocate memory" << endl;
-		exit(1);
-	}*/
-	local_taken = char_ptr;
-
-	int64_ptr = (INT64*) realloc(transition_counts, brHist_size * sizeof(INT64));
-	/*if(int64_ptr == (INT64*)NULL) {
-		cerr,"Could not allocate memory" << endl;
-		exit(1);
-	}*/
-	transition_counts = int64_ptr;
-
-	int64_ptr = (INT64*) realloc(local_brCounts, brHist_size * sizeof(INT64));
-	/*if(int64_ptr == (INT64*)NULL) {
-		cerr << "Could not allocate memory" << endl;
-		exit(1);
-	}*/
-	local_brCounts = int64_ptr;
-
-	int64_ptr = (INT64*) realloc(local_taken_counts, brHist_size * sizeof(INT64));
-	/*if(int64_ptr == (INT64*)NULL) {
-		cerr << "Could not allocate memory" << endl;
-		exit(1);
-	}*/
-	local_taken_counts = int64_ptr;
+VOID reallocate_brHist(ppm_state* p){
+
+	INT64 i;
+	INT64 old_size = p->brHist_size;
+
+	p->brHist_size = p->brHist_size*2;
+
+	p->local_bhr = (INT32*) checked_realloc(p->local_bhr, p->brHist_size * sizeof(INT32));
+	p->pht_slot = (UINT32*) checked_realloc(p->pht_slot, p->brHist_size * sizeof(UINT32));
+	p->local_taken = (char*) checked_realloc(p->local_taken, p->brHist_size * sizeof(char));
+	p->transition_counts = (INT64*) checked_realloc(p->transition_counts, p->brHist_size * sizeof(INT64));
+	p->local_brCounts = (INT64*) checked_realloc(p->local_brCounts, p->brHist_size * sizeof(INT64));
+	p->local_taken_counts = (INT64*) checked_realloc(p->local_taken_counts, p->brHist_size * sizeof(INT64));
+
+	for(i = old_size; i < p->brHist_size; i++){
+		p->local_bhr[i] = 0;
+		p->transition_counts[i] = 0;
+		p->local_taken[i] = -1;
+		p->local_brCounts[i] = 0;
+		p->local_taken_counts[i] = 0;
+		p->pht_slot[i] = 0;
+	}
 }
 
+/* GAs PHTs of the branch, followed by its PAs PHTs (allocated when the branch executes for the first time) */
+static inline char* ppm_branch_pht(ppm_state* p, UINT32 id){
 
-VOID condBr(UINT32 id, BOOL _t){
+	if(p->pht_slot[id] == 0){
+		if(p->pht_arena_cnt == p->pht_arena_size){
+			p->pht_arena_size *= 2;
+			p->pht_arena = (char*) checked_realloc(p->pht_arena, (size_t)p->pht_arena_size * 2 * ppm_branch_pht_size * sizeof(char));
+		}
+		p->pht_slot[id] = p->pht_arena_cnt++;
+		memset(p->pht_arena + (size_t)p->pht_slot[id] * 2 * ppm_branch_pht_size, -1, 2 * ppm_branch_pht_size * sizeof(char));
+	}
+	return p->pht_arena + (size_t)p->pht_slot[id] * 2 * ppm_branch_pht_size;
+}
 
-	int i,j,k;
-	int hist;
-	BOOL taken = (_t != 0) ? 1 : 0;
+/* the prediction is made by the highest order PHT (the longest history) with a counter which is set */
+template <int H>
+static inline void ppm_predict(char* pht, INT32 history, int* pred_hist, INT32* pred_taken){
 
-	/* predict direction */
+	int i;
+	char c;
+
+	for(i = H; i >= 0; i--){
+		c = pht[(1 << i) - 1 + (history & ((1 << i) - 1))];
+		if(c != 0){
+			*pred_hist = i; // used to only update predictor doing the prediction and higher order predictors (update exclusion)
+			*pred_taken = (c > 0) ? 1 : 0;
+			break;
+		}
+	}
+}
 
-	/* GAs PPM predictor lookup */
-	if(!GAs_touched[id]){
-		/* allocate PPM predictor */
+/* using update exclusion: only update predictor doing the prediction and higher order predictors */
+template <int H>
+static inline void ppm_update(char* pht, INT32 history, int pred_hist, BOOL taken){
 
-		GAs_touched[id] = 1;
+	int i;
+	char* c;
 
-		GAs_pht[id] = (char***) checked_malloc(NUM_HIST_LENGTHS * sizeof(char**));
-		for(j = 0; j < NUM_HIST_LENGTHS; j++){
-			GAs_pht[id][j] = (char**) checked_malloc((history_lengths[j]+1) * sizeof(char*));
-			for(i = 0; i <= (int)history_lengths[j]; i++){
-				GAs_pht[id][j][i] = (char*) checked_malloc((1 << i) * sizeof(char));
-				for(k = 0; k < (1<<i); k++){
-					GAs_pht[id][j][i][k] = -1;
-				}
-			}
+	for(i = pred_hist; i <= H; i++){
+		c = &pht[(1 << i) - 1 + (history & ((1 << i) - 1))];
+		if(taken){
+			if(*c < 127)
+				(*c)++;
+		}
+		else{
+			if(*c > -127)
+				(*c)--;
+		}
+		/* avoid == 0 because that means 'not set' */
+		if(*c == 0){
+			if(taken)
+				(*c)++;
+			else
+				(*c)--;
 		}
 	}
+}
 
-	/* PAs PPM predictor lookup */
-	if(!PAs_touched[id]){
-		/* allocate PPM predictor */
+/* predicts the branch with the 4 predictors using history length j, counts the mispredictions and
+ * updates the predictors; specialized on the history length H (_ppm_hist_lengths[j]), so the loops
+ * over the orders have constant bounds and table offsets (GAs and PAs are the PHTs of the branch) */
+template <int H>
+static VOID ppm_kernel(ppm_state* p, UINT32 j, UINT32 id, char* GAs, char* PAs, BOOL taken){
 
-		PAs_touched[id] = 1;
+	INT32 bhr = p->bhr;
+	INT32 local_bhr = p->local_bhr[id];
+	char* GAg = p->GAg_pht + ppm_pht_offsets[j];
+	char* PAg = p->PAg_pht + ppm_pht_offsets[j];
 
-		PAs_pht[id] = (char***) checked_malloc(NUM_HIST_LENGTHS * sizeof(char**));
-		for(j = 0; j < NUM_HIST_LENGTHS; j++){
-			PAs_pht[id][j] = (char**) checked_malloc((history_lengths[j]+1) * sizeof(char*));
-			for(i = 0; i <= (int)history_lengths[j]; i++){
-				PAs_pht[id][j][i] = (char*) checked_malloc((1 << i) * sizeof(char));
-				for(k = 0; k < (1 << i); k++){
-					PAs_pht[id][j][i][k] = -1;
-				}
-			}
-		}
-	}
+	/* predict direction */
+	ppm_predict<H>(GAg, bhr, &p->GAg_pred_hist[j], &p->GAg_pred_taken[j]);
+	ppm_predict<H>(PAg, local_bhr, &p->PAg_pred_hist[j], &p->PAg_pred_taken[j]);
+	ppm_predict<H>(GAs, bhr, &p->GAs_pred_hist[j], &p->GAs_pred_taken[j]);
+	ppm_predict<H>(PAs, local_bhr, &p->PAs_pred_hist[j], &p->PAs_pred_taken[j]);
+
+	/* update statistics according to predictions */
+	if(taken != p->GAg_pred_taken[j])
+		p->GAg_incorrect_pred[j]++;
+	if(taken != p->GAs_pred_taken[j])
+		p->GAs_incorrect_pred[j]++;
+	if(taken != p->PAg_pred_taken[j])
+		p->PAg_incorrect_pred[j]++;
+	if(taken != p->PAs_pred_taken[j])
+		p->PAs_incorrect_pred[j]++;
+
+	/* update PPM pattern history tables */
+	ppm_update<H>(GAg, bhr, p->GAg_pred_hist[j], taken);
+	ppm_update<H>(PAg, local_bhr, p->PAg_pred_hist[j], taken);
+	ppm_update<H>(GAs, bhr, p->GAs_pred_hist[j], taken);
+	ppm_update<H>(PAs, local_bhr, p->PAs_pred_hist[j], taken);
+}
 
-	for(j = 0; j < NUM_HIST_LENGTHS; j++){
-		/* GAg PPM predictor lookup */
-		for(i = (int)history_lengths[j]; i >= 0; i--){
-
-			hist = bhr & (((int) 1 << i) -1);
-			if(GAg_pht[j][i][hist] != 0){
-				GAg_pred_hist[j] = i; // used to only update predictor doing the prediction and higher order predictors (update exclusion)
-				if(GAg_pht[j][i][hist] > 0)
-					GAg_pred_taken[j] = 1;
-				else
-					GAg_pred_taken[j] = 0;
-				break;
-			}
-		}
+VOID condBr(mica_thread* t, UINT32 id, BOOL _t){
 
-		/* PAg PPM predictor lookup */
-		for(i = (int)history_lengths[j]; i >= 0; i--){
-			hist = local_bhr[id] & (((int) 1 << i) -1);
-			if(PAg_pht[j][i][hist] != 0){
-				PAg_pred_hist[j] = i;
-				if(PAg_pht[j][i][hist] > 0)
-					PAg_pred_taken[j] = 1;
-				else
-					PAg_pred_taken[j] = 0;
-				break;
-			}
-		}
+	UINT32 j;
+	char* branch_pht = NULL;
+	char* GAs_pht;
+	char* PAs_pht;
+	BOOL taken = (_t != 0) ? 1 : 0;
+	ppm_state* p = t->ppm;
 
-		/* GAs PPM predictor lookup */
-		for(i = (int)history_lengths[j]; i >= 0; i--){
-			hist = bhr & (((int) 1 << i) -1);
-			if(GAs_pht[id][j][i][hist] != 0){
-				GAs_pred_hist[j] = i;
-				if(GAs_pht[id][j][i][hist] > 0)
-					GAs_pred_taken[j] = 1;
-				else
-					GAs_pred_taken[j] = 0;
-				break;
-			}
-		}
+	/* branch ids are assigned globally, so grow this thread's tables if needed */
+	while(id >= p->brHist_size)
+		reallocate_brHist(p);
 
-		/* PAs PPM predictor lookup */
-		for(i = (int)history_lengths[j]; i >= 0; i--){
-			hist = local_bhr[id] & (((int) 1 << i) -1);
-			if(PAs_pht[id][j][i][hist] != 0){
-				PAs_pred_hist[j] = i;
-				if(PAs_pht[id][j][i][hist] > 0)
-					PAs_pred_taken[j] = 1;
-				else
-					PAs_pred_taken[j] = 0;
-				break;
-			}
+	if(ppm_branch_pht_size > 0)
+		branch_pht = ppm_branch_pht(p, id);
+
+	/* the history lengths are independent predictors; each static branch has two ids, so the
+	 * shared sets are selected by the bits above the lowest one */
+	for(j = 0; j < _ppm_hist_length_cnt; j++){
+		if(ppm_shared_sets[j] == 0){
+			GAs_pht = branch_pht + ppm_branch_pht_offsets[j];
+			PAs_pht = GAs_pht + ppm_branch_pht_size;
+		}
+		else{
+			GAs_pht = p->shared_pht[j] + (size_t)((id >> 1) & (ppm_shared_sets[j] - 1)) * ppm_shared_set_size[j];
+			PAs_pht = GAs_pht + (size_t)ppm_shared_sets[j] * ppm_shared_set_size[j];
 		}
+		ppm_kernels[j](p, j, id, GAs_pht, PAs_pht, taken);
 	}
 
 	/* transition/taken rate */
-	if(local_taken[id] > -1){
-		if(taken != local_taken[id])
-			transition_counts[id]++;
+	if(p->local_taken[id] > -1){
+		if(taken != p->local_taken[id])
+			p->transition_counts[id]++;
 	}
-	local_taken[id] = taken;
-	local_brCounts[id]++;
+	p->local_taken[id] = taken;
+	p->local_brCounts[id]++;
 	if(taken)
-		local_taken_counts[id]++;
-
-	for(j=0; j < NUM_HIST_LENGTHS; j++){
-		/* update statistics according to predictions */
-		if(taken != GAg_pred_taken[j])
-			GAg_incorrect_pred[j]++;
-		if(taken != GAs_pred_taken[j])
-			GAs_incorrect_pred[j]++;
-		if(taken != PAg_pred_taken[j])
-			PAg_incorrect_pred[j]++;
-		if(taken != PAs_pred_taken[j])
-			PAs_incorrect_pred[j]++;
-
-		/* using update exclusion: only update predictor doing the prediction and higher order predictors */
-
-		/* update GAg PPM pattern history tables */
-		for(i = (int)GAg_pred_hist[j]; i <= (int)history_lengths[j]; i++){
-			hist = bhr & ((1 << i) - 1);
-			if(taken){
-				if(GAg_pht[j][i][hist] < 127)
-					GAg_pht[j][i][hist]++;
-			}
-			else{
-				if(GAg_pht[j][i][hist] > -127)
-					GAg_pht[j][i][hist]--;
-			}
-			/* avoid == 0 because that means 'not set' */
-			if(GAg_pht[j][i][hist] == 0){
-				if(taken){
-					GAg_pht[j][i][hist]++;
-				}
-				else{
-					GAg_pht[j][i][hist]--;
-				}
-			}
-		}
-		/* update PAg PPM pattern history tables */
-		for(i = (int)PAg_pred_hist[j]; i <= (int)history_lengths[j]; i++){
-			hist = local_bhr[id] & ((1 << i) - 1);
-			if(taken){
-				if(PAg_pht[j][i][hist] < 127)
-					PAg_pht[j][i][hist]++;
-			}
-			else{
-				if(PAg_pht[j][i][hist] > -127)
-					PAg_pht[j][i][hist]--;
-			}
-			/* avoid == 0 because that means 'not set' */
-			if(PAg_pht[j][i][hist] == 0){
-				if(taken){
-					PAg_pht[j][i][hist]++;
-				}
-				else{
-					PAg_pht[j][i][hist]--;
-				}
-			}
-		}
-		/* update GAs PPM pattern history tables */
-		for(i = (int)GAs_pred_hist[j]; i <= (int)history_lengths[j]; i++){
-			hist = bhr & ((1 << i) - 1);
-			if(taken){
-				if(GAs_pht[id][j][i][hist] < 127)
-					GAs_pht[id][j][i][hist]++;
-			}
-			else{
-				if(GAs_pht[id][j][i][hist] > -127)
-					GAs_pht[id][j][i][hist]--;
-			}
-			/* avoid == 0 because that means 'not set' */
-			if(GAs_pht[id][j][i][hist] == 0){
-				if(taken){
-					GAs_pht[id][j][i][hist]++;
-				}
-				else{
-					GAs_pht[id][j][i][hist]--;
-				}
-			}
-		}
-		/* update PAs PPM pattern history tables */
-		for(i = (int)PAs_pred_hist[j]; i <= (int)history_lengths[j]; i++){
-			hist = local_bhr[id] & ((1 << i) - 1);
-			if(taken){
-				if(PAs_pht[id][j][i][hist] < 127)
-					PAs_pht[id][j][i][hist]++;
-			}
-			else{
-				if(PAs_pht[id][j][i][hist] > -127)
-					PAs_pht[id][j][i][hist]--;
-			}
-			/* avoid == 0 because that means 'not set' */
-			if(PAs_pht[id][j][i][hist] == 0){
-				if(taken){
-					PAs_pht[id][j][i][hist]++;
-				}
-				else{
-					PAs_pht[id][j][i][hist]--;
-				}
-			}
-		}
-	}
+		p->local_taken_counts[id]++;
 
 	/* update global history register */
-	bhr = bhr << 1;
-	bhr |= taken;
+	p->bhr = p->bhr << 1;
+	p->bhr |= taken;
 
 	/* update local history */
-	local_bhr[id] = local_bhr[id] << 1;
-	local_bhr[id] |= taken;
+	p->local_bhr[id] = p->local_bhr[id] << 1;
+	p->local_bhr[id] |= taken;
 }
 
-/* index for static conditional branch */
-UINT32 index_condBr(ADDRINT ins_addr){
-
-	UINT64 i;
-	for(i=0; i <= numStatCondBranchInst; i++){
-		if(indices_condBr[i] == ins_addr)
-			return i; /* found */
-	}
-	return 0; /* not found */
-}
-
-/* register static conditional branch with some index */
-void register_condBr(ADDRINT ins_addr){
-
-	ADDRINT* ptr;
-
-	/* reallocation needed */
-	if(numStatCondBranchInst >= indices_condBr_size){
-
-		indices_condBr_size *= 2;
-		ptr = (ADDRINT*) realloc(indices_condBr, indices_condBr_size*sizeof(ADDRINT));
-		/*if(ptr == (ADDRINT*)NULL){
-			cerr << "Could not allocate memory (realloc in register_condBr)!" << endl;
-			exit(1);
-		}*/
-		indices_condBr = ptr;
-
-	}
-
-	/* register instruction to index */
-	indices_condBr[numStatCondBranchInst++] = ins_addr;
+VOID condBr_tid(THREADID tid, UINT32 id, BOOL _t){
+	condBr(get_mica_thread(tid), id, _t);
 }
 
 // static int _count  = 0;
 VOID instrument_ppm_cond_br(INS ins){
-    UINT32 index = index_condBr(INS_Address(ins));
+    UINT32 index = ins_index_lookup(&indices_condBr, INS_Address(ins));
 	if(index < 1){
 
 		/* We don't know the number of static conditional branch instructions up front,
-		 * so we double the size of the branch history tables as needed by calling this function */
-		if(numStatCondBranchInst >= brHist_size)
-			reallocate_brHist();
-
+		 * so the per-thread branch history tables are grown on demand in condBr */
 		index = numStatCondBranchInst;
 
-		register_condBr(INS_Address(ins));
-        register_condBr(INS_Address(ins));
+		/* each static branch reserves two ids */
+		ins_index_insert(&indices_condBr, INS_Address(ins), index);
+		numStatCondBranchInst += 2;
 	}
     
     const char* str = INS_Disassemble(ins).c_str();
@@ -559,7 +444,7 @@ VOID instrument_ppm_cond_br(INS ins){
         printf("as of pin 3.4 -- I don't think we can parse xend so skipping...\n");
         return;
     }
-    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)condBr,IARG_UINT32, index, IARG_BRANCH_TAKEN, IARG_END);
+    mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, condBr_tid, IARG_THREAD_ID, IARG_UINT32, index, IARG_BRANCH_TAKEN, IARG_END);
 }
 
 /* instrumenting (instruction level) */
@@ -572,13 +457,7 @@ VOID instrument_ppm(INS ins, VOID* v){
 		instrument_ppm_cond_br(ins);
 	}
 
-	/* inserting calls for counting instructions (full) is done in mica.cpp */
-
-	if(interval_size != -1){
-		INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)ppm_instr_intervals,IARG_END);
-		/* only called if interval is 'full' */
-		INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)ppm_instr_interval,IARG_END);
-	}
+	/* inserting calls for counting instructions and checking interval boundaries is done in mica.cpp */
 }
 
 
@@ -586,37 +465,80 @@ VOID instrument_ppm(INS ins, VOID* v){
 VOID fini_ppm(INT32 code, VOID* v){
 
 	int i;
-
-	if(interval_size == -1){
-		output_file_ppm.open(mkfilename("ppm_full_int"), ios::out|ios::trunc);
-		//output_file_ppm << total_ins_count;
-	}
-	else{
-		output_file_ppm.open(mkfilename("ppm_phases_int"), ios::out|ios::app);
-		//output_file_ppm << interval_ins_count;
+	UINT32 j,k;
+	mica_thread* t;
+	ppm_state* merged;
+	ofstream output_file_ppm;
+
+	for(k=0; k < mica_thread_cnt; k++){
+		t = mica_threads[k];
+		if(interval_size == -1){
+			output_file_ppm.open(mkfilename_thread("ppm_full_int", t->tid), ios::out|ios::trunc);
+			//output_file_ppm << total_ins_count;
+		}
+		else{
+			output_file_ppm.open(mkfilename_thread("ppm_phases_int", t->tid), ios::out|ios::app);
+			//output_file_ppm << interval_ins_count;
+		}
+		ppm_output(output_file_ppm, t->ppm, false);
+		//output_file_ppm << "number of instructions: " << total_ins_count_for_hpc_alignment << endl;
+		output_file_ppm << " ";
+		output_file_ppm.close();
 	}
-	for(i=0; i < NUM_HIST_LENGTHS; i++)
-		output_file_ppm << GAg_incorrect_pred[i] << " " << PAg_incorrect_pred[i] << " " << GAs_incorrect_pred[i] << " " << PAs_incorrect_pred[i] << " ";
-
-	INT64 total_transition_count = 0;
-	INT64 total_taken_count = 0;
-	INT64 total_brCount = 0;
-	for(i=0; i < brHist_size; i++){
-		if(local_brCounts[i] > 0){
-			if( transition_counts[i] > local_brCounts[i]/2)
-				total_transition_count += local_brCounts[i]-transition_counts[i];
-			else
-				total_transition_count += transition_counts[i];
 
-			if( local_taken_counts[i] > local_brCounts[i]/2)
-				total_taken_count += local_brCounts[i] - local_taken_counts[i];
-			else
-				total_taken_count += local_taken_counts[i];
-			total_brCount += local_brCounts[i];
+	if(interval_size == -1 && mica_thread_cnt > 1){
+		/* misprediction counts are summed, per-branch statistics are summed per static branch */
+		merged = (ppm_state*) checked_malloc(sizeof(ppm_state));
+		merged->brHist_size = 0;
+		for(k=0; k < mica_thread_cnt; k++){
+			if(mica_threads[k]->ppm->brHist_size > merged->brHist_size)
+				merged->brHist_size = mica_threads[k]->ppm->brHist_size;
+		}
+		merged->transition_counts = (INT64*) checked_malloc(merged->brHist_size * sizeof(INT64));
+		merged->local_brCounts = (INT64*) checked_malloc(merged->brHist_size * sizeof(INT64));
+		merged->local_taken_counts = (INT64*) checked_malloc(merged->brHist_size * sizeof(INT64));
+		for(i=0; i < merged->brHist_size; i++){
+			merged->transition_counts[i] = 0;
+			merged->local_brCounts[i] = 0;
+			merged->local_taken_counts[i] = 0;
+		}
+		for(j=0; j < _ppm_hist_length_cnt; j++){
+			merged->GAg_incorrect_pred[j] = 0;
+			merged->GAs_incorrect_pred[j] = 0;
+			merged->PAg_incorrect_pred[j] = 0;
+			merged->PAs_incorrect_pred[j] = 0;
 		}
+		for(k=0; k < mica_thread_cnt; k++){
+			ppm_state* p = mica_threads[k]->ppm;
+			for(j=0; j < _ppm_hist_length_cnt; j++){
+				merged->GAg_incorrect_pred[j] += p->GAg_incorrect_pred[j];
+				merged->GAs_incorrect_pred[j] += p->GAs_incorrect_pred[j];
+				merged->PAg_incorrect_pred[j] += p->PAg_incorrect_pred[j];
+				merged->PAs_incorrect_pred[j] += p->PAs_incorrect_pred[j];
+			}
+			for(i=0; i < p->brHist_size; i++){
+				merged->transition_counts[i] += p->transition_counts[i];
+				merged->local_brCounts[i] += p->local_brCounts[i];
+				merged->local_taken_counts[i] += p->local_taken_counts[i];
+			}
+		}
+		output_file_ppm.open(mkfilename("ppm_full_int_merged"), ios::out|ios::trunc);
+		ppm_output(output_file_ppm, merged, false);
+		output_file_ppm << " ";
+		output_file_ppm.close();
+
+		free(merged->transition_counts);
+		free(merged->local_brCounts);
+		free(merged->local_taken_counts);
+		free(merged);
 	}
-	output_file_ppm << total_brCount << " " << total_transition_count << " " << total_taken_count << endl;
-	//output_file_ppm << "number of instructions: " << total_ins_count_for_hpc_alignment << endl;
-	output_file_ppm << " ";
-	output_file_ppm.close();
 }
+
+/* kernels instantiated for every supported history length, indexed by history length */
+const ppm_kernel_fun ppm_kernels_by_length[MAX_HIST_LENGTH + 1] = {
+	NULL,
+	ppm_kernel<1>, ppm_kernel<2>, ppm_kernel<3>, ppm_kernel<4>, ppm_kernel<5>, ppm_kernel<6>,
+	ppm_kernel<7>, ppm_kernel<8>, ppm_kernel<9>, ppm_kernel<10>, ppm_kernel<11>, ppm_kernel<12>,
+	ppm_kernel<13>, ppm_kernel<14>, ppm_kernel<15>, ppm_kernel<16>, ppm_kernel<17>, ppm_kernel<18>,
+	ppm_kernel<19>, ppm_kernel<20>, ppm_kernel<21>, ppm_kernel<22>, ppm_kernel<23>, ppm_kernel<24>
+};
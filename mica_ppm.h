@@ -8,11 +8,13 @@
  */
 
 #include "mica.h"
+#include "mica_utils.h"
 
 void init_ppm();
+VOID init_ppm_thread(mica_thread* t);
 VOID instrument_ppm(INS ins, VOID* v);
 VOID fini_ppm(INT32 code, VOID* v);
 
 VOID instrument_ppm_cond_br(INS ins);
-VOID ppm_instr_interval_output();
-VOID ppm_instr_interval_reset();
+VOID ppm_instr_interval_output(mica_thread* t);
+VOID ppm_instr_interval_reset(mica_thread* t);
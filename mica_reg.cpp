@@ -15,98 +15,110 @@
 /* Global variables */
 
 extern INT64 interval_size;
-extern INT64 interval_ins_count;
-extern INT64 interval_ins_count_for_hpc_alignment;
-extern INT64 total_ins_count;
-extern INT64 total_ins_count_for_hpc_alignment;
 
-ofstream output_file_reg;
-
-UINT64* opCounts; // array which keeps track of number-of-operands-per-instruction stats
-BOOL* regRef; // register references
-INT64* PCTable; // production addresses of registers
-INT64* regUseCnt; // usage counters for each register
-INT64* regUseDistr; // distribution of register usage
-INT64* regAgeDistr; // distribution of register ages
+/* per-thread state */
+typedef struct reg_state_type {
+	UINT64* opCounts; // array which keeps track of number-of-operands-per-instruction stats
+	BOOL* regRef; // register references
+	INT64* PCTable; // production addresses of registers
+	INT64* regUseCnt; // usage counters for each register
+	INT64* regUseDistr; // distribution of register usage
+	INT64* regAgeDistr; // distribution of register ages
+} reg_state;
 
 /* initializing */
 void init_reg(){
 
+	/* initializing total instruction counts is done in mica.cpp */
+
+	/* all state is per thread, see init_reg_thread */
+
+	interval_register(reg_instr_interval_output, reg_instr_interval_reset);
+}
+
+VOID init_reg_thread(mica_thread* t){
+
 	int i;
+	reg_state* r = (reg_state*) checked_aligned_malloc(sizeof(reg_state));
 
-	/* initializing total instruction counts is done in mica.cpp */
+	t->reg = r;
 
 	/* allocate memory */
-	opCounts = (UINT64*) checked_malloc(MAX_NUM_OPER * sizeof(UINT64));
-	regRef = (BOOL*) checked_malloc(MAX_NUM_REGS * sizeof(BOOL));
-	PCTable = (INT64*) checked_malloc(MAX_NUM_REGS * sizeof(INT64));
-	regUseCnt = (INT64*) checked_malloc(MAX_NUM_REGS * sizeof(INT64));
-	regUseDistr = (INT64*) checked_malloc(MAX_REG_USE * sizeof(INT64));
-	regAgeDistr = (INT64*) checked_malloc(MAX_COMM_DIST * sizeof(INT64));
+	r->opCounts = (UINT64*) checked_malloc(MAX_NUM_OPER * sizeof(UINT64));
+	r->regRef = (BOOL*) checked_malloc(MAX_NUM_REGS * sizeof(BOOL));
+	r->PCTable = (INT64*) checked_malloc(MAX_NUM_REGS * sizeof(INT64));
+	r->regUseCnt = (INT64*) checked_malloc(MAX_NUM_REGS * sizeof(INT64));
+	r->regUseDistr = (INT64*) checked_malloc(MAX_REG_USE * sizeof(INT64));
+	r->regAgeDistr = (INT64*) checked_malloc(MAX_COMM_DIST * sizeof(INT64));
 
 	/* initialize */
 	for(i = 0; i < MAX_NUM_OPER; i++){
-		opCounts[i] = 0;
+		r->opCounts[i] = 0;
 	}
 	for(i = 0; i < MAX_NUM_REGS; i++){
-		regRef[i] = false;
-		PCTable[i] = 0;
-		regUseCnt[i] = 0;
+		r->regRef[i] = false;
+		r->PCTable[i] = 0;
+		r->regUseCnt[i] = 0;
 	}
 	for(i = 0; i < MAX_REG_USE; i++){
-		regUseDistr[i] = 0;
+		r->regUseDistr[i] = 0;
 	}
 	for(i = 0; i < MAX_COMM_DIST; i++){
-		regAgeDistr[i] = 0;
+		r->regAgeDistr[i] = 0;
 	}
 
 	if(interval_size != -1){
-		output_file_reg.open(mkfilename("reg_phases_int"), ios::out|ios::trunc);
+		ofstream output_file_reg;
+		output_file_reg.open(mkfilename_thread("reg_phases_int", t->tid), ios::out|ios::trunc);
 		output_file_reg.close();
 	}
 }
 
 /* read register operand */
-VOID readRegOp_reg(UINT32 regId){
+VOID readRegOp_reg(mica_thread* t, UINT32 regId, UINT32 lag){
+
+	reg_state* r = t->reg;
 
 	/* *** REG *** */
 
 
 	/* register age */
-	INT64 age = total_ins_count - PCTable[regId]; // dependency distance
+	INT64 age = t->total_ins_count - lag - r->PCTable[regId]; // dependency distance
 	if(age >= MAX_COMM_DIST){
 		age = MAX_COMM_DIST - 1; // trim if needed
 	}
 	//assert(age >= 0);
-	regAgeDistr[age]++;
+	r->regAgeDistr[age]++;
 
 	/* register usage */
-	regUseCnt[regId]++;
-	regRef[regId] = 1; // (operand) register was referenced
+	r->regUseCnt[regId]++;
+	r->regRef[regId] = 1; // (operand) register was referenced
 }
 
-VOID writeRegOp_reg(UINT32 regId){
+VOID writeRegOp_reg(mica_thread* t, UINT32 regId, UINT32 lag){
+
+	reg_state* r = t->reg;
 
 	/* *** REG *** */
 	UINT32 num;
 
 	/* if register was referenced before, adjust use distribution */
-	if(regRef[regId]){
-		num = regUseCnt[regId];
+	if(r->regRef[regId]){
+		num = r->regUseCnt[regId];
 		if(num >= MAX_REG_USE) // trim if needed
 			num = MAX_REG_USE - 1;
 		//assert(num >= 0);
-		regUseDistr[num]++;
+		r->regUseDistr[num]++;
 	}
 
 	/* reset register stuff because of new value produced */
 
-	PCTable[regId] = total_ins_count; // last production = now
-	regUseCnt[regId] = 0; // new value is never used (yet)
-	regRef[regId] = true; // (destination) register was referenced (for tracking use distribution)
+	r->PCTable[regId] = t->total_ins_count - lag; // last production = now
+	r->regUseCnt[regId] = 0; // new value is never used (yet)
+	r->regRef[regId] = true; // (destination) register was referenced (for tracking use distribution)
 }
 
-VOID reg_instr_full(VOID* _e){
+VOID reg_instr_full(mica_thread* t, VOID* _e, UINT32 lag){
 
 	/* counting instructions is done in all_instr_full() */
 
@@ -115,110 +127,93 @@ VOID reg_instr_full(VOID* _e){
 	INT32 i;
 
 	for(i=0; i < e->regReadCnt; i++){
-		readRegOp_reg((UINT32)e->regsRead[i]);
+		readRegOp_reg(t, (UINT32)e->regsRead[i], lag);
 	}
 	for(i=0; i < e->regWriteCnt; i++){
-		writeRegOp_reg((UINT32)e->regsWritten[i]);
+		writeRegOp_reg(t, (UINT32)e->regsWritten[i], lag);
 	}
 
-	opCounts[e->regOpCnt]++;
+	t->reg->opCounts[e->regOpCnt]++;
 }
 
-ADDRINT reg_instr_intervals(VOID* _e) {
-
-	/* counting instructions is done in all_instr_intervals() */
-
-	ins_buffer_entry* e = (ins_buffer_entry*)_e;
-
-	INT32 i;
-
-	for(i=0; i < e->regReadCnt; i++){
-		readRegOp_reg((UINT32)e->regsRead[i]);
-	}
-	for(i=0; i < e->regWriteCnt; i++){
-		writeRegOp_reg((UINT32)e->regsWritten[i]);
-	}
-
-	opCounts[e->regOpCnt]++;
-
-	return (ADDRINT) (interval_ins_count_for_hpc_alignment == interval_size);
+VOID reg_instr_full_tid(THREADID tid, VOID* _e, UINT32 lag){
+	reg_instr_full(get_mica_thread(tid), _e, lag);
 }
 
-VOID reg_instr_interval_output(){
+/* operand count, degree of use and register dependency distribution */
+static VOID reg_output(ofstream& output_file_reg, reg_state* r){
 	int i;
-
-	output_file_reg.open(mkfilename("reg_phases_int"), ios::out|ios::app);
-
 	UINT64 totNumOps = 0;
 	UINT64 num;
 
 	/* total number of operands */
 	for(i = 1; i < MAX_NUM_OPER; i++){
-		totNumOps += opCounts[i]*i;
+		totNumOps += r->opCounts[i]*i;
 	}
-	output_file_reg << interval_size << " " << totNumOps;
+	output_file_reg << totNumOps;
 
 	/* average degree of use */
 	num = 0;
 	for(i = 0; i < MAX_REG_USE; i++){
-		num += regUseDistr[i];
+		num += r->regUseDistr[i];
 	}
 	output_file_reg << " " << num;
 	num = 0;
 	for(i = 0; i < MAX_REG_USE; i++){
-		num += i * regUseDistr[i];
+		num += i * r->regUseDistr[i];
 	}
 	output_file_reg << " " << num;
 
 	/* register dependency distributions */
 	num = 0;
 	for(i = 0; i < MAX_COMM_DIST; i++){
-		num += regAgeDistr[i];
+		num += r->regAgeDistr[i];
 	}
 	output_file_reg << " " << num;
 	num = 0;
 	for(i = 0; i < MAX_COMM_DIST; i++){
-		num += regAgeDistr[i];
+		num += r->regAgeDistr[i];
 		if( (i == 1) || (i == 2) || (i == 4) || (i == 8) || (i == 16) || (i == 32) || (i == 64)){
 			output_file_reg << " " << num;
 		}
 	}
 	output_file_reg << endl;
+}
+
+VOID reg_instr_interval_output(mica_thread* t){
+	ofstream output_file_reg;
+
+	output_file_reg.open(mkfilename_thread("reg_phases_int", t->tid), ios::out|ios::app);
+
+	output_file_reg << interval_size << " ";
+	reg_output(output_file_reg, t->reg);
 
 	output_file_reg.close();
 }
 
-VOID reg_instr_interval_reset(){
+VOID reg_instr_interval_reset(mica_thread* t){
 
 	int i;
+	reg_state* r = t->reg;
 
 	for(i = 0; i < MAX_NUM_OPER; i++){
-		opCounts[i] = 0;
+		r->opCounts[i] = 0;
 	}
 	/* do NOT reset register use counts or register definition addresses
 	 * that should only be done when the register is written to */
 	/* for(i = 0; i < MAX_NUM_REGS; i++){
-	   regRef[i] = false;
-	   PCTable[i] = 0;
-	   regUseCnt[i] = 0;
+	   r->regRef[i] = false;
+	   r->PCTable[i] = 0;
+	   r->regUseCnt[i] = 0;
 	   } */
 	for(i = 0; i < MAX_REG_USE; i++){
-		regUseDistr[i] = 0;
+		r->regUseDistr[i] = 0;
 	}
 	for(i = 0; i < MAX_COMM_DIST; i++){
-		regAgeDistr[i] = 0;
+		r->regAgeDistr[i] = 0;
 	}
 }
 
-VOID reg_instr_interval() {
-
-	reg_instr_interval_output();
-	reg_instr_interval_reset();
-	interval_ins_count = 0;
-	interval_ins_count_for_hpc_alignment = 0;
-
-}
-
 VOID instrument_reg(INS ins, ins_buffer_entry* e){
 
 
@@ -305,64 +300,61 @@ VOID instrument_reg(INS ins, ins_buffer_entry* e){
 		e->setRegOpCnt = true;
 	}
 
-	if(interval_size == -1){
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)reg_instr_full, IARG_PTR, (void*)e, IARG_END);
-	}
-	else{
-		INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)reg_instr_intervals, IARG_PTR, (void*)e, IARG_END);
-		/* only called if interval is full */
-		INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)reg_instr_interval, IARG_END);
-	}
+	/* interval boundaries are checked in mica.cpp */
+	mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, reg_instr_full_tid, IARG_THREAD_ID, IARG_PTR, (void*)e, IARG_UINT32, ins_lag, IARG_END);
 }
 
 /* finishing... */
 VOID fini_reg(INT32 code, VOID* v){
 
-	if(interval_size == -1){
-		output_file_reg.open(mkfilename("reg_full_int"), ios::out|ios::trunc);
-		//output_file_reg << total_ins_count;
-	}
-	else{
-		output_file_reg.open(mkfilename("reg_phases_int"), ios::out|ios::app);
-		//output_file_reg << interval_ins_count;
-	}
-
 	int i;
-	UINT64 totNumOps = 0;
-	UINT64 num;
-	/* total number of operands */
-	for(i = 1; i < MAX_NUM_OPER; i++){
-		totNumOps += opCounts[i]*i;
-	}
-	output_file_reg << totNumOps;
-
-	// ** average degree of use **
-	num = 0;
-	for(i = 0; i < MAX_REG_USE; i++){
-		num += regUseDistr[i];
-	}
-	output_file_reg << " " << num;
-	num = 0;
-	for(i = 0; i < MAX_REG_USE; i++){
-		num += i * regUseDistr[i];
+	UINT32 k;
+	mica_thread* t;
+	ofstream output_file_reg;
+
+	for(k=0; k < mica_thread_cnt; k++){
+		t = mica_threads[k];
+		if(interval_size == -1){
+			output_file_reg.open(mkfilename_thread("reg_full_int", t->tid), ios::out|ios::trunc);
+			//output_file_reg << total_ins_count;
+		}
+		else{
+			output_file_reg.open(mkfilename_thread("reg_phases_int", t->tid), ios::out|ios::app);
+			//output_file_reg << interval_ins_count;
+		}
+		reg_output(output_file_reg, t->reg);
+		//output_file_reg << "number of instructions: " << total_ins_count_for_hpc_alignment << endl;
+		output_file_reg << " ";
+		output_file_reg.close();
 	}
-	output_file_reg << " " << num;
 
-	// ** register dependency distributions **
-	num = 0;
-	for(i = 0; i < MAX_COMM_DIST; i++){
-		num += regAgeDistr[i];
-	}
-	output_file_reg << " " << num;
-	num = 0;
-	for(i = 0; i < MAX_COMM_DIST; i++){
-		num += regAgeDistr[i];
-		if( (i == 1) || (i == 2) || (i == 4) || (i == 8) || (i == 16) || (i == 32) || (i == 64)){
-			output_file_reg << " " << num;
+	if(interval_size == -1 && mica_thread_cnt > 1){
+		/* distributions are summed over all threads */
+		reg_state merged;
+		merged.opCounts = (UINT64*) checked_malloc(MAX_NUM_OPER * sizeof(UINT64));
+		merged.regUseDistr = (INT64*) checked_malloc(MAX_REG_USE * sizeof(INT64));
+		merged.regAgeDistr = (INT64*) checked_malloc(MAX_COMM_DIST * sizeof(INT64));
+		for(i = 0; i < MAX_NUM_OPER; i++){
+			merged.opCounts[i] = 0;
+			for(k=0; k < mica_thread_cnt; k++)
+				merged.opCounts[i] += mica_threads[k]->reg->opCounts[i];
+		}
+		for(i = 0; i < MAX_REG_USE; i++){
+			merged.regUseDistr[i] = 0;
+			for(k=0; k < mica_thread_cnt; k++)
+				merged.regUseDistr[i] += mica_threads[k]->reg->regUseDistr[i];
 		}
+		for(i = 0; i < MAX_COMM_DIST; i++){
+			merged.regAgeDistr[i] = 0;
+			for(k=0; k < mica_thread_cnt; k++)
+				merged.regAgeDistr[i] += mica_threads[k]->reg->regAgeDistr[i];
+		}
+		output_file_reg.open(mkfilename("reg_full_int_merged"), ios::out|ios::trunc);
+		reg_output(output_file_reg, &merged);
+		output_file_reg << " ";
+		output_file_reg.close();
+		free(merged.opCounts);
+		free(merged.regUseDistr);
+		free(merged.regAgeDistr);
 	}
-	output_file_reg << endl;
-	//output_file_reg << "number of instructions: " << total_ins_count_for_hpc_alignment << endl;
-	output_file_reg << " ";
-	output_file_reg.close();
 }
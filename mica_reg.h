@@ -11,11 +11,11 @@
 #include "mica_utils.h"
 
 void init_reg();
+VOID init_reg_thread(mica_thread* t);
 VOID instrument_reg(INS ins, ins_buffer_entry* e);
 VOID fini_reg(INT32 code, VOID* v);
 
-VOID reg_instr_full(VOID* _e);
-ADDRINT reg_instr_intervals(VOID* _e);
-VOID reg_instr_interval_output();
-VOID reg_instr_interval_reset();
+VOID reg_instr_full(mica_thread* t, VOID* _e, UINT32 lag);
+VOID reg_instr_interval_output(mica_thread* t);
+VOID reg_instr_interval_reset(mica_thread* t);
 
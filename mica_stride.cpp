@@ -16,79 +16,81 @@
 /* Global variables */
 
 extern INT64 interval_size;
-extern INT64 interval_ins_count;
-extern INT64 interval_ins_count_for_hpc_alignment;
-extern INT64 total_ins_count;
-extern INT64 total_ins_count_for_hpc_alignment;
 
-ofstream output_file_stride;
-
-UINT64 numRead, numWrite;
 UINT32 readIndex;
 UINT32 writeIndex;
-ADDRINT* instrRead;
-ADDRINT* instrWrite;
-UINT64 numInstrsAnalyzed;
-UINT64 numReadInstrsAnalyzed;
-UINT64 numWriteInstrsAnalyzed;
-UINT64 localReadDistrib[MAX_DISTR];
-UINT64 globalReadDistrib[MAX_DISTR];
-UINT64 localWriteDistrib[MAX_DISTR];
-UINT64 globalWriteDistrib[MAX_DISTR];
-ADDRINT lastReadAddr;
-ADDRINT lastWriteAddr;
-ADDRINT* indices_memRead;
-UINT32 indices_memRead_size;
-ADDRINT* indices_memWrite;
-UINT32 indices_memWrite_size;
+/* translation of instruction address to indices (the second read operand of an instruction has its own index) */
+ins_index indices_memRead1;
+ins_index indices_memRead2;
+ins_index indices_memWrite;
+
+/* per-thread state */
+typedef struct stride_state_type {
+	UINT64 numRead, numWrite;
+	ADDRINT* instrRead;
+	ADDRINT* instrWrite;
+	UINT64 numInstrsAnalyzed;
+	UINT64 numReadInstrsAnalyzed;
+	UINT64 numWriteInstrsAnalyzed;
+	UINT64 localReadDistrib[STRIDE_BUCKET_CNT];
+	UINT64 globalReadDistrib[STRIDE_BUCKET_CNT];
+	UINT64 localWriteDistrib[STRIDE_BUCKET_CNT];
+	UINT64 globalWriteDistrib[STRIDE_BUCKET_CNT];
+	ADDRINT lastReadAddr;
+	ADDRINT lastWriteAddr;
+} stride_state;
 
 
 /* initializing */
 void init_stride(){
 
+	/* initializing total instruction counts is done in mica.cpp */
+
+	readIndex = 1;
+	writeIndex = 1;
+
+	ins_index_init(&indices_memRead1);
+	ins_index_init(&indices_memRead2);
+	ins_index_init(&indices_memWrite);
+
+	interval_register(stride_instr_interval_output, stride_instr_interval_reset);
+}
+
+VOID init_stride_thread(mica_thread* t){
+
 	int i;
+	stride_state* s = (stride_state*) checked_aligned_malloc(sizeof(stride_state));
 
-	/* initializing total instruction counts is done in mica.cpp */
+	t->stride = s;
 
 	/* initial sizes */
-	numRead = 1024;
-	numWrite = 1024;
+	s->numRead = 1024;
+	s->numWrite = 1024;
 
 	/* allocate memory */
-	instrRead = (ADDRINT*) checked_malloc(numRead * sizeof(ADDRINT));
-	instrWrite = (ADDRINT*) checked_malloc(numWrite * sizeof(ADDRINT));
+	s->instrRead = (ADDRINT*) checked_malloc(s->numRead * sizeof(ADDRINT));
+	s->instrWrite = (ADDRINT*) checked_malloc(s->numWrite * sizeof(ADDRINT));
 
 	/* initialize */
-	readIndex = 1;
-	writeIndex = 1;
-	for (i = 0; i < (int)numRead; i++)
-		instrRead[i] = 0;
-	for (i = 0; i < (int)numWrite; i++)
-		instrWrite[i] = 0;
-	lastReadAddr = 0;
-	lastWriteAddr = 0;
-	for (i = 0; i < MAX_DISTR; i++) {
-		localReadDistrib[i] = 0;
-		localWriteDistrib[i] = 0;
-		globalReadDistrib[i] = 0;
-		globalWriteDistrib[i] = 0;
+	for (i = 0; i < (int)s->numRead; i++)
+		s->instrRead[i] = 0;
+	for (i = 0; i < (int)s->numWrite; i++)
+		s->instrWrite[i] = 0;
+	s->lastReadAddr = 0;
+	s->lastWriteAddr = 0;
+	for (i = 0; i < STRIDE_BUCKET_CNT; i++) {
+		s->localReadDistrib[i] = 0;
+		s->localWriteDistrib[i] = 0;
+		s->globalReadDistrib[i] = 0;
+		s->globalWriteDistrib[i] = 0;
 	}
-	numInstrsAnalyzed = 0;
-	numReadInstrsAnalyzed = 0;
-	numWriteInstrsAnalyzed = 0;
-
-	indices_memRead_size = 1024;
-	indices_memRead = (ADDRINT*) checked_malloc(indices_memRead_size*sizeof(ADDRINT));
-	for (i = 0; i < (int)indices_memRead_size; i++)
-		indices_memRead[i] = 0;
-
-	indices_memWrite_size = 1024;
-	indices_memWrite = (ADDRINT*) checked_malloc(indices_memWrite_size*sizeof(ADDRINT));
-	for (i = 0; i < (int)indices_memWrite_size; i++)
-		indices_memWrite[i] = 0;
+	s->numInstrsAnalyzed = 0;
+	s->numReadInstrsAnalyzed = 0;
+	s->numWriteInstrsAnalyzed = 0;
 
 	if(interval_size != -1){
-		output_file_stride.open(mkfilename("stride_phases_int"), ios::out|ios::trunc);
+		ofstream output_file_stride;
+		output_file_stride.open(mkfilename_thread("stride_phases_int", t->tid), ios::out|ios::trunc);
 		output_file_stride.close();
 	}
 }
@@ -96,286 +98,190 @@ void init_stride(){
 /*VOID stride_instr_full(){
 }*/
 
-ADDRINT stride_instr_intervals(){
-	/* counting instructions is done in all_instr_intervals() */
-
-	return (ADDRINT) (interval_ins_count_for_hpc_alignment == interval_size);
-}
-
-VOID stride_instr_interval_output(){
+/* cumulative distribution up to strides 0, 8, 64, 512, 4096, 32768 and 262144 */
+static VOID stride_output_distrib(ofstream& output_file_stride, UINT64* distrib){
 	int i;
 
-	UINT64 cum;
-
-	output_file_stride.open(mkfilename("stride_phases_int"), ios::out|ios::app);
+	UINT64 cum = 0;
 
-	output_file_stride << numReadInstrsAnalyzed;
-	/* local read distribution */
-	cum = 0;
-	for(i = 0; i < MAX_DISTR; i++){
-		cum += localReadDistrib[i];
-		if( (i == 0) || (i == 8) || (i == 64) || (i == 512) || (i == 4096) || (i == 32768) || (i == 262144) ){
-			output_file_stride << " " << cum;
-		}
-		if(i == 262144)
-			break;
-	}
-	/* global read distribution */
-	cum = 0;
-	for(i = 0; i < MAX_DISTR; i++){
-		cum += globalReadDistrib[i];
-		if( (i == 0) || (i == 8) || (i == 64) || (i == 512) || (i == 4096) || (i == 32768) || (i == 262144) ){
+	for(i = 0; i <= LOG_MAX_STRIDE + 1; i++){
+		cum += distrib[i];
+		/* bucket 3k+1 ends at stride 2^(3k) */
+		if( (i == 0) || (i % 3 == 1 && i > 1) ){
 			output_file_stride << " " << cum;
 		}
-		if(i == 262144)
-			break;
 	}
-	output_file_stride << " " << numWriteInstrsAnalyzed;
-	/* local write distribution */
-	cum = 0;
-	for(i = 0; i < MAX_DISTR; i++){
-		cum += localWriteDistrib[i];
-		if( (i == 0) || (i == 8) || (i == 64) || (i == 512) || (i == 4096) || (i == 32768) || (i == 262144) ){
-			output_file_stride << " " << cum;
-		}
-		if(i == 262144)
-			break;
-	}
-	/* global write distribution */
-	cum = 0;
-	for(i = 0; i < MAX_DISTR; i++){
-		cum += globalWriteDistrib[i];
-		if( (i == 0) || (i == 8) || (i == 64) || (i == 512) || (i == 4096) || (i == 32768) ){
-			output_file_stride << " " << cum;
-		}
-		if(i == 262144){
-			output_file_stride << " " << cum << endl;
-			break;
-		}
-	}
-	output_file_stride.close();
-}
-
-VOID stride_instr_interval_reset(){
-	int i;
-
-	for (i = 0; i < MAX_DISTR; i++) {
-		localReadDistrib [i] = 0;
-		localWriteDistrib [i] = 0;
-		globalReadDistrib [i] = 0;
-		globalWriteDistrib [i] = 0;
-	}
-	numInstrsAnalyzed = 0;
-	numReadInstrsAnalyzed = 0;
-	numWriteInstrsAnalyzed = 0;
-	interval_ins_count = 0;
-	interval_ins_count_for_hpc_alignment = 0;
 }
 
-void stride_instr_interval(){
-
-	stride_instr_interval_output();
-	stride_instr_interval_reset();
-}
+/* number of analyzed reads/writes and cumulative local/global stride distributions */
+static VOID stride_output(ofstream& output_file_stride, stride_state* s){
 
-/* Finds indices for instruction at some address, given some list of index-instruction pairs
- * Note: the 'nth_occur' argument is needed because a single instruction can have two read memory operands (which both have a different index) */
-UINT32 index_memRead_stride(int nth_occur, ADDRINT ins_addr){
-
-	UINT32 i;
-	int j=0;
-	for(i=1; i <= readIndex; i++){
-		if(indices_memRead[i] == ins_addr)
-			j++;
-		if(j==nth_occur)
-			return i; /* found */
-	}
-	return 0; /* not found */
+	output_file_stride << s->numReadInstrsAnalyzed;
+	stride_output_distrib(output_file_stride, s->localReadDistrib);
+	stride_output_distrib(output_file_stride, s->globalReadDistrib);
+	output_file_stride << " " << s->numWriteInstrsAnalyzed;
+	stride_output_distrib(output_file_stride, s->localWriteDistrib);
+	stride_output_distrib(output_file_stride, s->globalWriteDistrib);
+	output_file_stride << endl;
 }
 
-/* We don't know the static number of read/write operations until
- * the entire program has executed, hence we dynamically allocate the arrays */
-VOID reallocate_readArray_stride(){
+VOID stride_instr_interval_output(mica_thread* t){
+	ofstream output_file_stride;
 
-	ADDRINT* ptr;
-
-	numRead *= 2;
-
-	ptr = (ADDRINT*) checked_realloc(instrRead, numRead * sizeof(ADDRINT));
-	/*if (ptr == (ADDRINT*) NULL) {
-		cerr << "Not enough memory (in reallocate_readArray_stride)" << endl;
-		exit(1);
-	}*/
-	instrRead = ptr;
+	output_file_stride.open(mkfilename_thread("stride_phases_int", t->tid), ios::out|ios::app);
+	stride_output(output_file_stride, t->stride);
+	output_file_stride.close();
 }
 
-UINT32 index_memWrite_stride(ADDRINT ins_addr){
+VOID stride_instr_interval_reset(mica_thread* t){
+	int i;
+	stride_state* s = t->stride;
 
-	UINT32 i;
-	for(i=1; i <= writeIndex; i++){
-		if(indices_memWrite[i] == ins_addr)
-			return i; /* found */
+	for (i = 0; i < STRIDE_BUCKET_CNT; i++) {
+		s->localReadDistrib [i] = 0;
+		s->localWriteDistrib [i] = 0;
+		s->globalReadDistrib [i] = 0;
+		s->globalWriteDistrib [i] = 0;
 	}
-	return 0; /* not found */
+	s->numInstrsAnalyzed = 0;
+	s->numReadInstrsAnalyzed = 0;
+	s->numWriteInstrsAnalyzed = 0;
 }
 
+/* bucket of a stride: 0 for stride 0, otherwise 1 + ceil(log2(stride)), trimmed to the last bucket */
+static inline UINT32 stride_bucket(ADDRINT stride){
 
-VOID reallocate_writeArray_stride(){
-
-	ADDRINT* ptr;
+	UINT32 b;
 
-	numWrite *= 2;
-
-	ptr = (ADDRINT*) checked_realloc(instrWrite, numWrite * sizeof(ADDRINT));
-	/*if (ptr == (ADDRINT*) NULL) {
-		cerr << "Not enough memory (in reallocate_writeArray_stride)" << endl;
-		exit(1);
-	}*/
-	instrWrite = ptr;
+	if(stride == 0)
+		return 0;
+	if(stride > ((ADDRINT)1 << LOG_MAX_STRIDE))
+		return STRIDE_BUCKET_CNT - 1;
+	b = 64 - __builtin_clzll(2 * (UINT64)stride - 1);
+	return b;
 }
 
-void register_memRead_stride(ADDRINT ins_addr){
-
-	ADDRINT* ptr;
-
-	/* reallocation needed */
-	if(readIndex >= indices_memRead_size){
+/* We don't know the static number of read/write operations until
+ * the entire program has executed, hence we dynamically allocate the arrays
+ * (per thread, on first use of an index beyond the current size) */
+VOID reallocate_readArray_stride(stride_state* s){
 
-		indices_memRead_size *= 2;
-		ptr = (ADDRINT*) realloc(indices_memRead, indices_memRead_size*sizeof(ADDRINT));
-		/*if(ptr == (ADDRINT*)NULL){
-			cerr << "Could not allocate memory (realloc in register_readMem)!" << endl;
-			exit(1);
-		}*/
-		indices_memRead = ptr;
+	UINT64 i;
+	UINT64 old_size = s->numRead;
 
-	}
+	s->numRead *= 2;
 
-	/* register instruction to index */
-	indices_memRead[readIndex++] = ins_addr;
+	s->instrRead = (ADDRINT*) checked_realloc(s->instrRead, s->numRead * sizeof(ADDRINT));
+	for(i = old_size; i < s->numRead; i++)
+		s->instrRead[i] = 0;
 }
 
-void register_memWrite_stride(ADDRINT ins_addr){
-
-	ADDRINT* ptr;
+VOID reallocate_writeArray_stride(stride_state* s){
 
-	/* reallocation needed */
-	if(writeIndex >= indices_memWrite_size){
+	UINT64 i;
+	UINT64 old_size = s->numWrite;
 
-		indices_memWrite_size *= 2;
-		ptr = (ADDRINT*) realloc(indices_memWrite, indices_memWrite_size*sizeof(ADDRINT));
-		/*if(ptr == (ADDRINT*)NULL){
-			cerr << "Could not allocate memory (realloc in register_writeMem)!" << endl;
-			exit(1);
-		}*/
-		indices_memWrite = ptr;
+	s->numWrite *= 2;
 
-	}
-
-	/* register instruction to index */
-	indices_memWrite[writeIndex++] = ins_addr;
+	s->instrWrite = (ADDRINT*) checked_realloc(s->instrWrite, s->numWrite * sizeof(ADDRINT));
+	for(i = old_size; i < s->numWrite; i++)
+		s->instrWrite[i] = 0;
 }
 
-VOID readMem_stride(UINT32 index, ADDRINT effAddr, ADDRINT size){
+VOID readMem_stride(mica_thread* t, UINT32 index, ADDRINT effAddr, ADDRINT size){
 
 	ADDRINT stride;
+	stride_state* s = t->stride;
+
+	while(index >= s->numRead)
+		reallocate_readArray_stride(s);
 
-	numReadInstrsAnalyzed++;
+	s->numReadInstrsAnalyzed++;
 
 	/* local stride	*/
 	/* avoid negative values, has to be done like this (not stride < 0 => stride = -stride (avoid problems with unsigned values)) */
-	if(effAddr > instrRead[index])
-		stride = effAddr - instrRead[index];
+	if(effAddr > s->instrRead[index])
+		stride = effAddr - s->instrRead[index];
 	else
-		stride = instrRead[index] - effAddr;
-	if(stride >= MAX_DISTR){
-		stride = MAX_DISTR-1; // trim if needed
-	}
-
-	localReadDistrib[stride]++;
-	instrRead[index] = effAddr + size - 1;
+		stride = s->instrRead[index] - effAddr;
+	s->localReadDistrib[stride_bucket(stride)]++;
+	s->instrRead[index] = effAddr + size - 1;
 
 	/* global stride */
 	/* avoid negative values, has to be done like this (not stride < 0 => stride = -stride (avoid problems with unsigned values)) */
-	if(effAddr > lastReadAddr)
-		stride = effAddr - lastReadAddr;
+	if(effAddr > s->lastReadAddr)
+		stride = effAddr - s->lastReadAddr;
 	else
-		stride = lastReadAddr - effAddr;
-	if(stride >= MAX_DISTR){
-		stride = MAX_DISTR-1; // trim if needed
-	}
-
-	globalReadDistrib[stride]++;
-	lastReadAddr = effAddr + size - 1;
+		stride = s->lastReadAddr - effAddr;
+	s->globalReadDistrib[stride_bucket(stride)]++;
+	s->lastReadAddr = effAddr + size - 1;
 }
 
-VOID writeMem_stride(UINT32 index, ADDRINT effAddr, ADDRINT size){
+VOID writeMem_stride(mica_thread* t, UINT32 index, ADDRINT effAddr, ADDRINT size){
 
 	ADDRINT stride;
+	stride_state* s = t->stride;
+
+	while(index >= s->numWrite)
+		reallocate_writeArray_stride(s);
 
-	numWriteInstrsAnalyzed++;
+	s->numWriteInstrsAnalyzed++;
 
 	/* local stride */
 	/* avoid negative values, has to be doen like this (not stride < 0 => stride = -stride) */
-	if(effAddr > instrWrite[index])
-		stride = effAddr - instrWrite[index];
+	if(effAddr > s->instrWrite[index])
+		stride = effAddr - s->instrWrite[index];
 	else
-		stride = instrWrite[index] - effAddr;
-	if(stride >= MAX_DISTR){
-		stride = MAX_DISTR-1; // trim if needed
-	}
-
-	localWriteDistrib[stride]++;
-	instrWrite[index] = effAddr + size - 1;
+		stride = s->instrWrite[index] - effAddr;
+	s->localWriteDistrib[stride_bucket(stride)]++;
+	s->instrWrite[index] = effAddr + size - 1;
 
 	/* global stride */
 	/* avoid negative values, has to be doen like this (not stride < 0 => stride = -stride) */
-	if(effAddr > lastWriteAddr)
-		stride = effAddr - lastWriteAddr;
+	if(effAddr > s->lastWriteAddr)
+		stride = effAddr - s->lastWriteAddr;
 	else
-		stride = lastWriteAddr - effAddr;
-	if(stride >= MAX_DISTR){
-		stride = MAX_DISTR-1; // trim if needed
-	}
+		stride = s->lastWriteAddr - effAddr;
+	s->globalWriteDistrib[stride_bucket(stride)]++;
+	s->lastWriteAddr = effAddr + size - 1;
+}
+
+VOID readMem_stride_tid(THREADID tid, UINT32 index, ADDRINT effAddr, ADDRINT size){
+	readMem_stride(get_mica_thread(tid), index, effAddr, size);
+}
 
-	globalWriteDistrib[stride]++;
-	lastWriteAddr = effAddr + size - 1;
+VOID writeMem_stride_tid(THREADID tid, UINT32 index, ADDRINT effAddr, ADDRINT size){
+	writeMem_stride(get_mica_thread(tid), index, effAddr, size);
 }
 
+/* Finds the index for the memory operand of the instruction at address a, registering a new index
+ * if the instruction was not seen before */
 UINT32 stride_index_memRead1(ADDRINT a){
 
-	UINT32 index = index_memRead_stride(1, a);
+	UINT32 index = ins_index_lookup(&indices_memRead1, a);
 	if(index < 1){
-		if(readIndex >= numRead){
-			reallocate_readArray_stride();
-		}
-		index = readIndex;
-
-		register_memRead_stride(a);
+		index = readIndex++;
+		ins_index_insert(&indices_memRead1, a, index);
 	}
 	return index;
 }
 
 UINT32 stride_index_memRead2(ADDRINT a){
-	UINT32 index = index_memRead_stride(2, a);
-	if(index < 1){
-		if(readIndex >= numRead){
-			reallocate_readArray_stride();
-		}
-		index = readIndex;
 
-		register_memRead_stride(a);
+	UINT32 index = ins_index_lookup(&indices_memRead2, a);
+	if(index < 1){
+		index = readIndex++;
+		ins_index_insert(&indices_memRead2, a, index);
 	}
 	return index;
 }
 
 UINT32 stride_index_memWrite(ADDRINT a){
-	UINT32 index = index_memWrite_stride(a);
+
+	UINT32 index = ins_index_lookup(&indices_memWrite, a);
 	if(index < 1){
-		if(writeIndex >= numWrite)
-			reallocate_writeArray_stride();
-		index = writeIndex;
-		register_memWrite_stride(a);
+		index = writeIndex++;
+		ins_index_insert(&indices_memWrite, a, index);
 	}
 	return index;
 }
@@ -388,86 +294,70 @@ VOID instrument_stride(INS ins, VOID* v){
 	if( INS_IsMemoryRead(ins) ){ // instruction has memory read operand
 
 		index = stride_index_memRead1(INS_Address(ins));
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)readMem_stride, IARG_UINT32, index, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_END);
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, readMem_stride_tid, IARG_THREAD_ID, IARG_UINT32, index, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE, IARG_END);
 
 		if( INS_HasMemoryRead2(ins) ){ // second memory read operand
 
 			index = stride_index_memRead2(INS_Address(ins));
-			INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)readMem_stride, IARG_UINT32, index, IARG_MEMORYREAD2_EA, IARG_MEMORYREAD_SIZE, IARG_END);
+			mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, readMem_stride_tid, IARG_THREAD_ID, IARG_UINT32, index, IARG_MEMORYREAD2_EA, IARG_MEMORYREAD_SIZE, IARG_END);
 		}
 	}
 
 	if( INS_IsMemoryWrite(ins) ){ // instruction has memory write operand
 		index =  stride_index_memWrite(INS_Address(ins));
-		INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)writeMem_stride, IARG_UINT32, index, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_END);
+		mica_insert_call(MICA_CALL, ins, IPOINT_BEFORE, writeMem_stride_tid, IARG_THREAD_ID, IARG_UINT32, index, IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE, IARG_END);
 
 	}
 
-	/* inserting calls for counting instructions (full) is done in mica.cpp */
-
-	if(interval_size != -1){
-		INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)stride_instr_intervals, IARG_END);
-		INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)stride_instr_interval, IARG_END);
-	}
+	/* inserting calls for counting instructions and checking interval boundaries is done in mica.cpp */
 }
 
 /* finishing... */
 VOID fini_stride(INT32 code, VOID* v){
 
 	int i;
-
-	UINT64 cum;
-
-	if(interval_size == -1){
-		output_file_stride.open(mkfilename("stride_full_int"), ios::out|ios::trunc);
-	}
-	else{
-		output_file_stride.open(mkfilename("stride_phases_int"), ios::out|ios::app);
-	}
-	output_file_stride << numReadInstrsAnalyzed;
-	/* local read distribution */
-	cum = 0;
-	for(i = 0; i < MAX_DISTR; i++){
-		cum += localReadDistrib[i];
-		if( (i == 0) || (i == 8) || (i == 64) || (i == 512) || (i == 4096) || (i == 32768) || (i == 262144) ){
-			output_file_stride << " " << cum;
-		}
-		if(i == 262144)
-			break;
-	}
-	/* global read distribution */
-	cum = 0;
-	for(i = 0; i < MAX_DISTR; i++){
-		cum += globalReadDistrib[i];
-		if( (i == 0) || (i == 8) || (i == 64) || (i == 512) || (i == 4096) || (i == 32768) || (i == 262144) ){
-			output_file_stride << " " << cum;
+	UINT32 k;
+	mica_thread* t;
+	ofstream output_file_stride;
+
+	for(k=0; k < mica_thread_cnt; k++){
+		t = mica_threads[k];
+		if(interval_size == -1){
+			output_file_stride.open(mkfilename_thread("stride_full_int", t->tid), ios::out|ios::trunc);
 		}
-		if(i == 262144)
-			break;
-	}
-	output_file_stride << " " << numWriteInstrsAnalyzed;
-	/* local write distribution */
-	cum = 0;
-	for(i = 0; i < MAX_DISTR; i++){
-		cum += localWriteDistrib[i];
-		if( (i == 0) || (i == 8) || (i == 64) || (i == 512) || (i == 4096) || (i == 32768) || (i == 262144) ){
-			output_file_stride << " " << cum;
+		else{
+			output_file_stride.open(mkfilename_thread("stride_phases_int", t->tid), ios::out|ios::app);
 		}
-		if(i == 262144)
-			break;
+		stride_output(output_file_stride, t->stride);
+		//output_file_stride << "number of instructions: " << total_ins_count_for_hpc_alignment << endl;
+		output_file_stride.close();
 	}
-	/* global write distribution */
-	cum = 0;
-	for(i = 0; i < MAX_DISTR; i++){
-		cum += globalWriteDistrib[i];
-		if( (i == 0) || (i == 8) || (i == 64) || (i == 512) || (i == 4096) || (i == 32768) ){
-			output_file_stride << " " << cum;
+
+	if(interval_size == -1 && mica_thread_cnt > 1){
+		/* distributions are summed over all threads */
+		stride_state* merged = (stride_state*) checked_malloc(sizeof(stride_state));
+		merged->numReadInstrsAnalyzed = 0;
+		merged->numWriteInstrsAnalyzed = 0;
+		for(i = 0; i < STRIDE_BUCKET_CNT; i++){
+			merged->localReadDistrib[i] = 0;
+			merged->globalReadDistrib[i] = 0;
+			merged->localWriteDistrib[i] = 0;
+			merged->globalWriteDistrib[i] = 0;
 		}
-		if(i == 262144){
-			output_file_stride << " " << cum << endl;
-			break;
+		for(k=0; k < mica_thread_cnt; k++){
+			stride_state* s = mica_threads[k]->stride;
+			merged->numReadInstrsAnalyzed += s->numReadInstrsAnalyzed;
+			merged->numWriteInstrsAnalyzed += s->numWriteInstrsAnalyzed;
+			for(i = 0; i < STRIDE_BUCKET_CNT; i++){
+				merged->localReadDistrib[i] += s->localReadDistrib[i];
+				merged->globalReadDistrib[i] += s->globalReadDistrib[i];
+				merged->localWriteDistrib[i] += s->localWriteDistrib[i];
+				merged->globalWriteDistrib[i] += s->globalWriteDistrib[i];
+			}
 		}
+		output_file_stride.open(mkfilename("stride_full_int_merged"), ios::out|ios::trunc);
+		stride_output(output_file_stride, merged);
+		output_file_stride.close();
+		free(merged);
 	}
-	//output_file_stride << "number of instructions: " << total_ins_count_for_hpc_alignment << endl;
-	output_file_stride.close();
 }
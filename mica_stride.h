@@ -8,8 +8,10 @@
  */
 
 #include "mica.h"
+#include "mica_utils.h"
 
 void init_stride();
+VOID init_stride_thread(mica_thread* t);
 VOID instrument_stride(INS ins, VOID* v);
 VOID fini_stride(INT32 code, VOID* v);
 
@@ -17,8 +19,8 @@ UINT32 stride_index_memRead1(ADDRINT a);
 UINT32 stride_index_memRead2(ADDRINT a);
 UINT32 stride_index_memWrite(ADDRINT a);
 
-VOID readMem_stride(UINT32 index, ADDRINT effAddr, ADDRINT size);
-VOID writeMem_stride(UINT32 index, ADDRINT effAdrr, ADDRINT size);
+VOID readMem_stride(mica_thread* t, UINT32 index, ADDRINT effAddr, ADDRINT size);
+VOID writeMem_stride(mica_thread* t, UINT32 index, ADDRINT effAdrr, ADDRINT size);
 
-VOID stride_instr_interval_output();
-VOID stride_instr_interval_reset();
+VOID stride_instr_interval_output(mica_thread* t);
+VOID stride_instr_interval_reset(mica_thread* t);
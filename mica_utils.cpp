@@ -10,63 +10,348 @@
 /* MICA includes */
 #include "mica_utils.h"
 
-/* lookup memNode for key in table
- * returns NULL is no such memNode is found
- */
-memNode* lookup(nlist** table, ADDRINT key){
+#include <stddef.h>
+
+/* *** address map *** */
+
+#define ADDR_MAP_INIT_SIZE 1024
+
+void addr_map_init(addr_map* m){
+
+	m->mask = ADDR_MAP_INIT_SIZE - 1;
+	m->cnt = 0;
+	m->slots = (addr_map_slot*)checked_malloc(ADDR_MAP_INIT_SIZE * sizeof(addr_map_slot));
+	memset(m->slots, 0, ADDR_MAP_INIT_SIZE * sizeof(addr_map_slot));
+	m->last_key = 0;
+	m->last_chunk = NULL;
+}
 
-	nlist* np;
+/* doubles the number of slots and reinserts all chunks */
+static void addr_map_grow(addr_map* m){
 
-	for (np = table[key % MAX_MEM_TABLE_ENTRIES]; np != (nlist*)NULL; np = np->next){
-		if(np-> id == key)
-			return np->mem;
+	UINT32 i, j;
+	UINT32 old_size = m->mask + 1;
+	addr_map_slot* old_slots = m->slots;
+
+	m->mask = 2 * old_size - 1;
+	m->slots = (addr_map_slot*)checked_malloc(2 * old_size * sizeof(addr_map_slot));
+	memset(m->slots, 0, 2 * old_size * sizeof(addr_map_slot));
+
+	for(i = 0; i < old_size; i++){
+		if(old_slots[i].chunk != NULL){
+			for(j = addr_map_index(m, old_slots[i].key); m->slots[j].chunk != NULL; j = (j + 1) & m->mask);
+			m->slots[j] = old_slots[i];
+		}
 	}
+	free(old_slots);
+}
+
+/* inserts the chunk for key (which should not be in the map yet) */
+void addr_map_insert(addr_map* m, ADDRINT key, VOID* chunk){
+
+	UINT32 i;
 
-	return (memNode*)NULL;
+	/* keep the load factor below 1/2 */
+	if(2 * (m->cnt + 1) > m->mask + 1)
+		addr_map_grow(m);
+
+	for(i = addr_map_index(m, key); m->slots[i].chunk != NULL; i = (i + 1) & m->mask);
+	m->slots[i].key = key;
+	m->slots[i].chunk = chunk;
+	m->cnt++;
+
+	m->last_key = key;
+	m->last_chunk = chunk;
+}
+
+/* frees all chunks, and shrinks the map back to its initial size */
+void addr_map_clear(addr_map* m){
+
+	UINT32 i;
+
+	for(i = 0; i <= m->mask; i++){
+		if(m->slots[i].chunk != NULL)
+			free(m->slots[i].chunk);
+	}
+	free(m->slots);
+	addr_map_init(m);
 }
 
-/* install new memNode in table */
-memNode* install(nlist** table, ADDRINT key){
+/* *** cache line directory *** */
+
+extern int analysis_threads;
+
+addr_map* line_dir_of(mica_thread* t){
 
-	nlist* np;
-	ADDRINT index;
+	addr_map* d;
 
-	index = key % MAX_MEM_TABLE_ENTRIES;
+	if(t->lines != NULL && !analysis_threads)
+		return t->lines;
+
+	d = (addr_map*)checked_malloc(sizeof(addr_map));
+	addr_map_init(d);
+	if(!analysis_threads)
+		t->lines = d;
+
+	return d;
+}
 
-	np = table[index];
+line_dir_chunk* line_dir_install(addr_map* d, ADDRINT key){
 
-	if(np == (nlist*)NULL) {
-		np = (nlist*)checked_malloc(sizeof(nlist));
-		table[index] = np;
+	line_dir_chunk* c = (line_dir_chunk*)checked_malloc(sizeof(line_dir_chunk));
+
+	memset(c, 0, sizeof(line_dir_chunk));
+	addr_map_insert(d, key, c);
+
+	return c;
+}
+
+VOID line_dir_clear(addr_map* d, LINE_DIR_CLIENT client){
+
+	UINT32 i;
+	line_dir_chunk* c;
+
+	for(i = 0; i <= d->mask; i++){
+		c = (line_dir_chunk*)d->slots[i].chunk;
+		if(c != NULL && c->client[client] != NULL){
+			free(c->client[client]);
+			c->client[client] = NULL;
+		}
 	}
-	else{
-		while(np->next != (nlist*)NULL){
-			np = np->next;
+}
+
+/* *** static instruction index *** */
+
+#define INS_INDEX_INIT_SIZE 1024
+
+static inline UINT32 ins_index_slot(ins_index* idx, ADDRINT key){
+	/* instruction addresses are not uniformly distributed in the low bits, mix them (Fibonacci hashing) */
+	return (UINT32)(((UINT64)key * 0x9E3779B97F4A7C15ULL) >> 32) & idx->mask;
+}
+
+void ins_index_init(ins_index* idx){
+
+	idx->mask = INS_INDEX_INIT_SIZE - 1;
+	idx->cnt = 0;
+	idx->keys = (ADDRINT*)checked_malloc(INS_INDEX_INIT_SIZE * sizeof(ADDRINT));
+	idx->ids = (UINT32*)checked_malloc(INS_INDEX_INIT_SIZE * sizeof(UINT32));
+	memset(idx->keys, 0, INS_INDEX_INIT_SIZE * sizeof(ADDRINT));
+}
+
+/* returns the id for the instruction at address key, or 0 if it was not inserted before */
+UINT32 ins_index_lookup(ins_index* idx, ADDRINT key){
+
+	UINT32 i;
+
+	for(i = ins_index_slot(idx, key); idx->keys[i] != 0; i = (i + 1) & idx->mask){
+		if(idx->keys[i] == key)
+			return idx->ids[i];
+	}
+	return 0;
+}
+
+/* doubles the number of slots and reinserts all entries */
+static void ins_index_grow(ins_index* idx){
+
+	UINT32 i, j;
+	UINT32 old_size = idx->mask + 1;
+	ADDRINT* old_keys = idx->keys;
+	UINT32* old_ids = idx->ids;
+
+	idx->mask = 2 * old_size - 1;
+	idx->keys = (ADDRINT*)checked_malloc(2 * old_size * sizeof(ADDRINT));
+	idx->ids = (UINT32*)checked_malloc(2 * old_size * sizeof(UINT32));
+	memset(idx->keys, 0, 2 * old_size * sizeof(ADDRINT));
+
+	for(i = 0; i < old_size; i++){
+		if(old_keys[i] != 0){
+			for(j = ins_index_slot(idx, old_keys[i]); idx->keys[j] != 0; j = (j + 1) & idx->mask);
+			idx->keys[j] = old_keys[i];
+			idx->ids[j] = old_ids[i];
+		}
+	}
+	free(old_keys);
+	free(old_ids);
+}
+
+/* inserts the instruction at address key (which should not be in the index yet) with the given id */
+void ins_index_insert(ins_index* idx, ADDRINT key, UINT32 id){
+
+	UINT32 i;
+
+	/* keep the load factor below 1/2 */
+	if(2 * (idx->cnt + 1) > idx->mask + 1)
+		ins_index_grow(idx);
+
+	for(i = ins_index_slot(idx, key); idx->keys[i] != 0; i = (i + 1) & idx->mask);
+	idx->keys[i] = key;
+	idx->ids[i] = id;
+	idx->cnt++;
+}
+
+/* *** deferred analysis calls *** */
+
+BOOL mica_recording;
+mica_call_list* mica_recording_list;
+
+VOID mica_call_list_init(mica_call_list* l){
+	l->calls = NULL;
+	l->cnt = 0;
+	l->size = 0;
+}
+
+#define MICA_EVENT_INDEX(field) (offsetof(mica_event, field) / sizeof(ADDRINT))
+
+static VOID mica_call_arg(mica_call* c, MICA_CALL_ARG_BASE base, UINT32 index, ADDRINT mask){
+	c->base[c->argc] = base;
+	c->index[c->argc] = index;
+	c->mask[c->argc] = mask;
+}
+
+/* parse the Pin arguments of an analysis call of instruction ins (up to IARG_END) */
+static VOID mica_call_list_add(mica_call_list* l, MICA_CALL_KIND kind, INS ins, mica_call_fun fun, UINT32 argc, va_list args){
+
+	mica_call* c;
+	IARG_TYPE type;
+	REG reg;
+
+	if(l->cnt == l->size){
+		l->size = l->size == 0 ? 4 : 2 * l->size;
+		l->calls = (mica_call*)checked_realloc(l->calls, l->size * sizeof(mica_call));
+	}
+	c = &l->calls[l->cnt++];
+	c->fun = fun;
+	c->kind = kind;
+	c->ret_version = false;
+	c->argc = 0;
+
+	for(type = (IARG_TYPE)va_arg(args, int); type != IARG_END; type = (IARG_TYPE)va_arg(args, int)){
+
+		if(c->argc == MICA_CALL_MAX_ARGS){
+			cerr << "FATAL ERROR: Too many arguments for deferred analysis call (max. " << MICA_CALL_MAX_ARGS << ")" << endl;
+			exit(1);
+		}
+		c->val[c->argc] = 0;
+
+		switch(type){
+			case IARG_UINT32: c->val[c->argc] = va_arg(args, UINT32); mica_call_arg(c, MICA_ARG_CONST, c->argc, ~(ADDRINT)0); break;
+			case IARG_ADDRINT: c->val[c->argc] = va_arg(args, ADDRINT); mica_call_arg(c, MICA_ARG_CONST, c->argc, ~(ADDRINT)0); break;
+			case IARG_PTR: c->val[c->argc] = (ADDRINT)va_arg(args, VOID*); mica_call_arg(c, MICA_ARG_CONST, c->argc, ~(ADDRINT)0); break;
+			case IARG_THREAD_ID: mica_call_arg(c, MICA_ARG_CONTEXT, 0, ~(ADDRINT)0); break;
+			case IARG_REG_VALUE:
+				/* the tool register holds the mica_thread, the only other register recorded is the REP count register */
+				reg = (REG)va_arg(args, int);
+				if(reg == mica_thread_reg){
+					mica_call_arg(c, MICA_ARG_CONTEXT, 1, ~(ADDRINT)0);
+				}
+				else if(INS_HasRealRep(ins) && reg == INS_RepCountRegister(ins)){
+					mica_call_arg(c, MICA_ARG_EVENT, MICA_EVENT_INDEX(rep_cnt), ~(ADDRINT)0);
+				}
+				else{
+					cerr << "FATAL ERROR: Unsupported register (" << reg << ") for deferred analysis call" << endl;
+					exit(1);
+				}
+				break;
+			case IARG_MEMORYREAD_EA: mica_call_arg(c, MICA_ARG_EVENT, MICA_EVENT_INDEX(read_ea), ~(ADDRINT)0); break;
+			case IARG_MEMORYREAD2_EA: mica_call_arg(c, MICA_ARG_EVENT, MICA_EVENT_INDEX(read2_ea), ~(ADDRINT)0); break;
+			case IARG_MEMORYREAD_SIZE: mica_call_arg(c, MICA_ARG_EVENT, MICA_EVENT_INDEX(read_size), 0xffffffff); break;
+			case IARG_MEMORYWRITE_EA: mica_call_arg(c, MICA_ARG_EVENT, MICA_EVENT_INDEX(write_ea), ~(ADDRINT)0); break;
+			case IARG_MEMORYWRITE_SIZE: mica_call_arg(c, MICA_ARG_EVENT, MICA_EVENT_INDEX(write_size), 0xffffffff); break;
+			case IARG_BRANCH_TAKEN: mica_call_arg(c, MICA_ARG_EVENT, MICA_EVENT_INDEX(taken), 0xff); break;
+			case IARG_FIRST_REP_ITERATION: mica_call_arg(c, MICA_ARG_EVENT, MICA_EVENT_INDEX(first_rep), 0xff); break;
+			case IARG_RETURN_REGS:
+				/* not an argument of the routine */
+				reg = (REG)va_arg(args, int);
+				if(reg != mica_version_reg){
+					cerr << "FATAL ERROR: Unsupported return register (" << reg << ") for deferred analysis call" << endl;
+					exit(1);
+				}
+				c->ret_version = true;
+				continue;
+			default:
+				cerr << "FATAL ERROR: Unsupported argument type (" << type << ") for deferred analysis call" << endl;
+				exit(1);
 		}
-		np->next = (nlist*)checked_malloc(sizeof(nlist));
-		np = np->next;
+		c->argc++;
 	}
-	np->next = (nlist*)NULL;
-	np->id = key;
-	np->mem = (memNode*)checked_malloc(sizeof(memNode));
-	for(ADDRINT i = 0; i < MAX_MEM_ENTRIES; i++){
-		(np->mem)->timeAvailable[i] = 0;
+
+	if(c->argc != argc){
+		cerr << "FATAL ERROR: Deferred analysis call with " << c->argc << " arguments for a routine taking " << argc << endl;
+		exit(1);
 	}
-	for(ADDRINT i = 0; i < MAX_MEM_BLOCK; i++){
-		(np->mem)->numReferenced[i] = false;
+}
+
+VOID mica_record_call(mica_call_list* l, MICA_CALL_KIND kind, INS ins, mica_call_fun fun, UINT32 argc, ...){
+
+	va_list args;
+
+	va_start(args, argc);
+	mica_call_list_add(l, kind, ins, fun, argc, args);
+	va_end(args);
+}
+
+/* do a deferred call, through the trampoline of the analysis routine */
+static inline ADDRINT mica_call_do(mica_call* c, ADDRINT** bases){
+
+	ADDRINT a[MICA_CALL_MAX_ARGS];
+	UINT32 i;
+
+	bases[MICA_ARG_CONST] = c->val;
+	for(i = 0; i < c->argc; i++)
+		a[i] = bases[c->base[i]][c->index[i]] & c->mask[i];
+
+	return c->fun(a);
+}
+
+VOID mica_call_list_add_version_case(mica_call_list* l, REG reg, INT32 case_value, ADDRINT version){
+
+	mica_call* c;
+
+	if(reg != mica_version_reg){
+		cerr << "FATAL ERROR: Unsupported register (" << reg << ") for version case" << endl;
+		exit(1);
 	}
-	return (np->mem);
+
+	if(l->cnt == l->size){
+		l->size = l->size == 0 ? 4 : 2 * l->size;
+		l->calls = (mica_call*)checked_realloc(l->calls, l->size * sizeof(mica_call));
+	}
+	c = &l->calls[l->cnt++];
+	c->fun = NULL;
+	c->kind = MICA_VERSION_CASE;
+	c->ret_version = false;
+	c->argc = 0;
+	c->val[0] = (ADDRINT)case_value;
+	c->val[1] = version;
 }
 
-/**
- * Free a nlist and set the pointer to NULL.
- */
-void free_nlist(nlist*& np) {
-	nlist* np_rm;
-	while(np != (nlist*)NULL){
-		np_rm = np;
-		np = np->next;
-		free(np_rm->mem);
-		free(np_rm);
+/* do the deferred calls of an executed instruction, a then call is only done if the preceding if call returned non-zero */
+ADDRINT mica_call_list_run(mica_call_list* l, mica_event* ev, mica_call_context* ctx){
+
+	mica_call* c = l->calls;
+	mica_call* end = l->calls + l->cnt;
+	ADDRINT* bases[3];
+	ADDRINT cond = 0;
+	ADDRINT ret;
+
+	bases[MICA_ARG_EVENT] = (ADDRINT*)ev;
+	bases[MICA_ARG_CONTEXT] = (ADDRINT*)ctx;
+
+	for(; c != end; c++){
+		switch(c->kind){
+			case MICA_CALL:
+				ret = mica_call_do(c, bases);
+				if(c->ret_version)
+					ctx->version = ret;
+				break;
+			case MICA_IF_CALL: cond = mica_call_do(c, bases); break;
+			case MICA_THEN_CALL: if(cond) mica_call_do(c, bases); break;
+			case MICA_VERSION_CASE:
+				if(ctx->version == c->val[0])
+					return c->val[1];
+				break;
+		}
 	}
+
+	return MICA_NO_VERSION;
 }
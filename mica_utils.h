@@ -9,6 +9,9 @@
 
 #include "mica.h"
 
+#include <stdarg.h>
+#include <type_traits>
+
 #ifndef MICA_UTILS
 
 #define MICA_UTILS
@@ -23,28 +26,342 @@
 #define checked_malloc(size) ({ void *result = malloc (size); if (__builtin_expect (!result, false)) { ERROR_MSG ("Out of memory at " LOCATION "."); exit (1); }; result; })
 #define checked_strdup(string) ({ char *result = strdup (string); if (__builtin_expect (!result, false)) { ERROR_MSG ("Out of memory at " LOCATION "."); exit (1); }; result; })
 #define checked_realloc(ptr, size) ({ void *result = realloc (ptr, size); if (__builtin_expect (!result, false)) { ERROR_MSG ("Out of memory at " LOCATION "."); exit (1); }; result; })
+#define checked_aligned_malloc(size) ({ void *result = NULL; if (__builtin_expect (posix_memalign (&result, CACHE_LINE_SIZE, size) != 0, false)) { ERROR_MSG ("Out of memory at " LOCATION "."); exit (1); }; result; })
 
 
 /* *** struct definitions *** */
 
-/* memory node struct */
-typedef struct memNode_type{
-	/* ilp */
-	INT32 timeAvailable[MAX_MEM_ENTRIES];
-	/* memfootprint */
-	bool numReferenced [MAX_MEM_BLOCK];
-} memNode;
-
-/* linked list struct */
-typedef struct nlist_type {
-	ADDRINT id;
-	memNode* mem;
-	struct nlist_type* next;
-} nlist;
-
-memNode* lookup(nlist** table, ADDRINT key);
-memNode* install(nlist** table, ADDRINT key);
-void free_nlist(nlist*& np);
+/* address map: open-addressing hash table from the upper bits of an address to a chunk of
+ * per-address state (allocated by the user of the map), resized as the footprint grows,
+ * with a one-entry cache of the last chunk found (consecutive accesses mostly hit the same chunk) */
+typedef struct addr_map_slot_type {
+	ADDRINT key;
+	VOID* chunk; // NULL marks an empty slot
+} addr_map_slot;
+
+typedef struct addr_map_type {
+	addr_map_slot* slots;
+	UINT32 mask; // number of slots - 1 (number of slots is a power of two)
+	UINT32 cnt;
+	ADDRINT last_key;
+	VOID* last_chunk; // NULL if there was no hit yet
+} addr_map;
+
+void addr_map_init(addr_map* m);
+void addr_map_insert(addr_map* m, ADDRINT key, VOID* chunk);
+void addr_map_clear(addr_map* m); // frees all chunks
+
+static inline UINT32 addr_map_index(addr_map* m, ADDRINT key){
+	return (UINT32)(((UINT64)key * 0x9E3779B97F4A7C15ULL) >> 32) & m->mask;
+}
+
+/* returns the chunk for key, or NULL if there is none */
+static inline VOID* addr_map_lookup(addr_map* m, ADDRINT key){
+
+	UINT32 i;
+
+	if(key == m->last_key && m->last_chunk != NULL)
+		return m->last_chunk;
+
+	for(i = addr_map_index(m, key); m->slots[i].chunk != NULL; i = (i + 1) & m->mask){
+		if(m->slots[i].key == key){
+			m->last_key = key;
+			m->last_chunk = m->slots[i].chunk;
+			return m->last_chunk;
+		}
+	}
+	return NULL;
+}
+
+/* open-addressing hash index from static instruction address to dense id,
+ * used at instrumentation time (instrumentation routines are serialized by Pin, so no locking is needed) */
+typedef struct ins_index_type {
+	ADDRINT* keys; // 0 marks an empty slot, there is no instruction at address 0
+	UINT32* ids;
+	UINT32 mask; // number of slots - 1 (number of slots is a power of two)
+	UINT32 cnt;
+} ins_index;
+
+void ins_index_init(ins_index* idx);
+UINT32 ins_index_lookup(ins_index* idx, ADDRINT key);
+void ins_index_insert(ins_index* idx, ADDRINT key, UINT32 id);
+
+/* per-thread analysis context
+ *
+ * Each analysis module keeps its state in a private struct, which is allocated
+ * per thread (cache line aligned) when the thread starts. Analysis routines
+ * fetch the context of the executing thread through Pin TLS.
+ */
+typedef struct mica_thread_type {
+	THREADID tid;
+	/* instruction counters */
+	INT64 interval_ins_count;
+	INT64 interval_ins_count_for_hpc_alignment; // one count for REP prefixed instructions
+	INT64 total_ins_count;
+	INT64 total_ins_count_for_hpc_alignment;
+	UINT64 roi_ins_count; // instructions counted for the region of interest (see mica.cpp)
+	UINT32 interval_clients; // interval engine clients handled for this thread (bit per client)
+	/* per-module analysis state (NULL for modules which are not used) */
+	struct ilp_state_type* ilp;
+	struct itypes_state_type* itypes;
+	struct ppm_state_type* ppm;
+	struct reg_state_type* reg;
+	struct stride_state_type* stride;
+	struct memfootprint_state_type* memfootprint;
+	struct memstackdist_state_type* memstackdist;
+	struct capture_state_type* capture;
+	struct bbv_state_type* bbv;
+	addr_map* lines; // cache line directory (see below), NULL if no module uses it
+} mica_thread;
+
+extern TLS_KEY mica_tls_key;
+
+/* all threads seen so far, used to write output when the program ends */
+extern mica_thread** mica_threads;
+extern UINT32 mica_thread_cnt;
+
+/* analysis threads (see mica_workers.h) keep their own copy of the state of every program thread,
+ * which they pass to analysis routines as a thread id starting from MICA_WORKER_TID */
+#define MICA_WORKER_TID 0x40000000
+extern mica_thread** mica_worker_threads;
+
+static inline mica_thread* get_mica_thread(THREADID tid){
+	if(__builtin_expect(tid >= MICA_WORKER_TID, false))
+		return mica_worker_threads[tid - MICA_WORKER_TID];
+	return (mica_thread*)PIN_GetThreadData(mica_tls_key, tid);
+}
+
+/* *** cache line directory ***
+ *
+ * memfootprint and memstackdist both keep state per cache line (of block_size bytes), in chunks of
+ * MAX_MEM_ENTRIES lines. Their chunks are found through a single per-thread address map, which holds
+ * a slot for each of them per chunk of lines, so that a memory operand is split into cache lines and
+ * looked up once for all of them (mem_lines). Modules allocate and free their own chunks. */
+enum LINE_DIR_CLIENT { LINE_DIR_MEMFOOTPRINT = 0, LINE_DIR_MEMSTACKDIST_READS, LINE_DIR_MEMSTACKDIST_WRITES, LINE_DIR_CLIENT_CNT };
+
+typedef struct line_dir_chunk_type {
+	VOID* client[LINE_DIR_CLIENT_CNT]; // chunk of each module, NULL if it has none (yet)
+} line_dir_chunk;
+
+/* the line directory a module uses for thread t: the one of the thread, or a directory of its own
+ * with analysis threads (modules are analysed on different threads then) */
+addr_map* line_dir_of(mica_thread* t);
+line_dir_chunk* line_dir_install(addr_map* d, ADDRINT key);
+VOID line_dir_clear(addr_map* d, LINE_DIR_CLIENT client); // frees the chunks of client
+
+/* returns the directory chunk for key (upper bits of a cache line address), allocated if there is none */
+static inline line_dir_chunk* line_dir_get(addr_map* d, ADDRINT key){
+
+	line_dir_chunk* c = (line_dir_chunk*)addr_map_lookup(d, key);
+
+	if(c == NULL)
+		c = line_dir_install(d, key);
+	return c;
+}
+
+/* cache lines touched by a memory operand */
+typedef struct mem_lines_type {
+	ADDRINT ea;
+	ADDRINT size;
+	ADDRINT first;
+	ADDRINT last;
+	line_dir_chunk* chunk; // directory chunk holding all of them, NULL if not resolved or in several chunks
+} mem_lines;
+
+extern UINT32 _block_size;
+
+/* splits a memory operand into cache lines */
+static inline VOID mem_lines_init(mem_lines* l, ADDRINT ea, ADDRINT size){
+	l->ea = ea;
+	l->size = size;
+	l->first = ea >> _block_size;
+	l->last = (ea + size - 1) >> _block_size;
+	l->chunk = NULL;
+}
+
+/* splits a memory operand into cache lines, and finds their chunk in directory d (if any) */
+static inline VOID mem_lines_resolve(addr_map* d, mem_lines* l, ADDRINT ea, ADDRINT size){
+	mem_lines_init(l, ea, size);
+	if(d != NULL && (l->first >> LOG_MAX_MEM_ENTRIES) == (l->last >> LOG_MAX_MEM_ENTRIES))
+		l->chunk = line_dir_get(d, l->first >> LOG_MAX_MEM_ENTRIES);
+}
+
+/* chunk of line a of l in directory d */
+static inline line_dir_chunk* mem_lines_chunk(addr_map* d, const mem_lines* l, ADDRINT a){
+	if(l->chunk != NULL)
+		return l->chunk;
+	return line_dir_get(d, a >> LOG_MAX_MEM_ENTRIES);
+}
+
+/* tool register holding the mica_thread of the executing thread */
+extern REG mica_thread_reg;
+
+/* tool register selecting the version of the next block (see Trace_timed in mica.cpp) */
+extern REG mica_version_reg;
+
+/* Instructions are counted once per run of (non-REP) instructions in a basic block,
+ * at the head of the run. Inside a run, the counters are therefore ahead of the
+ * executing instruction by the number of instructions that follow it in the run,
+ * its lag. The lag is known statically and passed to analysis routines which look
+ * at the counters (ins_lag holds it for the instruction being instrumented).
+ * Code that outputs or resets interval counters rewinds them first, and forwards
+ * them again afterwards, so the rest of the run is counted in the next interval. */
+extern UINT32 ins_lag;
+
+/* number of instructions counted by the instruction being instrumented: the length of the run
+ * at its head, 1 for REP prefixed instructions (counted per iteration), 0 inside a run */
+extern UINT32 ins_run;
+
+static inline void ins_counts_rewind(mica_thread* t, UINT32 lag){
+	t->interval_ins_count -= lag;
+	t->interval_ins_count_for_hpc_alignment -= lag;
+	t->total_ins_count -= lag;
+	t->total_ins_count_for_hpc_alignment -= lag;
+}
+
+static inline void ins_counts_forward(mica_thread* t, UINT32 lag){
+	t->interval_ins_count += lag;
+	t->interval_ins_count_for_hpc_alignment += lag;
+	t->total_ins_count += lag;
+	t->total_ins_count_for_hpc_alignment += lag;
+}
+
+/* Interval boundaries are checked centrally (in mica.cpp), with a single check per
+ * instruction. Modules register a routine to output their per-interval state and one
+ * to reset it (typically in their init function), which are called for each thread
+ * when it reaches the end of an interval, in order of registration. */
+VOID interval_register(VOID (*output)(mica_thread* t), VOID (*reset)(mica_thread* t));
+
+/* false while per-interval output is suppressed (warmup intervals in sampled mode),
+ * the per-interval state is still reset */
+extern BOOL interval_output;
+
+/* *** deferred analysis calls ***
+ *
+ * Analysis calls can be recorded at instrumentation time and done later, on another thread
+ * (mica_workers.cpp) or when replaying a trace (mica_replay). Their arguments are either constants,
+ * or read from the event record of the executed instruction, or from the calling context. */
+
+/* event record, one per executed instruction; fields are ADDRINT, narrower values (sizes, flags)
+ * only set the low bytes and are masked when read */
+typedef struct mica_event_type {
+	ADDRINT id; // (dynamic) instruction id, the index of its deferred calls
+	ADDRINT read_ea;
+	ADDRINT read_size;
+	ADDRINT read2_ea;
+	ADDRINT write_ea;
+	ADDRINT write_size;
+	ADDRINT taken;
+	ADDRINT first_rep;
+	ADDRINT rep_cnt;
+} mica_event;
+
+/* calling context: thread id and mica_thread passed to analysis routines */
+typedef struct mica_call_context_type {
+	ADDRINT tid;
+	ADDRINT thread;
+	ADDRINT version; // value of mica_version_reg
+} mica_call_context;
+
+#define MICA_CALL_MAX_ARGS 12
+
+/* a version case switches to another version of the instrumentation (only when replaying, see
+ * INS_InsertVersionCase in replay/pin.H), the rest of the calls of that version are not done */
+enum MICA_CALL_KIND { MICA_CALL, MICA_IF_CALL, MICA_THEN_CALL, MICA_VERSION_CASE };
+
+#define MICA_NO_VERSION (~(ADDRINT)0)
+
+enum MICA_CALL_ARG_BASE { MICA_ARG_CONST, MICA_ARG_EVENT, MICA_ARG_CONTEXT };
+
+/* Deferred calls are done through a trampoline per analysis routine, which converts the recorded
+ * ADDRINT arguments back to the types of the routine's parameters (integers, BOOL or pointers,
+ * checked at compile time) and its return value (of if calls) to ADDRINT. */
+typedef ADDRINT (*mica_call_fun)(const ADDRINT* args);
+
+template <UINT32... I> struct mica_call_indices {};
+template <UINT32 N, UINT32... I> struct mica_call_make_indices : mica_call_make_indices<N - 1, N - 1, I...> {};
+template <UINT32... I> struct mica_call_make_indices<0, I...> { typedef mica_call_indices<I...> type; };
+
+template <typename T> static inline T mica_call_arg_value(ADDRINT a){
+	static_assert(std::is_integral<T>::value || std::is_pointer<T>::value, "deferred analysis routines only take integer or pointer arguments");
+	static_assert(sizeof(T) <= sizeof(ADDRINT), "deferred analysis routine argument wider than ADDRINT");
+	return (T)a;
+}
+
+template <typename F, F f> struct mica_call_trampoline;
+
+template <typename R, typename... A, R (*f)(A...)> struct mica_call_trampoline<R (*)(A...), f> {
+	static_assert(sizeof...(A) <= MICA_CALL_MAX_ARGS, "too many arguments for deferred analysis routine");
+	static_assert(std::is_integral<R>::value, "deferred analysis routines return VOID or an integer");
+	static const UINT32 argc = sizeof...(A);
+	template <UINT32... I> static inline ADDRINT call(const ADDRINT* args, mica_call_indices<I...>){
+		return (ADDRINT)f(mica_call_arg_value<A>(args[I])...);
+	}
+	static ADDRINT run(const ADDRINT* args){
+		return call(args, typename mica_call_make_indices<sizeof...(A)>::type());
+	}
+};
+
+template <typename... A, VOID (*f)(A...)> struct mica_call_trampoline<VOID (*)(A...), f> {
+	static_assert(sizeof...(A) <= MICA_CALL_MAX_ARGS, "too many arguments for deferred analysis routine");
+	static const UINT32 argc = sizeof...(A);
+	template <UINT32... I> static inline VOID call(const ADDRINT* args, mica_call_indices<I...>){
+		f(mica_call_arg_value<A>(args[I])...);
+	}
+	static ADDRINT run(const ADDRINT* args){
+		call(args, typename mica_call_make_indices<sizeof...(A)>::type());
+		return 0;
+	}
+};
+
+#define MICA_CALL_TRAMPOLINE(fun) mica_call_trampoline<decltype(&fun), &fun>
+
+typedef struct mica_call_type {
+	mica_call_fun fun; // trampoline of the analysis routine
+	MICA_CALL_KIND kind;
+	BOOL ret_version; // the return value is written to mica_version_reg (IARG_RETURN_REGS)
+	UINT32 argc;
+	UINT8 base[MICA_CALL_MAX_ARGS]; // MICA_CALL_ARG_BASE
+	UINT8 index[MICA_CALL_MAX_ARGS]; // ADDRINT index in the base (argument array, event record or context)
+	ADDRINT mask[MICA_CALL_MAX_ARGS];
+	ADDRINT val[MICA_CALL_MAX_ARGS]; // constant arguments
+} mica_call;
+
+/* deferred calls of an instruction */
+typedef struct mica_call_list_type {
+	mica_call* calls;
+	UINT32 cnt;
+	UINT32 size;
+} mica_call_list;
+
+VOID mica_call_list_init(mica_call_list* l);
+VOID mica_call_list_add_version_case(mica_call_list* l, REG reg, INT32 case_value, ADDRINT version);
+/* returns the version switched to, or MICA_NO_VERSION */
+ADDRINT mica_call_list_run(mica_call_list* l, mica_event* ev, mica_call_context* ctx);
+
+/* add a call of the routine with trampoline fun, taking argc arguments, given as Pin arguments (up to IARG_END) */
+VOID mica_record_call(mica_call_list* l, MICA_CALL_KIND kind, INS ins, mica_call_fun fun, UINT32 argc, ...);
+
+/* While recording is enabled (see workers_record_begin), the analysis calls of the instrumented
+ * instruction are added to mica_recording_list rather than inserted by Pin. */
+extern BOOL mica_recording;
+extern mica_call_list* mica_recording_list;
+
+/* Analysis calls are inserted with mica_insert_call(kind, ins, ipoint, routine, Pin arguments...),
+ * which inserts them with INS_InsertCall, INS_InsertIfCall or INS_InsertThenCall (depending on kind),
+ * or records them while recording is enabled. The replay engine (replay/pin.H) keeps all calls as
+ * deferred calls of the instruction. */
+#ifdef MICA_REPLAY
+mica_call_list* replay_ins_calls(INS ins);
+#define mica_insert_call(kind, ins, ipoint, fun, ...) \
+	mica_record_call(mica_recording ? mica_recording_list : replay_ins_calls(ins), kind, ins, MICA_CALL_TRAMPOLINE(fun)::run, MICA_CALL_TRAMPOLINE(fun)::argc, __VA_ARGS__)
+#else
+#define mica_insert_call(kind, ins, ipoint, fun, ...) \
+	(mica_recording ? mica_record_call(mica_recording_list, kind, ins, MICA_CALL_TRAMPOLINE(fun)::run, MICA_CALL_TRAMPOLINE(fun)::argc, __VA_ARGS__) : \
+	(kind) == MICA_CALL ? INS_InsertCall(ins, ipoint, (AFUNPTR)fun, __VA_ARGS__) : \
+	(kind) == MICA_IF_CALL ? INS_InsertIfCall(ins, ipoint, (AFUNPTR)fun, __VA_ARGS__) : \
+	INS_InsertThenCall(ins, ipoint, (AFUNPTR)fun, __VA_ARGS__))
+#endif
 
 typedef struct ins_buffer_entry_type {
 	ADDRINT insAddr;
@@ -0,0 +1,367 @@
+/*
+ * This file is part of MICA, a Pin tool to collect
+ * microarchitecture-independent program characteristics using the Pin
+ * instrumentation framework.
+ *
+ * Please see the README.txt file distributed with the MICA release for more
+ * information.
+ */
+
+#include "pin.H"
+
+#include <stddef.h>
+
+/* MICA includes */
+#include "mica_utils.h"
+#include "mica_workers.h"
+
+/* Global variables */
+
+extern ofstream _log;
+
+/* copies of the program threads used by the workers, indexed by (worker, program thread id) */
+mica_thread** mica_worker_threads;
+
+/* full buffer, consumed by all workers */
+typedef struct worker_block_type {
+	THREADID tid;
+	mica_event* events;
+	UINT64 cnt;
+	INT32 refs; // number of workers which did not consume the block yet
+} worker_block;
+
+/* per-worker state */
+typedef struct worker_type {
+	UINT32 index;
+	UINT32 interval_clients; // interval clients handled by the worker
+	volatile UINT64 done; // number of blocks consumed
+	PIN_THREAD_UID uid;
+} worker;
+
+static worker* workers;
+static UINT32 workers_cnt;
+static volatile BOOL workers_stopped;
+
+static BUFFER_ID workers_buffer;
+static worker_block workers_blocks[WORKER_MAX_BLOCKS];
+static volatile UINT64 workers_block_cnt; // number of blocks handed to the workers
+static PIN_LOCK workers_lock; // serializes handing over blocks (program threads) and draining them after the workers stopped
+
+/* consumed buffers, reused by the program threads */
+static VOID** workers_pool;
+static UINT32 workers_pool_cnt;
+static PIN_LOCK workers_pool_lock;
+
+/* program threads, by thread id */
+static mica_thread** workers_program_threads;
+
+/* deferred calls of every instrumented instruction (for each worker), by instruction id;
+ * chunks are never moved, so the workers can look up instructions while new ones are added */
+static mica_call_list** workers_ins_chunks[WORKER_INS_CHUNKS];
+static UINT32 workers_ins_cnt;
+
+
+/* *** instrumentation *** */
+
+/* new instrumented instruction (every time an instruction is instrumented, as its calls depend on the trace it is part of) */
+UINT32 workers_new_ins(){
+
+	UINT32 id = workers_ins_cnt;
+	UINT32 chunk = id >> LOG_WORKER_INS_CHUNK_SIZE;
+	UINT32 i;
+	mica_call_list* lists;
+
+	if(chunk == WORKER_INS_CHUNKS){
+		cerr << "FATAL ERROR: Too many instrumented instructions for the analysis threads!" << endl;
+		_log << "FATAL ERROR: Too many instrumented instructions for the analysis threads!" << endl;
+		exit(1);
+	}
+	if(workers_ins_chunks[chunk] == NULL)
+		workers_ins_chunks[chunk] = (mica_call_list**)checked_malloc(BITS_TO_COUNT(LOG_WORKER_INS_CHUNK_SIZE) * sizeof(mica_call_list*));
+
+	lists = (mica_call_list*)checked_malloc(workers_cnt * sizeof(mica_call_list));
+	for(i = 0; i < workers_cnt; i++)
+		mica_call_list_init(&lists[i]);
+	workers_ins_chunks[chunk][id & BITS_TO_MASK(LOG_WORKER_INS_CHUNK_SIZE)] = lists;
+
+	workers_ins_cnt++;
+
+	return id;
+}
+
+static inline mica_call_list* workers_ins_calls(UINT32 id, UINT32 w){
+	return &workers_ins_chunks[id >> LOG_WORKER_INS_CHUNK_SIZE][id & BITS_TO_MASK(LOG_WORKER_INS_CHUNK_SIZE)][w];
+}
+
+/* calls inserted until workers_record_end are done by the given worker, for instruction id */
+VOID workers_record_begin(UINT32 id, UINT32 w){
+	mica_recording_list = workers_ins_calls(id, w);
+	mica_recording = true;
+}
+
+VOID workers_record_end(){
+	mica_recording = false;
+	mica_recording_list = NULL;
+}
+
+/* fill an event record for every execution of the instruction; fields which are not valid
+ * for the instruction get its address instead, they are not used by its deferred calls */
+VOID workers_fill(INS ins, UINT32 id){
+
+	BOOL read = INS_IsMemoryRead(ins);
+	BOOL read2 = INS_HasMemoryRead2(ins);
+	BOOL write = INS_IsMemoryWrite(ins);
+	BOOL branch = CATEGORY_StringShort(INS_Category(ins)) == "COND_BR";
+	BOOL rep = INS_HasRealRep(ins);
+
+	INS_InsertFillBuffer(ins, IPOINT_BEFORE, workers_buffer,
+		IARG_UINT32, id, offsetof(mica_event, id),
+		read ? IARG_MEMORYREAD_EA : IARG_INST_PTR, offsetof(mica_event, read_ea),
+		read ? IARG_MEMORYREAD_SIZE : IARG_INST_PTR, offsetof(mica_event, read_size),
+		read2 ? IARG_MEMORYREAD2_EA : IARG_INST_PTR, offsetof(mica_event, read2_ea),
+		write ? IARG_MEMORYWRITE_EA : IARG_INST_PTR, offsetof(mica_event, write_ea),
+		write ? IARG_MEMORYWRITE_SIZE : IARG_INST_PTR, offsetof(mica_event, write_size),
+		branch ? IARG_BRANCH_TAKEN : IARG_INST_PTR, offsetof(mica_event, taken),
+		rep ? IARG_FIRST_REP_ITERATION : IARG_INST_PTR, offsetof(mica_event, first_rep),
+		IARG_REG_VALUE, rep ? INS_RepCountRegister(ins) : REG_INST_PTR, offsetof(mica_event, rep_cnt),
+		IARG_END);
+}
+
+/* *** consuming blocks *** */
+
+/* copy of the program thread for the worker, made when the worker sees the thread for the first time */
+static mica_thread* worker_thread(worker* w, THREADID tid, UINT32* vtid){
+
+	UINT32 index = w->index * MAX_WORKER_PROGRAM_THREADS + tid;
+	mica_thread* t = mica_worker_threads[index];
+
+	if(t == NULL){
+		t = (mica_thread*)checked_aligned_malloc(sizeof(mica_thread));
+		*t = *workers_program_threads[tid];
+		t->interval_clients = w->interval_clients;
+		mica_worker_threads[index] = t;
+	}
+	*vtid = MICA_WORKER_TID + index;
+
+	return t;
+}
+
+static VOID workers_pool_put(VOID* buf){
+	PIN_GetLock(&workers_pool_lock, 0);
+	workers_pool[workers_pool_cnt++] = buf;
+	PIN_ReleaseLock(&workers_pool_lock);
+}
+
+static VOID* workers_pool_get(){
+
+	VOID* buf = NULL;
+
+	PIN_GetLock(&workers_pool_lock, 0);
+	if(workers_pool_cnt > 0)
+		buf = workers_pool[--workers_pool_cnt];
+	PIN_ReleaseLock(&workers_pool_lock);
+
+	if(buf == NULL)
+		buf = PIN_AllocateBuffer(workers_buffer);
+
+	return buf;
+}
+
+/* do the deferred calls of the worker for all events in its next block */
+static VOID worker_consume(worker* w){
+
+	worker_block* b = &workers_blocks[w->done % WORKER_MAX_BLOCKS];
+	mica_event* ev;
+	mica_event* end;
+	mica_call_context ctx;
+	UINT32 vtid;
+
+	__sync_synchronize();
+
+	ctx.thread = (ADDRINT)worker_thread(w, b->tid, &vtid);
+	ctx.tid = vtid;
+	ctx.version = 0;
+
+	for(ev = b->events, end = b->events + b->cnt; ev != end; ev++)
+		mica_call_list_run(workers_ins_calls((UINT32)ev->id, w->index), ev, &ctx);
+
+	if(__sync_sub_and_fetch(&b->refs, 1) == 0)
+		workers_pool_put(b->events);
+
+	__sync_synchronize();
+	w->done++;
+}
+
+static VOID worker_main(VOID* arg){
+
+	worker* w = (worker*)arg;
+	UINT32 idle = 0;
+
+	while(true){
+		if(w->done == workers_block_cnt){
+			if(workers_stopped)
+				break;
+			/* wait for the next block */
+			if(++idle < 1000)
+				PIN_Yield();
+			else
+				PIN_Sleep(1);
+			continue;
+		}
+		idle = 0;
+		worker_consume(w);
+	}
+}
+
+static UINT64 workers_min_done(){
+
+	UINT64 min = workers_block_cnt;
+	UINT32 i;
+
+	for(i = 0; i < workers_cnt; i++){
+		if(workers[i].done < min)
+			min = workers[i].done;
+	}
+	return min;
+}
+
+/* consume all remaining blocks on the calling thread, once the workers stopped (with workers_lock held) */
+static VOID workers_drain(){
+
+	UINT32 i;
+
+	for(i = 0; i < workers_cnt; i++){
+		while(workers[i].done < workers_block_cnt)
+			worker_consume(&workers[i]);
+	}
+}
+
+/* trace buffer of a program thread is full (or the thread exits): hand it to the workers */
+static VOID* workers_buffer_full(BUFFER_ID id, THREADID tid, const CONTEXT* ctxt, VOID* buf, UINT64 n, VOID* v){
+
+	worker_block* b;
+
+	if(n == 0)
+		return buf;
+
+	PIN_GetLock(&workers_lock, tid+1);
+
+	/* wait until the slowest worker is done with the oldest block */
+	while(workers_block_cnt - workers_min_done() == WORKER_MAX_BLOCKS){
+		if(workers_stopped){
+			workers_drain();
+			break;
+		}
+		PIN_ReleaseLock(&workers_lock);
+		PIN_Yield();
+		PIN_GetLock(&workers_lock, tid+1);
+	}
+
+	b = &workers_blocks[workers_block_cnt % WORKER_MAX_BLOCKS];
+	b->tid = tid;
+	b->events = (mica_event*)buf;
+	b->cnt = n;
+	b->refs = workers_cnt;
+
+	__sync_synchronize();
+	workers_block_cnt++;
+
+	PIN_ReleaseLock(&workers_lock);
+
+	return workers_pool_get();
+}
+
+VOID workers_thread_start(mica_thread* t){
+
+	if(t->tid >= MAX_WORKER_PROGRAM_THREADS){
+		cerr << "FATAL ERROR: Too many threads for the analysis threads (max. " << MAX_WORKER_PROGRAM_THREADS << ")" << endl;
+		_log << "FATAL ERROR: Too many threads for the analysis threads (max. " << MAX_WORKER_PROGRAM_THREADS << ")" << endl;
+		exit(1);
+	}
+	workers_program_threads[t->tid] = t;
+}
+
+/* the workers are stopped before the program ends, as Pin may terminate internal threads after that */
+static VOID workers_prepare_fini(VOID* v){
+
+	UINT32 i;
+
+	workers_stopped = true;
+	for(i = 0; i < workers_cnt; i++)
+		PIN_WaitForThreadTermination(workers[i].uid, PIN_INFINITE_TIMEOUT, NULL);
+}
+
+/* consume the last blocks, and copy the instruction counts of the workers back to the program threads */
+static VOID workers_fini(INT32 code, VOID* v){
+
+	UINT32 k;
+	mica_thread* t;
+	mica_thread* c;
+
+	PIN_GetLock(&workers_lock, 0);
+	workers_drain();
+	PIN_ReleaseLock(&workers_lock);
+
+	for(k=0; k < mica_thread_cnt; k++){
+		t = mica_threads[k];
+		c = mica_worker_threads[t->tid];
+		if(c != NULL){
+			t->interval_ins_count = c->interval_ins_count;
+			t->interval_ins_count_for_hpc_alignment = c->interval_ins_count_for_hpc_alignment;
+			t->total_ins_count = c->total_ins_count;
+			t->total_ins_count_for_hpc_alignment = c->total_ins_count_for_hpc_alignment;
+		}
+	}
+
+	LOG_MSG(workers_block_cnt << " blocks of events analyzed by " << workers_cnt << " analysis threads");
+}
+
+/* set up the trace buffers and start worker_cnt workers; interval_clients holds the interval clients of each worker */
+VOID init_workers(UINT32 worker_cnt, const UINT32* interval_clients){
+
+	UINT32 i;
+
+	if(worker_cnt > MAX_WORKERS){
+		cerr << "FATAL ERROR: Too many analysis threads (max. " << MAX_WORKERS << ")" << endl;
+		_log << "FATAL ERROR: Too many analysis threads (max. " << MAX_WORKERS << ")" << endl;
+		exit(1);
+	}
+
+	workers_cnt = worker_cnt;
+	workers_stopped = false;
+	workers_block_cnt = 0;
+	workers_ins_cnt = 0;
+	PIN_InitLock(&workers_lock);
+	PIN_InitLock(&workers_pool_lock);
+
+	workers_program_threads = (mica_thread**)checked_malloc(MAX_WORKER_PROGRAM_THREADS * sizeof(mica_thread*));
+	memset(workers_program_threads, 0, MAX_WORKER_PROGRAM_THREADS * sizeof(mica_thread*));
+	mica_worker_threads = (mica_thread**)checked_malloc(worker_cnt * MAX_WORKER_PROGRAM_THREADS * sizeof(mica_thread*));
+	memset(mica_worker_threads, 0, worker_cnt * MAX_WORKER_PROGRAM_THREADS * sizeof(mica_thread*));
+
+	/* every block in flight and every program thread holds a buffer */
+	workers_pool = (VOID**)checked_malloc((WORKER_MAX_BLOCKS + MAX_WORKER_PROGRAM_THREADS) * sizeof(VOID*));
+	workers_pool_cnt = 0;
+
+	workers_buffer = PIN_DefineTraceBuffer(sizeof(mica_event), WORKER_BUFFER_PAGES, workers_buffer_full, 0);
+	if(workers_buffer == BUFFER_ID_INVALID){
+		cerr << "FATAL ERROR: Could not define a trace buffer for the analysis threads!" << endl;
+		_log << "FATAL ERROR: Could not define a trace buffer for the analysis threads!" << endl;
+		exit(1);
+	}
+
+	workers = (worker*)checked_malloc(worker_cnt * sizeof(worker));
+	for(i = 0; i < worker_cnt; i++){
+		workers[i].index = i;
+		workers[i].interval_clients = interval_clients[i];
+		workers[i].done = 0;
+		if(PIN_SpawnInternalThread(worker_main, &workers[i], 0, &workers[i].uid) == INVALID_THREADID){
+			cerr << "FATAL ERROR: Could not start analysis thread!" << endl;
+			_log << "FATAL ERROR: Could not start analysis thread!" << endl;
+			exit(1);
+		}
+	}
+
+	PIN_AddPrepareForFiniFunction(workers_prepare_fini, 0);
+	PIN_AddFiniFunction(workers_fini, 0);
+}
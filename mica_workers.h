@@ -0,0 +1,40 @@
+/*
+ * This file is part of MICA, a Pin tool to collect
+ * microarchitecture-independent program characteristics using the Pin
+ * instrumentation framework.
+ *
+ * Please see the README.txt file distributed with the MICA release for more
+ * information.
+ */
+
+#include "mica.h"
+#include "mica_utils.h"
+
+#ifndef MICA_WORKERS
+#define MICA_WORKERS
+
+/* *** analysis threads ***
+ *
+ * Program threads only fill Pin trace buffers with an event record per executed instruction.
+ * Full buffers are handed to a set of internal analysis threads (workers), which all consume
+ * every buffer: each worker does the analysis calls recorded for it at instrumentation time
+ * (typically those of a single module), using its own copy of the state of every program thread. */
+
+#define MAX_WORKERS 16
+#define MAX_WORKER_PROGRAM_THREADS 4096
+
+#define WORKER_BUFFER_PAGES 256 // size of a trace buffer, in pages
+#define WORKER_MAX_BLOCKS 64 // number of full buffers handed to the workers but not consumed by all of them yet
+
+#define LOG_WORKER_INS_CHUNK_SIZE 14
+#define WORKER_INS_CHUNKS 4096 // at most 4096 * 2^14 (64M) instrumented instructions
+
+VOID init_workers(UINT32 worker_cnt, const UINT32* interval_clients);
+VOID workers_thread_start(mica_thread* t);
+
+UINT32 workers_new_ins();
+VOID workers_record_begin(UINT32 id, UINT32 worker);
+VOID workers_record_end();
+VOID workers_fill(INS ins, UINT32 id);
+
+#endif
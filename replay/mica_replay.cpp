@@ -0,0 +1,689 @@
+/*
+ * This file is part of MICA, a Pin tool to collect
+ * microarchitecture-independent program characteristics using the Pin
+ * instrumentation framework.
+ *
+ * Please see the README.txt file distributed with the MICA release for more
+ * information.
+ */
+
+/* mica_replay: offline analysis of a trace written in capture mode, without Pin
+ *
+ * usage: mica_replay <instruction table> <trace>
+ *   e.g. mica_replay mica_trace_ins_pin.out mica_trace_pin.out
+ *
+ * The MICA tool is linked against the Pin API emulation below (see pin.H in this directory),
+ * so the analyses are instrumented and run exactly as in a Pin run: the recorded instructions
+ * are instrumented the first time they are seen, and the inserted analysis routines are called
+ * for every event in the trace, with arguments taken from the event. The analyses are chosen
+ * in mica.conf as usual, each thread of the captured program is replayed separately.
+ * Trace buffers are filled as well, and internal threads are run as POSIX threads, so the
+ * analysis threads (analysis_threads: yes) can be used when replaying. */
+
+#include "pin.H"
+
+#include <stdarg.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+
+/* MICA includes */
+#include "mica.h"
+#include "mica_utils.h"
+#include "mica_capture.h"
+
+/* *** recorded instructions and the analysis calls inserted for them *** */
+
+#define REPLAY_MAX_CATEGORIES 256
+#define REPLAY_MAX_FILL_ARGS 16
+#define REPLAY_MAX_VERSIONS 4
+
+/* value written to a trace buffer record */
+typedef struct replay_fill_arg_type {
+	IARG_TYPE type;
+	ADDRINT val; // constants and registers
+	UINT32 offset;
+} replay_fill_arg;
+
+typedef struct replay_ins_type {
+	ADDRINT addr;
+	UINT32 size;
+	UINT32 flags; // CAPTURE_INS_*
+	UINT32 opCnt;
+	UINT8* opIsReg;
+	UINT32 regReadCnt;
+	REG* regsRead;
+	UINT32 regWriteCnt;
+	REG* regsWritten;
+	INT32 category;
+	char* mnemonic;
+	char* disassembly;
+	/* every version of the instruction is instrumented separately (see INS_InsertVersionCase) */
+	BOOL instrumented[REPLAY_MAX_VERSIONS];
+	mica_call_list calls[REPLAY_MAX_VERSIONS];
+	ADDRINT target_version[REPLAY_MAX_VERSIONS]; // version of the next instruction
+	replay_fill_arg* fill; // NULL if the instruction does not fill the trace buffer
+	UINT32 fill_cnt;
+} replay_ins;
+
+static replay_ins* replay_ins_table;
+static UINT32 replay_ins_cnt;
+
+static char* replay_categories[REPLAY_MAX_CATEGORIES];
+static INT32 replay_category_cnt;
+
+/* the event being replayed and the replayed thread, analysis routine arguments are read from here */
+static mica_event ev;
+static mica_call_context ctx;
+
+/* tool setup */
+static const char* replay_ins_file_name;
+static const char* replay_trace_file_name;
+
+static TRACE_INSTRUMENT_CALLBACK replay_trace_callback;
+static VOID* replay_trace_callback_val;
+static BOOL replay_remove_pending; // instrumentation removed, every instruction is instrumented again
+static ADDRINT replay_version; // version of the executing (or instrumented) instruction
+static THREAD_START_CALLBACK replay_thread_start_callback;
+static VOID* replay_thread_start_callback_val;
+
+#define REPLAY_MAX_FINI 16
+static FINI_CALLBACK replay_fini_callbacks[REPLAY_MAX_FINI];
+static VOID* replay_fini_callback_vals[REPLAY_MAX_FINI];
+static UINT32 replay_fini_cnt;
+
+#define REPLAY_MAX_PREPARE_FINI 16
+static PREPARE_FOR_FINI_CALLBACK replay_prepare_fini_callbacks[REPLAY_MAX_PREPARE_FINI];
+static VOID* replay_prepare_fini_callback_vals[REPLAY_MAX_PREPARE_FINI];
+static UINT32 replay_prepare_fini_cnt;
+
+/* trace buffer */
+static size_t replay_buffer_record_size;
+static size_t replay_buffer_size;
+static TRACE_BUFFER_CALLBACK replay_buffer_callback;
+static VOID* replay_buffer_callback_val;
+static UINT8* replay_buffer;
+static UINT64 replay_buffer_cnt; // number of records in replay_buffer
+
+/* internal threads */
+#define REPLAY_MAX_INTERNAL_THREADS 64
+static pthread_t replay_internal_threads[REPLAY_MAX_INTERNAL_THREADS];
+static UINT32 replay_internal_thread_cnt;
+
+static const VOID* replay_thread_data;
+
+
+static VOID replay_error(const char* msg, const char* name){
+	cerr << "FATAL ERROR: " << msg << " " << name << endl;
+	exit(1);
+}
+
+/* *** Pin API: instrumentation *** */
+
+/* the calls are kept like the deferred calls of the analysis threads (see mica_insert_call in mica_utils.h) */
+mica_call_list* replay_ins_calls(INS ins){
+	return &ins->calls[replay_version];
+}
+
+VOID INS_InsertVersionCase(INS ins, REG reg, INT32 case_value, ADDRINT version, ...){
+	if(version >= REPLAY_MAX_VERSIONS)
+		replay_error("unsupported instrumentation version for", ins->mnemonic);
+	mica_call_list_add_version_case(&ins->calls[replay_version], reg, case_value, version);
+}
+
+ADDRINT TRACE_Version(TRACE trace){ return replay_version; }
+VOID BBL_SetTargetVersion(BBL bbl, ADDRINT version){ bbl->target_version[replay_version] = version; }
+
+/* the values to write are given as (IARG type, [value,] offset) up to IARG_END */
+VOID INS_InsertFillBuffer(INS ins, IPOINT action, BUFFER_ID id, ...){
+
+	va_list args;
+	IARG_TYPE type;
+	replay_fill_arg* a;
+
+	if(ins->fill != NULL)
+		replay_error("trace buffer filled twice by instruction", ins->mnemonic);
+	ins->fill = (replay_fill_arg*)checked_malloc(REPLAY_MAX_FILL_ARGS * sizeof(replay_fill_arg));
+	ins->fill_cnt = 0;
+
+	va_start(args, id);
+	for(type = (IARG_TYPE)va_arg(args, int); type != IARG_END; type = (IARG_TYPE)va_arg(args, int)){
+
+		if(ins->fill_cnt == REPLAY_MAX_FILL_ARGS)
+			replay_error("too many trace buffer fields for instruction", ins->mnemonic);
+		a = &ins->fill[ins->fill_cnt++];
+		a->type = type;
+		a->val = 0;
+
+		switch(type){
+			case IARG_UINT32: a->val = va_arg(args, UINT32); break;
+			case IARG_ADDRINT: a->val = va_arg(args, ADDRINT); break;
+			case IARG_REG_VALUE: a->val = va_arg(args, int); break;
+			case IARG_MEMORYREAD_EA: case IARG_MEMORYREAD2_EA: case IARG_MEMORYREAD_SIZE:
+			case IARG_MEMORYWRITE_EA: case IARG_MEMORYWRITE_SIZE: case IARG_BRANCH_TAKEN:
+			case IARG_FIRST_REP_ITERATION: case IARG_INST_PTR: case IARG_THREAD_ID:
+				break;
+			default:
+				replay_error("unsupported trace buffer field for instruction", ins->mnemonic);
+		}
+		a->offset = va_arg(args, UINT32);
+	}
+	va_end(args);
+}
+
+/* every instruction is a trace (and basic block) on its own */
+BBL TRACE_BblHead(TRACE trace){ return trace; }
+BOOL BBL_Valid(BBL bbl){ return bbl != NULL; }
+BBL BBL_Next(BBL bbl){ return NULL; }
+INS BBL_InsHead(BBL bbl){ return bbl; }
+UINT32 BBL_NumIns(BBL bbl){ return 1; }
+BOOL INS_Valid(INS ins){ return ins != NULL; }
+INS INS_Next(INS ins){ return NULL; }
+
+/* *** Pin API: instruction inspection, from the instruction table *** */
+
+ADDRINT INS_Address(INS ins){ return ins->addr; }
+USIZE INS_Size(INS ins){ return ins->size; }
+INT32 INS_Category(INS ins){ return ins->category; }
+std::string CATEGORY_StringShort(INT32 category){ return std::string(replay_categories[category]); }
+std::string INS_Mnemonic(INS ins){ return std::string(ins->mnemonic); }
+std::string INS_Disassemble(INS ins){ return std::string(ins->disassembly); }
+BOOL INS_IsMemoryRead(INS ins){ return (ins->flags & CAPTURE_INS_MEM_READ) != 0; }
+BOOL INS_IsMemoryWrite(INS ins){ return (ins->flags & CAPTURE_INS_MEM_WRITE) != 0; }
+BOOL INS_HasMemoryRead2(INS ins){ return (ins->flags & CAPTURE_INS_MEM_READ2) != 0; }
+BOOL INS_HasRealRep(INS ins){ return (ins->flags & CAPTURE_INS_REP) != 0; }
+REG INS_RepCountRegister(INS ins){ return REG_REPLAY_REP_COUNT; }
+BOOL INS_IsMov(INS ins){ return (ins->flags & CAPTURE_INS_MOV) != 0; }
+UINT32 INS_OperandCount(INS ins){ return ins->opCnt; }
+BOOL INS_OperandIsReg(INS ins, UINT32 n){ return ins->opIsReg[n] != 0; }
+UINT32 INS_MaxNumRRegs(INS ins){ return ins->regReadCnt; }
+REG INS_RegR(INS ins, UINT32 k){ return ins->regsRead[k]; }
+UINT32 INS_MaxNumWRegs(INS ins){ return ins->regWriteCnt; }
+REG INS_RegW(INS ins, UINT32 k){ return ins->regsWritten[k]; }
+
+/* only the registers considered by MICA were recorded, they pass all of its register checks */
+BOOL REG_valid(REG reg){ return reg != REG_INVALID_; }
+BOOL REG_is_fr(REG reg){ return false; }
+BOOL REG_is_mm(REG reg){ return false; }
+BOOL REG_is_xmm(REG reg){ return false; }
+BOOL REG_is_gr(REG reg){ return reg != REG_INVALID_; }
+BOOL REG_is_gr8(REG reg){ return false; }
+BOOL REG_is_gr16(REG reg){ return false; }
+BOOL REG_is_gr32(REG reg){ return false; }
+BOOL REG_is_gr64(REG reg){ return false; }
+
+/* *** Pin API: tool setup *** */
+
+BOOL PIN_Init(INT32 argc, char** argv){
+
+	if(argc != 3){
+		cerr << "usage: " << argv[0] << " <instruction table> <trace>" << endl;
+		cerr << "  e.g. " << argv[0] << " mica_trace_ins_pin.out mica_trace_pin.out" << endl;
+		exit(1);
+	}
+	replay_ins_file_name = argv[1];
+	replay_trace_file_name = argv[2];
+
+	return false;
+}
+
+VOID TRACE_AddInstrumentFunction(TRACE_INSTRUMENT_CALLBACK fun, VOID* val){
+	replay_trace_callback = fun;
+	replay_trace_callback_val = val;
+}
+
+BOOL PIN_InitSymbols(){ return false; }
+
+VOID RTN_AddInstrumentFunction(RTN_INSTRUMENT_CALLBACK fun, VOID* val){
+	replay_error("routines can not be instrumented when replaying (e.g. for roi_function), traces hold no symbols", "");
+}
+
+/* never called, as there are no routines */
+const std::string& RTN_Name(RTN rtn){ static std::string name; return name; }
+VOID RTN_Open(RTN rtn){}
+VOID RTN_Close(RTN rtn){}
+VOID RTN_InsertCall(RTN rtn, IPOINT action, AFUNPTR funptr, ...){}
+
+/* every instruction is its own trace, so the removal takes effect at the next event */
+VOID PIN_RemoveInstrumentation(){
+	replay_remove_pending = true;
+}
+
+VOID PIN_AddFiniFunction(FINI_CALLBACK fun, VOID* val){
+	if(replay_fini_cnt == REPLAY_MAX_FINI)
+		replay_error("too many fini functions", "");
+	replay_fini_callbacks[replay_fini_cnt] = fun;
+	replay_fini_callback_vals[replay_fini_cnt] = val;
+	replay_fini_cnt++;
+}
+
+VOID PIN_AddThreadStartFunction(THREAD_START_CALLBACK fun, VOID* val){
+	replay_thread_start_callback = fun;
+	replay_thread_start_callback_val = val;
+}
+
+/* the first tool register holds the thread (mica_thread_reg), the second the version (mica_version_reg) */
+REG PIN_ClaimToolRegister(){
+
+	static UINT32 claimed = 0;
+
+	switch(claimed++){
+		case 0: return REG_REPLAY_TOOL;
+		case 1: return REG_REPLAY_TOOL2;
+		default: return REG_INVALID_;
+	}
+}
+
+VOID PIN_SetContextReg(CONTEXT* ctxt, REG reg, ADDRINT val){
+	if(reg == REG_REPLAY_TOOL)
+		ctx.thread = val;
+	else
+		ctx.version = val;
+}
+
+TLS_KEY PIN_CreateThreadDataKey(DESTRUCTFUN destruct_func){ return 0; }
+BOOL PIN_SetThreadData(TLS_KEY key, const VOID* data, THREADID tid){ replay_thread_data = data; return true; }
+VOID* PIN_GetThreadData(TLS_KEY key, THREADID tid){ return (VOID*)replay_thread_data; }
+
+VOID PIN_AddPrepareForFiniFunction(PREPARE_FOR_FINI_CALLBACK fun, VOID* val){
+	if(replay_prepare_fini_cnt == REPLAY_MAX_PREPARE_FINI)
+		replay_error("too many prepare for fini functions", "");
+	replay_prepare_fini_callbacks[replay_prepare_fini_cnt] = fun;
+	replay_prepare_fini_callback_vals[replay_prepare_fini_cnt] = val;
+	replay_prepare_fini_cnt++;
+}
+
+VOID PIN_InitLock(PIN_LOCK* lock){ pthread_mutex_init(&lock->mutex, NULL); }
+VOID PIN_GetLock(PIN_LOCK* lock, INT32 val){ pthread_mutex_lock(&lock->mutex); }
+VOID PIN_ReleaseLock(PIN_LOCK* lock){ pthread_mutex_unlock(&lock->mutex); }
+
+/* *** Pin API: trace buffer *** */
+
+#define REPLAY_PAGE_SIZE 4096
+
+BUFFER_ID PIN_DefineTraceBuffer(size_t recordSize, UINT32 numPages, TRACE_BUFFER_CALLBACK fun, VOID* val){
+	if(replay_buffer_callback != NULL)
+		return BUFFER_ID_INVALID;
+	replay_buffer_record_size = recordSize;
+	replay_buffer_size = (size_t)numPages * REPLAY_PAGE_SIZE;
+	replay_buffer_callback = fun;
+	replay_buffer_callback_val = val;
+	return 0;
+}
+
+VOID* PIN_AllocateBuffer(BUFFER_ID id){ return checked_malloc(replay_buffer_size); }
+VOID PIN_DeallocateBuffer(BUFFER_ID id, VOID* buf){ free(buf); }
+
+/* hand the (full or last) buffer to the tool, like Pin does */
+static VOID replay_buffer_flush(CONTEXT* ctxt){
+	replay_buffer = (UINT8*)replay_buffer_callback(0, (THREADID)ctx.tid, ctxt, replay_buffer, replay_buffer_cnt, replay_buffer_callback_val);
+	replay_buffer_cnt = 0;
+}
+
+/* write a record for the executed instruction, with the field widths Pin uses */
+static inline VOID replay_buffer_fill(replay_ins* ins, CONTEXT* ctxt){
+
+	UINT8* rec;
+	replay_fill_arg* a;
+	replay_fill_arg* end;
+	ADDRINT v;
+
+	if((replay_buffer_cnt + 1) * replay_buffer_record_size > replay_buffer_size)
+		replay_buffer_flush(ctxt);
+	rec = replay_buffer + replay_buffer_cnt * replay_buffer_record_size;
+
+	for(a = ins->fill, end = ins->fill + ins->fill_cnt; a != end; a++){
+		switch(a->type){
+			case IARG_UINT32: *(UINT32*)(rec + a->offset) = (UINT32)a->val; break;
+			case IARG_ADDRINT: *(ADDRINT*)(rec + a->offset) = a->val; break;
+			case IARG_THREAD_ID: *(THREADID*)(rec + a->offset) = (THREADID)ctx.tid; break;
+			case IARG_REG_VALUE:
+				if(a->val == REG_REPLAY_TOOL)
+					v = ctx.thread;
+				else if(a->val == REG_INST_PTR)
+					v = ins->addr;
+				else
+					v = ev.rep_cnt;
+				*(ADDRINT*)(rec + a->offset) = v;
+				break;
+			case IARG_MEMORYREAD_EA: *(ADDRINT*)(rec + a->offset) = ev.read_ea; break;
+			case IARG_MEMORYREAD2_EA: *(ADDRINT*)(rec + a->offset) = ev.read2_ea; break;
+			case IARG_MEMORYREAD_SIZE: *(UINT32*)(rec + a->offset) = (UINT32)ev.read_size; break;
+			case IARG_MEMORYWRITE_EA: *(ADDRINT*)(rec + a->offset) = ev.write_ea; break;
+			case IARG_MEMORYWRITE_SIZE: *(UINT32*)(rec + a->offset) = (UINT32)ev.write_size; break;
+			case IARG_BRANCH_TAKEN: *(BOOL*)(rec + a->offset) = ev.taken != 0; break;
+			case IARG_FIRST_REP_ITERATION: *(BOOL*)(rec + a->offset) = ev.first_rep != 0; break;
+			case IARG_INST_PTR: *(ADDRINT*)(rec + a->offset) = ins->addr; break;
+			default: break;
+		}
+	}
+	replay_buffer_cnt++;
+}
+
+/* *** Pin API: internal threads *** */
+
+static VOID* replay_internal_thread_main(VOID* arg){
+
+	VOID** a = (VOID**)arg;
+	ROOT_THREAD_FUNC fun = (ROOT_THREAD_FUNC)a[0];
+
+	fun(a[1]);
+	free(a);
+
+	return NULL;
+}
+
+THREADID PIN_SpawnInternalThread(ROOT_THREAD_FUNC pThreadFunc, VOID* arg, size_t stackSize, PIN_THREAD_UID* pThreadUid){
+
+	VOID** a;
+
+	if(replay_internal_thread_cnt == REPLAY_MAX_INTERNAL_THREADS)
+		return INVALID_THREADID;
+
+	a = (VOID**)checked_malloc(2 * sizeof(VOID*));
+	a[0] = (VOID*)pThreadFunc;
+	a[1] = arg;
+	if(pthread_create(&replay_internal_threads[replay_internal_thread_cnt], NULL, replay_internal_thread_main, a) != 0){
+		free(a);
+		return INVALID_THREADID;
+	}
+	if(pThreadUid != NULL)
+		*pThreadUid = replay_internal_thread_cnt;
+
+	return (THREADID)(1 + replay_internal_thread_cnt++);
+}
+
+BOOL PIN_WaitForThreadTermination(const PIN_THREAD_UID& threadUid, UINT32 milliseconds, INT32* pExitCode){
+	if(pExitCode != NULL)
+		*pExitCode = 0;
+	return pthread_join(replay_internal_threads[threadUid], NULL) == 0;
+}
+
+VOID PIN_Yield(){ sched_yield(); }
+VOID PIN_Sleep(UINT32 milliseconds){ usleep(milliseconds * 1000); }
+
+/* *** reading the instruction table *** */
+
+typedef struct replay_reader_type {
+	FILE* file;
+	const char* name;
+	UINT8* buf;
+	UINT32 len; // number of bytes in buf
+	UINT32 pos; // next byte to read
+} replay_reader;
+
+static VOID replay_open(replay_reader* r, const char* name, const char* magic){
+
+	char m[CAPTURE_MAGIC_LENGTH];
+
+	r->name = name;
+	r->file = fopen(name, "rb");
+	if(r->file == (FILE*)NULL)
+		replay_error("could not open", name);
+	if(fread(m, 1, CAPTURE_MAGIC_LENGTH, r->file) != CAPTURE_MAGIC_LENGTH || memcmp(m, magic, CAPTURE_MAGIC_LENGTH) != 0)
+		replay_error("not a MICA capture file (or wrong order of arguments):", name);
+
+	r->buf = (UINT8*)checked_malloc(CAPTURE_BUFFER_SIZE);
+	r->len = 0;
+	r->pos = 0;
+}
+
+/* make sure at least CAPTURE_EVENT_MAX_SIZE bytes are buffered, unless the end of the file is near;
+ * returns false at the end of the file */
+static inline BOOL replay_fill(replay_reader* r){
+
+	if(r->len - r->pos >= CAPTURE_EVENT_MAX_SIZE)
+		return true;
+
+	memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+	r->len -= r->pos;
+	r->pos = 0;
+	r->len += fread(r->buf + r->len, 1, CAPTURE_BUFFER_SIZE - r->len, r->file);
+
+	return r->len > 0;
+}
+
+static inline UINT8 replay_get_byte(replay_reader* r){
+
+	if(r->pos == r->len && !replay_fill(r))
+		replay_error("unexpected end of file", r->name);
+
+	return r->buf[r->pos++];
+}
+
+static inline UINT64 replay_get_varint(replay_reader* r){
+
+	UINT64 v = 0;
+	UINT32 shift = 0;
+	UINT8 b;
+
+	do{
+		b = replay_get_byte(r);
+		v |= (UINT64)(b & 0x7f) << shift;
+		shift += 7;
+	} while(b & 0x80);
+
+	return v;
+}
+
+static inline ADDRINT replay_get_addr(replay_reader* r, ADDRINT* last_addr){
+
+	UINT64 z = replay_get_varint(r);
+
+	*last_addr += (ADDRINT)((z >> 1) ^ (~(z & 1) + 1));
+
+	return *last_addr;
+}
+
+static VOID replay_get_bytes(replay_reader* r, VOID* dest, UINT32 n){
+
+	UINT32 i;
+
+	for(i = 0; i < n; i++)
+		((UINT8*)dest)[i] = replay_get_byte(r);
+}
+
+static char* replay_get_string(replay_reader* r){
+
+	UINT8 len;
+	char* s;
+
+	replay_get_bytes(r, &len, 1);
+	s = (char*)checked_malloc(len + 1);
+	replay_get_bytes(r, s, len);
+	s[len] = '\0';
+
+	return s;
+}
+
+static REG* replay_get_regs(replay_reader* r, UINT32* cnt){
+
+	UINT8 n;
+	UINT16 reg;
+	UINT32 i;
+	REG* regs;
+
+	replay_get_bytes(r, &n, 1);
+	regs = (REG*)checked_malloc((n + 1) * sizeof(REG));
+	for(i = 0; i < n; i++){
+		replay_get_bytes(r, &reg, sizeof(UINT16));
+		regs[i] = (REG)reg;
+	}
+	*cnt = n;
+
+	return regs;
+}
+
+static INT32 replay_category(char* cat){
+
+	INT32 i;
+
+	for(i = 0; i < replay_category_cnt; i++){
+		if(strcmp(replay_categories[i], cat) == 0){
+			free(cat);
+			return i;
+		}
+	}
+	if(replay_category_cnt == REPLAY_MAX_CATEGORIES)
+		replay_error("too many instruction categories in", replay_ins_file_name);
+	replay_categories[replay_category_cnt] = cat;
+
+	return replay_category_cnt++;
+}
+
+static VOID replay_read_ins_table(){
+
+	replay_reader r;
+	replay_ins* ins;
+	UINT64 addr;
+	UINT8 size, flags, opCnt;
+	UINT32 ins_size = 1024;
+	UINT32 v;
+
+	replay_open(&r, replay_ins_file_name, CAPTURE_INS_MAGIC);
+
+	replay_ins_table = (replay_ins*)checked_malloc(ins_size * sizeof(replay_ins));
+	replay_ins_cnt = 0;
+
+	while(replay_fill(&r)){
+		if(replay_ins_cnt == ins_size){
+			ins_size *= 2;
+			replay_ins_table = (replay_ins*)checked_realloc(replay_ins_table, ins_size * sizeof(replay_ins));
+		}
+		ins = &replay_ins_table[replay_ins_cnt++];
+
+		replay_get_bytes(&r, &addr, sizeof(UINT64));
+		replay_get_bytes(&r, &size, 1);
+		replay_get_bytes(&r, &flags, 1);
+		replay_get_bytes(&r, &opCnt, 1);
+		ins->addr = (ADDRINT)addr;
+		ins->size = size;
+		ins->flags = flags;
+		ins->opCnt = opCnt;
+		ins->opIsReg = (UINT8*)checked_malloc(opCnt + 1);
+		replay_get_bytes(&r, ins->opIsReg, opCnt);
+		ins->regsRead = replay_get_regs(&r, &ins->regReadCnt);
+		ins->regsWritten = replay_get_regs(&r, &ins->regWriteCnt);
+		ins->category = replay_category(replay_get_string(&r));
+		ins->mnemonic = replay_get_string(&r);
+		ins->disassembly = replay_get_string(&r);
+		for(v = 0; v < REPLAY_MAX_VERSIONS; v++){
+			ins->instrumented[v] = false;
+			mica_call_list_init(&ins->calls[v]);
+			ins->target_version[v] = v;
+		}
+		ins->fill = NULL;
+		ins->fill_cnt = 0;
+	}
+
+	fclose(r.file);
+	free(r.buf);
+}
+
+/* *** replaying the trace *** */
+
+/* instrument the current version of the instruction the first time it is executed, like Pin does */
+static inline VOID replay_instrument(replay_ins* ins){
+	if(!ins->instrumented[replay_version]){
+		if(replay_trace_callback != NULL)
+			replay_trace_callback(ins, replay_trace_callback_val);
+		ins->instrumented[replay_version] = true;
+	}
+}
+
+VOID PIN_StartProgram(){
+
+	replay_reader r;
+	replay_ins* ins;
+	UINT32 tid, i, v;
+	UINT64 id, event_cnt = 0;
+	ADDRINT last_addr = 0;
+	ADDRINT version;
+	CONTEXT ctxt;
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	replay_read_ins_table();
+
+	replay_open(&r, replay_trace_file_name, CAPTURE_TRACE_MAGIC);
+	replay_get_bytes(&r, &tid, sizeof(UINT32));
+	ctx.tid = tid;
+
+	cerr << "Replaying thread " << tid << " (" << replay_ins_cnt << " static instructions)..." << endl;
+
+	if(replay_thread_start_callback != NULL)
+		replay_thread_start_callback(tid, &ctxt, 0, replay_thread_start_callback_val);
+	if(replay_buffer_callback != NULL)
+		replay_buffer = (UINT8*)PIN_AllocateBuffer(0);
+
+	while(replay_fill(&r)){
+
+		id = replay_get_varint(&r);
+		if(id >= replay_ins_cnt)
+			replay_error("unknown instruction id in", replay_trace_file_name);
+		ins = &replay_ins_table[id];
+
+		if(ins->flags & CAPTURE_INS_REP){
+			ev.first_rep = replay_get_byte(&r);
+			if(ev.first_rep)
+				ev.rep_cnt = replay_get_varint(&r);
+		}
+		if(ins->flags & CAPTURE_INS_MEM_READ){
+			ev.read_ea = replay_get_addr(&r, &last_addr);
+			ev.read_size = replay_get_varint(&r);
+		}
+		if(ins->flags & CAPTURE_INS_MEM_READ2){
+			ev.read2_ea = replay_get_addr(&r, &last_addr);
+		}
+		if(ins->flags & CAPTURE_INS_MEM_WRITE){
+			ev.write_ea = replay_get_addr(&r, &last_addr);
+			ev.write_size = replay_get_varint(&r);
+		}
+		if(ins->flags & CAPTURE_INS_COND_BR){
+			ev.taken = replay_get_byte(&r);
+		}
+
+		if(replay_remove_pending){
+			for(i = 0; i < replay_ins_cnt; i++){
+				for(v = 0; v < REPLAY_MAX_VERSIONS; v++){
+					replay_ins_table[i].instrumented[v] = false;
+					replay_ins_table[i].calls[v].cnt = 0;
+					replay_ins_table[i].target_version[v] = v;
+				}
+				free(replay_ins_table[i].fill);
+				replay_ins_table[i].fill = NULL;
+				replay_ins_table[i].fill_cnt = 0;
+			}
+			replay_remove_pending = false;
+		}
+
+		replay_instrument(ins);
+		if(ins->fill != NULL)
+			replay_buffer_fill(ins, &ctxt);
+
+		/* a version case continues in another version of the instruction */
+		while((version = mica_call_list_run(&ins->calls[replay_version], &ev, &ctx)) != MICA_NO_VERSION){
+			replay_version = version;
+			replay_instrument(ins);
+		}
+		replay_version = ins->target_version[replay_version];
+		event_cnt++;
+	}
+
+	fclose(r.file);
+
+	/* the thread exits */
+	if(replay_buffer_callback != NULL)
+		replay_buffer_flush(&ctxt);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	cerr << "Replayed " << event_cnt << " events in " << (double)(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9 << " s" << endl;
+
+	for(i = 0; i < replay_prepare_fini_cnt; i++)
+		replay_prepare_fini_callbacks[i](replay_prepare_fini_callback_vals[i]);
+	for(i = 0; i < replay_fini_cnt; i++)
+		replay_fini_callbacks[i](0, replay_fini_callback_vals[i]);
+
+	exit(0);
+}